@@ -0,0 +1,910 @@
+/**
+ * Copyright (C) 2008-2011 by ProFUSION embedded systems
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * @author Gustavo Sverzut Barbieri <barbieri@profusion.mobi>
+ */
+
+/*
+ * Synthetic media for scan-bench.
+ *
+ * Files are the smallest ones parsers take as valid, with tags, made
+ * only from their number so trees are the same on every run. Payloads
+ * are silence or missing, parsers only read headers.
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench-media.h"
+
+const struct bench_format_info bench_formats[BENCH_FORMAT_COUNT] = {
+    [BENCH_FORMAT_MP3] = {"mp3", ".mp3", "id3"},
+    [BENCH_FORMAT_FLAC] = {"flac", ".flac", "flac"},
+    [BENCH_FORMAT_OGG] = {"ogg", ".ogg", "ogg"},
+    [BENCH_FORMAT_M4A] = {"mp4", ".m4a", "mp4"},
+    [BENCH_FORMAT_JPEG] = {"jpeg", ".jpg", "jpeg"},
+    [BENCH_FORMAT_PNG] = {"png", ".png", "png"},
+    [BENCH_FORMAT_WAV] = {"wav", ".wav", "wave"},
+    [BENCH_FORMAT_WMA] = {"asf", ".wma", "asf"},
+    [BENCH_FORMAT_M3U] = {"m3u", ".m3u", "m3u"},
+    [BENCH_FORMAT_PLS] = {"pls", ".pls", "pls"},
+};
+
+struct buf {
+    unsigned char *data;
+    size_t len;
+    size_t size;
+    int error;
+};
+
+static void
+_put(struct buf *b, const void *data, size_t len)
+{
+    if (b->len + len > b->size) {
+        size_t size = b->size ? b->size : 1024;
+        unsigned char *tmp;
+
+        while (size < b->len + len)
+            size *= 2;
+        tmp = realloc(b->data, size);
+        if (!tmp) {
+            b->error = 1;
+            return;
+        }
+        b->data = tmp;
+        b->size = size;
+    }
+
+    if (data)
+        memcpy(b->data + b->len, data, len);
+    else
+        memset(b->data + b->len, 0, len);
+    b->len += len;
+}
+
+static void
+_put8(struct buf *b, unsigned int v)
+{
+    unsigned char c = v;
+
+    _put(b, &c, 1);
+}
+
+static void
+_put16le(struct buf *b, unsigned int v)
+{
+    _put8(b, v);
+    _put8(b, v >> 8);
+}
+
+static void
+_put16be(struct buf *b, unsigned int v)
+{
+    _put8(b, v >> 8);
+    _put8(b, v);
+}
+
+static void
+_put24be(struct buf *b, unsigned int v)
+{
+    _put8(b, v >> 16);
+    _put16be(b, v);
+}
+
+static void
+_put32le(struct buf *b, uint32_t v)
+{
+    _put16le(b, v);
+    _put16le(b, v >> 16);
+}
+
+static void
+_put32be(struct buf *b, uint32_t v)
+{
+    _put16be(b, v >> 16);
+    _put16be(b, v);
+}
+
+static void
+_put64le(struct buf *b, uint64_t v)
+{
+    _put32le(b, v);
+    _put32le(b, v >> 32);
+}
+
+static void
+_put64be(struct buf *b, uint64_t v)
+{
+    _put32be(b, v >> 32);
+    _put32be(b, v);
+}
+
+static void
+_puts(struct buf *b, const char *s)
+{
+    _put(b, s, strlen(s));
+}
+
+static void
+_set32be(struct buf *b, size_t off, uint32_t v)
+{
+    if (b->error)
+        return;
+    b->data[off] = v >> 24;
+    b->data[off + 1] = v >> 16;
+    b->data[off + 2] = v >> 8;
+    b->data[off + 3] = v;
+}
+
+/* zlib's, as used by PNG */
+static uint32_t
+_crc32(const unsigned char *data, size_t len)
+{
+    uint32_t crc = 0xffffffff;
+    size_t i;
+    int k;
+
+    for (i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (k = 0; k < 8; k++)
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+
+    return ~crc;
+}
+
+/***********************************************************************
+ * MP3 with ID3v2.3 tag
+ ***********************************************************************/
+
+static void
+_id3_frame(struct buf *b, const char *id, const char *text)
+{
+    _puts(b, id);
+    _put32be(b, strlen(text) + 1);
+    _put16be(b, 0); /* flags */
+    _put8(b, 0); /* ISO-8859-1 */
+    _puts(b, text);
+}
+
+static void
+_gen_mp3(struct buf *b, unsigned int n)
+{
+    char text[64];
+    size_t start;
+    unsigned int size, i;
+
+    _puts(b, "ID3");
+    _put16be(b, 0x0300);
+    _put8(b, 0);
+    start = b->len;
+    _put32be(b, 0); /* syncsafe size, set below */
+
+    snprintf(text, sizeof(text), "Title %u", n);
+    _id3_frame(b, "TIT2", text);
+    snprintf(text, sizeof(text), "Artist %u", n % 97);
+    _id3_frame(b, "TPE1", text);
+    snprintf(text, sizeof(text), "Album %u", n % 31);
+    _id3_frame(b, "TALB", text);
+    snprintf(text, sizeof(text), "%u", n % 20 + 1);
+    _id3_frame(b, "TRCK", text);
+
+    size = b->len - start - 4;
+    _set32be(b, start, ((size & 0x0fe00000) << 3) | ((size & 0x1fc000) << 2) |
+             ((size & 0x3f80) << 1) | (size & 0x7f));
+
+    /* MPEG-1 layer III, 128kbps, 44.1kHz, no padding: 417 bytes each */
+    for (i = 0; i < 8; i++) {
+        _put32be(b, 0xfffb9064);
+        _put(b, NULL, 417 - 4);
+    }
+}
+
+/***********************************************************************
+ * FLAC
+ ***********************************************************************/
+
+static void
+_vorbis_comments(struct buf *b, unsigned int n)
+{
+    char text[64];
+
+    _put32le(b, sizeof("lms-bench") - 1);
+    _puts(b, "lms-bench");
+    _put32le(b, 4);
+
+    snprintf(text, sizeof(text), "TITLE=Title %u", n);
+    _put32le(b, strlen(text));
+    _puts(b, text);
+    snprintf(text, sizeof(text), "ARTIST=Artist %u", n % 97);
+    _put32le(b, strlen(text));
+    _puts(b, text);
+    snprintf(text, sizeof(text), "ALBUM=Album %u", n % 31);
+    _put32le(b, strlen(text));
+    _puts(b, text);
+    snprintf(text, sizeof(text), "TRACKNUMBER=%u", n % 20 + 1);
+    _put32le(b, strlen(text));
+    _puts(b, text);
+}
+
+static void
+_gen_flac(struct buf *b, unsigned int n)
+{
+    uint64_t samples = 44100ULL * (n % 300 + 10);
+    size_t start;
+
+    _puts(b, "fLaC");
+
+    _put8(b, 0); /* STREAMINFO */
+    _put24be(b, 34);
+    _put16be(b, 4096); /* min and max block size */
+    _put16be(b, 4096);
+    _put24be(b, 0); /* min and max frame size, unknown */
+    _put24be(b, 0);
+    /* rate:20, channels - 1:3, bits per sample - 1:5, samples:36 */
+    _put64be(b, (44100ULL << 44) | (1ULL << 41) | (15ULL << 36) | samples);
+    _put(b, NULL, 16); /* MD5 */
+
+    _put8(b, 0x80 | 4); /* last, VORBIS_COMMENT */
+    start = b->len;
+    _put24be(b, 0);
+    _vorbis_comments(b, n);
+    if (!b->error) {
+        unsigned int size = b->len - start - 3;
+
+        b->data[start] = size >> 16;
+        b->data[start + 1] = size >> 8;
+        b->data[start + 2] = size;
+    }
+}
+
+/***********************************************************************
+ * Ogg Vorbis
+ ***********************************************************************/
+
+struct bits {
+    struct buf *b;
+    unsigned int acc;
+    int n;
+};
+
+/* LSb first, as libogg's oggpack */
+static void
+_bits_put(struct bits *w, uint32_t v, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        w->acc |= ((v >> i) & 1) << w->n;
+        if (++w->n == 8) {
+            _put8(w->b, w->acc);
+            w->acc = 0;
+            w->n = 0;
+        }
+    }
+}
+
+static void
+_bits_flush(struct bits *w)
+{
+    if (w->n)
+        _put8(w->b, w->acc);
+    w->acc = 0;
+    w->n = 0;
+}
+
+/*
+ * Smallest setup header decoders accept: one 2 entries codebook, one
+ * floor 1 without partitions, one residue 0, one mapping and one mode.
+ */
+static void
+_vorbis_setup(struct buf *b)
+{
+    struct bits w = {b, 0, 0};
+
+    _put8(b, 5);
+    _puts(b, "vorbis");
+
+    _bits_put(&w, 0, 8); /* codebooks - 1 */
+    _bits_put(&w, 0x564342, 24);
+    _bits_put(&w, 1, 16); /* dimensions */
+    _bits_put(&w, 2, 24); /* entries */
+    _bits_put(&w, 0, 1); /* not ordered */
+    _bits_put(&w, 0, 1); /* not sparse */
+    _bits_put(&w, 0, 5); /* length - 1 of each entry */
+    _bits_put(&w, 0, 5);
+    _bits_put(&w, 0, 4); /* no lookup */
+
+    _bits_put(&w, 0, 6); /* time domain transforms - 1 */
+    _bits_put(&w, 0, 16);
+
+    _bits_put(&w, 0, 6); /* floors - 1 */
+    _bits_put(&w, 1, 16); /* type */
+    _bits_put(&w, 0, 5); /* partitions */
+    _bits_put(&w, 0, 2); /* multiplier - 1 */
+    _bits_put(&w, 8, 4); /* range bits */
+
+    _bits_put(&w, 0, 6); /* residues - 1 */
+    _bits_put(&w, 0, 16); /* type */
+    _bits_put(&w, 0, 24); /* begin */
+    _bits_put(&w, 0, 24); /* end */
+    _bits_put(&w, 0, 24); /* partition size - 1 */
+    _bits_put(&w, 0, 6); /* classifications - 1 */
+    _bits_put(&w, 0, 8); /* classbook */
+    _bits_put(&w, 0, 3); /* cascade */
+    _bits_put(&w, 0, 1);
+
+    _bits_put(&w, 0, 6); /* mappings - 1 */
+    _bits_put(&w, 0, 16); /* type */
+    _bits_put(&w, 0, 1); /* single submap */
+    _bits_put(&w, 0, 1); /* no coupling */
+    _bits_put(&w, 0, 2); /* reserved */
+    _bits_put(&w, 0, 8); /* submap time, floor and residue */
+    _bits_put(&w, 0, 8);
+    _bits_put(&w, 0, 8);
+
+    _bits_put(&w, 0, 6); /* modes - 1 */
+    _bits_put(&w, 0, 1); /* short block */
+    _bits_put(&w, 0, 16); /* window type */
+    _bits_put(&w, 0, 16); /* transform type */
+    _bits_put(&w, 0, 8); /* mapping */
+
+    _bits_put(&w, 1, 1); /* framing */
+    _bits_flush(&w);
+}
+
+static uint32_t
+_ogg_crc(const unsigned char *data, size_t len)
+{
+    uint32_t crc = 0;
+    size_t i;
+    int k;
+
+    for (i = 0; i < len; i++) {
+        crc ^= (uint32_t)data[i] << 24;
+        for (k = 0; k < 8; k++)
+            crc = (crc << 1) ^ (0x04c11db7 & -(crc >> 31));
+    }
+
+    return crc;
+}
+
+/* packets given by their lengths in p, one after the other */
+static void
+_ogg_page(struct buf *b, unsigned int flags, unsigned int seq, const struct buf *p, const size_t *lens, unsigned int n_lens)
+{
+    size_t start = b->len;
+    unsigned int i, segs = 0;
+
+    _puts(b, "OggS");
+    _put8(b, 0);
+    _put8(b, flags);
+    _put64le(b, 0); /* granule position */
+    _put32le(b, 0x6c6d7331); /* serial */
+    _put32le(b, seq);
+    _put32le(b, 0); /* CRC, set below */
+    _put8(b, 0); /* segments, set below */
+
+    for (i = 0; i < n_lens; i++) {
+        size_t len = lens[i];
+
+        for (; len >= 255; len -= 255, segs++)
+            _put8(b, 255);
+        _put8(b, len);
+        segs++;
+    }
+
+    _put(b, p->data, p->len);
+    if (b->error)
+        return;
+
+    b->data[start + 26] = segs;
+    {
+        uint32_t crc = _ogg_crc(b->data + start, b->len - start);
+
+        b->data[start + 22] = crc;
+        b->data[start + 23] = crc >> 8;
+        b->data[start + 24] = crc >> 16;
+        b->data[start + 25] = crc >> 24;
+    }
+}
+
+static void
+_gen_ogg(struct buf *b, unsigned int n)
+{
+    struct buf p = { };
+    size_t lens[2];
+
+    /* identification header alone in the first page */
+    _put8(&p, 1);
+    _puts(&p, "vorbis");
+    _put32le(&p, 0); /* version */
+    _put8(&p, 2); /* channels */
+    _put32le(&p, 44100);
+    _put32le(&p, 0); /* maximum bitrate */
+    _put32le(&p, 128000); /* nominal bitrate */
+    _put32le(&p, 0); /* minimum bitrate */
+    _put8(&p, (11 << 4) | 8); /* 2048 and 256 samples blocks */
+    _put8(&p, 1); /* framing */
+    lens[0] = p.len;
+    _ogg_page(b, 0x02, 0, &p, lens, 1);
+
+    /* comments and setup must end the second one */
+    p.len = 0;
+    _put8(&p, 3);
+    _puts(&p, "vorbis");
+    _vorbis_comments(&p, n);
+    _put8(&p, 1); /* framing */
+    lens[0] = p.len;
+    _vorbis_setup(&p);
+    lens[1] = p.len - lens[0];
+    _ogg_page(b, 0, 1, &p, lens, 2);
+
+    if (p.error)
+        b->error = 1;
+    free(p.data);
+}
+
+/***********************************************************************
+ * MPEG-4 audio
+ ***********************************************************************/
+
+static size_t
+_box_begin(struct buf *b, const char *type)
+{
+    size_t start = b->len;
+
+    _put32be(b, 0);
+    _put(b, type, 4);
+    return start;
+}
+
+static void
+_box_end(struct buf *b, size_t start)
+{
+    _set32be(b, start, b->len - start);
+}
+
+static size_t
+_full_box_begin(struct buf *b, const char *type, uint32_t version_flags)
+{
+    size_t start = _box_begin(b, type);
+
+    _put32be(b, version_flags);
+    return start;
+}
+
+static void
+_mp4_matrix(struct buf *b)
+{
+    _put32be(b, 0x00010000);
+    _put32be(b, 0);
+    _put32be(b, 0);
+    _put32be(b, 0);
+    _put32be(b, 0x00010000);
+    _put32be(b, 0);
+    _put32be(b, 0);
+    _put32be(b, 0);
+    _put32be(b, 0x40000000);
+}
+
+static void
+_mp4_tag(struct buf *b, const char *type, const char *text)
+{
+    size_t tag, data;
+
+    tag = _box_begin(b, type);
+    data = _full_box_begin(b, "data", 1); /* UTF-8 */
+    _put32be(b, 0); /* locale */
+    _puts(b, text);
+    _box_end(b, data);
+    _box_end(b, tag);
+}
+
+static void
+_gen_m4a(struct buf *b, unsigned int n)
+{
+    uint32_t secs = n % 300 + 10;
+    size_t moov, trak, mdia, minf, dinf, dref, stbl, stsd, mp4a, box;
+    char text[64];
+
+    box = _box_begin(b, "ftyp");
+    _puts(b, "M4A ");
+    _put32be(b, 0x200);
+    _puts(b, "M4A mp42isom");
+    _box_end(b, box);
+
+    moov = _box_begin(b, "moov");
+
+    box = _full_box_begin(b, "mvhd", 0);
+    _put32be(b, 0); /* creation and modification time */
+    _put32be(b, 0);
+    _put32be(b, 1000); /* time scale */
+    _put32be(b, secs * 1000);
+    _put32be(b, 0x00010000); /* rate */
+    _put16be(b, 0x0100); /* volume */
+    _put(b, NULL, 10);
+    _mp4_matrix(b);
+    _put(b, NULL, 24);
+    _put32be(b, 2); /* next track id */
+    _box_end(b, box);
+
+    trak = _box_begin(b, "trak");
+
+    box = _full_box_begin(b, "tkhd", 7); /* enabled, in movie and preview */
+    _put32be(b, 0);
+    _put32be(b, 0);
+    _put32be(b, 1); /* track id */
+    _put32be(b, 0);
+    _put32be(b, secs * 1000);
+    _put(b, NULL, 8);
+    _put16be(b, 0); /* layer */
+    _put16be(b, 0); /* alternate group */
+    _put16be(b, 0x0100); /* volume */
+    _put16be(b, 0);
+    _mp4_matrix(b);
+    _put32be(b, 0); /* width and height */
+    _put32be(b, 0);
+    _box_end(b, box);
+
+    mdia = _box_begin(b, "mdia");
+
+    box = _full_box_begin(b, "mdhd", 0);
+    _put32be(b, 0);
+    _put32be(b, 0);
+    _put32be(b, 44100);
+    _put32be(b, secs * 44100);
+    _put16be(b, 0x55c4); /* "und" */
+    _put16be(b, 0);
+    _box_end(b, box);
+
+    box = _full_box_begin(b, "hdlr", 0);
+    _put32be(b, 0);
+    _puts(b, "soun");
+    _put(b, NULL, 12);
+    _put(b, "SoundHandler", sizeof("SoundHandler"));
+    _box_end(b, box);
+
+    minf = _box_begin(b, "minf");
+
+    box = _full_box_begin(b, "smhd", 0);
+    _put32be(b, 0); /* balance and reserved */
+    _box_end(b, box);
+
+    dinf = _box_begin(b, "dinf");
+    dref = _full_box_begin(b, "dref", 0);
+    _put32be(b, 1);
+    box = _full_box_begin(b, "url ", 1); /* data is in this file */
+    _box_end(b, box);
+    _box_end(b, dref);
+    _box_end(b, dinf);
+
+    stbl = _box_begin(b, "stbl");
+
+    stsd = _full_box_begin(b, "stsd", 0);
+    _put32be(b, 1);
+    mp4a = _box_begin(b, "mp4a");
+    _put(b, NULL, 6);
+    _put16be(b, 1); /* data reference index */
+    _put(b, NULL, 8);
+    _put16be(b, 2); /* channels */
+    _put16be(b, 16); /* sample size */
+    _put32be(b, 0);
+    _put32be(b, 44100 << 16);
+    box = _full_box_begin(b, "esds", 0);
+    _put8(b, 0x03); /* ES_Descriptor */
+    _put8(b, 25);
+    _put16be(b, 0); /* ES_ID */
+    _put8(b, 0);
+    _put8(b, 0x04); /* DecoderConfigDescriptor */
+    _put8(b, 17);
+    _put8(b, 0x40); /* MPEG-4 audio */
+    _put8(b, 0x15); /* audio stream */
+    _put24be(b, 0); /* buffer size */
+    _put32be(b, 128000); /* max and average bitrate */
+    _put32be(b, 128000);
+    _put8(b, 0x05); /* DecoderSpecificInfo */
+    _put8(b, 2);
+    _put16be(b, 0x1210); /* AAC LC, 44.1kHz, stereo */
+    _put8(b, 0x06); /* SLConfigDescriptor */
+    _put8(b, 1);
+    _put8(b, 0x02);
+    _box_end(b, box);
+    _box_end(b, mp4a);
+    _box_end(b, stsd);
+
+    /* no samples */
+    box = _full_box_begin(b, "stts", 0);
+    _put32be(b, 0);
+    _box_end(b, box);
+    box = _full_box_begin(b, "stsc", 0);
+    _put32be(b, 0);
+    _box_end(b, box);
+    box = _full_box_begin(b, "stsz", 0);
+    _put32be(b, 0);
+    _put32be(b, 0);
+    _box_end(b, box);
+    box = _full_box_begin(b, "stco", 0);
+    _put32be(b, 0);
+    _box_end(b, box);
+
+    _box_end(b, stbl);
+    _box_end(b, minf);
+    _box_end(b, mdia);
+    _box_end(b, trak);
+
+    {
+        size_t udta, meta, ilst;
+
+        udta = _box_begin(b, "udta");
+        meta = _full_box_begin(b, "meta", 0);
+        box = _full_box_begin(b, "hdlr", 0);
+        _put32be(b, 0);
+        _puts(b, "mdir");
+        _puts(b, "appl");
+        _put(b, NULL, 9); /* reserved and empty name */
+        _box_end(b, box);
+        ilst = _box_begin(b, "ilst");
+        snprintf(text, sizeof(text), "Title %u", n);
+        _mp4_tag(b, "\251nam", text);
+        snprintf(text, sizeof(text), "Artist %u", n % 97);
+        _mp4_tag(b, "\251ART", text);
+        snprintf(text, sizeof(text), "Album %u", n % 31);
+        _mp4_tag(b, "\251alb", text);
+        _box_end(b, ilst);
+        _box_end(b, meta);
+        _box_end(b, udta);
+    }
+
+    _box_end(b, moov);
+}
+
+/***********************************************************************
+ * Images
+ ***********************************************************************/
+
+static void
+_gen_jpeg(struct buf *b, unsigned int n)
+{
+    static const unsigned char jfif[] = {
+        0xff, 0xd8, /* SOI */
+        0xff, 0xe0, 0x00, 0x10, 'J', 'F', 'I', 'F', 0x00,
+        0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00
+    };
+    static const unsigned char tail[] = {
+        0x03, 0x01, 0x22, 0x00, 0x02, 0x11, 0x01, 0x03, 0x11, 0x01,
+        0xff, 0xfe, 0x00, 0x07, 'h', 'e', 'l', 'l', 'o', /* COM */
+        0xff, 0xda, 0x00, 0x08, 0x01, 0x01, 0x00, 0x00, 0x3f, 0x00, /* SOS */
+        0xff, 0xd9 /* EOI */
+    };
+
+    _put(b, jfif, sizeof(jfif));
+    _put16be(b, 0xffc0); /* SOF0 */
+    _put16be(b, 17);
+    _put8(b, 8);
+    _put16be(b, 480 + n % 64); /* height */
+    _put16be(b, 640 + n % 128); /* width */
+    _put(b, tail, sizeof(tail));
+}
+
+static void
+_png_chunk(struct buf *b, const char *type, const struct buf *data)
+{
+    size_t start;
+
+    _put32be(b, data ? data->len : 0);
+    start = b->len;
+    _puts(b, type);
+    if (data)
+        _put(b, data->data, data->len);
+    if (!b->error)
+        _put32be(b, _crc32(b->data + start, b->len - start));
+}
+
+static void
+_gen_png(struct buf *b, unsigned int n)
+{
+    struct buf ihdr = { };
+
+    _put(b, "\211PNG\r\n\032\n", 8);
+
+    _put32be(&ihdr, 640 + n % 128);
+    _put32be(&ihdr, 480 + n % 64);
+    _put8(&ihdr, 8); /* bit depth */
+    _put8(&ihdr, 2); /* RGB */
+    _put8(&ihdr, 0);
+    _put8(&ihdr, 0);
+    _put8(&ihdr, 0);
+    _png_chunk(b, "IHDR", &ihdr);
+    _png_chunk(b, "IEND", NULL);
+
+    if (ihdr.error)
+        b->error = 1;
+    free(ihdr.data);
+}
+
+/***********************************************************************
+ * WAV and WMA
+ ***********************************************************************/
+
+static void
+_gen_wav(struct buf *b, unsigned int n)
+{
+    unsigned int data_len = 4096 * (n % 4 + 1);
+
+    _puts(b, "RIFF");
+    _put32le(b, 4 + 8 + 16 + 8 + data_len);
+    _puts(b, "WAVE");
+    _puts(b, "fmt ");
+    _put32le(b, 16);
+    _put16le(b, 1); /* PCM */
+    _put16le(b, 2);
+    _put32le(b, 44100);
+    _put32le(b, 44100 * 4);
+    _put16le(b, 4);
+    _put16le(b, 16);
+    _puts(b, "data");
+    _put32le(b, data_len);
+    _put(b, NULL, data_len);
+}
+
+static void
+_put_utf16le(struct buf *b, const char *s)
+{
+    for (; *s; s++)
+        _put16le(b, (unsigned char)*s);
+    _put16le(b, 0);
+}
+
+static void
+_gen_wma(struct buf *b, unsigned int n)
+{
+    static const char header_guid[16] = "\x30\x26\xB2\x75\x8E\x66\xCF\x11\xA6\xD9\x00\xAA\x00\x62\xCE\x6C";
+    static const char content_description_guid[16] = "\x33\x26\xB2\x75\x8E\x66\xCF\x11\xA6\xD9\x00\xAA\x00\x62\xCE\x6C";
+    static const char data_guid[16] = "\x36\x26\xB2\x75\x8E\x66\xCF\x11\xA6\xD9\x00\xAA\x00\x62\xCE\x6C";
+    char title[64], artist[64];
+    size_t cd;
+
+    snprintf(title, sizeof(title), "Title %u", n);
+    snprintf(artist, sizeof(artist), "Artist %u", n % 97);
+
+    _put(b, header_guid, 16);
+    _put64le(b, 0); /* size, set below */
+    _put32le(b, 1); /* objects */
+    _put8(b, 1);
+    _put8(b, 2);
+
+    cd = b->len;
+    _put(b, content_description_guid, 16);
+    _put64le(b, 0);
+    _put16le(b, (strlen(title) + 1) * 2);
+    _put16le(b, (strlen(artist) + 1) * 2);
+    _put16le(b, 0); /* copyright, description and rating */
+    _put16le(b, 0);
+    _put16le(b, 0);
+    _put_utf16le(b, title);
+    _put_utf16le(b, artist);
+
+    if (!b->error) {
+        uint64_t size = b->len - cd;
+        int i;
+
+        for (i = 0; i < 8; i++)
+            b->data[cd + 16 + i] = size >> (i * 8);
+        size = b->len;
+        for (i = 0; i < 8; i++)
+            b->data[16 + i] = size >> (i * 8);
+    }
+
+    _put(b, data_guid, 16);
+    _put64le(b, 50);
+    _put(b, NULL, 16); /* file id */
+    _put64le(b, 0); /* packets */
+    _put16le(b, 0x0101);
+}
+
+/***********************************************************************
+ * Playlists
+ ***********************************************************************/
+
+static void
+_gen_m3u(struct buf *b, unsigned int n)
+{
+    char line[128];
+    unsigned int i;
+
+    _puts(b, "#EXTM3U\n");
+    for (i = 0; i < n % 8 + 2; i++) {
+        snprintf(line, sizeof(line), "#EXTINF:%u,Artist %u - Title %u\n"
+                 "f%06u.mp3\n", 180 + i, (n + i) % 97, n + i, n + i);
+        _puts(b, line);
+    }
+}
+
+static void
+_gen_pls(struct buf *b, unsigned int n)
+{
+    char line[128];
+    unsigned int i, count = n % 8 + 2;
+
+    _puts(b, "[playlist]\n");
+    for (i = 1; i <= count; i++) {
+        snprintf(line, sizeof(line), "File%u=f%06u.mp3\nTitle%u=Title %u\n"
+                 "Length%u=%u\n", i, n + i, i, n + i, i, 180 + i);
+        _puts(b, line);
+    }
+    snprintf(line, sizeof(line), "NumberOfEntries=%u\nVersion=2\n", count);
+    _puts(b, line);
+}
+
+static void (*const _generators[BENCH_FORMAT_COUNT])(struct buf *b, unsigned int n) = {
+    [BENCH_FORMAT_MP3] = _gen_mp3,
+    [BENCH_FORMAT_FLAC] = _gen_flac,
+    [BENCH_FORMAT_OGG] = _gen_ogg,
+    [BENCH_FORMAT_M4A] = _gen_m4a,
+    [BENCH_FORMAT_JPEG] = _gen_jpeg,
+    [BENCH_FORMAT_PNG] = _gen_png,
+    [BENCH_FORMAT_WAV] = _gen_wav,
+    [BENCH_FORMAT_WMA] = _gen_wma,
+    [BENCH_FORMAT_M3U] = _gen_m3u,
+    [BENCH_FORMAT_PLS] = _gen_pls,
+};
+
+/*
+ * Write the n-th file of the given format to path, same n gives the
+ * same file.
+ *
+ * Return: its size, < 0 on error.
+ */
+long
+bench_media_write(const char *path, enum bench_format format, unsigned int n)
+{
+    struct buf b = { };
+    long r = -1;
+    int fd;
+
+    if (format >= BENCH_FORMAT_COUNT)
+        return -1;
+
+    _generators[format](&b, n);
+    if (b.error) {
+        fprintf(stderr, "ERROR: could not allocate %s file.\n",
+                bench_formats[format].name);
+        goto end;
+    }
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror(path);
+        goto end;
+    }
+
+    if (write(fd, b.data, b.len) != (ssize_t)b.len)
+        perror(path);
+    else
+        r = b.len;
+    close(fd);
+
+  end:
+    free(b.data);
+    return r;
+}
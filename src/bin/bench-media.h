@@ -0,0 +1,49 @@
+/**
+ * Copyright (C) 2008-2011 by ProFUSION embedded systems
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * @author Gustavo Sverzut Barbieri <barbieri@profusion.mobi>
+ */
+
+#ifndef _BENCH_MEDIA_H_
+#define _BENCH_MEDIA_H_ 1
+
+enum bench_format {
+    BENCH_FORMAT_MP3,
+    BENCH_FORMAT_FLAC,
+    BENCH_FORMAT_OGG,
+    BENCH_FORMAT_M4A,
+    BENCH_FORMAT_JPEG,
+    BENCH_FORMAT_PNG,
+    BENCH_FORMAT_WAV,
+    BENCH_FORMAT_WMA,
+    BENCH_FORMAT_M3U,
+    BENCH_FORMAT_PLS,
+    BENCH_FORMAT_COUNT
+};
+
+struct bench_format_info {
+    const char *name;
+    const char *ext; /* with the dot */
+    const char *parser; /* that handles it */
+};
+
+extern const struct bench_format_info bench_formats[BENCH_FORMAT_COUNT];
+
+long bench_media_write(const char *path, enum bench_format format, unsigned int n);
+
+#endif /* _BENCH_MEDIA_H_ */
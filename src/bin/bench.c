@@ -0,0 +1,681 @@
+/**
+ * Copyright (C) 2008-2011 by ProFUSION embedded systems
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * @author Gustavo Sverzut Barbieri <barbieri@profusion.mobi>
+ */
+
+/*
+ * Scan benchmark: generate a synthetic media tree (see bench-media.c)
+ * and time process and check passes over it with every method, first
+ * with cold caches and a new DB, then again with nothing to do.
+ * Results are printed as JSON.
+ */
+
+#define _XOPEN_SOURCE 700
+#include <lightmediascanner.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench-media.h"
+
+#define BENCH_MTIME 1262304000 /* 2010-01-01, files are always the same */
+
+enum bench_method {
+    BENCH_METHOD_MONO,
+    BENCH_METHOD_DUAL,
+    BENCH_METHOD_THREADED,
+    BENCH_METHOD_COUNT
+};
+
+static const char *method_names[BENCH_METHOD_COUNT] = {
+    "mono", "dual", "threaded"
+};
+
+struct bench {
+    unsigned int n_dirs;
+    unsigned int n_files; /* per format */
+    unsigned int methods; /* bitmask of enum bench_method */
+    char workdir[PATH_MAX - 16]; /* room for tree and DB names */
+    char tree[PATH_MAX];
+    char db_path[PATH_MAX];
+    unsigned int keep:1;
+    unsigned int tmp_workdir:1;
+
+    unsigned long long tree_files;
+    unsigned long long tree_bytes;
+    const char *parsers[BENCH_FORMAT_COUNT * 2];
+    unsigned int n_parsers;
+    unsigned int missing; /* bitmask of formats without parser */
+
+    /* lms settings, 0 or NULL keep the defaults */
+    unsigned int workers;
+    unsigned int walkers;
+    unsigned int preload;
+    int bulk_readdir;
+    int skip_unchanged;
+    const char *plugins_dir;
+    const char *pragmas[16][2]; /* name, value */
+    unsigned int n_pragmas;
+
+    FILE *out;
+    unsigned int n_runs;
+};
+
+static const char short_options[] = "d:f:m:t:ko:p:D:w:W:BuM:g:h";
+
+static const struct option long_options[] = {
+    {"dirs", 1, NULL, 'd'},
+    {"files", 1, NULL, 'f'},
+    {"methods", 1, NULL, 'm'},
+    {"workdir", 1, NULL, 't'},
+    {"keep", 0, NULL, 'k'},
+    {"output", 1, NULL, 'o'},
+    {"parser", 1, NULL, 'p'},
+    {"plugins-dir", 1, NULL, 'D'},
+    {"workers", 1, NULL, 'w'},
+    {"walkers", 1, NULL, 'W'},
+    {"bulk-readdir", 0, NULL, 'B'},
+    {"skip-unchanged", 0, NULL, 'u'},
+    {"preload-budget", 1, NULL, 'M'},
+    {"pragma", 1, NULL, 'g'},
+    {"help", 0, NULL, 'h'},
+    {NULL, 0, 0, 0}
+};
+
+static const char *help_texts[] = {
+    "Number of directories to spread files over (default 20)",
+    "Number of files of each format (default 100)",
+    "Comma separated methods: mono, dual, threaded (default all)",
+    "Directory for tree and DB, a temporary one is removed when done",
+    "Keep temporary directory",
+    "Write JSON results to this file instead of stdout",
+    "Parser path or name to add, default is one per format",
+    "Load parsers from this plugins build directory",
+    "Number of slave processes or parser threads",
+    "Number of threads walking directories",
+    "Read directories in bulk with getdents64()",
+    "Skip files of directories unchanged since last scan",
+    "Preload known files using up to this many bytes",
+    "SQLite pragma for every connection, as name=value",
+    "this help message",
+    NULL
+};
+
+static void
+show_help(const char *prg_name)
+{
+    const struct option *lo;
+    const char **help;
+
+    fprintf(stderr,
+            "Usage:\n"
+            "\t%s [options]\n"
+            "where options are:\n", prg_name);
+
+    for (lo = long_options, help = help_texts; lo->name; lo++, help++) {
+        char opt[64];
+
+        snprintf(opt, sizeof(opt), "--%s%s", lo->name,
+                 lo->has_arg ? "=ARG" : "");
+        fprintf(stderr, "\t-%c, %-24s %s\n", lo->val, opt, *help);
+    }
+    fputc('\n', stderr);
+}
+
+static int
+parse_methods(struct bench *b, const char *str)
+{
+    char *s, *tok, *save = NULL;
+    int i;
+
+    s = strdup(str);
+    if (!s)
+        return -1;
+
+    b->methods = 0;
+    for (tok = strtok_r(s, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        for (i = 0; i < BENCH_METHOD_COUNT; i++)
+            if (strcmp(tok, method_names[i]) == 0)
+                break;
+        if (i == BENCH_METHOD_COUNT) {
+            fprintf(stderr, "ERROR: unknown method '%s'.\n", tok);
+            free(s);
+            return -1;
+        }
+        b->methods |= 1U << i;
+    }
+
+    free(s);
+    return 0;
+}
+
+static void
+json_string(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fprintf(fp, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            fprintf(fp, "\\u%04x", *s);
+        else
+            fputc(*s, fp);
+    }
+    fputc('"', fp);
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/***********************************************************************
+ * Tree
+ ***********************************************************************/
+
+static int
+remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    if (remove(path) != 0)
+        perror(path);
+    return 0;
+}
+
+static void
+remove_tree(const char *path)
+{
+    struct stat st;
+
+    if (lstat(path, &st) == 0)
+        nftw(path, remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+static int
+drop_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    int fd;
+
+    if (flag != FTW_F)
+        return 0;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+    return 0;
+}
+
+/*
+ * Best effort cold cache, file data is dropped from page cache if it's
+ * not dirty, directories are not.
+ */
+static void
+drop_caches(const struct bench *b)
+{
+    sync();
+    nftw(b->tree, drop_entry, 64, FTW_PHYS);
+    drop_entry(b->db_path, NULL, FTW_F, NULL);
+}
+
+/* d%03u/s%05u, ten top directories as a library sorted by artist */
+static int
+dir_path(const struct bench *b, unsigned int dir, char *path, size_t size, int create)
+{
+    int len;
+
+    len = snprintf(path, size, "%s/d%03u", b->tree, dir % 10);
+    if (create && mkdir(path, 0755) != 0 && errno != EEXIST) {
+        perror(path);
+        return -1;
+    }
+
+    len += snprintf(path + len, size - len, "/s%05u", dir);
+    if (create && mkdir(path, 0755) != 0 && errno != EEXIST) {
+        perror(path);
+        return -1;
+    }
+
+    return len;
+}
+
+static int
+generate_tree(struct bench *b)
+{
+    char path[PATH_MAX];
+    unsigned int f, i;
+
+    remove_tree(b->tree);
+    if (mkdir(b->tree, 0755) != 0) {
+        perror(b->tree);
+        return -1;
+    }
+
+    for (i = 0; i < b->n_dirs; i++)
+        if (dir_path(b, i, path, sizeof(path), 1) < 0)
+            return -1;
+
+    for (f = 0; f < BENCH_FORMAT_COUNT; f++) {
+        for (i = 0; i < b->n_files; i++) {
+            struct timespec times[2] = {
+                {BENCH_MTIME + i, 0}, {BENCH_MTIME + i, 0}
+            };
+            long size;
+            int len;
+
+            len = dir_path(b, i % b->n_dirs, path, sizeof(path), 0);
+            snprintf(path + len, sizeof(path) - len, "/f%06u%s",
+                     i, bench_formats[f].ext);
+
+            size = bench_media_write(path, f, i);
+            if (size < 0)
+                return -1;
+            utimensat(AT_FDCWD, path, times, 0);
+
+            b->tree_files++;
+            b->tree_bytes += size;
+        }
+    }
+
+    return 0;
+}
+
+/***********************************************************************
+ * Runs
+ ***********************************************************************/
+
+static void
+add_parsers(struct bench *b, lms_t *lms)
+{
+    unsigned int i;
+
+    if (b->n_parsers) {
+        for (i = 0; i < b->n_parsers; i++) {
+            const char *p = b->parsers[i];
+
+            if (p[0] == '.' || p[0] == '/')
+                lms_parser_add(lms, p);
+            else
+                lms_parser_find_and_add(lms, p);
+        }
+        return;
+    }
+
+    b->missing = 0;
+    for (i = 0; i < BENCH_FORMAT_COUNT; i++) {
+        const char *name = bench_formats[i].parser;
+        lms_plugin_t *p = NULL;
+
+        if (b->plugins_dir) {
+            char path[PATH_MAX];
+
+            snprintf(path, sizeof(path), "%s/%s/.libs/%s.so",
+                     b->plugins_dir, name, name);
+            if (access(path, R_OK) != 0)
+                snprintf(path, sizeof(path), "%s/%s.so",
+                         b->plugins_dir, name);
+            if (access(path, R_OK) == 0)
+                p = lms_parser_add(lms, path);
+        } else
+            p = lms_parser_find_and_add(lms, name);
+
+        if (!p)
+            b->missing |= 1U << i;
+    }
+}
+
+static lms_t *
+setup_lms(struct bench *b)
+{
+    unsigned int i;
+    lms_t *lms;
+
+    lms = lms_new(b->db_path);
+    if (!lms)
+        return NULL;
+
+    add_parsers(b, lms);
+
+    if (b->workers)
+        lms_set_worker_count(lms, b->workers);
+    if (b->walkers)
+        lms_set_walker_count(lms, b->walkers);
+    if (b->preload)
+        lms_set_preload_budget(lms, b->preload);
+    if (b->bulk_readdir)
+        lms_set_bulk_readdir(lms, 1);
+    if (b->skip_unchanged)
+        lms_set_skip_unchanged_dirs(lms, 1);
+    for (i = 0; i < b->n_pragmas; i++)
+        lms_set_db_pragma(lms, b->pragmas[i][0], b->pragmas[i][1]);
+
+    return lms;
+}
+
+static unsigned long long
+file_size(const char *path)
+{
+    struct stat st;
+
+    if (stat(path, &st) != 0)
+        return 0;
+    return st.st_size;
+}
+
+static int
+run(lms_t *lms, enum bench_method method, int check, const char *path)
+{
+    switch (method) {
+    case BENCH_METHOD_MONO:
+        return check ? lms_check_single_process(lms, path) :
+            lms_process_single_process(lms, path);
+    case BENCH_METHOD_DUAL:
+        return check ? lms_check(lms, path) : lms_process(lms, path);
+    case BENCH_METHOD_THREADED:
+        return check ? lms_check_threaded(lms, path) :
+            lms_process_threaded(lms, path);
+    default:
+        return -1;
+    }
+}
+
+static void
+print_run(struct bench *b, enum bench_method method, int check, int cold, int r, double secs, const struct lms_stats *stats)
+{
+    char wal[PATH_MAX + 4];
+    unsigned long long files = 0, errors;
+    unsigned int i;
+
+    for (i = 0; i <= LMS_PROGRESS_STATUS_UNKNOWN; i++)
+        files += stats->files[i];
+    errors = stats->files[LMS_PROGRESS_STATUS_KILLED] +
+        stats->files[LMS_PROGRESS_STATUS_ERROR_PARSE] +
+        stats->files[LMS_PROGRESS_STATUS_ERROR_COMM];
+    snprintf(wal, sizeof(wal), "%s-wal", b->db_path);
+
+    fprintf(b->out,
+            "%s\n    {\"method\": \"%s\", \"pass\": \"%s\", "
+            "\"cache\": \"%s\", \"status\": %d, \"seconds\": %.6f,\n"
+            "     \"files\": %llu, \"files_per_sec\": %.1f, "
+            "\"syscalls_per_file\": %.2f, \"bytes_read\": %llu, "
+            "\"db_bytes\": %llu,\n"
+            "     \"up_to_date\": %llu, \"processed\": %llu, "
+            "\"deleted\": %llu, \"skipped\": %llu, \"errors\": %llu}",
+            b->n_runs ? "," : "", method_names[method],
+            check ? "check" : "process", cold ? "cold" : "warm", r, secs,
+            files, secs > 0 ? files / secs : 0.0,
+            files ? (double)stats->syscalls / files : 0.0,
+            stats->bytes_read, file_size(b->db_path) + file_size(wal),
+            stats->files[LMS_PROGRESS_STATUS_UP_TO_DATE],
+            stats->files[LMS_PROGRESS_STATUS_PROCESSED],
+            stats->files[LMS_PROGRESS_STATUS_DELETED],
+            stats->files[LMS_PROGRESS_STATUS_SKIPPED], errors);
+    b->n_runs++;
+}
+
+/* cold process on a new DB, then warm, then check the same way */
+static int
+bench_method(struct bench *b, enum bench_method method)
+{
+    static const char *suffixes[] = {"", "-wal", "-shm", "-journal"};
+    int pass, ret = 0;
+    unsigned int i;
+    lms_t *lms;
+
+    for (i = 0; i < sizeof(suffixes) / sizeof(*suffixes); i++) {
+        char path[PATH_MAX + 16];
+
+        snprintf(path, sizeof(path), "%s%s", b->db_path, suffixes[i]);
+        unlink(path);
+    }
+
+    lms = setup_lms(b);
+    if (!lms)
+        return -1;
+
+    for (pass = 0; pass < 4; pass++) {
+        int check = pass >= 2, cold = !(pass & 1);
+        struct lms_stats stats;
+        double start, secs;
+        int r;
+
+        if (cold)
+            drop_caches(b);
+
+        start = now();
+        r = run(lms, method, check, b->tree);
+        secs = now() - start;
+
+        lms_get_stats(lms, &stats);
+        print_run(b, method, check, cold, r, secs, &stats);
+        if (r != 0)
+            ret = r;
+    }
+
+    lms_free(lms);
+    return ret;
+}
+
+static void
+print_header(struct bench *b)
+{
+    unsigned int i;
+    lms_t *lms;
+
+    /* also finds out which parsers are missing */
+    lms = setup_lms(b);
+
+    fprintf(b->out, "{\n  \"tree\": {\"dirs\": %u, \"files_per_format\": %u, "
+            "\"files\": %llu, \"bytes\": %llu, \"path\": ",
+            b->n_dirs, b->n_files, b->tree_files, b->tree_bytes);
+    json_string(b->out, b->tree);
+    fputs("},\n  \"formats\": [", b->out);
+    for (i = 0; i < BENCH_FORMAT_COUNT; i++) {
+        int missing = !b->n_parsers && (b->missing & (1U << i));
+
+        if (missing)
+            fprintf(stderr, "WARNING: no parser '%s', %s files are skipped.\n",
+                    bench_formats[i].parser, bench_formats[i].name);
+        fprintf(b->out, "%s{\"name\": \"%s\", \"parser\": \"%s\", "
+                "\"loaded\": %s}", i ? ", " : "", bench_formats[i].name,
+                bench_formats[i].parser,
+                b->n_parsers ? "null" : missing ? "false" : "true");
+    }
+    fputs("],\n", b->out);
+
+    /* settings actually used, defaults included */
+    if (lms) {
+        fprintf(b->out, "  \"settings\": {\"workers\": %u, \"walkers\": %u, "
+                "\"bulk_readdir\": %s, \"skip_unchanged\": %s, "
+                "\"preload_budget\": %u},\n",
+                lms_get_worker_count(lms), lms_get_walker_count(lms),
+                lms_get_bulk_readdir(lms) ? "true" : "false",
+                lms_get_skip_unchanged_dirs(lms) ? "true" : "false",
+                lms_get_preload_budget(lms));
+        lms_free(lms);
+    }
+
+    fputs("  \"runs\": [", b->out);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct bench b = {
+        .n_dirs = 20,
+        .n_files = 100,
+        .methods = (1U << BENCH_METHOD_COUNT) - 1,
+    };
+    const char *output = NULL;
+    unsigned int i;
+    int r = 0;
+
+    while (1) {
+        int c, opt_index = 0;
+
+        c = getopt_long(argc, argv, short_options, long_options, &opt_index);
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'd':
+            b.n_dirs = atoi(optarg);
+            break;
+        case 'f':
+            b.n_files = atoi(optarg);
+            break;
+        case 'm':
+            if (parse_methods(&b, optarg) != 0)
+                return -1;
+            break;
+        case 't':
+            snprintf(b.workdir, sizeof(b.workdir), "%s", optarg);
+            break;
+        case 'k':
+            b.keep = 1;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'p':
+            if (b.n_parsers == sizeof(b.parsers) / sizeof(*b.parsers)) {
+                fputs("ERROR: too many parsers.\n", stderr);
+                return -1;
+            }
+            b.parsers[b.n_parsers++] = optarg;
+            break;
+        case 'D':
+            b.plugins_dir = optarg;
+            break;
+        case 'w':
+            b.workers = atoi(optarg);
+            break;
+        case 'W':
+            b.walkers = atoi(optarg);
+            break;
+        case 'B':
+            b.bulk_readdir = 1;
+            break;
+        case 'u':
+            b.skip_unchanged = 1;
+            break;
+        case 'M':
+            b.preload = atoi(optarg);
+            break;
+        case 'g': {
+            char *sep = strchr(optarg, '=');
+
+            if (!sep) {
+                fprintf(stderr, "ERROR: pragma must be name=value: %s\n",
+                        optarg);
+                return -1;
+            }
+            if (b.n_pragmas == sizeof(b.pragmas) / sizeof(*b.pragmas)) {
+                fputs("ERROR: too many pragmas.\n", stderr);
+                return -1;
+            }
+            *sep = '\0';
+            b.pragmas[b.n_pragmas][0] = optarg;
+            b.pragmas[b.n_pragmas][1] = sep + 1;
+            b.n_pragmas++;
+            break;
+        }
+        case 'h':
+            show_help(argv[0]);
+            return 0;
+        default:
+            show_help(argv[0]);
+            return -1;
+        }
+    }
+
+    if (b.n_dirs < 1 || b.n_files < 1 || !b.methods) {
+        fputs("ERROR: nothing to benchmark.\n", stderr);
+        return -1;
+    }
+
+    if (!b.workdir[0]) {
+        const char *tmp = getenv("TMPDIR");
+
+        snprintf(b.workdir, sizeof(b.workdir), "%s/lms-bench-XXXXXX",
+                 tmp ? tmp : "/tmp");
+        if (!mkdtemp(b.workdir)) {
+            perror("mkdtemp");
+            return -1;
+        }
+        b.tmp_workdir = 1;
+    } else if (mkdir(b.workdir, 0755) != 0 && errno != EEXIST) {
+        perror(b.workdir);
+        return -1;
+    }
+
+    snprintf(b.tree, sizeof(b.tree), "%s/tree", b.workdir);
+    snprintf(b.db_path, sizeof(b.db_path), "%s/bench.db", b.workdir);
+
+    b.out = stdout;
+    if (output) {
+        b.out = fopen(output, "w");
+        if (!b.out) {
+            perror(output);
+            r = -1;
+            goto end;
+        }
+    }
+
+    fprintf(stderr, "generating %u files of %u formats in %s\n",
+            b.n_files, BENCH_FORMAT_COUNT, b.tree);
+    if (generate_tree(&b) != 0) {
+        r = -1;
+        goto end;
+    }
+
+    print_header(&b);
+    for (i = 0; i < BENCH_METHOD_COUNT; i++) {
+        if (!(b.methods & (1U << i)))
+            continue;
+
+        fprintf(stderr, "running %s\n", method_names[i]);
+        if (bench_method(&b, i) != 0)
+            r = -1;
+    }
+    fputs("\n  ]\n}\n", b.out);
+
+  end:
+    if (b.out && b.out != stdout)
+        fclose(b.out);
+
+    if (b.tmp_workdir && !b.keep)
+        remove_tree(b.workdir);
+    else if (b.tmp_workdir)
+        fprintf(stderr, "kept %s\n", b.workdir);
+
+    return r;
+}
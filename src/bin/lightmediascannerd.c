@@ -8,11 +8,17 @@
 
 static char *db_path = NULL;
 static char **charsets = NULL;
+static char **pragmas = NULL;
+static lms_db_session_t *db_session = NULL;
 static GHashTable *categories = NULL;
 static int commit_interval = 100;
 static int slave_timeout = 60;
+static int workers = 1;
+static gboolean shm_transport = FALSE;
 static int delete_older_than = 30;
+static int purge_chunk = 1000;
 static gboolean vacuum = FALSE;
+static int vacuum_pages = 256;
 static gboolean startup_scan = FALSE;
 static gboolean omit_scan_progress = FALSE;
 
@@ -29,6 +35,7 @@ static const char introspection_xml[] =
     "    <property name=\"WriteLocked\" type=\"b\" access=\"read\" />"
     "    <property name=\"UpdateID\" type=\"t\" access=\"read\" />"
     "    <property name=\"Categories\" type=\"a{sv}\" access=\"read\" />"
+    "    <property name=\"Stats\" type=\"a{sv}\" access=\"read\" />"
     "    <method name=\"Scan\">"
     "      <arg direction=\"in\" type=\"a{sv}\" name=\"specification\" />"
     "    </method>"
@@ -90,6 +97,14 @@ typedef struct scan_progress {
 
 #define SCAN_MOUNTPOINTS_TIMEOUT 1 /* in seconds */
 
+/* Old files are purged in chunks of purge_chunk files, sleeping
+ * PURGE_YIELD_TIMEOUT between them so clients waiting for the database
+ * get it. Free pages are then given back vacuum_pages at a time, every
+ * VACUUM_STEP_TIMEOUT, from the main loop while not scanning.
+ */
+#define PURGE_YIELD_TIMEOUT 50 /* in milliseconds */
+#define VACUUM_STEP_TIMEOUT 100 /* in milliseconds */
+
 typedef struct scanner {
     GDBusConnection *conn;
     char *write_lock;
@@ -107,12 +122,22 @@ typedef struct scanner {
         GList *pending;
     } mounts;
     guint64 update_id;
+    struct {
+        sqlite3 *db;
+        unsigned timer;
+    } vacuum;
+    /* of every lms used by the last scan, see scanner_thread_work */
+    struct {
+        struct lms_stats last;
+        struct lms_stats thread; /* only touched by worker thread */
+    } stats;
     struct {
         unsigned idler; /* not a flag, but g_source tag */
         unsigned is_scanning : 1;
         unsigned write_locked : 1;
         unsigned update_id : 1;
         unsigned categories: 1;
+        unsigned stats: 1;
     } changed_props;
 } scanner_t;
 
@@ -195,13 +220,88 @@ end:
     return update_id;
 }
 
+/*
+ * Delete dirs no file is in anymore, purge_chunk at a time in id order
+ * like do_delete_old(). Ones with a known state (children >= 0, see
+ * lms_set_skip_unchanged_dirs()) are kept, deleting files of a
+ * directory resets it, so that's only the ones without media.
+ */
+static void
+do_delete_unused_dirs(scanner_t *scanner, sqlite3 *db)
+{
+    const char select_sql[] = "SELECT max(id) FROM (SELECT id FROM dirs "
+        "WHERE id > ? ORDER BY id LIMIT ?)";
+    const char delete_sql[] = "DELETE FROM dirs "
+        "WHERE id > ? AND id <= ? AND children < 0 AND NOT EXISTS "
+        "(SELECT 1 FROM files WHERE files.dir_id = dirs.id)";
+    sqlite3_stmt *select_stmt = NULL, *delete_stmt = NULL;
+    gint64 first = 0, last;
+    guint64 deleted = 0;
+    int ret;
+
+    if (sqlite3_prepare_v2(db, select_sql, -1, &select_stmt, NULL) != SQLITE_OK ||
+        sqlite3_prepare_v2(db, delete_sql, -1, &delete_stmt, NULL) != SQLITE_OK) {
+        g_warning("Couldn't prepare delete unused dirs from %s: %s",
+                  db_path, sqlite3_errmsg(db));
+        goto cleanup;
+    }
+
+    while (!scanner->pending_stop) {
+        sqlite3_bind_int64(select_stmt, 1, first);
+        sqlite3_bind_int(select_stmt, 2, purge_chunk > 0 ? purge_chunk : -1);
+
+        ret = sqlite3_step(select_stmt);
+        if (ret != SQLITE_ROW) {
+            g_warning("Couldn't run SQL select dirs, ret=%d: %s",
+                      ret, sqlite3_errmsg(db));
+            break;
+        }
+        if (sqlite3_column_type(select_stmt, 0) == SQLITE_NULL) {
+            sqlite3_reset(select_stmt);
+            break;
+        }
+        last = sqlite3_column_int64(select_stmt, 0);
+        sqlite3_reset(select_stmt);
+
+        sqlite3_bind_int64(delete_stmt, 1, first);
+        sqlite3_bind_int64(delete_stmt, 2, last);
+
+        ret = sqlite3_step(delete_stmt);
+        sqlite3_reset(delete_stmt);
+        if (ret != SQLITE_DONE) {
+            g_warning("Couldn't run SQL delete unused dirs, ret=%d: %s",
+                      ret, sqlite3_errmsg(db));
+            break;
+        }
+
+        deleted += sqlite3_changes(db);
+        first = last;
+        g_usleep(PURGE_YIELD_TIMEOUT * 1000);
+    }
+
+    g_debug("Deleted %"G_GUINT64_FORMAT" unused dirs.", deleted);
+
+cleanup:
+    sqlite3_finalize(select_stmt);
+    sqlite3_finalize(delete_stmt);
+}
+
+/*
+ * Delete files with old dtime, purge_chunk at a time in id order. Each
+ * chunk is its own transaction, so readers are blocked for a short
+ * while only. Then dirs left without files.
+ */
 static void
-do_delete_old(void)
+do_delete_old(scanner_t *scanner)
 {
-    const char sql[] = "DELETE FROM files WHERE dtime > 0 and dtime <= ?";
+    const char select_sql[] = "SELECT max(id) FROM (SELECT id FROM files "
+        "WHERE id > ? AND dtime > 0 AND dtime <= ? ORDER BY id LIMIT ?)";
+    const char delete_sql[] = "DELETE FROM files "
+        "WHERE id > ? AND id <= ? AND dtime > 0 AND dtime <= ?";
     sqlite3 *db;
-    sqlite3_stmt *stmt;
-    gint64 dtime;
+    sqlite3_stmt *select_stmt = NULL, *delete_stmt = NULL;
+    gint64 dtime, first = 0, last;
+    guint64 deleted = 0;
     int ret;
 
     ret = sqlite3_open_v2(db_path, &db, SQLITE_OPEN_READWRITE, NULL);
@@ -210,38 +310,92 @@ do_delete_old(void)
         goto end;
     }
 
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+    /* clients may be reading, wait for them instead of giving up */
+    sqlite3_busy_timeout(db, slave_timeout * 1000);
+
+    if (sqlite3_prepare_v2(db, select_sql, -1, &select_stmt, NULL) != SQLITE_OK ||
+        sqlite3_prepare_v2(db, delete_sql, -1, &delete_stmt, NULL) != SQLITE_OK) {
         g_warning("Couldn't prepare delete old from %s: %s",
                   db_path, sqlite3_errmsg(db));
-        goto end;
+        goto cleanup;
     }
 
     dtime = (gint64)time(NULL) - delete_older_than * (24 * 60 * 60);
-    if (sqlite3_bind_int64(stmt, 1, dtime) != SQLITE_OK) {
-        g_warning("Couldn't bind delete old dtime '%"G_GINT64_FORMAT
-                  "'from %s: %s", dtime, db_path, sqlite3_errmsg(db));
-        goto cleanup;
+
+    while (!scanner->pending_stop) {
+        sqlite3_bind_int64(select_stmt, 1, first);
+        sqlite3_bind_int64(select_stmt, 2, dtime);
+        sqlite3_bind_int(select_stmt, 3, purge_chunk > 0 ? purge_chunk : -1);
+
+        ret = sqlite3_step(select_stmt);
+        if (ret != SQLITE_ROW) {
+            g_warning("Couldn't run SQL select old dtime '%"G_GINT64_FORMAT
+                      "', ret=%d: %s", dtime, ret, sqlite3_errmsg(db));
+            break;
+        }
+        if (sqlite3_column_type(select_stmt, 0) == SQLITE_NULL) {
+            sqlite3_reset(select_stmt);
+            break;
+        }
+        last = sqlite3_column_int64(select_stmt, 0);
+        sqlite3_reset(select_stmt);
+
+        sqlite3_bind_int64(delete_stmt, 1, first);
+        sqlite3_bind_int64(delete_stmt, 2, last);
+        sqlite3_bind_int64(delete_stmt, 3, dtime);
+
+        ret = sqlite3_step(delete_stmt);
+        sqlite3_reset(delete_stmt);
+        if (ret != SQLITE_DONE) {
+            g_warning("Couldn't run SQL delete old dtime '%"G_GINT64_FORMAT
+                      "', ret=%d: %s", dtime, ret, sqlite3_errmsg(db));
+            break;
+        }
+
+        deleted += sqlite3_changes(db);
+        first = last;
+        g_usleep(PURGE_YIELD_TIMEOUT * 1000);
     }
 
-    ret = sqlite3_step(stmt);
-    if (ret != SQLITE_DONE)
-        g_warning("Couldn't run SQL delete old dtime '%"G_GINT64_FORMAT
-                  "', ret=%d: %s", dtime, ret, sqlite3_errmsg(db));
+    g_debug("Deleted %"G_GUINT64_FORMAT" old files.", deleted);
+
+    do_delete_unused_dirs(scanner, db);
 
 cleanup:
-    sqlite3_reset(stmt);
-    sqlite3_finalize(stmt);
+    sqlite3_finalize(select_stmt);
+    sqlite3_finalize(delete_stmt);
 
 end:
     sqlite3_close(db);
 }
 
+static int
+get_auto_vacuum(sqlite3 *db)
+{
+    sqlite3_stmt *stmt;
+    int mode = -1;
+
+    if (sqlite3_prepare_v2(db, "PRAGMA auto_vacuum", -1, &stmt,
+                           NULL) != SQLITE_OK)
+        return -1;
+
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+        mode = sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+
+    return mode;
+}
+
+/*
+ * Full VACUUM, just needed once to turn on incremental auto vacuum of
+ * databases created without it, see scanner_vacuum_step().
+ */
 static void
 do_vacuum(void)
 {
-    const char sql[] = "VACUUM";
+    const char sql[] = "PRAGMA auto_vacuum = INCREMENTAL; VACUUM";
     sqlite3 *db;
-    sqlite3_stmt *stmt;
+    char *errmsg = NULL;
     int ret;
 
     ret = sqlite3_open_v2(db_path, &db, SQLITE_OPEN_READWRITE, NULL);
@@ -250,24 +404,102 @@ do_vacuum(void)
         goto end;
     }
 
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
-        g_warning("Couldn't vacuum from %s: %s",
-                  db_path, sqlite3_errmsg(db));
+    if (get_auto_vacuum(db) == 2) {
+        g_debug("Incremental auto vacuum is on, skip VACUUM.");
         goto end;
     }
 
-    ret = sqlite3_step(stmt);
-    if (ret != SQLITE_DONE)
-        g_warning("Couldn't run SQL VACUUM, ret=%d: %s",
-                  ret, sqlite3_errmsg(db));
-
-    sqlite3_reset(stmt);
-    sqlite3_finalize(stmt);
+    ret = sqlite3_exec(db, sql, NULL, NULL, &errmsg);
+    if (ret != SQLITE_OK) {
+        g_warning("Couldn't run SQL VACUUM, ret=%d: %s", ret, errmsg);
+        sqlite3_free(errmsg);
+    }
 
 end:
     sqlite3_close(db);
 }
 
+static void
+scanner_vacuum_stop(scanner_t *scanner)
+{
+    if (scanner->vacuum.timer) {
+        g_source_remove(scanner->vacuum.timer);
+        scanner->vacuum.timer = 0;
+    }
+
+    if (scanner->vacuum.db) {
+        sqlite3_close(scanner->vacuum.db);
+        scanner->vacuum.db = NULL;
+    }
+}
+
+/*
+ * Give back up to vacuum_pages free pages, until there are none left.
+ * Busy databases are left for the next step.
+ */
+static gboolean
+scanner_vacuum_step(gpointer data)
+{
+    scanner_t *scanner = data;
+    sqlite3 *db = scanner->vacuum.db;
+    sqlite3_stmt *stmt;
+    char sql[64];
+    int ret, free_pages = 0;
+
+    if (!db) {
+        ret = sqlite3_open_v2(db_path, &db, SQLITE_OPEN_READWRITE, NULL);
+        if (ret != SQLITE_OK) {
+            g_warning("Couldn't open '%s': %s", db_path, sqlite3_errmsg(db));
+            sqlite3_close(db);
+            goto stop;
+        }
+        scanner->vacuum.db = db;
+
+        if (get_auto_vacuum(db) != 2) {
+            g_debug("Incremental auto vacuum is off, see --vacuum.");
+            goto stop;
+        }
+    }
+
+    snprintf(sql, sizeof(sql), "PRAGMA incremental_vacuum(%d)",
+             vacuum_pages);
+    ret = sqlite3_exec(db, sql, NULL, NULL, NULL);
+    if (ret == SQLITE_BUSY || ret == SQLITE_LOCKED)
+        return TRUE;
+    else if (ret != SQLITE_OK) {
+        g_warning("Couldn't run SQL incremental vacuum, ret=%d: %s",
+                  ret, sqlite3_errmsg(db));
+        goto stop;
+    }
+
+    if (sqlite3_prepare_v2(db, "PRAGMA freelist_count", -1, &stmt,
+                           NULL) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW)
+            free_pages = sqlite3_column_int(stmt, 0);
+        sqlite3_finalize(stmt);
+    }
+
+    if (free_pages > 0)
+        return TRUE;
+
+    g_debug("Finished incremental vacuum.");
+
+stop:
+    scanner->vacuum.timer = 0;
+    scanner_vacuum_stop(scanner);
+    return FALSE;
+}
+
+static void
+scanner_vacuum_start(scanner_t *scanner)
+{
+    if (vacuum_pages <= 0 || scanner->vacuum.timer)
+        return;
+
+    scanner->vacuum.timer = g_timeout_add(VACUUM_STEP_TIMEOUT,
+                                          scanner_vacuum_step, scanner);
+}
+
 static gboolean
 check_write_locked(const scanner_t *scanner)
 {
@@ -318,6 +550,130 @@ categories_get_variant(void)
     return variant;
 }
 
+/* parser names are kept, lms and its parsers are gone by then */
+static void
+scan_stats_clear(struct lms_stats *stats)
+{
+    unsigned int i;
+
+    for (i = 0; i < stats->n_parsers; i++)
+        g_free((char *)stats->parsers[i].name);
+    memset(stats, 0, sizeof(*stats));
+}
+
+static void
+scan_stats_timer_add(struct lms_stats_timer *acc, const struct lms_stats_timer *t)
+{
+    unsigned int i;
+
+    acc->count += t->count;
+    acc->total_us += t->total_us;
+    if (acc->max_us < t->max_us)
+        acc->max_us = t->max_us;
+    for (i = 0; i < LMS_STATS_BUCKETS; i++)
+        acc->buckets[i] += t->buckets[i];
+}
+
+/* categories have their own lms, parsers are summed by name */
+static void
+scan_stats_add(struct lms_stats *acc, lms_t *lms)
+{
+    struct lms_stats stats;
+    unsigned int i, j;
+
+    if (lms_get_stats(lms, &stats) != 0)
+        return;
+
+    for (i = 0; i < LMS_STATS_PHASE_COUNT; i++)
+        scan_stats_timer_add(acc->phases + i, stats.phases + i);
+    for (i = 0; i <= LMS_PROGRESS_STATUS_UNKNOWN; i++)
+        acc->files[i] += stats.files[i];
+    acc->bytes_read += stats.bytes_read;
+    acc->syscalls += stats.syscalls;
+
+    for (i = 0; i < stats.n_parsers; i++) {
+        if (!stats.parsers[i].parse.count)
+            continue;
+
+        for (j = 0; j < acc->n_parsers; j++)
+            if (strcmp(acc->parsers[j].name, stats.parsers[i].name) == 0)
+                break;
+        if (j == acc->n_parsers) {
+            if (j == LMS_STATS_MAX_PARSERS)
+                continue;
+            acc->parsers[j].name = g_strdup(stats.parsers[i].name);
+            acc->n_parsers++;
+        }
+
+        scan_stats_timer_add(&acc->parsers[j].parse, &stats.parsers[i].parse);
+    }
+}
+
+static GVariant *
+scan_stats_timer_get_variant(const struct lms_stats_timer *t)
+{
+    GVariantBuilder *builder;
+    GVariant *variant;
+    unsigned int i;
+
+    builder = g_variant_builder_new(G_VARIANT_TYPE("at"));
+    for (i = 0; i < LMS_STATS_BUCKETS; i++)
+        g_variant_builder_add(builder, "t", (guint64)t->buckets[i]);
+
+    variant = g_variant_new("(tttat)", (guint64)t->count,
+                            (guint64)t->total_us, (guint64)t->max_us,
+                            builder);
+    g_variant_builder_unref(builder);
+
+    return variant;
+}
+
+/*
+ * Timers are (count, total_us, max_us, buckets), where buckets[i] has
+ * the events that took less than 2^i microseconds.
+ */
+static GVariant *
+scan_stats_get_variant(const struct lms_stats *stats)
+{
+    static const char *phases[LMS_STATS_PHASE_COUNT] = {
+        "Walk", "Stat", "Lookup", "Match", "Parse", "Commit"
+    };
+    static const char *files[LMS_PROGRESS_STATUS_UNKNOWN + 1] = {
+        "UpToDate", "Processed", "Deleted", "Killed", "ErrorParse",
+        "ErrorComm", "Skipped", "Unknown"
+    };
+    GVariantBuilder *builder, *parsers;
+    GVariant *variant;
+    unsigned int i;
+
+    builder = g_variant_builder_new(G_VARIANT_TYPE("a{sv}"));
+
+    for (i = 0; i <= LMS_PROGRESS_STATUS_UNKNOWN; i++)
+        g_variant_builder_add(builder, "{sv}", files[i],
+                              g_variant_new_uint64(stats->files[i]));
+    g_variant_builder_add(builder, "{sv}", "BytesRead",
+                          g_variant_new_uint64(stats->bytes_read));
+    g_variant_builder_add(builder, "{sv}", "Syscalls",
+                          g_variant_new_uint64(stats->syscalls));
+    for (i = 0; i < LMS_STATS_PHASE_COUNT; i++)
+        g_variant_builder_add(builder, "{sv}", phases[i],
+                              scan_stats_timer_get_variant(stats->phases + i));
+
+    parsers = g_variant_builder_new(G_VARIANT_TYPE("a{sv}"));
+    for (i = 0; i < stats->n_parsers; i++)
+        g_variant_builder_add(
+            parsers, "{sv}", stats->parsers[i].name,
+            scan_stats_timer_get_variant(&stats->parsers[i].parse));
+    g_variant_builder_add(builder, "{sv}", "Parsers",
+                          g_variant_builder_end(parsers));
+    g_variant_builder_unref(parsers);
+
+    variant = g_variant_builder_end(builder);
+    g_variant_builder_unref(builder);
+
+    return variant;
+}
+
 static gboolean
 scanner_dbus_props_changed(gpointer data)
 {
@@ -356,6 +712,11 @@ scanner_dbus_props_changed(gpointer data)
         g_variant_builder_add(builder, "{sv}", "Categories",
                               categories_get_variant());
     }
+    if (scanner->changed_props.stats) {
+        scanner->changed_props.stats = FALSE;
+        g_variant_builder_add(builder, "{sv}", "Stats",
+                              scan_stats_get_variant(&scanner->stats.last));
+    }
 
     g_dbus_connection_emit_signal(scanner->conn,
                                   NULL,
@@ -594,6 +955,16 @@ scanner_is_scanning_changed(scanner_t *scanner)
     scanner->changed_props.is_scanning = TRUE;
 }
 
+static void
+scanner_stats_changed(scanner_t *scanner)
+{
+    if (scanner->changed_props.idler == 0)
+        scanner->changed_props.idler = g_idle_add(scanner_dbus_props_changed,
+                                                  scanner);
+
+    scanner->changed_props.stats = TRUE;
+}
+
 static gboolean
 report_scan_progress(gpointer data)
 {
@@ -704,6 +1075,11 @@ setup_lms(const char *category, const scanner_t *scanner)
 
     lms_set_commit_interval(lms, commit_interval);
     lms_set_slave_timeout(lms, slave_timeout * 1000);
+    lms_set_worker_count(lms, workers);
+    lms_set_shm_transport(lms, shm_transport);
+
+    if (db_session && lms_set_db_session(lms, db_session) != 0)
+        g_warning("Couldn't use DB session, opening DB for each scan");
 
     if (charsets) {
         for (itr = charsets; *itr != NULL; itr++)
@@ -711,6 +1087,25 @@ setup_lms(const char *category, const scanner_t *scanner)
                 g_warning("Couldn't add charset: %s", *itr);
     }
 
+    /* just for new databases, it must be set before tables exist */
+    if (vacuum_pages > 0)
+        lms_set_db_pragma(lms, "auto_vacuum", "incremental");
+
+    if (pragmas) {
+        for (itr = pragmas; *itr != NULL; itr++) {
+            char *sep = strchr(*itr, '=');
+            if (!sep) {
+                g_warning("Invalid pragma, expected NAME=VALUE: %s", *itr);
+                continue;
+            }
+
+            *sep = '\0';
+            if (lms_set_db_pragma(lms, *itr, sep + 1) != 0)
+                g_warning("Couldn't set pragma: %s", *itr);
+            *sep = '=';
+        }
+    }
+
     for (itr = (char **)sc->parsers->data; *itr != NULL; itr++) {
         const char *parser = *itr;
         lms_plugin_t *plugin;
@@ -744,6 +1139,13 @@ scanner_thread_cleanup(gpointer data)
     scanner->thread = NULL;
     scanner->cleanup_thread_idler = 0;
 
+    scan_stats_clear(&scanner->stats.last);
+    scanner->stats.last = scanner->stats.thread;
+    memset(&scanner->stats.thread, 0, sizeof(scanner->stats.thread));
+    scanner_stats_changed(scanner);
+
+    scanner_vacuum_start(scanner);
+
     if (scanner->pending_stop) {
         g_dbus_method_invocation_return_value(scanner->pending_stop, NULL);
         g_object_unref(scanner->pending_stop);
@@ -828,11 +1230,15 @@ scanner_thread_work(gpointer data)
                     scanner->scan_progress = sp;
                 }
 
-                if (!scanner->pending_stop)
+                if (!scanner->pending_stop) {
                     lms_check(lms, path);
+                    scan_stats_add(&scanner->stats.thread, lms);
+                }
                 if (!scanner->pending_stop &&
-                    g_file_test(path, G_FILE_TEST_EXISTS))
+                    g_file_test(path, G_FILE_TEST_EXISTS)) {
                     lms_process(lms, path);
+                    scan_stats_add(&scanner->stats.thread, lms);
+                }
 
                 if (sp)
                     g_idle_add(report_scan_progress_and_free, sp);
@@ -850,7 +1256,7 @@ scanner_thread_work(gpointer data)
     if (delete_older_than >= 0) {
         g_debug("Delete from DB files with dtime older than %d days.",
                 delete_older_than);
-        do_delete_old();
+        do_delete_old(scanner);
     }
 
     if (vacuum) {
@@ -873,6 +1279,7 @@ scanner_thread_work(gpointer data)
 static void
 do_scan(scanner_t *scanner)
 {
+    scanner_vacuum_stop(scanner);
     scanner->thread = g_thread_new("scanner", scanner_thread_work, scanner);
 
     scanner_is_scanning_changed(scanner);
@@ -1016,6 +1423,8 @@ scanner_get_prop(GDBusConnection *conn, const char *sender, const char *opath, c
         ret = g_variant_new_uint64(scanner->update_id);
     } else if (strcmp(prop, "Categories") == 0)
         ret = categories_get_variant();
+    else if (strcmp(prop, "Stats") == 0)
+        ret = scan_stats_get_variant(&scanner->stats.last);
     else
         ret = NULL;
 
@@ -1251,6 +1660,9 @@ scanner_destroyed(gpointer data)
         scanner_dbus_props_changed(scanner);
     }
 
+    scanner_vacuum_stop(scanner);
+    scan_stats_clear(&scanner->stats.last);
+
     g_assert(scanner->thread == NULL);
     g_assert(scanner->pending_scan == NULL);
     g_assert(scanner->cleanup_thread_idler == 0);
@@ -1576,6 +1988,13 @@ main(int argc, char *argv[])
          "Number of seconds to wait for slave to reply, otherwise kills it. "
          "Defaults to 60.",
          "SECONDS"},
+        {"workers", 'w', 0, G_OPTION_ARG_INT, &workers,
+         "Number of slave processes parsing files in parallel, each one "
+         "subject to slave-timeout. Defaults to 1.",
+         "NUMBER"},
+        {"shm-transport", 0, 0, G_OPTION_ARG_NONE, &shm_transport,
+         "Talk to slaves using shared memory instead of pipes.",
+         NULL},
         {"delete-older-than", 'd', 0, G_OPTION_ARG_INT, &delete_older_than,
          "Delete from database files that have 'dtime' older than the given "
          "number of DAYS. If not specified LightMediaScanner will keep the "
@@ -1586,8 +2005,20 @@ main(int argc, char *argv[])
          "Use a negative number to disable this behavior. "
          "Defaults to 30.",
          "DAYS"},
+        {"purge-chunk", 0, 0, G_OPTION_ARG_INT, &purge_chunk,
+         "Delete old files (see delete-older-than) this many at a time, "
+         "letting clients access the database in between. "
+         "Defaults to 1000.",
+         "NUMBER"},
         {"vacuum", 'V', 0, G_OPTION_ARG_NONE, &vacuum,
-         "Execute SQL VACUUM after every scan.", NULL},
+         "Execute SQL VACUUM after scans if the database doesn't have "
+         "incremental auto vacuum yet, turning it on.", NULL},
+        {"vacuum-pages", 0, 0, G_OPTION_ARG_INT, &vacuum_pages,
+         "Free pages given back to the file system at each incremental "
+         "vacuum step after scans, 0 to disable. New databases use "
+         "incremental auto vacuum, old ones after --vacuum. "
+         "Defaults to 256.",
+         "PAGES"},
         {"startup-scan", 'S', 0, G_OPTION_ARG_NONE, &startup_scan,
          "Execute full scan on startup.", NULL},
         {"omit-scan-progress", 0, 0, G_OPTION_ARG_NONE, &omit_scan_progress,
@@ -1598,6 +2029,13 @@ main(int argc, char *argv[])
          NULL},
         {"charset", 'C', 0, G_OPTION_ARG_STRING_ARRAY, &charsets,
          "Extra charset to use. (Multiple use)", "CHARSET"},
+        {"pragma", 0, 0, G_OPTION_ARG_STRING_ARRAY, &pragmas,
+         "SQLite pragma used by every scanner connection, one of "
+         "auto_vacuum, journal_mode, synchronous, cache_size, mmap_size or "
+         "temp_store. "
+         "Use journal_mode=WAL so clients reading the database are not "
+         "blocked while scanning. (Multiple use)",
+         "NAME=VALUE"},
         {"parser", 'P', 0, G_OPTION_ARG_STRING_ARRAY, &parsers,
          "Parsers to use, defaults to all. Format is 'category:parsername' or "
          "'parsername' to apply parser to all categories. The special "
@@ -1707,7 +2145,12 @@ main(int argc, char *argv[])
     g_debug("db-path: %s", db_path);
     g_debug("commit-interval: %d files", commit_interval);
     g_debug("slave-timeout: %d seconds", slave_timeout);
+    g_debug("workers: %d", workers);
+    g_debug("shm-transport: %s", shm_transport ? "yes" : "no");
     g_debug("delete-older-than: %d days", delete_older_than);
+    g_debug("purge-chunk: %d files", purge_chunk);
+    g_debug("vacuum: %s", vacuum ? "yes" : "no");
+    g_debug("vacuum-pages: %d", vacuum_pages);
 
     if (charsets) {
         char *tmp = g_strjoinv(", ", charsets);
@@ -1725,6 +2168,11 @@ main(int argc, char *argv[])
                         G_BUS_NAME_OWNER_FLAGS_NONE,
                         NULL, on_name_acquired, NULL, NULL, NULL);
 
+    /* kept across scans and categories, see lms_db_session_new() */
+    db_session = lms_db_session_new(db_path);
+    if (!db_session)
+        g_warning("Couldn't create DB session, opening DB for each scan");
+
     g_debug("starting main loop");
 
     loop = g_main_loop_new(NULL, FALSE);
@@ -1739,9 +2187,13 @@ main(int argc, char *argv[])
 
     g_dbus_node_info_unref(introspection_data);
 
+    if (db_session)
+        lms_db_session_free(db_session);
+
 end_options:
     g_free(db_path);
     g_strfreev(charsets);
+    g_strfreev(pragmas);
     g_strfreev(parsers);
     g_strfreev(dirs);
 
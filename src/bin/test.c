@@ -32,7 +32,8 @@
 #include <sys/stat.h>
 
 static int color = 0;
-static const char short_options[] = "s:S:p:P::c:i:t:m:v::h";
+static lms_db_session_t *session = NULL;
+static const char short_options[] = "s:S:p:P::c:i:b:l:t:w:G:W:k:rBuCM:g:em:v::h";
 
 static const struct option long_options[] = {
     {"scan-path", 1, NULL, 's'},
@@ -41,7 +42,20 @@ static const struct option long_options[] = {
     {"list-parsers", 2, NULL, 'P'},
     {"charset", 1, NULL, 'c'},
     {"commit-interval", 1, NULL, 'i'},
+    {"commit-bytes", 1, NULL, 'b'},
+    {"commit-latency", 1, NULL, 'l'},
     {"slave-timeout", 1, NULL, 't'},
+    {"workers", 1, NULL, 'w'},
+    {"slave-pool", 1, NULL, 'G'},
+    {"walkers", 1, NULL, 'W'},
+    {"check-batch", 1, NULL, 'k'},
+    {"shm-transport", 0, NULL, 'r'},
+    {"bulk-readdir", 0, NULL, 'B'},
+    {"skip-unchanged", 0, NULL, 'u'},
+    {"content-match", 0, NULL, 'C'},
+    {"preload-budget", 1, NULL, 'M'},
+    {"pragma", 1, NULL, 'g'},
+    {"db-session", 0, NULL, 'e'},
     {"method", 1, NULL, 'm'},
     {"verbose", 2, NULL, 'v'},
     {"help", 0, NULL, 'h'},
@@ -55,8 +69,21 @@ static const char *help_texts[] = {
     "List all know parsers, with argument list of that category",
     "Charset to add",
     "Commit interval, in number of transactions",
+    "Commit once parsed data queued reaches this many bytes",
+    "Commit parsed files waiting longer than this, in milliseconds",
     "Slave timeout, in milliseconds",
-    "Work method to use: 'dual' for two process (safe) or 'mono' for one.",
+    "Number of slave processes used by 'dual' method, or parser threads by 'threaded'",
+    "Parsers added after it go to a new pool of slaves, as workers[:timeout]",
+    "Number of threads walking directories",
+    "Number of files stat'ed at once when checking",
+    "Talk to slaves using shared memory rings instead of pipes",
+    "Read directories in bulk with getdents64()",
+    "Skip files of directories unchanged since last scan",
+    "Also match files by their contents, not only by name",
+    "Preload known files using up to this many bytes",
+    "SQLite pragma for every connection, as name=value",
+    "Keep DB and compiled statements between scan paths",
+    "Work method to use: 'dual' for two process (safe), 'mono' for one or 'threaded'.",
     "verbose mode, print progress (=0 to disable it)",
     "this help message",
     NULL
@@ -205,12 +232,13 @@ handle_options_independent(int argc, char **argv)
 static int
 handle_options_setup(lms_t *lms, int argc, char **argv)
 {
-    int opt_index, parsers_added;
+    int opt_index, parsers_added, slave_pool;
 
     optind = 0;
     opterr = 0;
     opt_index = 0;
     parsers_added = 0;
+    slave_pool = 0;
     while (1) {
         int c;
 
@@ -227,6 +255,9 @@ handle_options_setup(lms_t *lms, int argc, char **argv)
                 p = lms_parser_find_and_add(lms, optarg);
             if (!p)
                 return -1;
+            if (slave_pool > 0 &&
+                lms_parser_set_slave_pool(lms, p, slave_pool) != 0)
+                return -1;
             parsers_added = 1;
             break;
         }
@@ -237,9 +268,67 @@ handle_options_setup(lms_t *lms, int argc, char **argv)
         case 'i':
             lms_set_commit_interval(lms, atoi(optarg));
             break;
+        case 'b':
+            lms_set_commit_bytes(lms, atoi(optarg));
+            break;
+        case 'l':
+            lms_set_commit_latency(lms, atoi(optarg));
+            break;
         case 't':
             lms_set_slave_timeout(lms, atoi(optarg));
             break;
+        case 'w':
+            lms_set_worker_count(lms, atoi(optarg));
+            break;
+        case 'G': {
+            const char *sep = strchr(optarg, ':');
+            int timeout = sep ? atoi(sep + 1) : lms_get_slave_timeout(lms);
+
+            slave_pool = lms_slave_pool_add(lms, atoi(optarg), timeout);
+            if (slave_pool < 0)
+                return -1;
+            break;
+        }
+        case 'W':
+            lms_set_walker_count(lms, atoi(optarg));
+            break;
+        case 'k':
+            lms_set_check_batch(lms, atoi(optarg));
+            break;
+        case 'r':
+            lms_set_shm_transport(lms, 1);
+            break;
+        case 'B':
+            lms_set_bulk_readdir(lms, 1);
+            break;
+        case 'u':
+            lms_set_skip_unchanged_dirs(lms, 1);
+            break;
+        case 'C':
+            lms_set_content_match(lms, 1);
+            break;
+        case 'M':
+            lms_set_preload_budget(lms, atoi(optarg));
+            break;
+        case 'g': {
+            char *sep = strchr(optarg, '=');
+
+            if (!sep) {
+                fprintf(stderr, "ERROR: pragma must be name=value: %s\n",
+                        optarg);
+                return -1;
+            }
+            *sep = '\0';
+            if (lms_set_db_pragma(lms, optarg, sep + 1) != 0)
+                return -1;
+            break;
+        }
+        case 'e':
+            if (!session)
+                session = lms_db_session_new(lms_get_db_path(lms));
+            if (!session || lms_set_db_session(lms, session) != 0)
+                return -1;
+            break;
         default:
             break;
         }
@@ -260,6 +349,8 @@ method_name(int method)
         return "mono";
     case 2:
         return "dual";
+    case 3:
+        return "threaded";
     default:
         return "unknown";
     }
@@ -307,6 +398,63 @@ progress(lms_t *lms, const char *path, int path_len, lms_progress_status_t statu
            name, path, status, cstart, s[status], cend);
 }
 
+/* upper bound of the bucket holding the given fraction of events */
+static unsigned long long
+timer_percentile(const struct lms_stats_timer *t, double fraction)
+{
+    unsigned long long seen = 0;
+    int i;
+
+    for (i = 0; i < LMS_STATS_BUCKETS - 1; i++) {
+        seen += t->buckets[i];
+        if (seen >= t->count * fraction)
+            break;
+    }
+
+    return 1ULL << i;
+}
+
+static void
+print_timer(const char *name, const struct lms_stats_timer *t)
+{
+    if (!t->count)
+        return;
+
+    printf("  %-12s %8llu in %10llu us (%.1f avg, <%llu p50, "
+           "<%llu p99, %llu max)\n",
+           name, t->count, t->total_us, (double)t->total_us / t->count,
+           timer_percentile(t, 0.5), timer_percentile(t, 0.99), t->max_us);
+}
+
+static void
+print_stats(lms_t *lms, const char *name)
+{
+    static const char *phases[LMS_STATS_PHASE_COUNT] = {
+        "walk", "stat", "lookup", "match", "parse", "commit"
+    };
+    struct lms_stats stats;
+    unsigned int i;
+
+    if (lms_get_stats(lms, &stats) != 0)
+        return;
+
+    printf("STATS %s: %llu up to date, %llu processed, %llu deleted, "
+           "%llu killed, %llu errors, %llu skipped\n", name,
+           stats.files[LMS_PROGRESS_STATUS_UP_TO_DATE],
+           stats.files[LMS_PROGRESS_STATUS_PROCESSED],
+           stats.files[LMS_PROGRESS_STATUS_DELETED],
+           stats.files[LMS_PROGRESS_STATUS_KILLED],
+           stats.files[LMS_PROGRESS_STATUS_ERROR_PARSE] +
+           stats.files[LMS_PROGRESS_STATUS_ERROR_COMM],
+           stats.files[LMS_PROGRESS_STATUS_SKIPPED]);
+    printf("  %llu bytes read, %llu read/write syscalls\n",
+           stats.bytes_read, stats.syscalls);
+    for (i = 0; i < LMS_STATS_PHASE_COUNT; i++)
+        print_timer(phases[i], stats.phases + i);
+    for (i = 0; i < stats.n_parsers; i++)
+        print_timer(stats.parsers[i].name, &stats.parsers[i].parse);
+}
+
 static int
 work(lms_t *lms, int method, int verbose, const char *path)
 {
@@ -323,6 +471,8 @@ work(lms_t *lms, int method, int verbose, const char *path)
         r = lms_check_single_process(lms, path);
     else if (method == 2)
         r = lms_check(lms, path);
+    else if (method == 3)
+        r = lms_check_threaded(lms, path);
     else
         r = -1;
 
@@ -332,6 +482,9 @@ work(lms_t *lms, int method, int verbose, const char *path)
         return r;
     }
 
+    if (verbose)
+        print_stats(lms, "CHECK");
+
     if (stat(path, &st) != 0) {
         printf("PROCESS skipped for '%s': doesn't exist.\n", path);
         return 0;
@@ -348,6 +501,8 @@ work(lms_t *lms, int method, int verbose, const char *path)
         r = lms_process_single_process(lms, path);
     else if (method == 2)
         r = lms_process(lms, path);
+    else if (method == 3)
+        r = lms_process_threaded(lms, path);
 
     if (r != 0) {
         if (verbose)
@@ -355,13 +510,37 @@ work(lms_t *lms, int method, int verbose, const char *path)
         return r;
     }
 
+    if (verbose)
+        print_stats(lms, "PROCESS");
+
+    if (verbose && lms_get_bulk_readdir(lms) == 1) {
+        struct lms_dir_read_stats stats;
+
+        lms_get_dir_read_stats(lms, &stats);
+        printf("READDIR: %u directories, %u syscalls (%.2f avg, %u max)\n",
+               stats.dirs, stats.syscalls,
+               stats.dirs ? (double)stats.syscalls / stats.dirs : 0.0,
+               stats.max_syscalls);
+    }
+
+    if (verbose && lms_get_preload_budget(lms) > 0) {
+        struct lms_preload_stats stats;
+
+        lms_get_preload_stats(lms, &stats);
+        if (stats.over_budget)
+            printf("PRELOAD: over budget, not used\n");
+        else
+            printf("PRELOAD: %u files in %u bytes\n",
+                   stats.files, stats.bytes);
+    }
+
     return 0;
 }
 
 static int
 show(lms_t *lms, const char *orig_path)
 {
-    const char *sql = ("SELECT id, path, size FROM files WHERE path LIKE ? "
+    const char *sql = ("SELECT id, path, size FROM file_paths WHERE path LIKE ? "
                        "AND dtime = 0");
     char buf[PATH_MAX + 2];
     char path[PATH_MAX];
@@ -475,10 +654,13 @@ handle_options_work(lms_t *lms, int argc, char **argv)
             else if (strcmp(optarg, "2") == 0 ||
                      strcmp(optarg, "dual") == 0)
                 method = 2;
+            else if (strcmp(optarg, "3") == 0 ||
+                     strcmp(optarg, "threaded") == 0)
+                method = 3;
             else
                 fprintf(stderr,
-                        "ERROR: invalid method=%s, should be 'mono' (1) or "
-                        "'dual' (2). Default is dual.\n",
+                        "ERROR: invalid method=%s, should be 'mono' (1), "
+                        "'dual' (2) or 'threaded' (3). Default is dual.\n",
                         optarg);
             break;
         case 'v':
@@ -546,5 +728,7 @@ main(int argc, char *argv[])
         fputs("errors occurred, check out messages!\n", stderr);
 
     lms_free(lms);
+    if (session)
+        lms_db_session_free(session);
     return r;
 }
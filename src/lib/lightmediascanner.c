@@ -24,6 +24,7 @@
 #ifdef HAVE_MAGIC_H
 #include <magic.h>
 #endif
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -36,6 +37,13 @@
 
 #define DEFAULT_SLAVE_TIMEOUT 1000
 #define DEFAULT_COMMIT_INTERVAL 100
+#define DEFAULT_COMMIT_BYTES (1024 * 1024)
+#define DEFAULT_COMMIT_LATENCY 0
+#define DEFAULT_WORKER_COUNT 1
+#define DEFAULT_WALKER_COUNT 1
+#define MAX_WORKER_COUNT 64
+#define DEFAULT_CHECK_BATCH 128
+#define MAX_CHECK_BATCH 4096
 
 #ifdef HAVE_MAGIC_H
 static magic_t _magic_handle;
@@ -106,6 +114,7 @@ static int
 _parser_load(struct parser *p, const char *so_path)
 {
     lms_plugin_t *(*plugin_open)(void);
+    const struct lms_plugin_exts *(*plugin_exts)(void);
     char *errmsg;
 
     memset(p, 0, sizeof(*p));
@@ -137,6 +146,18 @@ _parser_load(struct parser *p, const char *so_path)
         return -4;
     }
 
+    plugin_exts = dlsym(p->dl_handle, "lms_plugin_exts");
+    if (plugin_exts)
+        p->exts = plugin_exts();
+    else
+        dlerror(); /* optional, clear error */
+
+    if (!p->exts && !p->plugin->match) {
+        fprintf(stderr, "ERROR: plugin \"%s\" has no way to match files.\n",
+                so_path);
+        return -5;
+    }
+
     return 0;
 }
 
@@ -200,7 +221,12 @@ lms_new(const char *db_path)
     }
 
     lms->commit_interval = DEFAULT_COMMIT_INTERVAL;
+    lms->commit_bytes = DEFAULT_COMMIT_BYTES;
+    lms->commit_latency = DEFAULT_COMMIT_LATENCY;
     lms->slave_timeout = DEFAULT_SLAVE_TIMEOUT;
+    lms->worker_count = DEFAULT_WORKER_COUNT;
+    lms->walker_count = DEFAULT_WALKER_COUNT;
+    lms->check_batch = DEFAULT_CHECK_BATCH;
     lms->db_path = strdup(db_path);
     if (!lms->db_path) {
         perror("strdup");
@@ -209,6 +235,9 @@ lms_new(const char *db_path)
         return NULL;
     }
 
+    /* scan goes on without them */
+    lms->stats = lms_stats_new();
+
     return lms;
 }
 
@@ -231,6 +260,11 @@ lms_free(lms_t *lms)
     if (lms->is_processing)
         return -1;
 
+    if (lms->exts)
+        lms_exts_free(lms->exts);
+    if (lms->magic)
+        lms_magic_free(lms->magic);
+
     if (lms->parsers) {
         for (i = 0; i < lms->n_parsers; i++)
             _parser_unload(lms->parsers + i);
@@ -241,6 +275,14 @@ lms_free(lms_t *lms)
     if (lms->progress.data && lms->progress.free_data)
         lms->progress.free_data(lms->progress.data);
 
+    for (i = 0; i < DB_PRAGMA_COUNT; i++)
+        free(lms->db_pragmas[i]);
+
+    free(lms->slave_pools);
+
+    if (lms->stats)
+        lms_stats_free(lms->stats);
+
     free(lms->db_path);
     lms_charset_conv_free(lms->cs_conv);
     free(lms);
@@ -273,6 +315,19 @@ lms_set_progress_callback(lms_t *lms, lms_progress_callback_t cb, const void *da
     lms->progress.free_data = free_data;
 }
 
+/* extensions and signatures refer to parsers by index, rebuild them */
+static void
+_matchers_update(lms_t *lms)
+{
+    if (lms->exts)
+        lms_exts_free(lms->exts);
+    lms->exts = lms_exts_new(lms);
+
+    if (lms->magic)
+        lms_magic_free(lms->magic);
+    lms->magic = lms_magic_new(lms);
+}
+
 static int
 _plugin_sort(const struct parser *a, const struct parser *b)
 {
@@ -292,6 +347,7 @@ lms_plugin_t *
 lms_parser_add(lms_t *lms, const char *so_path)
 {
     struct parser *parser;
+    lms_plugin_t *plugin;
     void *tmp;
 
     if (!lms)
@@ -319,10 +375,13 @@ lms_parser_add(lms_t *lms, const char *so_path)
         return NULL;
     }
 
+    /* sorting moves it */
+    plugin = parser->plugin;
     lms->n_parsers++;
     qsort(lms->parsers, lms->n_parsers, sizeof(struct parser),
           (comparison_fn_t)_plugin_sort);
-    return parser->plugin;
+    _matchers_update(lms);
+    return plugin;
 }
 
 static int
@@ -377,6 +436,7 @@ lms_parser_del_int(lms_t *lms, int i)
     if (lms->n_parsers == 0) {
         free(lms->parsers);
         lms->parsers = NULL;
+        _matchers_update(lms);
         return 0;
     } else {
         int dif;
@@ -386,6 +446,9 @@ lms_parser_del_int(lms_t *lms, int i)
         if (dif)
             memmove(parser, parser + 1, dif * sizeof(struct parser));
 
+        /* even if realloc() fails, indexes changed */
+        _matchers_update(lms);
+
         tmp = realloc(lms->parsers,
                       lms->n_parsers * sizeof(struct parser));
         if (!tmp)
@@ -426,6 +489,104 @@ lms_parser_del(lms_t *lms, lms_plugin_t *handle)
     return -3;
 }
 
+/**
+ * Add a pool of slave processes to lms_process().
+ *
+ * All files go to the lms_get_worker_count() slaves by default, so one
+ * slow file, like a big video given to a heavy parser, holds its slave
+ * and the paths queued behind it. Files matched by parsers given to a
+ * pool with lms_parser_set_slave_pool() go to the slaves of that pool
+ * instead, subject to its own timeout, while other files keep going
+ * through the default slaves. Replies of all slaves are handled as they
+ * come, in no particular order.
+ *
+ * Pools only apply to lms_process(), other methods ignore them.
+ *
+ * @param lms previously allocated Light Media Scanner instance.
+ * @param workers number of slave processes, 0 is handled as 1.
+ * @param slave_timeout like lms_set_slave_timeout(), for these slaves.
+ * @return pool id, greater than 0, or < 0 on error.
+ * @ingroup LMS_API
+ */
+int
+lms_slave_pool_add(lms_t *lms, unsigned int workers, int slave_timeout)
+{
+    struct slave_pool *sp;
+    void *tmp;
+
+    if (!lms)
+        return -1;
+
+    if (lms->is_processing) {
+        fprintf(stderr, "ERROR: do not add slave pools while it's processing.\n");
+        return -2;
+    }
+
+    if (workers < 1)
+        workers = 1;
+    else if (workers > MAX_WORKER_COUNT) {
+        fprintf(stderr, "WARNING: limiting %u workers to %u.\n",
+                workers, MAX_WORKER_COUNT);
+        workers = MAX_WORKER_COUNT;
+    }
+
+    tmp = realloc(lms->slave_pools,
+                  (lms->n_slave_pools + 1) * sizeof(*lms->slave_pools));
+    if (!tmp) {
+        perror("realloc");
+        return -3;
+    }
+    lms->slave_pools = tmp;
+
+    sp = lms->slave_pools + lms->n_slave_pools;
+    sp->workers = workers;
+    sp->slave_timeout = slave_timeout;
+
+    return ++lms->n_slave_pools;
+}
+
+/**
+ * Route files matched by parser to a pool of slaves.
+ *
+ * Files are routed by the calling process before they're handed to
+ * slaves, by path only: with the parser's extensions, or its match()
+ * if it has none. The first parser, by order, that matched and has a
+ * pool decides. Whichever slave gets the file still runs all parsers
+ * matching it.
+ *
+ * @param lms previously allocated Light Media Scanner instance.
+ * @param handle parser returned by lms_parser_add().
+ * @param pool id returned by lms_slave_pool_add(), 0 for default slaves.
+ * @return On success 0 is returned.
+ * @ingroup LMS_API
+ */
+int
+lms_parser_set_slave_pool(lms_t *lms, lms_plugin_t *handle, int pool)
+{
+    int i;
+
+    if (!lms)
+        return -1;
+    if (!handle)
+        return -2;
+    if (pool < 0 || (unsigned int)pool > lms->n_slave_pools) {
+        fprintf(stderr, "ERROR: unknown slave pool %d.\n", pool);
+        return -3;
+    }
+    if (lms->is_processing) {
+        fprintf(stderr, "ERROR: do not change slave pools while it's processing.\n");
+        return -4;
+    }
+
+    for (i = 0; i < lms->n_parsers; i++)
+        if (lms->parsers[i].plugin == handle) {
+            lms->parsers[i].slave_pool = pool;
+            return 0;
+        }
+
+    return -5;
+}
+
 /**
  * Checks if Light Media Scanner is being used in a processing operation lile
  * lms_process() or lms_check().
@@ -553,6 +714,823 @@ lms_set_commit_interval(lms_t *lms, unsigned int transactions)
     lms->commit_interval = transactions;
 }
 
+/**
+ * Get the amount of queued data that forces a database commit.
+ *
+ * @param lms previously allocated Light Media Scanner instance.
+ * @return (unsigned int)-1 on error, value otherwise.
+ * @ingroup LMS_API
+ */
+unsigned int
+lms_get_commit_bytes(const lms_t *lms)
+{
+    if (!lms) {
+        fprintf(stderr, "ERROR: lms_get_commit_bytes(NULL)\n");
+        return (unsigned int)-1;
+    }
+
+    return lms->commit_bytes;
+}
+
+/**
+ * Set the amount of queued data that forces a database commit.
+ *
+ * Parsed files are not written right away, they are queued and written
+ * in batches, each one in a single transaction. A batch is written when
+ * it has more than commit_interval files or when the file rows and
+ * records it holds take @p bytes or more, whatever comes first.
+ *
+ * @param lms previously allocated Light Media Scanner instance.
+ * @param bytes amount of queued data, 0 commits after every file.
+ * @ingroup LMS_API
+ */
+void
+lms_set_commit_bytes(lms_t *lms, unsigned int bytes)
+{
+    if (!lms) {
+        fprintf(stderr, "ERROR: lms_set_commit_bytes(NULL, %u)\n", bytes);
+        return;
+    }
+
+    lms->commit_bytes = bytes;
+}
+
+/**
+ * Get the maximum time a parsed file waits before being committed.
+ *
+ * @param lms previously allocated Light Media Scanner instance.
+ * @return -1 on error or if disabled, value otherwise.
+ * @ingroup LMS_API
+ */
+int
+lms_get_commit_latency(const lms_t *lms)
+{
+    if (!lms) {
+        fprintf(stderr, "ERROR: lms_get_commit_latency(NULL)\n");
+        return -1;
+    }
+
+    return lms->commit_latency;
+}
+
+/**
+ * Set the maximum time a parsed file waits before being committed.
+ *
+ * Bounds how long it takes for files to show up in the database while
+ * scanning slow media, since otherwise a batch is only written once
+ * it's big enough. See lms_set_commit_bytes().
+ *
+ * @param lms previously allocated Light Media Scanner instance.
+ * @param ms milliseconds, 0 or less disables it (the default).
+ * @ingroup LMS_API
+ */
+void
+lms_set_commit_latency(lms_t *lms, int ms)
+{
+    if (!lms) {
+        fprintf(stderr, "ERROR: lms_set_commit_latency(NULL, %d)\n", ms);
+        return;
+    }
+
+    lms->commit_latency = ms;
+}
+
+/**
+ * Get the number of slave processes used by lms_process().
+ *
+ * @param lms previously allocated Light Media Scanner instance.
+ * @return (unsigned int)-1 on error, value otherwise.
+ * @ingroup LMS_API
+ */
+unsigned int
+lms_get_worker_count(const lms_t *lms)
+{
+    if (!lms) {
+        fprintf(stderr, "ERROR: lms_get_worker_count(NULL)\n");
+        return (unsigned int)-1;
+    }
+
+    return lms->worker_count;
+}
+
+/**
+ * Set the number of slave processes used by lms_process().
+ *
+ * Each slave parses files independently and the master hands every new
+ * path to whichever slave is idle. Slave timeout, kill and restart
+ * semantics apply to each slave individually.
+ *
+ * Slaves share the database, so writes are serialized by SQLite. Each
+ * slave only holds the write lock while writing a batch of parsed files,
+ * see lms_set_commit_bytes().
+ *
+ * This is also the number of parser threads used by lms_process_threaded()
+ * and lms_check_threaded().
+ *
+ * @param lms previously allocated Light Media Scanner instance.
+ * @param workers number of slave processes, 0 is handled as 1.
+ * @ingroup LMS_API
+ */
+void
+lms_set_worker_count(lms_t *lms, unsigned int workers)
+{
+    if (!lms) {
+        fprintf(stderr, "ERROR: lms_set_worker_count(NULL, %u)\n", workers);
+        return;
+    }
+
+    if (lms->is_processing) {
+        fprintf(stderr, "ERROR: do not change workers while it's processing.\n");
+        return;
+    }
+
+    if (workers < 1)
+        workers = 1;
+    else if (workers > MAX_WORKER_COUNT) {
+        fprintf(stderr, "WARNING: limiting %u workers to %u.\n",
+                workers, MAX_WORKER_COUNT);
+        workers = MAX_WORKER_COUNT;
+    }
+
+    lms->worker_count = workers;
+}
+
+/**
+ * Get the number of threads walking directories.
+ *
+ * @param lms previously allocated Light Media Scanner instance.
+ * @return (unsigned int)-1 on error, value otherwise.
+ * @ingroup LMS_API
+ */
+unsigned int
+lms_get_walker_count(const lms_t *lms)
+{
+    if (!lms) {
+        fprintf(stderr, "ERROR: lms_get_walker_count(NULL)\n");
+        return (unsigned int)-1;
+    }
+
+    return lms->walker_count;
+}
+
+/**
+ * Set the number of threads walking directories.
+ *
+ * By default the calling thread walks the tree itself. On network
+ * filesystems scanning is bound by the latency of reading directories
+ * and stat'ing files, so with more than one walker, directories are
+ * read in parallel by @p walkers threads while the calling thread
+ * handles the files they find, as usual.
+ *
+ * Files are then found in no particular order. lms_stop_processing()
+ * and errors stop all walkers.
+ *
+ * @param lms previously allocated Light Media Scanner instance.
+ * @param walkers number of threads, 0 or 1 walks in the calling thread.
+ * @ingroup LMS_API
+ */
+void
+lms_set_walker_count(lms_t *lms, unsigned int walkers)
+{
+    if (!lms) {
+        fprintf(stderr, "ERROR: lms_set_walker_count(NULL, %u)\n", walkers);
+        return;
+    }
+
+    if (lms->is_processing) {
+        fprintf(stderr, "ERROR: do not change walkers while it's processing.\n");
+        return;
+    }
+
+    if (walkers < 1)
+        walkers = 1;
+    else if (walkers > MAX_WORKER_COUNT) {
+        fprintf(stderr, "WARNING: limiting %u walkers to %u.\n",
+                walkers, MAX_WORKER_COUNT);
+        walkers = MAX_WORKER_COUNT;
+    }
+
+    lms->walker_count = walkers;
+}
+
+/**
+ * Get the number of files stat'ed at once by lms_check().
+ *
+ * @param lms previously allocated Light Media Scanner instance.
+ * @return (unsigned int)-1 on error, value otherwise.
+ * @ingroup LMS_API
+ */
+unsigned int
+lms_get_check_batch(const lms_t *lms)
+{
+    if (!lms) {
+        fprintf(stderr, "ERROR: lms_get_check_batch(NULL)\n");
+        return (unsigned int)-1;
+    }
+
+    return lms->check_batch;
+}
+
+/**
+ * Set the number of files stat'ed at once by lms_check().
+ *
+ * Rows are read from the DB in batches of @p rows and their files are
+ * stat'ed concurrently, using io_uring if the kernel supports it or
+ * a few threads otherwise, before they are compared. This keeps many
+ * stat()s in flight on network filesystems and spinning disks.
+ *
+ * @param lms previously allocated Light Media Scanner instance.
+ * @param rows files per batch, 0 or 1 stats them one by one.
+ * @ingroup LMS_API
+ */
+void
+lms_set_check_batch(lms_t *lms, unsigned int rows)
+{
+    if (!lms) {
+        fprintf(stderr, "ERROR: lms_set_check_batch(NULL, %u)\n", rows);
+        return;
+    }
+
+    if (lms->is_processing) {
+        fprintf(stderr, "ERROR: do not change check batch while it's processing.\n");
+        return;
+    }
+
+    if (rows < 1)
+        rows = 1;
+    else if (rows > MAX_CHECK_BATCH) {
+        fprintf(stderr, "WARNING: limiting check batch of %u to %u.\n",
+                rows, MAX_CHECK_BATCH);
+        rows = MAX_CHECK_BATCH;
+    }
+
+    lms->check_batch = rows;
+}
+
+/**
+ * Get whether master and slaves talk through shared memory.
+ *
+ * @param lms previously allocated Light Media Scanner instance.
+ * @return (unsigned int)-1 on error, 1 if enabled, 0 otherwise.
+ * @ingroup LMS_API
+ */
+unsigned int
+lms_get_shm_transport(const lms_t *lms)
+{
+    if (!lms) {
+        fprintf(stderr, "ERROR: lms_get_shm_transport(NULL)\n");
+        return (unsigned int)-1;
+    }
+
+    return lms->shm_transport;
+}
+
+/**
+ * Set whether master and slaves talk through shared memory.
+ *
+ * By default paths and replies go through pipes. With this enabled
+ * they are written to a ring buffer shared by master and each slave,
+ * and an eventfd is only signaled when the other side is waiting, saving
+ * most of the system calls and copies. Slave timeout is handled the same
+ * way in both cases.
+ *
+ * @param lms previously allocated Light Media Scanner instance.
+ * @param enabled 1 to use shared memory, 0 for pipes.
+ * @ingroup LMS_API
+ */
+void
+lms_set_shm_transport(lms_t *lms, unsigned int enabled)
+{
+    if (!lms) {
+        fprintf(stderr, "ERROR: lms_set_shm_transport(NULL, %u)\n", enabled);
+        return;
+    }
+
+    if (lms->is_processing) {
+        fprintf(stderr, "ERROR: do not change transport while it's processing.\n");
+        return;
+    }
+
+#ifndef HAVE_SYS_EVENTFD_H
+    if (enabled) {
+        fprintf(stderr, "WARNING: shared memory transport is not supported, "
+                "using pipes.\n");
+        enabled = 0;
+    }
+#endif
+
+    lms->shm_transport = !!enabled;
+}
+
+/**
+ * Get whether directories are read in bulk.
+ *
+ * @param lms previously allocated Light Media Scanner instance.
+ * @return (unsigned int)-1 on error, value otherwise.
+ * @ingroup LMS_API
+ */
+unsigned int
+lms_get_bulk_readdir(const lms_t *lms)
+{
+    if (!lms) {
+        fprintf(stderr, "ERROR: lms_get_bulk_readdir(NULL)\n");
+        return (unsigned int)-1;
+    }
+
+    return lms->bulk_readdir;
+}
+
+/**
+ * Set whether directories are read in bulk.
+ *
+ * By default directories are read with readdir(3), that uses a small
+ * buffer. With this enabled (Linux only) entries are read directly with
+ * getdents64(2) into a large buffer, needing far less round trips on
+ * big directories of network and FUSE filesystems. See
+ * lms_get_dir_read_stats().
+ *
+ * @param lms previously allocated Light Media Scanner instance.
+ * @param enabled 1 to read in bulk, 0 to use readdir(3).
+ * @ingroup LMS_API
+ */
+void
+lms_set_bulk_readdir(lms_t *lms, unsigned int enabled)
+{
+    if (!lms) {
+        fprintf(stderr, "ERROR: lms_set_bulk_readdir(NULL, %u)\n", enabled);
+        return;
+    }
+
+    if (lms->is_processing) {
+        fprintf(stderr, "ERROR: do not change readdir while it's processing.\n");
+        return;
+    }
+
+#if !HAVE_DECL_SYS_GETDENTS64
+    if (enabled) {
+        fprintf(stderr, "WARNING: bulk readdir is not supported, "
+                "using readdir().\n");
+        enabled = 0;
+    }
+#endif
+
+    lms->bulk_readdir = !!enabled;
+}
+
+/**
+ * Get whether files of unchanged directories are skipped.
+ *
+ * @param lms previously allocated Light Media Scanner instance.
+ * @return (unsigned int)-1 on error, value otherwise.
+ * @ingroup LMS_API
+ */
+unsigned int
+lms_get_skip_unchanged_dirs(const lms_t *lms)
+{
+    if (!lms) {
+        fprintf(stderr, "ERROR: lms_get_skip_unchanged_dirs(NULL)\n");
+        return (unsigned int)-1;
+    }
+
+    return lms->skip_unchanged_dirs;
+}
+
+/**
+ * Set whether files of unchanged directories are skipped.
+ *
+ * With this enabled lms_process() and friends record the mtime and
+ * number of children of every directory they fully walked. Next time,
+ * files of a directory with the same mtime and children are neither
+ * stat'ed nor looked up in the database, they're reported as
+ * #LMS_PROGRESS_STATUS_UP_TO_DATE at once. Subdirectories are still
+ * walked, as changes to them don't change their parent's mtime.
+ *
+ * Files modified in place don't change their directory's mtime, these
+ * changes are only noticed by lms_check() or once something else in
+ * the directory changes. Files skipped for lack of a parser are not
+ * reported for unchanged directories.
+ *
+ * @param lms previously allocated Light Media Scanner instance.
+ * @param enabled 1 to skip unchanged directories, 0 to look at all files.
+ * @ingroup LMS_API
+ */
+void
+lms_set_skip_unchanged_dirs(lms_t *lms, unsigned int enabled)
+{
+    if (!lms) {
+        fprintf(stderr, "ERROR: lms_set_skip_unchanged_dirs(NULL, %u)\n",
+                enabled);
+        return;
+    }
+
+    if (lms->is_processing) {
+        fprintf(stderr, "ERROR: do not change skipping while it's processing.\n");
+        return;
+    }
+
+    lms->skip_unchanged_dirs = !!enabled;
+}
+
+/**
+ * Get whether files are also matched by their contents.
+ *
+ * @param lms previously allocated Light Media Scanner instance.
+ * @return (unsigned int)-1 on error, value otherwise.
+ * @ingroup LMS_API
+ */
+unsigned int
+lms_get_content_match(const lms_t *lms)
+{
+    if (!lms) {
+        fprintf(stderr, "ERROR: lms_get_content_match(NULL)\n");
+        return (unsigned int)-1;
+    }
+
+    return lms->content_match;
+}
+
+/**
+ * Set whether files are also matched by their contents.
+ *
+ * Parsers match files by path, usually by extension. With this enabled,
+ * files that no parser with signatures (see lms_plugin_magic()) matched
+ * by path have their first bytes read and looked up in the signatures
+ * of all parsers, so misnamed files are still parsed and files only
+ * matched by fallback parsers, like generic, go to the parser that
+ * knows their format instead. This costs one read for every such file,
+ * including those that end up skipped.
+ *
+ * @param lms previously allocated Light Media Scanner instance.
+ * @param enabled 1 to match by contents, 0 to match by path only.
+ * @ingroup LMS_API
+ */
+void
+lms_set_content_match(lms_t *lms, unsigned int enabled)
+{
+    if (!lms) {
+        fprintf(stderr, "ERROR: lms_set_content_match(NULL, %u)\n",
+                enabled);
+        return;
+    }
+
+    if (lms->is_processing) {
+        fprintf(stderr, "ERROR: do not change content match while it's processing.\n");
+        return;
+    }
+
+    lms->content_match = !!enabled;
+}
+
+/**
+ * Get the memory budget to preload known files.
+ *
+ * @param lms previously allocated Light Media Scanner instance.
+ * @return (unsigned int)-1 on error, value otherwise.
+ * @ingroup LMS_API
+ */
+unsigned int
+lms_get_preload_budget(const lms_t *lms)
+{
+    if (!lms) {
+        fprintf(stderr, "ERROR: lms_get_preload_budget(NULL)\n");
+        return (unsigned int)-1;
+    }
+
+    return lms->preload_budget;
+}
+
+/**
+ * Set the memory budget to preload known files.
+ *
+ * By default every file found by lms_process() and friends is looked up
+ * in the database with its own query. With a budget, files already in
+ * the database under the given path are loaded at once into a hash
+ * table before walking, each lookup is then done in memory. Each file
+ * takes a few tens of bytes plus its path under the given one, if they
+ * don't fit the budget nothing is preloaded and files are queried one
+ * by one. See lms_get_preload_stats().
+ *
+ * The table is built by the calling process and shared by slaves.
+ *
+ * @param lms previously allocated Light Media Scanner instance.
+ * @param bytes maximum memory to use, 0 disables preloading.
+ * @ingroup LMS_API
+ */
+void
+lms_set_preload_budget(lms_t *lms, unsigned int bytes)
+{
+    if (!lms) {
+        fprintf(stderr, "ERROR: lms_set_preload_budget(NULL, %u)\n", bytes);
+        return;
+    }
+
+    if (lms->is_processing) {
+        fprintf(stderr, "ERROR: do not change preload while it's processing.\n");
+        return;
+    }
+
+    lms->preload_budget = bytes;
+}
+
+/*
+ * In the order they're applied, auto_vacuum can't follow journal_mode.
+ * The first DB_PRAGMA_WRITE_COUNT ones are stored in the database file.
+ */
+#define DB_PRAGMA_WRITE_COUNT 2
+#define DB_PRAGMA_SQL_SIZE 64
+static const char *_db_pragma_names[DB_PRAGMA_COUNT] = {
+    "auto_vacuum",
+    "journal_mode",
+    "synchronous",
+    "cache_size",
+    "mmap_size",
+    "temp_store"
+};
+
+static int
+_db_pragma_find(const char *name)
+{
+    int i;
+
+    for (i = 0; i < DB_PRAGMA_COUNT; i++)
+        if (strcmp(_db_pragma_names[i], name) == 0)
+            return i;
+
+    return -1;
+}
+
+/**
+ * Get the value of a pragma set with lms_set_db_pragma().
+ *
+ * @param lms previously allocated Light Media Scanner instance.
+ * @param name pragma name.
+ * @return value or NULL if not set (SQLite default is used).
+ * @ingroup LMS_API
+ */
+const char *
+lms_get_db_pragma(const lms_t *lms, const char *name)
+{
+    int i;
+
+    if (!lms || !name) {
+        fprintf(stderr, "ERROR: lms_get_db_pragma(%p, %s)\n", lms, name);
+        return NULL;
+    }
+
+    i = _db_pragma_find(name);
+    if (i < 0)
+        return NULL;
+
+    return lms->db_pragmas[i];
+}
+
+/**
+ * Set a pragma for every database connection opened by Light Media
+ * Scanner.
+ *
+ * Known pragmas are "auto_vacuum", "journal_mode", "synchronous",
+ * "cache_size", "mmap_size" and "temp_store", see SQLite documentation
+ * for their values. With "journal_mode" set to "WAL" readers of the
+ * database, like the ones of lightmediascannerd clients, are not
+ * blocked while files are being written, and commits are cheaper, so a
+ * smaller commit interval costs less. Note WAL is kept in the database
+ * file, it's not undone by unsetting it here. So is "auto_vacuum", that
+ * only takes effect on databases without tables or after a VACUUM.
+ *
+ * @param lms previously allocated Light Media Scanner instance.
+ * @param name pragma name.
+ * @param value its value, just letters, digits, '-' and '_' are
+ *        allowed. NULL to use SQLite default again.
+ * @return On success 0 is returned.
+ * @ingroup LMS_API
+ */
+int
+lms_set_db_pragma(lms_t *lms, const char *name, const char *value)
+{
+    const char *p;
+    char *copy = NULL;
+    int i;
+
+    if (!lms || !name) {
+        fprintf(stderr, "ERROR: lms_set_db_pragma(%p, %s, %s)\n",
+                lms, name, value);
+        return -1;
+    }
+
+    if (lms->is_processing) {
+        fprintf(stderr, "ERROR: do not change pragmas while it's processing.\n");
+        return -2;
+    }
+
+    i = _db_pragma_find(name);
+    if (i < 0) {
+        fprintf(stderr, "ERROR: unknown pragma \"%s\".\n", name);
+        return -3;
+    }
+
+    if (value) {
+        for (p = value; *p; p++)
+            if (!isalnum((unsigned char)*p) && *p != '-' && *p != '_')
+                break;
+        if (*p || p == value) {
+            fprintf(stderr, "ERROR: invalid value for pragma %s: \"%s\".\n",
+                    name, value);
+            return -4;
+        }
+
+        /* "PRAGMA name = value" must fit lms_db_apply_pragmas() */
+        if (sizeof("PRAGMA  = ") + strlen(name) + (p - value) >
+            DB_PRAGMA_SQL_SIZE) {
+            fprintf(stderr, "ERROR: value for pragma %s is too long: "
+                    "\"%s\".\n", name, value);
+            return -4;
+        }
+
+        copy = strdup(value);
+        if (!copy) {
+            perror("strdup");
+            return -5;
+        }
+    }
+
+    free(lms->db_pragmas[i]);
+    lms->db_pragmas[i] = copy;
+    return 0;
+}
+
+/*
+ * Done right after every connection is opened. Read-only ones can't
+ * change the ones stored in the database file, they're left to writers.
+ */
+int
+lms_db_apply_pragmas(const lms_t *lms, sqlite3 *db)
+{
+    char sql[DB_PRAGMA_SQL_SIZE], *errmsg;
+    int i, readonly;
+
+    readonly = sqlite3_db_readonly(db, "main") == 1;
+    for (i = 0; i < DB_PRAGMA_COUNT; i++) {
+        if (!lms->db_pragmas[i])
+            continue;
+        if (readonly && i < DB_PRAGMA_WRITE_COUNT)
+            continue;
+
+        if (snprintf(sql, sizeof(sql), "PRAGMA %s = %s", _db_pragma_names[i],
+                     lms->db_pragmas[i]) >= (int)sizeof(sql)) {
+            fprintf(stderr, "ERROR: pragma %s is too long.\n",
+                    _db_pragma_names[i]);
+            return -1;
+        }
+
+        errmsg = NULL;
+        if (sqlite3_exec(db, sql, NULL, NULL, &errmsg) != SQLITE_OK) {
+            fprintf(stderr, "ERROR: could not execute \"%s\": %s\n",
+                    sql, errmsg);
+            sqlite3_free(errmsg);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Get DB session set with lms_set_db_session().
+ *
+ * @param lms previously allocated Light Media Scanner instance.
+ * @return session or NULL if connections are opened for each scan.
+ * @ingroup LMS_API
+ */
+lms_db_session_t *
+lms_get_db_session(const lms_t *lms)
+{
+    if (!lms) {
+        fprintf(stderr, "ERROR: lms_get_db_session(NULL)\n");
+        return NULL;
+    }
+
+    return lms->db_session;
+}
+
+/**
+ * Use a DB session instead of opening the DB for each scan.
+ *
+ * Many instances, like one per category, may share the session to
+ * reuse its connection and compiled statements, see
+ * lms_db_session_new(). It's not owned by the instance, it must
+ * outlive it.
+ *
+ * @param lms previously allocated Light Media Scanner instance.
+ * @param session session of the same DB path or NULL to not use one.
+ * @return On success 0 is returned.
+ * @ingroup LMS_API
+ */
+int
+lms_set_db_session(lms_t *lms, lms_db_session_t *session)
+{
+    if (!lms) {
+        fprintf(stderr, "ERROR: lms_set_db_session(NULL, %p)\n", session);
+        return -1;
+    }
+
+    if (lms->is_processing) {
+        fprintf(stderr, "ERROR: do not change DB session while it's processing.\n");
+        return -2;
+    }
+
+    if (session &&
+        strcmp(lms_db_session_get_path(session), lms->db_path) != 0) {
+        fprintf(stderr, "ERROR: DB session is for \"%s\", not \"%s\".\n",
+                lms_db_session_get_path(session), lms->db_path);
+        return -3;
+    }
+
+    lms->db_session = session;
+    return 0;
+}
+
+/**
+ * Get how known files were preloaded by the last lms_process().
+ *
+ * @param lms previously allocated Light Media Scanner instance.
+ * @param stats where to store them.
+ * @return On success 0 is returned.
+ * @ingroup LMS_API
+ */
+int
+lms_get_preload_stats(const lms_t *lms, struct lms_preload_stats *stats)
+{
+    if (!lms) {
+        fprintf(stderr, "ERROR: lms_get_preload_stats(NULL)\n");
+        return -1;
+    }
+
+    *stats = lms->preload_stats;
+    return 0;
+}
+
+/**
+ * Get timings and counters of the last lms_process() or lms_check().
+ *
+ * Phases are timed by the master, slaves and worker threads alike,
+ * their histograms give how many events took less than each power of
+ * two microseconds. Parsers are timed for the files they parsed, but
+ * only the first LMS_STATS_MAX_PARSERS added. Bytes read and system
+ * calls are only known on Linux.
+ *
+ * @param lms previously allocated Light Media Scanner instance.
+ * @param stats where to store them.
+ * @return On success 0 is returned.
+ * @ingroup LMS_API
+ */
+int
+lms_get_stats(const lms_t *lms, struct lms_stats *stats)
+{
+    int i;
+
+    if (!lms) {
+        fprintf(stderr, "ERROR: lms_get_stats(NULL)\n");
+        return -1;
+    }
+
+    if (lms->stats)
+        *stats = *lms->stats;
+    else
+        memset(stats, 0, sizeof(*stats));
+
+    stats->n_parsers = 0;
+    for (i = 0; i < lms->n_parsers && i < LMS_STATS_MAX_PARSERS; i++) {
+        stats->parsers[i].name = lms->parsers[i].plugin->name;
+        stats->n_parsers++;
+    }
+
+    return 0;
+}
+
+/**
+ * Get how directories were read by the last lms_process().
+ *
+ * Only directories read in bulk are accounted, see
+ * lms_set_bulk_readdir(). The number of system calls includes the last
+ * one, that finds the end of the directory.
+ *
+ * @param lms previously allocated Light Media Scanner instance.
+ * @param stats where to store them.
+ * @return On success 0 is returned.
+ * @ingroup LMS_API
+ */
+int
+lms_get_dir_read_stats(const lms_t *lms, struct lms_dir_read_stats *stats)
+{
+    if (!lms) {
+        fprintf(stderr, "ERROR: lms_get_dir_read_stats(NULL)\n");
+        return -1;
+    }
+
+    *stats = lms->dir_stats;
+    return 0;
+}
+
 /**
  * Register a new charset encoding to be used.
  *
@@ -163,6 +163,7 @@ extern "C" {
 
     typedef struct lms lms_t;
     typedef struct lms_plugin lms_plugin_t;
+    typedef struct lms_db_session lms_db_session_t;
 
     typedef enum {
         LMS_PROGRESS_STATUS_UP_TO_DATE,
@@ -184,6 +185,8 @@ extern "C" {
     API int lms_process_single_process(lms_t *lms, const char *top_path) GNUC_NON_NULL(1, 2);
     API int lms_check(lms_t *lms, const char *top_path) GNUC_NON_NULL(1, 2);
     API int lms_check_single_process(lms_t *lms, const char *top_path) GNUC_NON_NULL(1, 2);
+    API int lms_process_threaded(lms_t *lms, const char *top_path) GNUC_NON_NULL(1, 2);
+    API int lms_check_threaded(lms_t *lms, const char *top_path) GNUC_NON_NULL(1, 2);
     API void lms_stop_processing(lms_t *lms) GNUC_NON_NULL(1);
     API const char *lms_get_db_path(const lms_t *lms) GNUC_NON_NULL(1);
     API int lms_is_processing(const lms_t *lms) GNUC_PURE GNUC_NON_NULL(1);
@@ -191,6 +194,87 @@ extern "C" {
     API void lms_set_slave_timeout(lms_t *lms, int ms) GNUC_NON_NULL(1);
     API unsigned int lms_get_commit_interval(const lms_t *lms) GNUC_NON_NULL(1);
     API void lms_set_commit_interval(lms_t *lms, unsigned int transactions) GNUC_NON_NULL(1);
+    API unsigned int lms_get_commit_bytes(const lms_t *lms) GNUC_NON_NULL(1);
+    API void lms_set_commit_bytes(lms_t *lms, unsigned int bytes) GNUC_NON_NULL(1);
+    API int lms_get_commit_latency(const lms_t *lms) GNUC_NON_NULL(1);
+    API void lms_set_commit_latency(lms_t *lms, int ms) GNUC_NON_NULL(1);
+    API unsigned int lms_get_worker_count(const lms_t *lms) GNUC_NON_NULL(1);
+    API void lms_set_worker_count(lms_t *lms, unsigned int workers) GNUC_NON_NULL(1);
+    API unsigned int lms_get_walker_count(const lms_t *lms) GNUC_NON_NULL(1);
+    API void lms_set_walker_count(lms_t *lms, unsigned int walkers) GNUC_NON_NULL(1);
+    API unsigned int lms_get_check_batch(const lms_t *lms) GNUC_NON_NULL(1);
+    API void lms_set_check_batch(lms_t *lms, unsigned int rows) GNUC_NON_NULL(1);
+    API unsigned int lms_get_shm_transport(const lms_t *lms) GNUC_NON_NULL(1);
+    API void lms_set_shm_transport(lms_t *lms, unsigned int enabled) GNUC_NON_NULL(1);
+    API unsigned int lms_get_bulk_readdir(const lms_t *lms) GNUC_NON_NULL(1);
+    API void lms_set_bulk_readdir(lms_t *lms, unsigned int enabled) GNUC_NON_NULL(1);
+    API unsigned int lms_get_skip_unchanged_dirs(const lms_t *lms) GNUC_NON_NULL(1);
+    API void lms_set_skip_unchanged_dirs(lms_t *lms, unsigned int enabled) GNUC_NON_NULL(1);
+    API unsigned int lms_get_content_match(const lms_t *lms) GNUC_NON_NULL(1);
+    API void lms_set_content_match(lms_t *lms, unsigned int enabled) GNUC_NON_NULL(1);
+    API unsigned int lms_get_preload_budget(const lms_t *lms) GNUC_NON_NULL(1);
+    API void lms_set_preload_budget(lms_t *lms, unsigned int bytes) GNUC_NON_NULL(1);
+    API const char *lms_get_db_pragma(const lms_t *lms, const char *name) GNUC_NON_NULL(1, 2);
+    API int lms_set_db_pragma(lms_t *lms, const char *name, const char *value) GNUC_NON_NULL(1, 2);
+    API lms_db_session_t *lms_db_session_new(const char *db_path) GNUC_MALLOC GNUC_WARN_UNUSED_RESULT;
+    API int lms_db_session_free(lms_db_session_t *session);
+    API lms_db_session_t *lms_get_db_session(const lms_t *lms) GNUC_NON_NULL(1);
+    API int lms_set_db_session(lms_t *lms, lms_db_session_t *session) GNUC_NON_NULL(1);
+
+    struct lms_dir_read_stats {
+        unsigned int dirs; /**< directories read in bulk */
+        unsigned int syscalls; /**< system calls used to read them */
+        unsigned int max_syscalls; /**< most used by a single directory */
+    };
+
+    API int lms_get_dir_read_stats(const lms_t *lms, struct lms_dir_read_stats *stats) GNUC_NON_NULL(1, 2);
+
+    struct lms_preload_stats {
+        unsigned int files; /**< known files preloaded */
+        unsigned int bytes; /**< memory used for them */
+        unsigned int over_budget; /**< 1 if they didn't fit the budget */
+    };
+
+    API int lms_get_preload_stats(const lms_t *lms, struct lms_preload_stats *stats) GNUC_NON_NULL(1, 2);
+
+    /* phases of a scan timed by lms_get_stats() */
+    typedef enum {
+        LMS_STATS_PHASE_WALK, /**< reading a directory, per directory */
+        LMS_STATS_PHASE_STAT, /**< stat() of known files to check, per file */
+        LMS_STATS_PHASE_LOOKUP, /**< finding a walked file in DB, per file */
+        LMS_STATS_PHASE_MATCH, /**< asking parsers for a file, per file */
+        LMS_STATS_PHASE_PARSE, /**< running matching parsers, per file */
+        LMS_STATS_PHASE_COMMIT, /**< committing to DB, per transaction */
+        LMS_STATS_PHASE_COUNT
+    } lms_stats_phase_t;
+
+#define LMS_STATS_BUCKETS 24
+#define LMS_STATS_MAX_PARSERS 32
+
+    struct lms_stats_timer {
+        unsigned long long count; /**< timed events */
+        unsigned long long total_us; /**< time they took, in microseconds */
+        unsigned long long max_us; /**< longest one */
+        /** events taking less than 2^i microseconds but more than the
+         * previous bucket, the last one takes the longer ones too */
+        unsigned long long buckets[LMS_STATS_BUCKETS];
+    };
+
+    struct lms_stats {
+        struct lms_stats_timer phases[LMS_STATS_PHASE_COUNT];
+        /** files by the status given to progress callback, the ones in
+         * unchanged directories are only known if there is one */
+        unsigned long long files[LMS_PROGRESS_STATUS_UNKNOWN + 1];
+        unsigned long long bytes_read; /**< by all processes, 0 if unknown */
+        unsigned long long syscalls; /**< reads and writes, 0 if unknown */
+        unsigned int n_parsers;
+        struct {
+            const char *name;
+            struct lms_stats_timer parse;
+        } parsers[LMS_STATS_MAX_PARSERS]; /**< same order they were added */
+    };
+
+    API int lms_get_stats(const lms_t *lms, struct lms_stats *stats) GNUC_NON_NULL(1, 2);
     API void lms_set_progress_callback(lms_t *lms, lms_progress_callback_t cb, const void *data, lms_free_callback_t free_data) GNUC_NON_NULL(1);
 
 
@@ -215,6 +299,8 @@ extern "C" {
     API lms_plugin_t *lms_parser_add(lms_t *lms, const char *so_path) GNUC_NON_NULL(1, 2);
     API lms_plugin_t *lms_parser_find_and_add(lms_t *lms, const char *name) GNUC_NON_NULL(1, 2);
     API int lms_parser_del(lms_t *lms, lms_plugin_t *handle) GNUC_NON_NULL(1, 2);
+    API int lms_slave_pool_add(lms_t *lms, unsigned int workers, int slave_timeout) GNUC_NON_NULL(1);
+    API int lms_parser_set_slave_pool(lms_t *lms, lms_plugin_t *handle, int pool) GNUC_NON_NULL(1, 2);
 
     API int lms_charset_add(lms_t *lms, const char *charset) GNUC_NON_NULL(1, 2);
     API int lms_charset_del(lms_t *lms, const char *charset) GNUC_NON_NULL(1, 2);
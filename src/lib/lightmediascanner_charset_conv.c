@@ -21,6 +21,7 @@
  */
 
 #include "lightmediascanner_charset_conv.h"
+#include "lightmediascanner_private.h"
 #include <iconv.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -105,6 +106,30 @@ lms_charset_conv_new(void)
     return lms_charset_conv_new_full(1, 1);
 }
 
+/*
+ * Create a new conversion tool with the same charsets, iconv descriptors
+ * can't be shared among threads.
+ */
+lms_charset_conv_t *
+lms_charset_conv_dup(const lms_charset_conv_t *lcc)
+{
+    lms_charset_conv_t *copy;
+    unsigned int i;
+
+    copy = lms_charset_conv_new_full(lcc->check != (iconv_t)-1,
+                                     lcc->fallback != (iconv_t)-1);
+    if (!copy)
+        return NULL;
+
+    for (i = 0; i < lcc->size; i++)
+        if (lms_charset_conv_add(copy, lcc->names[i]) != 0) {
+            lms_charset_conv_free(copy);
+            return NULL;
+        }
+
+    return copy;
+}
+
 /**
  * Free existing charset conversion tool.
  *
@@ -38,6 +38,8 @@
 struct master_db {
     sqlite3 *handle;
     sqlite3_stmt *get_files;
+    sqlite3_stmt *transaction_begin;
+    sqlite3_stmt *transaction_commit;
 };
 
 struct slave_db {
@@ -62,6 +64,7 @@ struct single_process_db {
  ***********************************************************************/
 
 struct comm_finfo {
+    unsigned int seq;
     int path_len;
     int base;
     int64_t id;
@@ -73,11 +76,16 @@ struct comm_finfo {
 #define COMM_FINFO_FLAG_OUTDATED 1
 };
 
+/* flags of window entries, what to report once slave replies */
+#define WINDOW_FLAG_DELETED 1
+
 static int
-_master_send_file(const struct fds *master, const struct lms_file_info finfo, unsigned int flags)
+_master_send_file(struct pinfo *pinfo, const struct lms_file_info finfo, unsigned int flags)
 {
+    struct window_entry *e;
     struct comm_finfo ci;
 
+    ci.seq = 0; /* assigned by window */
     ci.path_len = finfo.path_len;
     ci.base = finfo.base;
     ci.id = finfo.id;
@@ -87,76 +95,32 @@ _master_send_file(const struct fds *master, const struct lms_file_info finfo, un
     ci.size = finfo.size;
     ci.flags = flags;
 
-    if (write(master->w, &ci, sizeof(ci)) < 0) {
-        perror("write");
-        return -1;
-    }
-
-    if (write(master->w, finfo.path, finfo.path_len) < 0) {
-        perror("write");
-        return -1;
-    }
-
-    return 0;
-}
-
-static int
-_master_send_finish(const struct fds *master)
-{
-    struct comm_finfo ci = {-1, -1, -1, -1, -1, -1, 0};
-
-    if (write(master->w, &ci, sizeof(ci)) < 0) {
-        perror("write");
+    e = lms_window_push(&pinfo->window, &ci, sizeof(ci),
+                        finfo.path, finfo.path_len,
+                        finfo.dtime ? WINDOW_FLAG_DELETED : 0,
+                        pinfo->slave_timeout);
+    if (!e)
         return -1;
-    }
 
-    return 0;
+    return lms_master_send(pinfo, e);
 }
 
 static int
-_master_recv_reply(const struct fds *master, struct pollfd *pfd, int *reply, int timeout)
+_master_send_finish(struct pinfo *pinfo)
 {
-    int r;
-
-    r = poll(pfd, 1, timeout);
-    if (r < 0) {
-        perror("poll");
-        return -1;
-    }
+    struct comm_finfo ci = {WINDOW_SEQ_SYNC, -1, -1, -1, -1, -1, -1, 0, 0};
 
-    if (r == 0)
-        return 1;
-
-    if (read(master->r, reply, sizeof(*reply)) != sizeof(*reply)) {
-        perror("read");
-        return -2;
-    }
-
-    return 0;
-}
-
-static int
-_slave_send_reply(const struct fds *slave, int reply)
-{
-    if (write(slave->w, &reply, sizeof(reply)) == 0) {
-        perror("write");
-        return -1;
-    }
-    return 0;
+    return lms_master_send_sync(pinfo, &ci, sizeof(ci));
 }
 
 static int
-_slave_recv_file(const struct fds *slave, struct lms_file_info *finfo, unsigned int *flags)
+_slave_recv_file(struct pinfo *pinfo, struct lms_file_info *finfo, unsigned int *flags, unsigned int *seq)
 {
     struct comm_finfo ci;
     static char path[PATH_SIZE + 1];
-    int r;
 
-    r = read(slave->r, &ci, sizeof(ci));
-    if (r != sizeof(ci)) {
-        perror("read");
+    if (lms_slave_recv(pinfo, &ci, sizeof(ci)) != 0)
         return -1;
-    }
 
     finfo->path_len = ci.path_len;
     finfo->base = ci.base;
@@ -167,6 +131,7 @@ _slave_recv_file(const struct fds *slave, struct lms_file_info *finfo, unsigned
     finfo->size = ci.size;
     finfo->path = NULL;
     *flags = ci.flags;
+    *seq = ci.seq;
 
     if (ci.path_len == -1)
         return 0;
@@ -177,10 +142,9 @@ _slave_recv_file(const struct fds *slave, struct lms_file_info *finfo, unsigned
         return -2;
     }
 
-    r = read(slave->r, path, ci.path_len);
-    if (r != ci.path_len) {
-        fprintf(stderr, "ERROR: could not read whole path %d/%d\n",
-                r, ci.path_len);
+    if (lms_slave_recv(pinfo, path, ci.path_len) != 0) {
+        fprintf(stderr, "ERROR: could not read whole path %d\n",
+                ci.path_len);
         return -3;
     }
 
@@ -221,7 +185,7 @@ _slave_db_compile_all_stmts(struct slave_db *db)
 }
 
 static struct slave_db *
-_slave_db_open(const char *db_path)
+_slave_db_open(const lms_t *lms)
 {
     struct slave_db *db;
 
@@ -231,16 +195,13 @@ _slave_db_open(const char *db_path)
         return NULL;
     }
 
-    if (sqlite3_open(db_path, &db->handle) != SQLITE_OK) {
-        fprintf(stderr, "ERROR: could not open DB \"%s\": %s\n",
-                db_path, sqlite3_errmsg(db->handle));
+    if (lms_db_open(lms, &db->handle, 0) != 0)
         goto error;
-    }
 
     return db;
 
   error:
-    sqlite3_close(db->handle);
+    lms_db_close(db->handle);
     free(db);
     return NULL;
 }
@@ -260,7 +221,7 @@ _slave_db_close(struct slave_db *db)
     if (db->update_file_info)
         lms_db_finalize_stmt(db->update_file_info, "update_file_info");
 
-    if (sqlite3_close(db->handle) != SQLITE_OK) {
+    if (lms_db_close(db->handle) != 0) {
         fprintf(stderr, "ERROR: clould not close DB (slave): %s\n",
                 sqlite3_errmsg(db->handle));
         return -1;
@@ -301,7 +262,7 @@ _single_process_db_compile_all_stmts(struct single_process_db *db)
 }
 
 static struct single_process_db *
-_single_process_db_open(const char *db_path)
+_single_process_db_open(const lms_t *lms)
 {
     struct single_process_db *db;
 
@@ -311,11 +272,8 @@ _single_process_db_open(const char *db_path)
         return NULL;
     }
 
-    if (sqlite3_open(db_path, &db->handle) != SQLITE_OK) {
-        fprintf(stderr, "ERROR: could not open DB \"%s\": %s\n",
-                db_path, sqlite3_errmsg(db->handle));
+    if (lms_db_open(lms, &db->handle, 0) != 0)
         goto error;
-    }
 
     if (lms_db_create_core_tables_if_required(db->handle) != 0) {
         fprintf(stderr, "ERROR: could not setup tables and indexes.\n");
@@ -330,7 +288,7 @@ _single_process_db_open(const char *db_path)
     return db;
 
   error:
-    sqlite3_close(db->handle);
+    lms_db_close(db->handle);
     free(db);
     return NULL;
 }
@@ -353,7 +311,7 @@ _single_process_db_close(struct single_process_db *db)
     if (db->update_file_info)
         lms_db_finalize_stmt(db->update_file_info, "update_file_info");
 
-    if (sqlite3_close(db->handle) != SQLITE_OK) {
+    if (lms_db_close(db->handle) != 0) {
         fprintf(stderr, "ERROR: clould not close DB (slave): %s\n",
                 sqlite3_errmsg(db->handle));
         return -1;
@@ -364,18 +322,32 @@ _single_process_db_close(struct single_process_db *db)
 }
 
 static int
-_init_sync_send(struct fds *fds)
+_end_transaction(const lms_t *lms, sqlite3_stmt *stmt)
 {
-    return _slave_send_reply(fds, 0);
+    int64_t start = lms_stats_now();
+    int r;
+
+    r = lms_db_end_transaction(stmt);
+    lms_stats_time(lms, LMS_STATS_PHASE_COMMIT, start);
+    return r;
 }
 
 static int
-_slave_work_int(lms_t *lms, struct fds *fds, struct slave_db *db,
+_init_sync_send(struct pinfo *pinfo)
+{
+    if (lms_slave_send_reply(pinfo, WINDOW_SEQ_SYNC, 0) != 0)
+        return -1;
+    return lms_slave_flush(pinfo);
+}
+
+static int
+_slave_work_int(lms_t *lms, struct pinfo *pinfo, struct slave_db *db,
                 unsigned int update_id)
 {
     struct lms_file_info finfo;
+    struct lms_context ctxt;
     void **parser_match;
-    unsigned int counter, flags, total_committed;
+    unsigned int counter, flags, seq, total_committed;
     int r;
 
     parser_match = malloc(lms->n_parsers * sizeof(*parser_match));
@@ -384,13 +356,15 @@ _slave_work_int(lms_t *lms, struct fds *fds, struct slave_db *db,
         return -6;
     }
 
-    _init_sync_send(fds);
+    lms_context_init(&ctxt, lms, db->handle);
+
+    _init_sync_send(pinfo);
 
     counter = 0;
     total_committed = 0;
     lms_db_begin_transaction(db->transaction_begin);
 
-    while (((r = _slave_recv_file(fds, &finfo, &flags)) == 0) &&
+    while (((r = _slave_recv_file(pinfo, &finfo, &flags, &seq)) == 0) &&
            finfo.path_len > 0) {
         r = lms_db_update_file_info(db->update_file_info, &finfo, update_id);
         if (r < 0)
@@ -398,11 +372,13 @@ _slave_work_int(lms_t *lms, struct fds *fds, struct slave_db *db,
         else if (flags & COMM_FINFO_FLAG_OUTDATED) {
             int used;
 
-            used = lms_parsers_check_using(lms, parser_match, &finfo);
+            used = lms_parsers_check_using(lms, lms->parsers, parser_match,
+                                           &finfo);
             if (!used)
                 r = 0;
             else {
-                r = lms_parsers_run(lms, db->handle, parser_match, &finfo);
+                r = lms_parsers_run(lms, lms->parsers, &ctxt, parser_match,
+                                    &finfo);
                 if (r < 0) {
                     fprintf(stderr, "ERROR: pid=%d failed to parse \"%s\".\n",
                             getpid(), finfo.path);
@@ -411,7 +387,7 @@ _slave_work_int(lms_t *lms, struct fds *fds, struct slave_db *db,
             }
         }
 
-        _slave_send_reply(fds, r);
+        lms_slave_send_reply(pinfo, seq, r);
         counter++;
         if (counter > lms->commit_interval) {
             if (!total_committed) {
@@ -419,7 +395,7 @@ _slave_work_int(lms_t *lms, struct fds *fds, struct slave_db *db,
                 lms_db_update_id_set(db->handle, update_id);
             }
 
-            lms_db_end_transaction(db->transaction_commit);
+            _end_transaction(lms, db->transaction_commit);
             lms_db_begin_transaction(db->transaction_begin);
             counter = 0;
         }
@@ -432,7 +408,7 @@ _slave_work_int(lms_t *lms, struct fds *fds, struct slave_db *db,
         lms_db_update_id_set(db->handle, update_id);
     }
 
-    lms_db_end_transaction(db->transaction_commit);
+    _end_transaction(lms, db->transaction_commit);
 
     return r;
 }
@@ -441,11 +417,10 @@ static int
 _slave_work(struct pinfo *pinfo)
 {
     lms_t *lms = pinfo->common.lms;
-    struct fds *fds = &pinfo->slave;
     struct slave_db *db;
     int r;
 
-    db = _slave_db_open(lms->db_path);
+    db = _slave_db_open(lms);
     if (!db)
         return -1;
 
@@ -472,12 +447,12 @@ _slave_work(struct pinfo *pinfo)
         goto end;
     }
 
-    r = _slave_work_int(lms, fds, db, pinfo->common.update_id);
+    r = _slave_work_int(lms, pinfo, db, pinfo->common.update_id);
 
   end:
     lms_parsers_finish(lms, db->handle);
     _slave_db_close(db);
-    _init_sync_send(fds);
+    _init_sync_send(pinfo);
 
     return r;
 }
@@ -498,11 +473,19 @@ _master_db_compile_all_stmts(struct master_db *db)
     if (!db->get_files)
         return -1;
 
+    db->transaction_begin = lms_db_compile_stmt_begin_transaction(handle);
+    if (!db->transaction_begin)
+        return -2;
+
+    db->transaction_commit = lms_db_compile_stmt_end_transaction(handle);
+    if (!db->transaction_commit)
+        return -3;
+
     return 0;
 }
 
 static struct master_db *
-_master_db_open(const char *db_path)
+_master_db_open(const lms_t *lms)
 {
     struct master_db *db;
 
@@ -512,11 +495,8 @@ _master_db_open(const char *db_path)
         return NULL;
     }
 
-    if (sqlite3_open(db_path, &db->handle) != SQLITE_OK) {
-        fprintf(stderr, "ERROR: could not open DB \"%s\": %s\n",
-                db_path, sqlite3_errmsg(db->handle));
+    if (lms_db_open(lms, &db->handle, 0) != 0)
         goto error;
-    }
 
     if (lms_db_create_core_tables_if_required(db->handle) != 0) {
         fprintf(stderr, "ERROR: could not setup tables and indexes.\n");
@@ -531,7 +511,7 @@ _master_db_open(const char *db_path)
     return db;
 
   error:
-    sqlite3_close(db->handle);
+    lms_db_close(db->handle);
     free(db);
     return NULL;
 }
@@ -542,7 +522,13 @@ _master_db_close(struct master_db *db)
     if (db->get_files)
         lms_db_finalize_stmt(db->get_files, "get_files");
 
-    if (sqlite3_close(db->handle) != SQLITE_OK) {
+    if (db->transaction_begin)
+        lms_db_finalize_stmt(db->transaction_begin, "transaction_begin");
+
+    if (db->transaction_commit)
+        lms_db_finalize_stmt(db->transaction_commit, "transaction_commit");
+
+    if (lms_db_close(db->handle) != 0) {
         fprintf(stderr, "ERROR: clould not close DB (master): %s\n",
                 sqlite3_errmsg(db->handle));
         return -1;
@@ -592,6 +578,8 @@ _report_progress(struct cinfo *info, const struct lms_file_info *finfo, lms_prog
     lms_progress_callback_t cb;
     lms_t *lms = info->lms;
 
+    lms_stats_files(lms, status, 1);
+
     cb = lms->progress.cb;
     if (!cb)
         return;
@@ -599,17 +587,19 @@ _report_progress(struct cinfo *info, const struct lms_file_info *finfo, lms_prog
     cb(lms, finfo->path, finfo->path_len, status, lms->progress.data);
 }
 
+/*
+ * Compare row with its stat() result.
+ *
+ * Return: 0 if there is nothing to do, 1 if row must be checked.
+ */
 static int
-_finfo_update(void *db_ptr, struct cinfo *info, struct lms_file_info *finfo, unsigned int *flags)
+_finfo_update(struct cinfo *info, struct lms_file_info *finfo, const struct stat_request *req, unsigned int *flags)
 {
-    struct master_db *db = db_ptr;
-    struct stat st;
-
-    _update_finfo_from_stmt(finfo, db->get_files);
+    const struct stat *st = &req->st;
 
     *flags = 0;
-    if (stat(finfo->path, &st) == 0) {
-        if (st.st_mtime == finfo->mtime && (size_t)st.st_size == finfo->size) {
+    if (req->error == 0) {
+        if (st->st_mtime == finfo->mtime && (size_t)st->st_size == finfo->size) {
             if (finfo->dtime == 0) {
                 _report_progress(info, finfo, LMS_PROGRESS_STATUS_UP_TO_DATE);
                 return 0;
@@ -618,7 +608,7 @@ _finfo_update(void *db_ptr, struct cinfo *info, struct lms_file_info *finfo, uns
                 finfo->itime = time(NULL);
             }
         } else {
-            _update_finfo_from_stat(finfo, &st);
+            _update_finfo_from_stat(finfo, st);
             *flags |= COMM_FINFO_FLAG_OUTDATED;
         }
     } else {
@@ -633,88 +623,167 @@ _finfo_update(void *db_ptr, struct cinfo *info, struct lms_file_info *finfo, uns
     return 1;
 }
 
+static inline void
+_report_entry(struct cinfo *info, const struct window_entry *e, lms_progress_status_t status)
+{
+    lms_progress_callback_t cb;
+    lms_t *lms = info->lms;
+
+    lms_stats_files(lms, status, 1);
+
+    cb = lms->progress.cb;
+    if (!cb)
+        return;
+
+    cb(lms, e->path, e->path_len, status, lms->progress.data);
+}
+
 static int
-_check_row(void *db_ptr, struct cinfo *info)
+_handle_reply(struct pinfo *pinfo, const struct comm_reply *reply)
 {
-    struct pinfo *pinfo = (struct pinfo *)info;
-    struct master_db *db = db_ptr;
-    struct lms_file_info finfo;
-    unsigned int flags;
-    int r, reply;
+    struct cinfo *info = &pinfo->common;
+    int timeout = pinfo->slave_timeout;
+    struct window_entry *e;
+    int lost, r;
 
-    r = _finfo_update(db, info, &finfo, &flags);
-    if (r == 0)
-        return r;
+    /* startup of a restarted slave */
+    if (reply->seq == WINDOW_SEQ_SYNC)
+        return 0;
 
-    if (_master_send_file(&pinfo->master, finfo, flags) != 0)
-        return -1;
+    lost = lms_window_lost_before(&pinfo->window, reply->seq);
+    if (lost < 0) {
+        fprintf(stderr, "ERROR: unexpected reply %u from slave %d\n",
+                reply->seq, pinfo->child);
+        return 0;
+    }
+
+    for (; lost > 0; lost--) {
+        e = lms_window_first(&pinfo->window);
+        _report_entry(info, e, LMS_PROGRESS_STATUS_KILLED);
+        lms_window_pop(&pinfo->window, timeout);
+    }
+
+    e = lms_window_first(&pinfo->window);
+    if (reply->status < 0) {
+        fprintf(stderr, "ERROR: pid=%d failed to parse \"%s\".\n",
+                getpid(), e->path);
+        _report_entry(info, e, LMS_PROGRESS_STATUS_ERROR_PARSE);
+        r = (-reply->status) << 8;
+    } else {
+        if (e->flags & WINDOW_FLAG_DELETED)
+            _report_entry(info, e, LMS_PROGRESS_STATUS_DELETED);
+        else
+            _report_entry(info, e, LMS_PROGRESS_STATUS_PROCESSED);
+        r = reply->status;
+    }
+
+    lms_window_pop(&pinfo->window, timeout);
+    return r;
+}
+
+/*
+ * Wait for the next reply from slave, restarting it if the path it's
+ * working on exceeds its deadline.
+ */
+static int
+_window_wait(struct pinfo *pinfo)
+{
+    struct window_entry *e;
+    struct comm_reply reply;
+    int r;
 
-    r = _master_recv_reply(&pinfo->master, &pinfo->poll, &reply,
-                           pinfo->common.lms->slave_timeout);
+    r = lms_master_recv_reply(pinfo, &reply,
+                              lms_window_timeout_left(&pinfo->window));
     if (r < 0) {
-        _report_progress(info, &finfo, LMS_PROGRESS_STATUS_ERROR_COMM);
+        e = lms_window_first(&pinfo->window);
+        _report_entry(&pinfo->common, e, LMS_PROGRESS_STATUS_ERROR_COMM);
         return -2;
     } else if (r == 1) {
         fprintf(stderr, "ERROR: slave took too long, restart %d\n",
                 pinfo->child);
-        _report_progress(info, &finfo, LMS_PROGRESS_STATUS_KILLED);
+        e = lms_window_first(&pinfo->window);
+        _report_entry(&pinfo->common, e, LMS_PROGRESS_STATUS_KILLED);
+        lms_window_pop(&pinfo->window, pinfo->slave_timeout);
         if (lms_restart_slave(pinfo, _slave_work) != 0)
             return -3;
         return 1;
-    } else {
-        if (reply < 0) {
-            fprintf(stderr, "ERROR: pid=%d failed to parse \"%s\".\n",
-                    getpid(), finfo.path);
-            _report_progress(info, &finfo, LMS_PROGRESS_STATUS_ERROR_PARSE);
-            return (-reply) << 8;
-        } else {
-            if (!finfo.dtime)
-                _report_progress(info, &finfo, LMS_PROGRESS_STATUS_PROCESSED);
-            else
-                _report_progress(info, &finfo, LMS_PROGRESS_STATUS_DELETED);
-            return reply;
-        }
     }
+
+    return _handle_reply(pinfo, &reply);
+}
+
+static int
+_window_drain(struct pinfo *pinfo)
+{
+    int r;
+
+    while (pinfo->window.count) {
+        r = _window_wait(pinfo);
+        if (r < 0)
+            return r;
+    }
+
+    return 0;
+}
+
+static int
+_check_row(void *db_ptr, struct cinfo *info, struct lms_file_info *finfo, unsigned int flags)
+{
+    struct pinfo *pinfo = (struct pinfo *)info;
+    int r;
+
+    /* keep slave busy while next rows are checked, only wait when it
+     * can't take more.
+     */
+    while (lms_window_is_full(&pinfo->window,
+                              sizeof(struct comm_finfo) + finfo->path_len)) {
+        r = _window_wait(pinfo);
+        if (r < 0)
+            return r;
+    }
+
+    if (_master_send_file(pinfo, *finfo, flags) != 0)
+        return -1;
+
+    return 0;
 }
 
 static int
-_check_row_single_process(void *db_ptr, struct cinfo *info)
+_check_row_single_process(void *db_ptr, struct cinfo *info, struct lms_file_info *finfo, unsigned int flags)
 {
     struct sinfo *sinfo = (struct sinfo *)info;
     struct single_process_db *db = db_ptr;
-    struct lms_file_info finfo;
-    unsigned int flags;
     int r;
 
     void **parser_match = sinfo->parser_match;
     lms_t *lms = info->lms;
 
-    r = _finfo_update(db, info, &finfo, &flags);
-    if (r == 0)
-        return r;
-
-    r = lms_db_update_file_info(db->update_file_info, &finfo,
+    r = lms_db_update_file_info(db->update_file_info, finfo,
                                 sinfo->common.update_id);
     if (r < 0)
         fprintf(stderr, "ERROR: could not update path in DB\n");
     else if (flags & COMM_FINFO_FLAG_OUTDATED) {
         int used;
 
-        used = lms_parsers_check_using(lms, parser_match, &finfo);
+        used = lms_parsers_check_using(lms, lms->parsers, parser_match,
+                                       finfo);
         if (!used)
             r = 0;
         else {
-            r = lms_parsers_run(lms, db->handle, parser_match, &finfo);
+            struct lms_context ctxt;
+
+            lms_context_init(&ctxt, lms, db->handle);
+            r = lms_parsers_run(lms, lms->parsers, &ctxt, parser_match, finfo);
             if (r < 0) {
                 fprintf(stderr, "ERROR: pid=%d failed to parse \"%s\".\n",
-                        getpid(), finfo.path);
-                lms_db_delete_file_info(db->delete_file_info, &finfo);
+                        getpid(), finfo->path);
+                lms_db_delete_file_info(db->delete_file_info, finfo);
             }
         }
     }
 
     if (r < 0) {
-        _report_progress(info, &finfo, LMS_PROGRESS_STATUS_ERROR_PARSE);
+        _report_progress(info, finfo, LMS_PROGRESS_STATUS_ERROR_PARSE);
         return (-r) << 8;
     } else {
         sinfo->commit_counter++;
@@ -724,27 +793,38 @@ _check_row_single_process(void *db_ptr, struct cinfo *info)
                 lms_db_update_id_set(db->handle, sinfo->common.update_id);
             }
 
-            lms_db_end_transaction(db->transaction_commit);
+            _end_transaction(lms, db->transaction_commit);
             lms_db_begin_transaction(db->transaction_begin);
             sinfo->commit_counter = 0;
         }
 
-        if (!finfo.dtime)
-            _report_progress(info, &finfo, LMS_PROGRESS_STATUS_PROCESSED);
+        if (!finfo->dtime)
+            _report_progress(info, finfo, LMS_PROGRESS_STATUS_PROCESSED);
         else
-            _report_progress(info, &finfo, LMS_PROGRESS_STATUS_DELETED);
+            _report_progress(info, finfo, LMS_PROGRESS_STATUS_DELETED);
         return r;
     }
 }
 
+static int
+_check_row_threaded(void *db_ptr, struct cinfo *info, struct lms_file_info *finfo, unsigned int flags)
+{
+    struct tinfo *tinfo = (struct tinfo *)info;
+
+    flags = (flags & COMM_FINFO_FLAG_OUTDATED) ? TJOB_CHECK | TJOB_PARSE :
+        TJOB_CHECK;
+    return lms_tpool_push(tinfo->tp, finfo, flags);
+}
+
 static int
 _init_sync_wait(struct pinfo *pinfo, int restart)
 {
-    int r, reply;
+    struct comm_reply reply;
+    int r;
 
     do {
-        r = _master_recv_reply(&pinfo->master, &pinfo->poll, &reply,
-                               pinfo->common.lms->slave_timeout);
+        r = lms_master_recv_reply(pinfo, &reply,
+                                  pinfo->slave_timeout);
         if (r < 0)
             return -1;
         else if (r == 1 && restart) {
@@ -759,35 +839,262 @@ _init_sync_wait(struct pinfo *pinfo, int restart)
 }
 
 static int
-_master_dummy_send_finish(const struct fds *master)
+_master_dummy_send_finish(struct pinfo *pinfo)
 {
     return 0;
 }
 
+/*
+ * Rows read ahead from get_files, so their paths are stat'ed in a single
+ * batch. Each one owns a PATH_SIZE slot of paths.
+ */
+struct check_rows {
+    struct lms_file_info *finfo;
+    struct stat_request *reqs;
+    char *paths;
+    unsigned int size;
+    unsigned int count;
+};
+
+static void
+_check_rows_free(struct check_rows *rows)
+{
+    free(rows->finfo);
+    free(rows->reqs);
+    free(rows->paths);
+}
+
 static int
-_db_files_loop(void *db_ptr, struct cinfo *info, check_row_callback_t check_row)
+_check_rows_init(struct check_rows *rows, unsigned int size)
 {
-    struct master_db *db = db_ptr;
-    lms_t *lms = info->lms;
+    if (size < 1)
+        size = 1;
+
+    rows->size = size;
+    rows->count = 0;
+    rows->finfo = malloc(size * sizeof(*rows->finfo));
+    rows->reqs = malloc(size * sizeof(*rows->reqs));
+    rows->paths = malloc(size * (PATH_SIZE + 1));
+    if (!rows->finfo || !rows->reqs || !rows->paths) {
+        perror("malloc");
+        _check_rows_free(rows);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Read up to rows->size rows.
+ *
+ * Return: 1 if there are more, 0 if all rows were read, < 0 on errors.
+ */
+static int
+_check_rows_fill(struct check_rows *rows, struct master_db *db)
+{
+    struct lms_file_info *finfo;
+    char *path;
     int r;
 
-    do {
+    rows->count = 0;
+    while (rows->count < rows->size) {
         r = sqlite3_step(db->get_files);
-        if (r == SQLITE_ROW) {
-            if (check_row(db_ptr, info) < 0) {
-                fprintf(stderr, "ERROR: could not check row.\n");
-                return -1;
-            }
-        } else if (r != SQLITE_DONE) {
+        if (r == SQLITE_DONE)
+            return 0;
+        else if (r != SQLITE_ROW) {
             fprintf(stderr, "ERROR: could not begin transaction: %s\n",
                     sqlite3_errmsg(db->handle));
             return -2;
         }
-    } while (r != SQLITE_DONE && !lms->stop_processing);
+
+        finfo = rows->finfo + rows->count;
+        _update_finfo_from_stmt(finfo, db->get_files);
+        if (finfo->path_len > PATH_SIZE) {
+            fprintf(stderr, "ERROR: path in DB is too long (%d, max: %d)\n",
+                    finfo->path_len, PATH_SIZE);
+            continue;
+        }
+
+        path = rows->paths + rows->count * (PATH_SIZE + 1);
+        memcpy(path, finfo->path, finfo->path_len);
+        path[finfo->path_len] = '\0';
+        finfo->path = path;
+        rows->reqs[rows->count].path = path;
+        rows->count++;
+    }
+
+    return 1;
+}
+
+/*
+ * Files found missing, marked as deleted at once by
+ * _check_deleted_flush() instead of one row at a time. Paths are kept
+ * NUL separated to be reported afterwards, if there is someone to.
+ */
+struct check_deleted {
+    int64_t *ids;
+    unsigned int count;
+    unsigned int size;
+    char *paths;
+    unsigned int paths_len;
+    unsigned int paths_size;
+    int dtime;
+};
+
+static void
+_check_deleted_free(struct check_deleted *deleted)
+{
+    free(deleted->ids);
+    free(deleted->paths);
+}
+
+static int
+_check_deleted_add(struct check_deleted *deleted, struct cinfo *info, const struct lms_file_info *finfo)
+{
+    if (deleted->count == deleted->size) {
+        unsigned int size = deleted->size ? deleted->size * 2 : 1024;
+        int64_t *ids;
+
+        ids = realloc(deleted->ids, size * sizeof(*ids));
+        if (!ids) {
+            perror("realloc");
+            return -1;
+        }
+        deleted->ids = ids;
+        deleted->size = size;
+    }
+
+    if (info->lms->progress.cb) {
+        unsigned int len = deleted->paths_len + finfo->path_len + 1;
+
+        if (len > deleted->paths_size) {
+            unsigned int size = deleted->paths_size ? deleted->paths_size : 65536;
+            char *paths;
+
+            while (size < len)
+                size *= 2;
+
+            paths = realloc(deleted->paths, size);
+            if (!paths) {
+                perror("realloc");
+                return -1;
+            }
+            deleted->paths = paths;
+            deleted->paths_size = size;
+        }
+
+        memcpy(deleted->paths + deleted->paths_len, finfo->path,
+               finfo->path_len);
+        deleted->paths[len - 1] = '\0';
+        deleted->paths_len = len;
+    }
+
+    if (!deleted->count)
+        deleted->dtime = finfo->dtime;
+    deleted->ids[deleted->count++] = finfo->id;
+
+    return 0;
+}
+
+/* Must be done within a transaction */
+static int
+_check_deleted_flush(struct check_deleted *deleted, sqlite3 *db, struct cinfo *info)
+{
+    lms_t *lms = info->lms;
+    unsigned int i;
+    int r;
+
+    if (!deleted->count)
+        return 0;
+
+    r = lms_db_mark_files_deleted(db, deleted->ids, deleted->count,
+                                  deleted->dtime, info->update_id);
+    if (r != 0) {
+        fprintf(stderr, "ERROR: could not mark %u files as deleted.\n",
+                deleted->count);
+        return r;
+    }
+
+    lms_db_update_id_set(db, info->update_id);
+    lms_stats_files(lms, LMS_PROGRESS_STATUS_DELETED, deleted->count);
+
+    if (lms->progress.cb && deleted->paths) {
+        const char *p = deleted->paths;
+
+        for (i = 0; i < deleted->count; i++) {
+            int len = strlen(p);
+
+            lms->progress.cb(lms, p, len, LMS_PROGRESS_STATUS_DELETED,
+                             lms->progress.data);
+            p += len + 1;
+        }
+    }
 
     return 0;
 }
 
+/*
+ * Check rows with check_row(), but the ones found missing that are
+ * collected in deleted, if given.
+ */
+static int
+_db_files_loop(void *db_ptr, struct cinfo *info, check_row_callback_t check_row, struct check_deleted *deleted)
+{
+    struct master_db *db = db_ptr;
+    lms_t *lms = info->lms;
+    struct stat_batch *batch;
+    struct check_rows rows;
+    unsigned int i, flags;
+    int64_t start;
+    int more, ret = 0;
+
+    if (_check_rows_init(&rows, lms->check_batch) != 0)
+        return -1;
+
+    batch = lms_stat_batch_new(rows.size);
+    if (!batch) {
+        _check_rows_free(&rows);
+        return -1;
+    }
+
+    do {
+        more = _check_rows_fill(&rows, db);
+        if (more < 0) {
+            ret = more;
+            break;
+        }
+
+        start = lms_stats_now();
+        lms_stat_batch_run(batch, rows.reqs, rows.count);
+        lms_stats_add(lms, LMS_STATS_PHASE_STAT, lms_stats_now() - start,
+                      rows.count);
+
+        for (i = 0; i < rows.count && !lms->stop_processing; i++) {
+            if (!_finfo_update(info, rows.finfo + i, rows.reqs + i, &flags))
+                continue;
+
+            if (deleted && rows.reqs[i].error != 0) {
+                if (_check_deleted_add(deleted, info, rows.finfo + i) != 0) {
+                    ret = -1;
+                    goto end;
+                }
+                continue;
+            }
+
+            if (check_row(db_ptr, info, rows.finfo + i, flags) < 0) {
+                fprintf(stderr, "ERROR: could not check row.\n");
+                ret = -1;
+                goto end;
+            }
+        }
+    } while (more && !lms->stop_processing);
+
+  end:
+    lms_stat_batch_free(batch);
+    _check_rows_free(&rows);
+    return ret;
+}
+
 static int
 _is_file(const char *path)
 {
@@ -797,24 +1104,30 @@ _is_file(const char *path)
     return S_ISREG(st.st_mode);
 }
 
+/* query of get_files for rows of path or, if a directory, files under it */
+static int
+_files_query(char *query, const char *path, int len)
+{
+    memcpy(query, path, len);
+    if (!_is_file(path) && (len == 0 || query[len - 1] != '/'))
+        query[len++] = '/';
+
+    return len;
+}
+
 static int
 _check(struct pinfo *pinfo, int len, char *path)
 {
-    char query[PATH_SIZE + 3];
+    struct check_deleted deleted = { };
+    char query[PATH_SIZE + 1];
     struct master_db *db;
     int ret;
 
-    db = _master_db_open(pinfo->common.lms->db_path);
+    db = _master_db_open(pinfo->common.lms);
     if (!db)
         return -1;
 
-    if (_is_file(path))
-        memcpy(query, path, len + 1);
-    else {
-        memcpy(query, path, len);
-        memcpy(query + len, "/%", sizeof("/%"));
-        len += sizeof("/%") - 1;
-    }
+    len = _files_query(query, path, len);
     ret = lms_db_get_files(db->get_files, query, len);
     if (ret != 0)
         goto end;
@@ -834,39 +1147,156 @@ _check(struct pinfo *pinfo, int len, char *path)
 
     _init_sync_wait(pinfo, 1);
 
-    ret = _db_files_loop(db, (struct cinfo *)pinfo, _check_row);
+    ret = _db_files_loop(db, (struct cinfo *)pinfo, _check_row, &deleted);
+    if (_window_drain(pinfo) < 0 && ret == 0)
+        ret = -3;
 
-    _master_send_finish(&pinfo->master);
+    _master_send_finish(pinfo);
     _init_sync_wait(pinfo, 0);
     lms_finish_slave(pinfo, _master_dummy_send_finish);
+
+    /* slave is gone with its transaction, nothing to wait for */
+    lms_db_reset_stmt(db->get_files);
+    if (deleted.count) {
+        int r;
+
+        lms_db_begin_transaction(db->transaction_begin);
+        r = _check_deleted_flush(&deleted, db->handle, &pinfo->common);
+        _end_transaction(pinfo->common.lms, db->transaction_commit);
+        if (r != 0 && ret == 0)
+            ret = -4;
+    }
   end:
     lms_db_reset_stmt(db->get_files);
     _master_db_close(db);
+    _check_deleted_free(&deleted);
+
+    return ret;
+}
+
+/*
+ * Rows to check are copied with copy_files, as the cursor can't be kept
+ * open on the pool connection, where the writer updates and deletes
+ * them, nor on another one, whose lock would keep its commits waiting.
+ */
+static int
+_check_threaded_copy(sqlite3 *db, const char *query, int len)
+{
+    sqlite3_stmt *copy;
+    int ret;
+
+    copy = lms_db_compile_stmt_copy_files(db);
+    if (!copy)
+        return -1;
+
+    ret = lms_db_get_files(copy, query, len);
+    if (ret == 0 && sqlite3_step(copy) != SQLITE_DONE) {
+        fprintf(stderr, "ERROR: could not copy files to check: %s\n",
+                sqlite3_errmsg(db));
+        ret = -1;
+    }
+
+    lms_db_reset_stmt(copy);
+    lms_db_finalize_stmt(copy, "copy_files");
 
     return ret;
 }
 
+static int
+_check_threaded(struct tinfo *tinfo, int len, char *path, struct check_deleted *deleted)
+{
+    char query[PATH_SIZE + 1];
+    struct master_db db;
+    int ret;
+
+    if (lms_db_open(tinfo->common.lms, &db.handle, SQLITE_OPEN_READONLY) != 0)
+        return -1;
+    sqlite3_busy_timeout(db.handle, DEFAULT_BUSY_TIMEOUT);
+
+    /* nothing is written yet */
+    ret = lms_db_update_id_get(db.handle);
+    if (ret < 0) {
+        fprintf(stderr, "ERROR: could not get global update id.\n");
+        lms_db_close(db.handle);
+        return ret;
+    }
+    tinfo->common.update_id = ret + 1;
+
+    len = _files_query(query, path, len);
+    ret = _check_threaded_copy(db.handle, query, len);
+    if (ret != 0) {
+        lms_db_close(db.handle);
+        return ret;
+    }
+
+    db.get_files = lms_db_compile_stmt_get_files_copy(db.handle);
+    if (!db.get_files) {
+        lms_db_close(db.handle);
+        return -1;
+    }
+
+    ret = _db_files_loop(&db, &tinfo->common, _check_row_threaded, deleted);
+
+    lms_db_reset_stmt(db.get_files);
+    lms_db_finalize_stmt(db.get_files, "get_files_copy");
+    lms_db_close(db.handle);
+
+    return ret;
+}
+
+static int
+_check_threaded_deleted_flush(struct check_deleted *deleted, struct cinfo *info)
+{
+    int64_t start;
+    sqlite3 *db;
+    int r = -1;
+
+    if (lms_db_open(info->lms, &db, 0) != 0)
+        return -1;
+
+    if (sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, NULL) != SQLITE_OK) {
+        fprintf(stderr, "ERROR: could not begin transaction: %s\n",
+                sqlite3_errmsg(db));
+        goto done;
+    }
+
+    if (_check_deleted_flush(deleted, db, info) != 0) {
+        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+        goto done;
+    }
+
+    start = lms_stats_now();
+    if (sqlite3_exec(db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK) {
+        fprintf(stderr, "ERROR: could not commit deleted files: %s\n",
+                sqlite3_errmsg(db));
+        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+        goto done;
+    }
+    lms_stats_time(info->lms, LMS_STATS_PHASE_COMMIT, start);
+
+    r = 0;
+
+  done:
+    lms_db_close(db);
+    return r;
+}
+
 static int
 _check_single_process(struct sinfo *sinfo, int len, char *path)
 {
+    struct check_deleted deleted = { };
     struct single_process_db *db;
-    char query[PATH_SIZE + 2];
+    char query[PATH_SIZE + 1];
     void **parser_match = NULL;
     lms_t *lms;
     int ret;
 
     lms = sinfo->common.lms;
-    db = _single_process_db_open(lms->db_path);
+    db = _single_process_db_open(lms);
     if (!db)
         return -1;
 
-    if (_is_file(path))
-        memcpy(query, path, len + 1);
-    else {
-        memcpy(query, path, len);
-        memcpy(query + len, "/%", sizeof("/%"));
-        len += sizeof("/%") - 1;
-    }
+    len = _files_query(query, path, len);
     ret = lms_db_get_files(db->get_files, query, len);
     if (ret != 0)
         goto end;
@@ -907,7 +1337,11 @@ _check_single_process(struct sinfo *sinfo, int len, char *path)
 
     lms_db_begin_transaction(db->transaction_begin);
 
-    ret = _db_files_loop(db, (struct cinfo *)sinfo, _check_row_single_process);
+    ret = _db_files_loop(db, (struct cinfo *)sinfo, _check_row_single_process,
+                         &deleted);
+    if (_check_deleted_flush(&deleted, db->handle, &sinfo->common) != 0 &&
+        ret == 0)
+        ret = -6;
 
     /* Check only if there are remaining commits to do */
     if (sinfo->commit_counter) {
@@ -915,13 +1349,14 @@ _check_single_process(struct sinfo *sinfo, int len, char *path)
         lms_db_update_id_set(db->handle, sinfo->common.update_id);
     }
 
-    lms_db_end_transaction(db->transaction_commit);
+    _end_transaction(lms, db->transaction_commit);
 
 end:
     free(parser_match);
     lms_parsers_finish(lms, db->handle);
     lms_db_reset_stmt(db->get_files);
     _single_process_db_close(db);
+    _check_deleted_free(&deleted);
 
     return ret;
 }
@@ -972,6 +1407,7 @@ lms_check(lms_t *lms, const char *top_path)
         return r;
 
     pinfo.common.lms = lms;
+    pinfo.slave_timeout = lms->slave_timeout;
 
     if (lms_create_pipes(&pinfo) != 0) {
         r = -5;
@@ -990,7 +1426,9 @@ lms_check(lms_t *lms, const char *top_path)
 
     lms->is_processing = 1;
     lms->stop_processing = 0;
+    lms_stats_begin(lms);
     r = _check(&pinfo, strlen(path), path);
+    lms_stats_end(lms);
     lms->is_processing = 0;
     lms->stop_processing = 0;
 
@@ -1039,9 +1477,77 @@ lms_check_single_process(lms_t *lms, const char *top_path)
 
     lms->is_processing = 1;
     lms->stop_processing = 0;
+    lms_stats_begin(lms);
     r = _check_single_process(&sinfo, strlen(path), path);
+    lms_stats_end(lms);
     lms->is_processing = 0;
     lms->stop_processing = 0;
 
     return r;
 }
+
+/**
+ * Check consistency of given directory or file using threads instead of processes.
+ *
+ * This will update media in the given directory or its children. If files
+ * are missing, they'll be marked as deleted (dtime is set), if they were
+ * marked as deleted and are now present, they are unmarked (dtime is unset).
+ *
+ * Same as lms_process_threaded(), outdated files are parsed by
+ * lms_get_worker_count() threads and there is no crash isolation nor
+ * slave timeout.
+ *
+ * @param lms previously allocated Light Media Scanner instance.
+ * @param top_path top directory or file to scan.
+ *
+ * @return On success 0 is returned.
+ */
+int
+lms_check_threaded(lms_t *lms, const char *top_path)
+{
+    struct check_deleted deleted = { };
+    char path[PATH_SIZE];
+    struct tinfo tinfo;
+    int r, r2, r3;
+
+    r = _lms_check_check_valid(lms, top_path);
+    if (r < 0)
+        return r;
+
+    if (realpath(top_path, path) == NULL) {
+        int len = strlen(top_path);
+        if (len + 1 < PATH_SIZE)
+            memcpy(path, top_path, len + 1);
+        else {
+            fprintf(stderr, "ERROR: path is too long: %s\n", top_path);
+            return -5;
+        }
+    }
+
+    tinfo.common.lms = lms;
+    tinfo.tp = lms_tpool_new(lms);
+    if (!tinfo.tp)
+        return -6;
+
+    lms->is_processing = 1;
+    lms->stop_processing = 0;
+    lms_stats_begin(lms);
+    r = _check_threaded(&tinfo, strlen(path), path, &deleted);
+    r2 = lms_tpool_free(tinfo.tp);
+
+    /* writer shares the pool connection, write them once it's gone */
+    if (deleted.count) {
+        r3 = _check_threaded_deleted_flush(&deleted, &tinfo.common);
+        if (r >= 0 && !r2)
+            r2 = r3;
+    }
+    lms_stats_end(lms);
+    lms->is_processing = 0;
+    lms->stop_processing = 0;
+    _check_deleted_free(&deleted);
+
+    if (r >= 0 && r2)
+        r = r2;
+
+    return r;
+}
@@ -730,11 +730,17 @@ lms_db_audio_add(lms_db_audio_t *lda, struct lms_audio_info *info)
     int64_t album_id, genre_id, artist_id;
     int ret_album, ret_genre, ret_artist;
     const struct lms_dlna_audio_profile *dlna;
+    int r;
 
     if (!lda)
         return -1;
     if (!info)
         return -2;
+
+    r = lms_db_record_capture(LMS_DB_RECORD_AUDIO, lda, info);
+    if (r != 0)
+        return r > 0 ? 0 : -7;
+
     if (info->id < 1)
         return -3;
 
@@ -105,6 +105,11 @@ lms_db_compile_stmt(sqlite3 *db, const char *sql)
 {
     sqlite3_stmt *stmt;
 
+    /* DB sessions keep statements compiled between scans */
+    stmt = lms_db_session_stmt_take(db, sql);
+    if (stmt)
+        return stmt;
+
     if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
         fprintf(stderr, "ERROR: could not prepare \"%s\": %s\n", sql,
                 sqlite3_errmsg(db));
@@ -117,6 +122,9 @@ lms_db_finalize_stmt(sqlite3_stmt *stmt, const char *name)
 {
     int r;
 
+    if (lms_db_session_stmt_give(stmt))
+        return 0;
+
     r = sqlite3_finalize(stmt);
     if (r != SQLITE_OK) {
         fprintf(stderr, "ERROR: could not finalize %s statement: #%d\n",
@@ -546,10 +554,293 @@ _db_table_updater_files_2(sqlite3 *db, const char *table, unsigned int current_v
     return 0;
 }
 
+static int
+_db_exec(sqlite3 *db, const char *sql)
+{
+    char *errmsg = NULL;
+
+    if (sqlite3_exec(db, sql, NULL, NULL, &errmsg) != SQLITE_OK) {
+        fprintf(stderr, "ERROR: could not execute \"%s\": %s\n", sql, errmsg);
+        sqlite3_free(errmsg);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* length of path's directory, including the trailing '/' */
+static int
+_path_dir_len(const char *path, int len)
+{
+    for (len--; len >= 0; len--)
+        if (path[len] == '/')
+            return len + 1;
+
+    return 0;
+}
+
+static void
+_free_strings(char **strings, int count)
+{
+    while (count > 0)
+        free(strings[--count]);
+    free(strings);
+}
+
+/* SQL of triggers on table, they're lost when the table is dropped */
+static int
+_db_get_triggers(sqlite3 *db, const char *table, char ***psql)
+{
+    sqlite3_stmt *stmt;
+    char **sql = NULL, **tmp;
+    int count = 0, r;
+
+    stmt = lms_db_compile_stmt(db,
+        "SELECT sql FROM sqlite_master WHERE type = 'trigger' AND tbl_name = ?");
+    if (!stmt)
+        return -1;
+
+    if (lms_db_bind_text(stmt, 1, table, -1) != 0)
+        goto error;
+
+    while ((r = sqlite3_step(stmt)) == SQLITE_ROW) {
+        tmp = realloc(sql, (count + 1) * sizeof(*sql));
+        if (!tmp) {
+            perror("realloc");
+            goto error;
+        }
+        sql = tmp;
+        sql[count] = strdup((const char *)sqlite3_column_text(stmt, 0));
+        if (!sql[count]) {
+            perror("strdup");
+            goto error;
+        }
+        count++;
+    }
+
+    if (r != SQLITE_DONE) {
+        fprintf(stderr, "ERROR: could not get triggers of '%s': %s\n",
+                table, sqlite3_errmsg(db));
+        goto error;
+    }
+
+    lms_db_finalize_stmt(stmt, "get_triggers");
+    *psql = sql;
+    return count;
+
+  error:
+    lms_db_finalize_stmt(stmt, "get_triggers");
+    _free_strings(sql, count);
+    return -1;
+}
+
+static int
+_db_files_3_copy(sqlite3 *db)
+{
+    sqlite3_stmt *get, *insert_dir = NULL, *insert = NULL;
+    const char *path;
+    int r, ret = -1, i, len, dir_len;
+
+    get = lms_db_compile_stmt(db,
+        "SELECT id, path, mtime, dtime, itime, size, update_id FROM files");
+    if (!get)
+        return -1;
+
+    insert_dir = lms_db_compile_stmt_insert_dir(db);
+    if (!insert_dir)
+        goto end;
+
+    insert = lms_db_compile_stmt(db,
+        "INSERT INTO files_new "
+        "(id, dir_id, name, mtime, dtime, itime, size, update_id) "
+        "VALUES (?, (SELECT id FROM dirs WHERE path = ?), ?, ?, ?, ?, ?, ?)");
+    if (!insert)
+        goto end;
+
+    while ((r = sqlite3_step(get)) == SQLITE_ROW) {
+        path = sqlite3_column_blob(get, 1);
+        len = sqlite3_column_bytes(get, 1);
+        dir_len = _path_dir_len(path, len);
+
+        if (lms_db_insert_dir(insert_dir, path, len) != 0)
+            goto end;
+
+        sqlite3_bind_value(insert, 1, sqlite3_column_value(get, 0));
+        lms_db_bind_blob(insert, 2, path, dir_len);
+        lms_db_bind_blob(insert, 3, path + dir_len, len - dir_len);
+        for (i = 2; i < 7; i++)
+            sqlite3_bind_value(insert, i + 2, sqlite3_column_value(get, i));
+
+        r = sqlite3_step(insert);
+        lms_db_reset_stmt(insert);
+        if (r != SQLITE_DONE) {
+            fprintf(stderr, "ERROR: could not move file %.*s: %s\n",
+                    len, path, sqlite3_errmsg(db));
+            goto end;
+        }
+    }
+
+    if (r != SQLITE_DONE) {
+        fprintf(stderr, "ERROR: could not read files: %s\n",
+                sqlite3_errmsg(db));
+        goto end;
+    }
+
+    ret = 0;
+
+  end:
+    if (insert)
+        lms_db_finalize_stmt(insert, "insert_file_new");
+    if (insert_dir)
+        lms_db_finalize_stmt(insert_dir, "insert_dir");
+    lms_db_finalize_stmt(get, "get_files_old");
+    return ret;
+}
+
+/*
+ * Store each directory once, in dirs, and (dir_id, name) in files
+ * instead of whole paths. Paths are still found in the file_paths view.
+ *
+ * SQLite can't drop the path column (it's UNIQUE), so files is rebuilt.
+ * Dropping it loses the triggers plugins created on it, so they are
+ * created again.
+ */
+static int
+_db_table_updater_files_3(sqlite3 *db, const char *table, unsigned int current_version, int is_last_run)
+{
+    char **triggers = NULL;
+    int n_triggers, i, ret = -1;
+
+    if (_db_exec(db, "SAVEPOINT files_3") != 0)
+        return -1;
+
+    n_triggers = _db_get_triggers(db, "files", &triggers);
+    if (n_triggers < 0)
+        goto rollback;
+
+    if (_db_exec(db,
+                 "CREATE TABLE IF NOT EXISTS dirs ("
+                 "id INTEGER PRIMARY KEY, "
+                 "path BLOB NOT NULL UNIQUE"
+                 ")") != 0)
+        goto rollback;
+
+    if (_db_exec(db,
+                 "CREATE TABLE files_new ("
+                 "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+                 "dir_id INTEGER NOT NULL, "
+                 "name BLOB NOT NULL, "
+                 "mtime INTEGER NOT NULL, "
+                 "dtime INTEGER NOT NULL, "
+                 "itime INTEGER NOT NULL, "
+                 "size INTEGER NOT NULL, "
+                 "update_id INTEGER DEFAULT 0"
+                 ")") != 0)
+        goto rollback;
+
+    if (_db_files_3_copy(db) != 0)
+        goto rollback;
+
+    /* keep ids of deleted files from being reused */
+    if (_db_exec(db,
+                 "DELETE FROM sqlite_sequence WHERE name = 'files_new'; "
+                 "INSERT INTO sqlite_sequence (name, seq) "
+                 "SELECT 'files_new', seq FROM sqlite_sequence "
+                 "WHERE name = 'files'") != 0)
+        goto rollback;
+
+    /* legacy, otherwise triggers of other tables that refer to files
+     * break the rename while it doesn't exist.
+     */
+    if (_db_exec(db,
+                 "DROP TABLE files; "
+                 "PRAGMA legacy_alter_table = ON; "
+                 "ALTER TABLE files_new RENAME TO files; "
+                 "PRAGMA legacy_alter_table = OFF") != 0)
+        goto rollback;
+
+    if (_db_exec(db,
+                 "CREATE UNIQUE INDEX IF NOT EXISTS files_dir_name_idx "
+                 "ON files (dir_id, name)") != 0)
+        goto rollback;
+
+    if (_db_exec(db,
+                 "CREATE VIEW IF NOT EXISTS file_paths AS "
+                 "SELECT files.id AS id, "
+                 "CAST(dirs.path || files.name AS BLOB) AS path, "
+                 "files.mtime AS mtime, files.dtime AS dtime, "
+                 "files.itime AS itime, files.size AS size, "
+                 "files.update_id AS update_id "
+                 "FROM files JOIN dirs ON dirs.id = files.dir_id") != 0)
+        goto rollback;
+
+    for (i = 0; i < n_triggers; i++)
+        if (_db_exec(db, triggers[i]) != 0)
+            goto rollback;
+
+    ret = _db_exec(db, "RELEASE files_3");
+    if (ret == 0)
+        goto end;
+
+  rollback:
+    _db_exec(db, "PRAGMA legacy_alter_table = OFF");
+    _db_exec(db, "ROLLBACK TO files_3; RELEASE files_3");
+  end:
+    if (n_triggers > 0)
+        _free_strings(triggers, n_triggers);
+    return ret;
+}
+
+/*
+ * Directory state used to skip unchanged directories, see
+ * lms_set_skip_unchanged_dirs(). Children is -1 if unknown: any change
+ * to the files of a directory, whoever does it, invalidates it.
+ */
+static int
+_db_table_updater_files_4(sqlite3 *db, const char *table, unsigned int current_version, int is_last_run)
+{
+    int ret;
+
+    if (_db_exec(db, "SAVEPOINT files_4") != 0)
+        return -1;
+
+    ret = _db_exec(db,
+                   "ALTER TABLE dirs ADD COLUMN mtime INTEGER DEFAULT 0; "
+                   "ALTER TABLE dirs ADD COLUMN children INTEGER DEFAULT -1; "
+                   "ALTER TABLE dirs ADD COLUMN update_id INTEGER DEFAULT 0");
+    if (ret != 0)
+        goto rollback;
+
+    ret = _db_exec(db,
+                   "CREATE TRIGGER IF NOT EXISTS dirs_files_insert "
+                   "AFTER INSERT ON files FOR EACH ROW BEGIN "
+                   "UPDATE dirs SET children = -1 WHERE id = NEW.dir_id; "
+                   "END; "
+                   "CREATE TRIGGER IF NOT EXISTS dirs_files_delete "
+                   "AFTER DELETE ON files FOR EACH ROW BEGIN "
+                   "UPDATE dirs SET children = -1 WHERE id = OLD.dir_id; "
+                   "END; "
+                   "CREATE TRIGGER IF NOT EXISTS dirs_files_update "
+                   "AFTER UPDATE OF mtime, dtime, size ON files "
+                   "FOR EACH ROW BEGIN "
+                   "UPDATE dirs SET children = -1 WHERE id = OLD.dir_id; "
+                   "END");
+    if (ret != 0)
+        goto rollback;
+
+    return _db_exec(db, "RELEASE files_4");
+
+  rollback:
+    _db_exec(db, "ROLLBACK TO files_4; RELEASE files_4");
+    return -1;
+}
+
 static lms_db_table_updater_t _db_table_updater_files[] = {
     _db_table_updater_files_0,
     _db_table_updater_files_1,
     _db_table_updater_files_2,
+    _db_table_updater_files_3,
+    _db_table_updater_files_4,
 };
 
 int
@@ -606,6 +897,12 @@ lms_db_begin_transaction(sqlite3_stmt *stmt)
     return ret;
 }
 
+sqlite3_stmt *
+lms_db_compile_stmt_begin_immediate_transaction(sqlite3 *db)
+{
+    return lms_db_compile_stmt(db, "BEGIN IMMEDIATE TRANSACTION");
+}
+
 sqlite3_stmt *
 lms_db_compile_stmt_end_transaction(sqlite3 *db)
 {
@@ -637,15 +934,22 @@ sqlite3_stmt *
 lms_db_compile_stmt_get_file_info(sqlite3 *db)
 {
     return lms_db_compile_stmt(db,
-        "SELECT id, mtime, dtime, itime, size FROM files WHERE path = ?");
+        "SELECT id, mtime, dtime, itime, size FROM files "
+        "WHERE dir_id = (SELECT id FROM dirs WHERE path = ?) AND name = ?");
 }
 
 int
 lms_db_get_file_info(sqlite3_stmt *stmt, struct lms_file_info *finfo)
 {
-    int r, ret;
+    int r, ret, dir_len;
+
+    dir_len = _path_dir_len(finfo->path, finfo->path_len);
+    ret = lms_db_bind_blob(stmt, 1, finfo->path, dir_len);
+    if (ret != 0)
+        goto done;
 
-    ret = lms_db_bind_blob(stmt, 1, finfo->path, finfo->path_len);
+    ret = lms_db_bind_blob(stmt, 2, finfo->path + dir_len,
+                           finfo->path_len - dir_len);
     if (ret != 0)
         goto done;
 
@@ -676,6 +980,99 @@ lms_db_get_file_info(sqlite3_stmt *stmt, struct lms_file_info *finfo)
     return ret;
 }
 
+/* ids bound by each statement, SQLite allows 999 variables by default */
+#define MARK_DELETED_BATCH 256
+
+static sqlite3_stmt *
+_compile_stmt_mark_files_deleted(sqlite3 *db, unsigned int count)
+{
+    static const char prefix[] =
+        "UPDATE files SET dtime = ?, update_id = ? WHERE id IN (?";
+    char sql[sizeof(prefix) + 2 * MARK_DELETED_BATCH];
+    char *p = sql + sizeof(prefix) - 1;
+
+    memcpy(sql, prefix, sizeof(prefix) - 1);
+    for (; count > 1; count--) {
+        *p++ = ',';
+        *p++ = '?';
+    }
+    *p++ = ')';
+    *p = '\0';
+
+    return lms_db_compile_stmt(db, sql);
+}
+
+static int
+_mark_files_deleted(sqlite3_stmt *stmt, const int64_t *ids, unsigned int count, int dtime, unsigned int update_id)
+{
+    unsigned int i;
+    int r, ret;
+
+    ret = lms_db_bind_int(stmt, 1, dtime);
+    if (ret != 0)
+        goto done;
+
+    ret = lms_db_bind_int(stmt, 2, update_id);
+    if (ret != 0)
+        goto done;
+
+    for (i = 0; i < count; i++) {
+        ret = lms_db_bind_int64(stmt, i + 3, ids[i]);
+        if (ret != 0)
+            goto done;
+    }
+
+    r = sqlite3_step(stmt);
+    if (r != SQLITE_DONE) {
+        fprintf(stderr, "ERROR: could not mark files as deleted: %s\n",
+                sqlite3_errmsg(sqlite3_db_handle(stmt)));
+        ret = -5;
+        goto done;
+    }
+
+    ret = 0;
+
+  done:
+    lms_db_reset_stmt(stmt);
+
+    return ret;
+}
+
+/*
+ * Same as lms_db_update_file_info() setting just dtime, for many files
+ * at once with few statements.
+ */
+int
+lms_db_mark_files_deleted(sqlite3 *db, const int64_t *ids, unsigned int count, int dtime, unsigned int update_id)
+{
+    sqlite3_stmt *stmt;
+    int ret = 0;
+
+    if (count >= MARK_DELETED_BATCH) {
+        stmt = _compile_stmt_mark_files_deleted(db, MARK_DELETED_BATCH);
+        if (!stmt)
+            return -1;
+
+        for (; count >= MARK_DELETED_BATCH && ret == 0;
+             count -= MARK_DELETED_BATCH, ids += MARK_DELETED_BATCH)
+            ret = _mark_files_deleted(stmt, ids, MARK_DELETED_BATCH,
+                                      dtime, update_id);
+
+        lms_db_finalize_stmt(stmt, "mark_files_deleted");
+    }
+
+    if (count > 0 && ret == 0) {
+        stmt = _compile_stmt_mark_files_deleted(db, count);
+        if (!stmt)
+            return -1;
+
+        ret = _mark_files_deleted(stmt, ids, count, dtime, update_id);
+        lms_db_finalize_stmt(stmt, "mark_files_deleted");
+    }
+
+    return ret;
+}
+
 sqlite3_stmt *
 lms_db_compile_stmt_update_file_info(sqlite3 *db)
 {
@@ -728,40 +1125,81 @@ lms_db_update_file_info(sqlite3_stmt *stmt, const struct lms_file_info *finfo, u
     return ret;
 }
 
+sqlite3_stmt *
+lms_db_compile_stmt_insert_dir(sqlite3 *db)
+{
+    return lms_db_compile_stmt(db,
+        "INSERT OR IGNORE INTO dirs (path) VALUES(?)");
+}
+
+/* add the directory of the file at path, if it's not there yet */
+int
+lms_db_insert_dir(sqlite3_stmt *stmt, const char *path, int len)
+{
+    int r, ret;
+
+    ret = lms_db_bind_blob(stmt, 1, path, _path_dir_len(path, len));
+    if (ret != 0)
+        goto done;
+
+    r = sqlite3_step(stmt);
+    if (r != SQLITE_DONE) {
+        fprintf(stderr, "ERROR: could not insert dir: %s\n",
+                sqlite3_errmsg(sqlite3_db_handle(stmt)));
+        ret = -2;
+        goto done;
+    }
+
+    ret = 0;
+
+  done:
+    lms_db_reset_stmt(stmt);
+
+    return ret;
+}
+
 sqlite3_stmt *
 lms_db_compile_stmt_insert_file_info(sqlite3 *db)
 {
     return lms_db_compile_stmt(db,
-        "INSERT INTO files (path, mtime, dtime, itime, size, update_id) VALUES(?, ?, ?, ?, ?, ?)");
+        "INSERT INTO files (dir_id, name, mtime, dtime, itime, size, update_id) "
+        "VALUES((SELECT id FROM dirs WHERE path = ?), ?, ?, ?, ?, ?, ?)");
 }
 
+/* its directory must be added with lms_db_insert_dir() before */
 int
 lms_db_insert_file_info(sqlite3_stmt *stmt, struct lms_file_info *finfo,
                         unsigned int update_id)
 {
-    int r, ret;
+    int r, ret, dir_len;
 
-    ret = lms_db_bind_blob(stmt, 1, finfo->path, finfo->path_len);
+    dir_len = _path_dir_len(finfo->path, finfo->path_len);
+    ret = lms_db_bind_blob(stmt, 1, finfo->path, dir_len);
     if (ret != 0)
         goto done;
 
-    ret = lms_db_bind_int(stmt, 2, finfo->mtime);
+    ret = lms_db_bind_blob(stmt, 2, finfo->path + dir_len,
+                           finfo->path_len - dir_len);
     if (ret != 0)
         goto done;
 
-    ret = lms_db_bind_int(stmt, 3, finfo->dtime);
+    ret = lms_db_bind_int(stmt, 3, finfo->mtime);
     if (ret != 0)
         goto done;
 
-    ret = lms_db_bind_int(stmt, 4, finfo->itime);
+    ret = lms_db_bind_int(stmt, 4, finfo->dtime);
     if (ret != 0)
         goto done;
 
-    ret = lms_db_bind_int(stmt, 5, finfo->size);
+    ret = lms_db_bind_int(stmt, 5, finfo->itime);
     if (ret != 0)
         goto done;
 
-    ret = lms_db_bind_int(stmt, 6, update_id);
+    ret = lms_db_bind_int(stmt, 6, finfo->size);
+    if (ret != 0)
+        goto done;
+
+    ret = lms_db_bind_int(stmt, 7, update_id);
     if (ret != 0)
         goto done;
 
@@ -851,18 +1289,199 @@ lms_db_set_file_dtime(sqlite3_stmt *stmt, const struct lms_file_info *finfo)
     return ret;
 }
 
+#define GET_FILES_SELECT                                                \
+    "SELECT files.id, CAST(dirs.path || files.name AS BLOB), "          \
+    "files.mtime, files.dtime, files.itime, files.size "                \
+    "FROM dirs JOIN files ON files.dir_id = dirs.id "                   \
+    "WHERE dirs.path >= ?1 AND dirs.path < ?2 "                         \
+    "AND (?3 IS NULL OR files.name = ?3)"
+
 sqlite3_stmt *
 lms_db_compile_stmt_get_files(sqlite3 *db)
+{
+    return lms_db_compile_stmt(db, GET_FILES_SELECT);
+}
+
+/*
+ * Copy rows of get_files, bound with lms_db_get_files() too, to the
+ * temporary table files_copy. Stepping it once takes a snapshot that
+ * is then read without keeping the database locked.
+ */
+sqlite3_stmt *
+lms_db_compile_stmt_copy_files(sqlite3 *db)
 {
     return lms_db_compile_stmt(db,
-        "SELECT id, path, mtime, dtime, itime, size FROM files WHERE path LIKE ?");
+        "CREATE TEMP TABLE files_copy AS " GET_FILES_SELECT);
+}
+
+/* rows copied by copy_files, same columns as get_files */
+sqlite3_stmt *
+lms_db_compile_stmt_get_files_copy(sqlite3 *db)
+{
+    return lms_db_compile_stmt(db, "SELECT * FROM files_copy");
 }
 
+/*
+ * Select the file at path or, if path ends with '/', every file under it.
+ *
+ * Paths are blobs, compared with memcmp(), so directories starting with
+ * a prefix are the range [prefix, end) with end being the prefix with
+ * its last byte incremented. A single file is looked up in the range of
+ * just its directory, [dir, dir + '\0'), and by name. Both are looked up
+ * in the dirs path index, then in files_dir_name_idx.
+ *
+ * Path is not copied, it must be kept while stmt is stepped.
+ */
 int
 lms_db_get_files(sqlite3_stmt *stmt, const char *path, int len)
 {
+    char *end;
+    int end_len, dir_len, ret;
+
+    if (len < 1) {
+        fprintf(stderr, "ERROR: empty path to get files.\n");
+        return -1;
+    }
+
+    dir_len = _path_dir_len(path, len);
+    end = malloc(dir_len + 1);
+    if (!end) {
+        perror("malloc");
+        return -1;
+    }
+
+    memcpy(end, path, dir_len);
+    if (dir_len == len) {
+        end[dir_len - 1] = '/' + 1;
+        end_len = dir_len;
+        ret = sqlite3_bind_null(stmt, 3) == SQLITE_OK ? 0 : -1;
+    } else {
+        end[dir_len] = '\0';
+        end_len = dir_len + 1;
+        ret = lms_db_bind_blob(stmt, 3, path + dir_len, len - dir_len);
+    }
+
+    if (ret == 0)
+        ret = lms_db_bind_blob(stmt, 1, path, dir_len);
+    if (ret != 0) {
+        free(end);
+        return ret;
+    }
+
+    /* sqlite takes end and frees it */
+    ret = sqlite3_bind_blob(stmt, 2, end, end_len, free);
+    if (ret != SQLITE_OK) {
+        fprintf(stderr, "ERROR: could not bind end of path range: %s\n",
+                sqlite3_errmsg(sqlite3_db_handle(stmt)));
+        return -1;
+    }
+
+    return 0;
+}
+
+sqlite3_stmt *
+lms_db_compile_stmt_get_dir_states(sqlite3 *db)
+{
+    return lms_db_compile_stmt(db,
+        "SELECT path, mtime, children FROM dirs "
+        "WHERE path >= ?1 AND path < ?2 AND children >= 0");
+}
+
+/*
+ * Select known states of the directory path, that must end with '/', and
+ * of every directory under it. Same range as lms_db_get_files().
+ */
+int
+lms_db_get_dir_states(sqlite3_stmt *stmt, const char *path, int len)
+{
+    char *end;
     int ret;
 
+    if (len < 1 || path[len - 1] != '/') {
+        fprintf(stderr, "ERROR: not a directory to get states: %.*s\n",
+                len, path);
+        return -1;
+    }
+
+    end = malloc(len);
+    if (!end) {
+        perror("malloc");
+        return -1;
+    }
+    memcpy(end, path, len);
+    end[len - 1] = '/' + 1;
+
     ret = lms_db_bind_blob(stmt, 1, path, len);
+    if (ret != 0) {
+        free(end);
+        return ret;
+    }
+
+    /* sqlite takes end and frees it */
+    ret = sqlite3_bind_blob(stmt, 2, end, len, free);
+    if (ret != SQLITE_OK) {
+        fprintf(stderr, "ERROR: could not bind end of path range: %s\n",
+                sqlite3_errmsg(sqlite3_db_handle(stmt)));
+        return -1;
+    }
+
+    return 0;
+}
+
+sqlite3_stmt *
+lms_db_compile_stmt_set_dir_state(sqlite3 *db)
+{
+    return lms_db_compile_stmt(db,
+        "UPDATE dirs SET mtime = ?, children = ?, update_id = ? "
+        "WHERE path = ?");
+}
+
+/* dirs row must exist already, see lms_db_insert_dir() */
+int
+lms_db_set_dir_state(sqlite3_stmt *stmt, const char *path, int len, int64_t mtime, int children, unsigned int update_id)
+{
+    int r, ret;
+
+    ret = lms_db_bind_int64(stmt, 1, mtime);
+    if (ret != 0)
+        goto done;
+
+    ret = lms_db_bind_int(stmt, 2, children);
+    if (ret != 0)
+        goto done;
+
+    ret = lms_db_bind_int(stmt, 3, update_id);
+    if (ret != 0)
+        goto done;
+
+    ret = lms_db_bind_blob(stmt, 4, path, len);
+    if (ret != 0)
+        goto done;
+
+    r = sqlite3_step(stmt);
+    if (r != SQLITE_DONE) {
+        fprintf(stderr, "ERROR: could not set dir state: %s\n",
+                sqlite3_errmsg(sqlite3_db_handle(stmt)));
+        ret = -2;
+    }
+
+  done:
+    lms_db_reset_stmt(stmt);
+
     return ret;
 }
+
+sqlite3_stmt *
+lms_db_compile_stmt_get_dir_files(sqlite3 *db)
+{
+    return lms_db_compile_stmt(db,
+        "SELECT files.name FROM dirs JOIN files ON files.dir_id = dirs.id "
+        "WHERE dirs.path = ? AND files.dtime = 0");
+}
+
+/* Path is not copied, it must be kept while stmt is stepped. */
+int
+lms_db_get_dir_files(sqlite3_stmt *stmt, const char *path, int len)
+{
+    return lms_db_bind_blob(stmt, 1, path, len);
+}
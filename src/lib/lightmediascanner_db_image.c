@@ -350,11 +350,17 @@ int
 lms_db_image_add(lms_db_image_t *ldi, struct lms_image_info *info)
 {
     const struct lms_dlna_image_profile *dlna;
+    int r;
 
     if (!ldi)
         return -1;
     if (!info)
         return -2;
+
+    r = lms_db_record_capture(LMS_DB_RECORD_IMAGE, ldi, info);
+    if (r != 0)
+        return r > 0 ? 0 : -7;
+
     if (info->id < 1)
         return -3;
 
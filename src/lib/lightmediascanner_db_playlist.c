@@ -258,10 +258,17 @@ _db_insert(lms_db_playlist_t *ldp, const struct lms_playlist_info *info)
 int
 lms_db_playlist_add(lms_db_playlist_t *ldp, struct lms_playlist_info *info)
 {
+    int r;
+
     if (!ldp)
         return -1;
     if (!info)
         return -2;
+
+    r = lms_db_record_capture(LMS_DB_RECORD_PLAYLIST, ldp, info);
+    if (r != 0)
+        return r > 0 ? 0 : -7;
+
     if (info->id < 1)
         return -3;
 
@@ -45,6 +45,8 @@ int lms_db_bind_int64_or_null(sqlite3_stmt *stmt, int col, int64_t *p_value) GNU
 int lms_db_bind_int(sqlite3_stmt *stmt, int col, int value) GNUC_NON_NULL(1);
 int lms_db_bind_double(sqlite3_stmt *stmt, int col, double value) GNUC_NON_NULL(1);
 int lms_db_create_trigger_if_not_exists(sqlite3 *db, const char *sql) GNUC_NON_NULL(1, 2);
+sqlite3_stmt *lms_db_session_stmt_take(sqlite3 *db, const char *sql) GNUC_NON_NULL(1, 2);
+int lms_db_session_stmt_give(sqlite3_stmt *stmt) GNUC_NON_NULL(1);
 
 int lms_db_update_id_get(sqlite3 *db) GNUC_NON_NULL(1);
 int lms_db_update_id_set(sqlite3 *db, unsigned int version) GNUC_NON_NULL(1);
@@ -74,22 +76,57 @@ int lms_db_cache_get(struct lms_db_cache *cache, const sqlite3 *db, void **pdata
 int lms_db_create_core_tables_if_required(sqlite3 *db) GNUC_NON_NULL(1);
 
 sqlite3_stmt *lms_db_compile_stmt_begin_transaction(sqlite3 *db) GNUC_NON_NULL(1);
+sqlite3_stmt *lms_db_compile_stmt_begin_immediate_transaction(sqlite3 *db) GNUC_NON_NULL(1);
 sqlite3_stmt *lms_db_compile_stmt_end_transaction(sqlite3 *db) GNUC_NON_NULL(1);
 sqlite3_stmt *lms_db_compile_stmt_get_file_info(sqlite3 *db) GNUC_NON_NULL(1);
+sqlite3_stmt *lms_db_compile_stmt_insert_dir(sqlite3 *db) GNUC_NON_NULL(1);
 sqlite3_stmt *lms_db_compile_stmt_insert_file_info(sqlite3 *db) GNUC_NON_NULL(1);
 sqlite3_stmt *lms_db_compile_stmt_update_file_info(sqlite3 *db) GNUC_NON_NULL(1);
 sqlite3_stmt *lms_db_compile_stmt_delete_file_info(sqlite3 *db) GNUC_NON_NULL(1);
 sqlite3_stmt *lms_db_compile_stmt_set_file_dtime(sqlite3 *db) GNUC_NON_NULL(1);
 sqlite3_stmt *lms_db_compile_stmt_get_files(sqlite3 *db) GNUC_NON_NULL(1);
+sqlite3_stmt *lms_db_compile_stmt_copy_files(sqlite3 *db) GNUC_NON_NULL(1);
+sqlite3_stmt *lms_db_compile_stmt_get_files_copy(sqlite3 *db) GNUC_NON_NULL(1);
+sqlite3_stmt *lms_db_compile_stmt_get_dir_states(sqlite3 *db) GNUC_NON_NULL(1);
+sqlite3_stmt *lms_db_compile_stmt_set_dir_state(sqlite3 *db) GNUC_NON_NULL(1);
+sqlite3_stmt *lms_db_compile_stmt_get_dir_files(sqlite3 *db) GNUC_NON_NULL(1);
 
 int lms_db_begin_transaction(sqlite3_stmt *stmt) GNUC_NON_NULL(1);
 int lms_db_end_transaction(sqlite3_stmt *stmt) GNUC_NON_NULL(1);
 int lms_db_update_file_info(sqlite3_stmt *stmt, const struct lms_file_info *finfo, unsigned int update_id) GNUC_NON_NULL(1, 2);
+int lms_db_mark_files_deleted(sqlite3 *db, const int64_t *ids, unsigned int count, int dtime, unsigned int update_id) GNUC_NON_NULL(1, 2);
 int lms_db_get_file_info(sqlite3_stmt *stmt, struct lms_file_info *finfo) GNUC_NON_NULL(1, 2);
+int lms_db_insert_dir(sqlite3_stmt *stmt, const char *path, int len) GNUC_NON_NULL(1, 2);
 int lms_db_insert_file_info(sqlite3_stmt *stmt, struct lms_file_info *finfo, unsigned int update_id) GNUC_NON_NULL(1, 2);
 int lms_db_delete_file_info(sqlite3_stmt *stmt, const struct lms_file_info *finfo) GNUC_NON_NULL(1, 2);
 int lms_db_set_file_dtime(sqlite3_stmt *stmt, const struct lms_file_info *finfo) GNUC_NON_NULL(1, 2);
 int lms_db_get_files(sqlite3_stmt *stmt, const char *path, int len) GNUC_NON_NULL(1, 2);
+int lms_db_get_dir_states(sqlite3_stmt *stmt, const char *path, int len) GNUC_NON_NULL(1, 2);
+int lms_db_set_dir_state(sqlite3_stmt *stmt, const char *path, int len, int64_t mtime, int children, unsigned int update_id) GNUC_NON_NULL(1, 2);
+int lms_db_get_dir_files(sqlite3_stmt *stmt, const char *path, int len) GNUC_NON_NULL(1, 2);
+
+enum lms_db_record_type {
+    LMS_DB_RECORD_IMAGE,
+    LMS_DB_RECORD_AUDIO,
+    LMS_DB_RECORD_VIDEO,
+    LMS_DB_RECORD_PLAYLIST
+};
+
+struct lms_db_record;
+
+/* records captured from lms_db_*_add(), in order */
+struct lms_db_record_list {
+    struct lms_db_record *head;
+    struct lms_db_record *tail;
+    unsigned int count;
+    unsigned int bytes;
+};
+
+void lms_db_record_capture_start(struct lms_db_record_list *list) GNUC_NON_NULL(1);
+void lms_db_record_capture_stop(void);
+int lms_db_record_capture(enum lms_db_record_type type, void *handle, const void *info) GNUC_NON_NULL(2, 3);
+int lms_db_record_list_flush(struct lms_db_record_list *list, int64_t id) GNUC_NON_NULL(1);
+void lms_db_record_list_clear(struct lms_db_record_list *list) GNUC_NON_NULL(1);
 
 
 
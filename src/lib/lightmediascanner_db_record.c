@@ -0,0 +1,307 @@
+/**
+ * Copyright (C) 2008-2011 by ProFUSION embedded systems
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * @author Gustavo Sverzut Barbieri <barbieri@profusion.mobi>
+ */
+
+/*
+ * Records given to lms_db_*_add() may be captured instead of written,
+ * so the writer (see lightmediascanner_db_writer.c) writes them later
+ * in a batch, from the same process or another thread. Captured
+ * records are deep copies, they are written by
+ * lms_db_record_list_flush() with the final file id.
+ */
+
+#include <lightmediascanner_db.h>
+#include "lightmediascanner_db_private.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+struct lms_db_record {
+    struct lms_db_record *next;
+    enum lms_db_record_type type;
+    unsigned int size;
+    void *handle;
+    union {
+        struct lms_image_info image;
+        struct lms_audio_info audio;
+        struct lms_video_info video;
+        struct lms_playlist_info playlist;
+    } info;
+};
+
+static __thread struct lms_db_record_list *_capture = NULL;
+
+#define STR(type, member) offsetof(struct type, member)
+
+static const size_t _image_strings[] = {
+    STR(lms_image_info, title),
+    STR(lms_image_info, artist),
+    STR(lms_image_info, dlna_profile),
+    STR(lms_image_info, dlna_mime),
+    STR(lms_image_info, container),
+    (size_t)-1
+};
+
+static const size_t _audio_strings[] = {
+    STR(lms_audio_info, title),
+    STR(lms_audio_info, artist),
+    STR(lms_audio_info, album),
+    STR(lms_audio_info, genre),
+    STR(lms_audio_info, container),
+    STR(lms_audio_info, codec),
+    STR(lms_audio_info, dlna_profile),
+    STR(lms_audio_info, dlna_mime),
+    (size_t)-1
+};
+
+static const size_t _video_strings[] = {
+    STR(lms_video_info, title),
+    STR(lms_video_info, artist),
+    STR(lms_video_info, container),
+    STR(lms_video_info, dlna_profile),
+    STR(lms_video_info, dlna_mime),
+    (size_t)-1
+};
+
+/* aspect_ratio must be the first, it only exists in video streams */
+static const size_t _stream_strings[] = {
+    STR(lms_stream, video.aspect_ratio),
+    STR(lms_stream, codec),
+    STR(lms_stream, lang),
+    (size_t)-1
+};
+
+static const size_t _playlist_strings[] = {
+    STR(lms_playlist_info, title),
+    (size_t)-1
+};
+
+#undef STR
+
+static const struct {
+    size_t info_size;
+    const size_t *strings;
+} _types[] = {
+    [LMS_DB_RECORD_IMAGE] = {sizeof(struct lms_image_info), _image_strings},
+    [LMS_DB_RECORD_AUDIO] = {sizeof(struct lms_audio_info), _audio_strings},
+    [LMS_DB_RECORD_VIDEO] = {sizeof(struct lms_video_info), _video_strings},
+    [LMS_DB_RECORD_PLAYLIST] = {sizeof(struct lms_playlist_info),
+                                _playlist_strings},
+};
+
+static size_t
+_strings_size(const void *info, const size_t *offsets)
+{
+    size_t size = 0;
+
+    for (; *offsets != (size_t)-1; offsets++) {
+        const struct lms_string_size *s = (const void *)
+            ((const char *)info + *offsets);
+        if (s->str)
+            size += s->len + 1;
+    }
+
+    return size;
+}
+
+static void
+_strings_copy(void *info, const size_t *offsets, char **arena)
+{
+    for (; *offsets != (size_t)-1; offsets++) {
+        struct lms_string_size *s = (void *)((char *)info + *offsets);
+        if (!s->str)
+            continue;
+        memcpy(*arena, s->str, s->len);
+        (*arena)[s->len] = '\0';
+        s->str = *arena;
+        *arena += s->len + 1;
+    }
+}
+
+static const size_t *
+_stream_strings_get(const struct lms_stream *s)
+{
+    if (s->type == LMS_STREAM_TYPE_VIDEO)
+        return _stream_strings;
+    return _stream_strings + 1;
+}
+
+static struct lms_db_record *
+_record_new(enum lms_db_record_type type, void *handle, const void *info)
+{
+    const size_t *offsets = _types[type].strings;
+    const struct lms_stream *s;
+    struct lms_db_record *rec;
+    struct lms_stream **pnext;
+    size_t size, n_streams;
+    char *arena;
+
+    size = sizeof(*rec) + _strings_size(info, offsets);
+    n_streams = 0;
+    if (type == LMS_DB_RECORD_VIDEO) {
+        for (s = ((const struct lms_video_info *)info)->streams; s;
+             s = s->next) {
+            size += _strings_size(s, _stream_strings_get(s));
+            n_streams++;
+        }
+        size += n_streams * sizeof(struct lms_stream);
+    }
+
+    rec = malloc(size);
+    if (!rec) {
+        perror("malloc");
+        return NULL;
+    }
+
+    rec->next = NULL;
+    rec->type = type;
+    rec->size = size;
+    rec->handle = handle;
+    memcpy(&rec->info, info, _types[type].info_size);
+
+    arena = (char *)(rec + 1);
+    if (type == LMS_DB_RECORD_VIDEO) {
+        struct lms_stream *copy = (struct lms_stream *)arena;
+
+        arena += n_streams * sizeof(struct lms_stream);
+        pnext = &rec->info.video.streams;
+        for (s = ((const struct lms_video_info *)info)->streams; s;
+             s = s->next, copy++) {
+            *copy = *s;
+            _strings_copy(copy, _stream_strings_get(copy), &arena);
+            *pnext = copy;
+            pnext = &copy->next;
+        }
+        *pnext = NULL;
+    }
+    _strings_copy(&rec->info, offsets, &arena);
+
+    return rec;
+}
+
+/*
+ * Start capturing records added from the calling thread into list,
+ * instead of writing them.
+ */
+void
+lms_db_record_capture_start(struct lms_db_record_list *list)
+{
+    _capture = list;
+}
+
+void
+lms_db_record_capture_stop(void)
+{
+    _capture = NULL;
+}
+
+/*
+ * Called by lms_db_*_add() before writing, so records of files being
+ * parsed between lms_db_record_capture_start() and
+ * lms_db_record_capture_stop() are captured instead. lms_process()
+ * does it for every file, in its slaves and in the single process
+ * method alike, and so do parser threads, as their file rows are
+ * written by the writer afterwards.
+ *
+ * Return: 0 if not capturing and record must be written, 1 if it was
+ * captured, < 0 on error.
+ */
+int
+lms_db_record_capture(enum lms_db_record_type type, void *handle, const void *info)
+{
+    struct lms_db_record_list *list = _capture;
+    struct lms_db_record *rec;
+
+    if (!list)
+        return 0;
+
+    rec = _record_new(type, handle, info);
+    if (!rec)
+        return -1;
+
+    if (list->tail)
+        list->tail->next = rec;
+    else
+        list->head = rec;
+    list->tail = rec;
+    list->count++;
+    list->bytes += rec->size;
+
+    return 1;
+}
+
+static int
+_record_write(struct lms_db_record *rec)
+{
+    switch (rec->type) {
+    case LMS_DB_RECORD_IMAGE:
+        return lms_db_image_add(rec->handle, &rec->info.image);
+    case LMS_DB_RECORD_AUDIO:
+        return lms_db_audio_add(rec->handle, &rec->info.audio);
+    case LMS_DB_RECORD_VIDEO:
+        return lms_db_video_add(rec->handle, &rec->info.video);
+    case LMS_DB_RECORD_PLAYLIST:
+        return lms_db_playlist_add(rec->handle, &rec->info.playlist);
+    }
+
+    return -1;
+}
+
+/*
+ * Write every captured record with the given file id, emptying the list.
+ * Must not be called while capturing.
+ *
+ * Return: 0 on success or the number of records that failed.
+ */
+int
+lms_db_record_list_flush(struct lms_db_record_list *list, int64_t id)
+{
+    struct lms_db_record *rec;
+    int failed = 0;
+
+    for (rec = list->head; rec; rec = rec->next) {
+        /* all info structs start with the id */
+        rec->info.audio.id = id;
+        if (_record_write(rec) != 0) {
+            fprintf(stderr, "ERROR: could not write record of file %"
+                    PRId64 ".\n", id);
+            failed++;
+        }
+    }
+
+    lms_db_record_list_clear(list);
+    return failed;
+}
+
+void
+lms_db_record_list_clear(struct lms_db_record_list *list)
+{
+    struct lms_db_record *rec, *next;
+
+    for (rec = list->head; rec; rec = next) {
+        next = rec->next;
+        free(rec);
+    }
+
+    list->head = list->tail = NULL;
+    list->count = 0;
+    list->bytes = 0;
+}
@@ -0,0 +1,326 @@
+/**
+ * Copyright (C) 2008-2011 by ProFUSION embedded systems
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * @author Gustavo Sverzut Barbieri <barbieri@profusion.mobi>
+ */
+
+/*
+ * Long lived DB connection shared by many scans, see
+ * lms_db_session_new().
+ *
+ * Statements compiled on the session connection are not finalized by
+ * lms_db_finalize_stmt(), they're reset and kept idle until the same
+ * SQL is compiled again, by the library or by plugins' _start().
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lightmediascanner.h"
+#include "lightmediascanner_private.h"
+#include "lightmediascanner_db_private.h"
+
+struct lms_db_session {
+    struct lms_db_session *next;
+    char *db_path;
+    sqlite3 *handle;
+    pid_t pid; /* connections can't be used across fork() */
+    pthread_mutex_t lock; /* parser threads compile on it at once */
+    sqlite3_stmt **idle;
+    unsigned int n_idle;
+    unsigned int idle_size;
+    unsigned int in_use:1;
+};
+
+static struct lms_db_session *_sessions = NULL;
+static pthread_mutex_t _sessions_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct lms_db_session *
+_session_find(const sqlite3 *db)
+{
+    struct lms_db_session *s;
+
+    pthread_mutex_lock(&_sessions_lock);
+    for (s = _sessions; s; s = s->next)
+        if (s->handle == db)
+            break;
+    pthread_mutex_unlock(&_sessions_lock);
+
+    return s;
+}
+
+/**
+ * Create a DB session to be shared by many Light Media Scanner instances.
+ *
+ * It keeps the DB open and compiled statements around between scans,
+ * so per scan setup is reduced to resetting them. Give it to every
+ * instance with lms_set_db_session(), it's used by one of them at a
+ * time and only by the process that created it, forked slaves still
+ * open their own connections.
+ *
+ * @param db_path path to DB used for data storage, same as lms_new().
+ * @return On success a newly allocated handle, otherwise NULL.
+ * @ingroup LMS_API
+ */
+lms_db_session_t *
+lms_db_session_new(const char *db_path)
+{
+    struct lms_db_session *s;
+
+    if (!db_path) {
+        fprintf(stderr, "ERROR: lms_db_session_new(NULL)\n");
+        return NULL;
+    }
+
+    s = calloc(1, sizeof(*s));
+    if (!s) {
+        perror("calloc");
+        return NULL;
+    }
+
+    s->db_path = strdup(db_path);
+    if (!s->db_path) {
+        perror("strdup");
+        free(s);
+        return NULL;
+    }
+
+    /* scans may run on other threads than the one creating it */
+    if (sqlite3_open_v2(db_path, &s->handle,
+                        SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE |
+                        SQLITE_OPEN_FULLMUTEX, NULL) != SQLITE_OK) {
+        fprintf(stderr, "ERROR: could not open DB \"%s\": %s\n",
+                db_path, sqlite3_errmsg(s->handle));
+        sqlite3_close(s->handle);
+        free(s->db_path);
+        free(s);
+        return NULL;
+    }
+
+    s->pid = getpid();
+    pthread_mutex_init(&s->lock, NULL);
+
+    pthread_mutex_lock(&_sessions_lock);
+    s->next = _sessions;
+    _sessions = s;
+    pthread_mutex_unlock(&_sessions_lock);
+
+    return s;
+}
+
+/**
+ * Free a DB session, closing its connection.
+ *
+ * Instances using it must be freed or given another session before.
+ *
+ * @param session previously allocated DB session.
+ * @return On success 0 is returned.
+ * @ingroup LMS_API
+ */
+int
+lms_db_session_free(lms_db_session_t *session)
+{
+    struct lms_db_session **p;
+    unsigned int i;
+
+    if (!session) {
+        fprintf(stderr, "ERROR: lms_db_session_free(NULL)\n");
+        return -1;
+    }
+
+    if (session->in_use) {
+        fprintf(stderr, "ERROR: DB session is still in use.\n");
+        return -2;
+    }
+
+    pthread_mutex_lock(&_sessions_lock);
+    for (p = &_sessions; *p; p = &(*p)->next)
+        if (*p == session) {
+            *p = session->next;
+            break;
+        }
+    pthread_mutex_unlock(&_sessions_lock);
+
+    for (i = 0; i < session->n_idle; i++)
+        sqlite3_finalize(session->idle[i]);
+    free(session->idle);
+
+    if (sqlite3_close(session->handle) != SQLITE_OK)
+        fprintf(stderr, "ERROR: clould not close DB: %s\n",
+                sqlite3_errmsg(session->handle));
+
+    pthread_mutex_destroy(&session->lock);
+    free(session->db_path);
+    free(session);
+
+    return 0;
+}
+
+const char *
+lms_db_session_get_path(const lms_db_session_t *session)
+{
+    return session->db_path;
+}
+
+/*
+ * Connection for lms, the session one if it's free in this process,
+ * otherwise a new one. Pragmas are applied to both. With
+ * SQLITE_OPEN_READONLY in flags it's always a new one, the session one
+ * is kept for writers.
+ *
+ * Return: 0 on success, *db is set to NULL on errors.
+ */
+int
+lms_db_open(const lms_t *lms, sqlite3 **db, int flags)
+{
+    struct lms_db_session *s = lms->db_session;
+
+    if (!(flags & SQLITE_OPEN_READONLY))
+        flags |= SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+    else
+        s = NULL;
+
+    if (s && s->pid == getpid()) {
+        int taken = 0;
+
+        pthread_mutex_lock(&s->lock);
+        if (!s->in_use) {
+            s->in_use = 1;
+            taken = 1;
+        }
+        pthread_mutex_unlock(&s->lock);
+
+        if (taken) {
+            *db = s->handle;
+            if (lms_db_apply_pragmas(lms, *db) != 0) {
+                lms_db_close(*db);
+                *db = NULL;
+                return -1;
+            }
+            return 0;
+        }
+    }
+
+    if (sqlite3_open_v2(lms->db_path, db, flags, NULL) != SQLITE_OK) {
+        fprintf(stderr, "ERROR: could not open DB \"%s\": %s\n",
+                lms->db_path, sqlite3_errmsg(*db));
+        sqlite3_close(*db);
+        *db = NULL;
+        return -1;
+    }
+
+    if (lms_db_apply_pragmas(lms, *db) != 0) {
+        sqlite3_close(*db);
+        *db = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Give back session connection or close the one from lms_db_open() */
+int
+lms_db_close(sqlite3 *db)
+{
+    struct lms_db_session *s = _session_find(db);
+
+    if (!s)
+        return sqlite3_close(db) == SQLITE_OK ? 0 : -1;
+
+    /* next user must not inherit a half done transaction */
+    if (!sqlite3_get_autocommit(db)) {
+        fprintf(stderr, "WARNING: transaction left open on DB session, "
+                "rolling back.\n");
+        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+    }
+
+    pthread_mutex_lock(&s->lock);
+    s->in_use = 0;
+    pthread_mutex_unlock(&s->lock);
+
+    return 0;
+}
+
+/*
+ * Take an idle statement with the given SQL compiled on db.
+ *
+ * Return: NULL if db is not a session or there is none.
+ */
+sqlite3_stmt *
+lms_db_session_stmt_take(sqlite3 *db, const char *sql)
+{
+    struct lms_db_session *s = _session_find(db);
+    sqlite3_stmt *stmt = NULL;
+    unsigned int i;
+
+    if (!s)
+        return NULL;
+
+    pthread_mutex_lock(&s->lock);
+    for (i = 0; i < s->n_idle; i++) {
+        if (strcmp(sqlite3_sql(s->idle[i]), sql) == 0) {
+            stmt = s->idle[i];
+            s->idle[i] = s->idle[--s->n_idle];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    return stmt;
+}
+
+/*
+ * Keep statement idle if it was compiled on a session connection.
+ *
+ * Return: 1 if kept, 0 if it must be finalized.
+ */
+int
+lms_db_session_stmt_give(sqlite3_stmt *stmt)
+{
+    struct lms_db_session *s = _session_find(sqlite3_db_handle(stmt));
+    int kept = 0;
+
+    if (!s)
+        return 0;
+
+    /* whatever the last step returned, it's reported by its user */
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+
+    pthread_mutex_lock(&s->lock);
+    if (s->n_idle == s->idle_size) {
+        unsigned int size = s->idle_size ? s->idle_size * 2 : 64;
+        sqlite3_stmt **idle;
+
+        idle = realloc(s->idle, size * sizeof(*idle));
+        if (idle) {
+            s->idle = idle;
+            s->idle_size = size;
+        }
+    }
+    if (s->n_idle < s->idle_size) {
+        s->idle[s->n_idle++] = stmt;
+        kept = 1;
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    return kept;
+}
@@ -612,6 +612,11 @@ lms_db_video_add(lms_db_video_t *ldv, struct lms_video_info *info)
         return -1;
     if (!info)
         return -2;
+
+    r = lms_db_record_capture(LMS_DB_RECORD_VIDEO, ldv, info);
+    if (r != 0)
+        return r > 0 ? 0 : -7;
+
     if (info->id < 1)
         return -3;
 
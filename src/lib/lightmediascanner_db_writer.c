@@ -0,0 +1,354 @@
+/**
+ * Copyright (C) 2008-2011 by ProFUSION embedded systems
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * @author Gustavo Sverzut Barbieri <barbieri@profusion.mobi>
+ */
+
+/*
+ * Writer stage used by lms_process() and friends.
+ *
+ * Parsing doesn't write to the DB: file rows to change and the records
+ * captured from lms_db_*_add() are queued and written in batches, each
+ * batch in a single transaction. So parsers never wait on SQLite I/O and
+ * the write lock is only taken while the batch is written.
+ *
+ * A batch is due when it has more than lms_get_commit_interval() files,
+ * lms_get_commit_bytes() bytes or its oldest file is waiting for more
+ * than lms_get_commit_latency() milliseconds.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lightmediascanner_private.h"
+#include "lightmediascanner_db_private.h"
+
+struct writer_entry {
+    struct writer_entry *next;
+    struct lms_file_info finfo;
+    enum writer_op op;
+    struct lms_db_record_list records;
+    char path[];
+};
+
+struct writer {
+    const lms_t *lms;
+    unsigned int update_id;
+    sqlite3_stmt *transaction_begin;
+    sqlite3_stmt *transaction_commit;
+    sqlite3_stmt *insert_dir;
+    sqlite3_stmt *insert_file_info;
+    sqlite3_stmt *update_file_info;
+    sqlite3_stmt *delete_file_info;
+    sqlite3_stmt *set_file_dtime;
+    struct writer_entry *head;
+    struct writer_entry *tail;
+    unsigned int count;
+    size_t bytes;
+    int64_t since; /* when the oldest entry was queued */
+};
+
+static void
+_writer_entry_free(struct writer_entry *e)
+{
+    lms_db_record_list_clear(&e->records);
+    free(e);
+}
+
+static void
+_writer_clear(struct writer *w)
+{
+    struct writer_entry *e, *next;
+
+    for (e = w->head; e; e = next) {
+        next = e->next;
+        _writer_entry_free(e);
+    }
+
+    w->head = w->tail = NULL;
+    w->count = 0;
+    w->bytes = 0;
+}
+
+/* directories of files not written must be walked again next time */
+static void
+_writer_entry_fail(const struct writer *w, const struct writer_entry *e)
+{
+    if (w->lms->dir_states)
+        lms_dir_states_fail(w->lms->dir_states, e->path, e->finfo.path_len);
+}
+
+static void
+_writer_fail_all(const struct writer *w)
+{
+    const struct writer_entry *e;
+
+    for (e = w->head; e; e = e->next)
+        _writer_entry_fail(w, e);
+}
+
+static void
+_writer_finalize_stmts(struct writer *w)
+{
+    if (w->transaction_begin)
+        lms_db_finalize_stmt(w->transaction_begin, "transaction_begin");
+
+    if (w->transaction_commit)
+        lms_db_finalize_stmt(w->transaction_commit, "transaction_commit");
+
+    if (w->insert_dir)
+        lms_db_finalize_stmt(w->insert_dir, "insert_dir");
+
+    if (w->insert_file_info)
+        lms_db_finalize_stmt(w->insert_file_info, "insert_file_info");
+
+    if (w->update_file_info)
+        lms_db_finalize_stmt(w->update_file_info, "update_file_info");
+
+    if (w->delete_file_info)
+        lms_db_finalize_stmt(w->delete_file_info, "delete_file_info");
+
+    if (w->set_file_dtime)
+        lms_db_finalize_stmt(w->set_file_dtime, "set_file_dtime");
+}
+
+struct writer *
+lms_writer_new(const lms_t *lms, sqlite3 *db, unsigned int update_id)
+{
+    struct writer *w;
+
+    w = calloc(1, sizeof(*w));
+    if (!w) {
+        perror("calloc");
+        return NULL;
+    }
+
+    w->lms = lms;
+    w->update_id = update_id;
+
+    w->transaction_begin = lms_db_compile_stmt_begin_immediate_transaction(db);
+    w->transaction_commit = lms_db_compile_stmt_end_transaction(db);
+    w->insert_dir = lms_db_compile_stmt_insert_dir(db);
+    w->insert_file_info = lms_db_compile_stmt_insert_file_info(db);
+    w->update_file_info = lms_db_compile_stmt_update_file_info(db);
+    w->delete_file_info = lms_db_compile_stmt_delete_file_info(db);
+    w->set_file_dtime = lms_db_compile_stmt_set_file_dtime(db);
+    if (!w->transaction_begin || !w->transaction_commit ||
+        !w->insert_dir || !w->insert_file_info || !w->update_file_info ||
+        !w->delete_file_info || !w->set_file_dtime) {
+        fprintf(stderr, "ERROR: could not compile writer statements.\n");
+        _writer_finalize_stmts(w);
+        free(w);
+        return NULL;
+    }
+
+    return w;
+}
+
+/*
+ * Pending entries are written before releasing it.
+ *
+ * Return: number of them that failed.
+ */
+int
+lms_writer_free(struct writer *w)
+{
+    int failed;
+
+    failed = lms_writer_flush(w);
+    if (failed < 0) {
+        fprintf(stderr, "ERROR: %u pending files were not written.\n",
+                w->count);
+        _writer_fail_all(w);
+        failed = w->count;
+    }
+
+    _writer_clear(w);
+    _writer_finalize_stmts(w);
+    free(w);
+
+    return failed;
+}
+
+/*
+ * Queue a change to the file row, taking the records list (it's left
+ * empty). Path is copied.
+ */
+int
+lms_writer_queue(struct writer *w, const struct lms_file_info *finfo, enum writer_op op, struct lms_db_record_list *records)
+{
+    struct writer_entry *e;
+
+    e = malloc(sizeof(*e) + finfo->path_len + 1);
+    if (!e) {
+        perror("malloc");
+        return -1;
+    }
+
+    memcpy(e->path, finfo->path, finfo->path_len);
+    e->path[finfo->path_len] = '\0';
+    e->next = NULL;
+    e->finfo = *finfo;
+    e->finfo.path = e->path;
+    e->op = op;
+    if (records) {
+        e->records = *records;
+        memset(records, 0, sizeof(*records));
+    } else
+        memset(&e->records, 0, sizeof(e->records));
+
+    if (w->tail)
+        w->tail->next = e;
+    else {
+        w->head = e;
+        w->since = lms_monotonic_ms();
+    }
+    w->tail = e;
+    w->count++;
+    w->bytes += sizeof(*e) + finfo->path_len + 1 + e->records.bytes;
+
+    return 0;
+}
+
+unsigned int
+lms_writer_pending(const struct writer *w)
+{
+    return w->count;
+}
+
+/*
+ * Return: milliseconds until the pending batch is due because of its
+ * latency, 0 if already due or -1 if there is no such deadline.
+ */
+int
+lms_writer_timeout_left(const struct writer *w)
+{
+    int latency = w->lms->commit_latency;
+    int64_t elapsed;
+
+    if (!w->head)
+        return -1;
+
+    if (w->count > w->lms->commit_interval ||
+        w->bytes >= w->lms->commit_bytes)
+        return 0;
+
+    if (latency <= 0)
+        return -1;
+
+    elapsed = lms_monotonic_ms() - w->since;
+    if (elapsed >= latency)
+        return 0;
+
+    return latency - elapsed;
+}
+
+int
+lms_writer_is_due(const struct writer *w)
+{
+    return lms_writer_timeout_left(w) == 0;
+}
+
+static int
+_writer_entry_write(struct writer *w, struct writer_entry *e)
+{
+    struct lms_file_info *finfo = &e->finfo;
+    unsigned int count;
+    int r;
+
+    switch (e->op) {
+    case WRITER_OP_RESTORE:
+        return lms_db_set_file_dtime(w->set_file_dtime, finfo);
+    case WRITER_OP_DELETE:
+        return lms_db_delete_file_info(w->delete_file_info, finfo);
+    case WRITER_OP_PARSED:
+        break;
+    default:
+        return -1;
+    }
+
+    if (finfo->id > 0)
+        r = lms_db_update_file_info(w->update_file_info, finfo, w->update_id);
+    else {
+        r = lms_db_insert_dir(w->insert_dir, finfo->path, finfo->path_len);
+        if (r == 0)
+            r = lms_db_insert_file_info(w->insert_file_info, finfo,
+                                        w->update_id);
+    }
+    if (r < 0) {
+        fprintf(stderr, "ERROR: could not register path in DB\n");
+        return r;
+    }
+
+    count = e->records.count;
+    if (!count)
+        return 0;
+
+    r = lms_db_record_list_flush(&e->records, finfo->id);
+    if (r > 0 && (unsigned int)r == count) {
+        lms_db_delete_file_info(w->delete_file_info, finfo);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Write every pending entry in one transaction.
+ *
+ * Return: number of entries that failed, all of them if the transaction
+ * could not be committed, < 0 if it could not be started (entries are
+ * kept for the next try).
+ */
+int
+lms_writer_flush(struct writer *w)
+{
+    sqlite3 *db = sqlite3_db_handle(w->transaction_begin);
+    struct writer_entry *e;
+    int64_t start;
+    int failed = 0;
+
+    if (!w->head)
+        return 0;
+
+    if (lms_db_begin_transaction(w->transaction_begin) != 0)
+        return -1;
+
+    for (e = w->head; e; e = e->next) {
+        if (_writer_entry_write(w, e) != 0) {
+            fprintf(stderr, "ERROR: could not write \"%s\".\n", e->path);
+            _writer_entry_fail(w, e);
+            failed++;
+        }
+    }
+
+    lms_db_update_id_set(db, w->update_id);
+    start = lms_stats_now();
+    if (lms_db_end_transaction(w->transaction_commit) != 0) {
+        /* ids given to new rows are gone too, nothing to retry with */
+        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+        fprintf(stderr, "ERROR: could not commit %u files.\n", w->count);
+        _writer_fail_all(w);
+        failed = w->count;
+    }
+    lms_stats_time(w->lms, LMS_STATS_PHASE_COMMIT, start);
+
+    _writer_clear(w);
+    return failed;
+}
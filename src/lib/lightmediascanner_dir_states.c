@@ -0,0 +1,480 @@
+/**
+ * Copyright (C) 2008-2011 by ProFUSION embedded systems
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * @author Gustavo Sverzut Barbieri <barbieri@profusion.mobi>
+ */
+
+/*
+ * Directory states used to skip unchanged directories on rescans, see
+ * lms_set_skip_unchanged_dirs().
+ *
+ * Known states of the directories being walked are loaded at once into
+ * a hash table, so walkers look them up without going to the database.
+ * A state is the directory mtime and its number of children (files and
+ * directories) when all its files were last known to be in the DB.
+ *
+ * States of directories fully walked are only written once the whole
+ * process finished without errors, any file that fails to be parsed or
+ * written keeps its directory from being written.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lightmediascanner.h"
+#include "lightmediascanner_private.h"
+#include "lightmediascanner_db_private.h"
+
+struct dir_state {
+    char *path; /* with trailing '/', NULL if slot is free */
+    int len;
+    int children;
+    int64_t mtime;
+};
+
+struct dir_table {
+    struct dir_state *entries;
+    unsigned int size; /* power of 2 */
+    unsigned int count;
+};
+
+struct dir_states {
+    lms_t *lms;
+    sqlite3 *db;
+    sqlite3_stmt *get_dir_files;
+    time_t start;
+
+    /* loaded from DB, read only while walking */
+    struct dir_table known;
+
+    /* walked and failed directories, written by many walkers */
+    pthread_mutex_t lock;
+    struct dir_state *walked;
+    unsigned int n_walked;
+    unsigned int walked_size;
+    struct dir_table failed;
+    int failed_lost; /* some failed directory could not be recorded */
+};
+
+/* FNV-1a */
+static unsigned int
+_hash(const char *path, int len)
+{
+    uint32_t h = 2166136261u;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char)path[i];
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+static struct dir_state *
+_table_find(struct dir_state *table, unsigned int size, const char *path, int len)
+{
+    unsigned int i = _hash(path, len) & (size - 1);
+
+    while (table[i].path) {
+        if (table[i].len == len && memcmp(table[i].path, path, len) == 0)
+            break;
+        i = (i + 1) & (size - 1);
+    }
+
+    return table + i;
+}
+
+static int
+_table_grow(struct dir_table *t)
+{
+    unsigned int i, size = t->size ? t->size * 2 : 256;
+    struct dir_state *table;
+
+    table = calloc(size, sizeof(*table));
+    if (!table) {
+        perror("calloc");
+        return -1;
+    }
+
+    for (i = 0; i < t->size; i++) {
+        struct dir_state *e = t->entries + i;
+
+        if (e->path)
+            *_table_find(table, size, e->path, e->len) = *e;
+    }
+
+    free(t->entries);
+    t->entries = table;
+    t->size = size;
+    return 0;
+}
+
+static int
+_table_add(struct dir_table *t, const void *path, int len, int64_t mtime, int children)
+{
+    struct dir_state *e;
+
+    /* keep at most half full, probing stays short */
+    if (2 * (t->count + 1) > t->size && _table_grow(t) != 0)
+        return -1;
+
+    e = _table_find(t->entries, t->size, path, len);
+    if (e->path)
+        return 0;
+
+    e->path = malloc(len);
+    if (!e->path) {
+        perror("malloc");
+        return -1;
+    }
+    memcpy(e->path, path, len);
+    e->len = len;
+    e->mtime = mtime;
+    e->children = children;
+    t->count++;
+
+    return 0;
+}
+
+static int
+_table_has(const struct dir_table *t, const char *path, int len)
+{
+    if (!t->count)
+        return 0;
+
+    return _table_find(t->entries, t->size, path, len)->path != NULL;
+}
+
+static void
+_table_free(struct dir_table *t)
+{
+    unsigned int i;
+
+    for (i = 0; i < t->size; i++)
+        free(t->entries[i].path);
+    free(t->entries);
+}
+
+static int
+_dir_states_load(struct dir_states *s, const char *path, int len)
+{
+    sqlite3_stmt *stmt;
+    int r, ret;
+
+    stmt = lms_db_compile_stmt_get_dir_states(s->db);
+    if (!stmt)
+        return -1;
+
+    ret = lms_db_get_dir_states(stmt, path, len);
+    if (ret != 0)
+        goto done;
+
+    while ((r = sqlite3_step(stmt)) == SQLITE_ROW) {
+        ret = _table_add(&s->known, sqlite3_column_blob(stmt, 0),
+                         sqlite3_column_bytes(stmt, 0),
+                         sqlite3_column_int64(stmt, 1),
+                         sqlite3_column_int(stmt, 2));
+        if (ret != 0)
+            goto done;
+    }
+
+    if (r != SQLITE_DONE) {
+        fprintf(stderr, "ERROR: could not load dir states: %s\n",
+                sqlite3_errmsg(s->db));
+        ret = -2;
+    }
+
+  done:
+    lms_db_reset_stmt(stmt);
+    lms_db_finalize_stmt(stmt, "get_dir_states");
+    return ret;
+}
+
+/*
+ * Load states of path, a directory ending with '/', and all directories
+ * under it.
+ */
+struct dir_states *
+lms_dir_states_new(lms_t *lms, const char *path, int len)
+{
+    struct dir_states *s;
+
+    s = calloc(1, sizeof(*s));
+    if (!s) {
+        perror("calloc");
+        return NULL;
+    }
+
+    s->lms = lms;
+    s->start = time(NULL);
+    pthread_mutex_init(&s->lock, NULL);
+
+    if (lms_db_open(lms, &s->db, 0) != 0)
+        goto error;
+
+    /* files are written meanwhile, wait for them */
+    sqlite3_busy_timeout(s->db, lms->slave_timeout > 0 ?
+                         lms->slave_timeout : DEFAULT_BUSY_TIMEOUT);
+
+    if (lms_db_create_core_tables_if_required(s->db) != 0) {
+        fprintf(stderr, "ERROR: could not setup tables and indexes.\n");
+        goto error;
+    }
+
+    if (_dir_states_load(s, path, len) != 0)
+        goto error;
+
+    if (lms->progress.cb) {
+        s->get_dir_files = lms_db_compile_stmt_get_dir_files(s->db);
+        if (!s->get_dir_files)
+            goto error;
+    }
+
+    return s;
+
+  error:
+    lms_dir_states_free(s);
+    return NULL;
+}
+
+void
+lms_dir_states_free(struct dir_states *s)
+{
+    unsigned int i;
+
+    if (s->get_dir_files)
+        lms_db_finalize_stmt(s->get_dir_files, "get_dir_files");
+    if (s->db)
+        lms_db_close(s->db);
+
+    _table_free(&s->known);
+
+    for (i = 0; i < s->n_walked; i++)
+        free(s->walked[i].path);
+    free(s->walked);
+
+    _table_free(&s->failed);
+
+    pthread_mutex_destroy(&s->lock);
+    free(s);
+}
+
+/*
+ * Safe to call from many threads, known states are not changed while
+ * walking.
+ *
+ * Return: number of children last time, if mtime didn't change, or -1.
+ */
+int
+lms_dir_states_get(const struct dir_states *s, const char *path, int len, int64_t mtime)
+{
+    const struct dir_state *e;
+
+    if (!s->known.count)
+        return -1;
+
+    e = _table_find(s->known.entries, s->known.size, path, len);
+    if (!e->path || e->mtime != mtime)
+        return -1;
+
+    return e->children;
+}
+
+/*
+ * Directory was fully walked, its state is written by
+ * lms_dir_states_commit().
+ *
+ * Directories changed since the process started may have changes that
+ * weren't seen and keep the same mtime afterwards, they're not
+ * recorded.
+ */
+int
+lms_dir_states_set(struct dir_states *s, const char *path, int len, int64_t mtime, int children)
+{
+    struct dir_state *e;
+    int ret = 0;
+
+    if (mtime >= s->start)
+        return 0;
+
+    pthread_mutex_lock(&s->lock);
+    if (s->n_walked == s->walked_size) {
+        unsigned int size = s->walked_size ? s->walked_size * 2 : 256;
+
+        e = realloc(s->walked, size * sizeof(*e));
+        if (!e) {
+            perror("realloc");
+            ret = -1;
+            goto done;
+        }
+        s->walked = e;
+        s->walked_size = size;
+    }
+
+    e = s->walked + s->n_walked;
+    e->path = malloc(len);
+    if (!e->path) {
+        perror("malloc");
+        ret = -1;
+        goto done;
+    }
+    memcpy(e->path, path, len);
+    e->len = len;
+    e->mtime = mtime;
+    e->children = children;
+    s->n_walked++;
+
+  done:
+    pthread_mutex_unlock(&s->lock);
+    return ret;
+}
+
+/*
+ * File at path was not processed, don't trust its directory next time.
+ * If that can't be recorded, no directory is.
+ */
+void
+lms_dir_states_fail(struct dir_states *s, const char *path, int len)
+{
+    int dir_len;
+
+    for (dir_len = len; dir_len > 0 && path[dir_len - 1] != '/'; dir_len--);
+
+    pthread_mutex_lock(&s->lock);
+    if (_table_add(&s->failed, path, dir_len, 0, 0) != 0)
+        s->failed_lost = 1;
+    pthread_mutex_unlock(&s->lock);
+}
+
+/*
+ * Report files of the unchanged directory path as up to date, they are
+ * not looked at. Only called from the thread calling process_file().
+ */
+int
+lms_dir_states_report(struct dir_states *s, const char *path, int len)
+{
+    lms_progress_callback_t cb = s->lms->progress.cb;
+    char file[PATH_SIZE];
+    int r, ret;
+
+    if (!s->get_dir_files || !cb)
+        return 0;
+
+    ret = lms_db_get_dir_files(s->get_dir_files, path, len);
+    if (ret != 0)
+        goto done;
+
+    memcpy(file, path, len);
+    while ((r = sqlite3_step(s->get_dir_files)) == SQLITE_ROW) {
+        int name_len = sqlite3_column_bytes(s->get_dir_files, 0);
+
+        if (len + name_len >= PATH_SIZE)
+            continue;
+
+        memcpy(file + len, sqlite3_column_blob(s->get_dir_files, 0),
+               name_len);
+        file[len + name_len] = '\0';
+        lms_stats_files(s->lms, LMS_PROGRESS_STATUS_UP_TO_DATE, 1);
+        cb(s->lms, file, len + name_len, LMS_PROGRESS_STATUS_UP_TO_DATE,
+           s->lms->progress.data);
+    }
+
+    if (r != SQLITE_DONE) {
+        fprintf(stderr, "ERROR: could not get files of dir: %s\n",
+                sqlite3_errmsg(s->db));
+        ret = -2;
+    }
+
+  done:
+    lms_db_reset_stmt(s->get_dir_files);
+    return ret;
+}
+
+/*
+ * Write states of walked directories, all in one transaction. They're
+ * tagged with the update id of files written by this process, if any.
+ */
+int
+lms_dir_states_commit(struct dir_states *s)
+{
+    sqlite3_stmt *insert_dir = NULL, *set_dir_state = NULL;
+    unsigned int i;
+    int update_id, ret = -1;
+
+    if (!s->n_walked)
+        return 0;
+
+    if (s->failed_lost) {
+        fprintf(stderr, "ERROR: failed directories are unknown, not writing "
+                "dir states.\n");
+        return -1;
+    }
+
+    update_id = lms_db_update_id_get(s->db);
+    if (update_id < 0) {
+        fprintf(stderr, "ERROR: could not get global update id.\n");
+        return -1;
+    }
+
+    insert_dir = lms_db_compile_stmt_insert_dir(s->db);
+    set_dir_state = lms_db_compile_stmt_set_dir_state(s->db);
+    if (!insert_dir || !set_dir_state)
+        goto done;
+
+    if (sqlite3_exec(s->db, "BEGIN TRANSACTION", NULL, NULL, NULL) != SQLITE_OK) {
+        fprintf(stderr, "ERROR: could not begin transaction: %s\n",
+                sqlite3_errmsg(s->db));
+        goto done;
+    }
+
+    for (i = 0; i < s->n_walked; i++) {
+        const struct dir_state *e = s->walked + i;
+
+        if (_table_has(&s->failed, e->path, e->len))
+            continue;
+
+        /* directory path given as a file path, it's its own directory */
+        if (lms_db_insert_dir(insert_dir, e->path, e->len) != 0 ||
+            lms_db_set_dir_state(set_dir_state, e->path, e->len, e->mtime,
+                                 e->children, update_id) != 0) {
+            sqlite3_exec(s->db, "ROLLBACK", NULL, NULL, NULL);
+            goto done;
+        }
+    }
+
+    if (sqlite3_exec(s->db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK) {
+        fprintf(stderr, "ERROR: could not commit dir states: %s\n",
+                sqlite3_errmsg(s->db));
+        sqlite3_exec(s->db, "ROLLBACK", NULL, NULL, NULL);
+        goto done;
+    }
+
+    ret = 0;
+
+  done:
+    if (insert_dir)
+        lms_db_finalize_stmt(insert_dir, "insert_dir");
+    if (set_dir_state)
+        lms_db_finalize_stmt(set_dir_state, "set_dir_state");
+    return ret;
+}
@@ -0,0 +1,278 @@
+/**
+ * Copyright (C) 2008-2011 by ProFUSION embedded systems
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * @author Gustavo Sverzut Barbieri <barbieri@profusion.mobi>
+ */
+
+/*
+ * Extension match for parsers implementing lms_plugin_exts().
+ *
+ * Extensions of all parsers are compiled into a trie of reversed
+ * suffixes, so a path is matched against all of them reading it
+ * backwards once, instead of once per parser with
+ * lms_which_extension(). Each node lists the parsers whose extensions
+ * end there. Root children, one per last character, are indexed by
+ * it, as that's where most paths stop.
+ *
+ * Like lms_which_extension(), upper case in paths is ignored.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lightmediascanner.h"
+#include "lightmediascanner_plugin.h"
+#include "lightmediascanner_utils.h"
+#include "lightmediascanner_private.h"
+
+struct ext_node {
+    int child; /* first child, 0 if none */
+    int next; /* next sibling, 0 if last */
+    int end; /* first extension ending here, -1 if none */
+    unsigned char c;
+};
+
+struct ext_end {
+    int parser;
+    int index; /* in parser's extensions */
+    int next; /* next ending at same node, -1 if last */
+};
+
+struct lms_exts {
+    int root[256]; /* by last character, 0 if none */
+    struct ext_node *nodes; /* 0 is not used, so it means none */
+    int n_nodes;
+    int nodes_size;
+    struct ext_end *ends;
+    int n_ends;
+    int ends_size;
+};
+
+static inline unsigned char
+_fold(unsigned char c)
+{
+    if (c >= 'A' && c <= 'Z')
+        return c + ('a' - 'A');
+    return c;
+}
+
+/* Return: index of new node or -1 on errors */
+static int
+_node_new(struct lms_exts *e, unsigned char c)
+{
+    struct ext_node *node;
+
+    if (e->n_nodes == e->nodes_size) {
+        int size = e->nodes_size ? e->nodes_size * 2 : 128;
+        void *tmp;
+
+        tmp = realloc(e->nodes, size * sizeof(*e->nodes));
+        if (!tmp) {
+            perror("realloc");
+            return -1;
+        }
+        e->nodes = tmp;
+        e->nodes_size = size;
+    }
+
+    node = e->nodes + e->n_nodes;
+    node->child = 0;
+    node->next = 0;
+    node->end = -1;
+    node->c = c;
+
+    return e->n_nodes++;
+}
+
+static inline int
+_child_find(const struct lms_exts *e, int node, unsigned char c)
+{
+    int i;
+
+    for (i = e->nodes[node].child; i; i = e->nodes[i].next)
+        if (e->nodes[i].c == c)
+            return i;
+
+    return 0;
+}
+
+static int
+_child_get(struct lms_exts *e, int node, unsigned char c)
+{
+    int i;
+
+    i = _child_find(e, node, c);
+    if (i)
+        return i;
+
+    i = _node_new(e, c);
+    if (i < 0)
+        return -1;
+
+    e->nodes[i].next = e->nodes[node].child;
+    e->nodes[node].child = i;
+    return i;
+}
+
+static int
+_end_add(struct lms_exts *e, int node, int parser, int index)
+{
+    struct ext_end *end;
+
+    if (e->n_ends == e->ends_size) {
+        int size = e->ends_size ? e->ends_size * 2 : 64;
+        void *tmp;
+
+        tmp = realloc(e->ends, size * sizeof(*e->ends));
+        if (!tmp) {
+            perror("realloc");
+            return -1;
+        }
+        e->ends = tmp;
+        e->ends_size = size;
+    }
+
+    end = e->ends + e->n_ends;
+    end->parser = parser;
+    end->index = index;
+    end->next = e->nodes[node].end;
+    e->nodes[node].end = e->n_ends++;
+
+    return 0;
+}
+
+static int
+_ext_add(struct lms_exts *e, int parser, int index, const struct lms_string_size *ext)
+{
+    const unsigned char *s;
+    unsigned char c;
+    int node;
+
+    if (ext->len == 0)
+        return 0;
+
+    s = (const unsigned char *)ext->str + ext->len - 1;
+    c = _fold(*s);
+    node = e->root[c];
+    if (!node) {
+        node = _node_new(e, c);
+        if (node < 0)
+            return -1;
+        e->root[c] = node;
+    }
+
+    for (s--; s >= (const unsigned char *)ext->str; s--) {
+        node = _child_get(e, node, _fold(*s));
+        if (node < 0)
+            return -1;
+    }
+
+    return _end_add(e, node, parser, index);
+}
+
+struct lms_exts *
+lms_exts_new(const lms_t *lms)
+{
+    struct lms_exts *e;
+    int i, found;
+
+    found = 0;
+    for (i = 0; i < lms->n_parsers; i++)
+        if (lms->parsers[i].exts)
+            found = 1;
+
+    if (!found)
+        return NULL;
+
+    e = calloc(1, sizeof(*e));
+    if (!e) {
+        perror("calloc");
+        return NULL;
+    }
+
+    if (_node_new(e, 0) < 0) /* 0, meaning none */
+        goto error;
+
+    for (i = 0; i < lms->n_parsers; i++) {
+        const struct lms_plugin_exts *exts = lms->parsers[i].exts;
+        unsigned int j;
+
+        if (!exts)
+            continue;
+
+        /* backwards, so first of duplicates ends up first in node */
+        for (j = exts->len; j > 0; j--)
+            if (_ext_add(e, i, j - 1, exts->exts + j - 1) != 0)
+                goto error;
+    }
+
+    return e;
+
+  error:
+    lms_exts_free(e);
+    return NULL;
+}
+
+void
+lms_exts_free(struct lms_exts *e)
+{
+    free(e->nodes);
+    free(e->ends);
+    free(e);
+}
+
+/*
+ * Match path against extensions of all parsers that have them, their
+ * entries in parser_match must be NULL.
+ *
+ * Return: 1 if some parser matched, 0 otherwise.
+ */
+int
+lms_exts_match(const struct lms_exts *e, void **parser_match, const char *path, int len)
+{
+    const unsigned char *s;
+    int node, used;
+
+    if (len < 1)
+        return 0;
+
+    s = (const unsigned char *)path + len - 1;
+    node = e->root[_fold(*s)];
+
+    used = 0;
+    while (node) {
+        int i;
+
+        /* shorter extensions end first, like lms_which_extension() */
+        for (i = e->nodes[node].end; i >= 0; i = e->ends[i].next) {
+            const struct ext_end *end = e->ends + i;
+
+            if (!parser_match[end->parser]) {
+                parser_match[end->parser] = (void *)(long)(end->index + 1);
+                used = 1;
+            }
+        }
+
+        if (s == (const unsigned char *)path)
+            break;
+        s--;
+        node = _child_find(e, node, _fold(*s));
+    }
+
+    return used;
+}
@@ -0,0 +1,317 @@
+/**
+ * Copyright (C) 2008-2011 by ProFUSION embedded systems
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * @author Gustavo Sverzut Barbieri <barbieri@profusion.mobi>
+ */
+
+/*
+ * Files known under the path being processed, preloaded so each walked
+ * file is looked up in memory instead of with a query, see
+ * lms_set_preload_budget().
+ *
+ * Entries are small and fixed size in a single open addressing table,
+ * keyed by a 64 bit hash of the path. Paths, minus the preloaded
+ * directory they all start with, are kept apart in an arena to confirm
+ * hits, so colliding ones are just different entries. The table is
+ * filled before slaves are forked, they share its pages.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lightmediascanner.h"
+#include "lightmediascanner_private.h"
+#include "lightmediascanner_db_private.h"
+
+struct file_entry {
+    uint64_t hash;
+    int64_t id; /* 0 if slot is free */
+    int64_t size;
+    int32_t mtime;
+    int32_t dtime;
+    uint32_t name; /* offset in paths */
+    uint32_t name_len;
+};
+
+struct file_cache {
+    struct file_entry *table;
+    unsigned int size; /* power of 2 */
+    unsigned int count;
+    char *paths; /* after prefix_len, not NUL terminated */
+    unsigned int paths_len;
+    unsigned int paths_size;
+    int prefix_len;
+};
+
+/* FNV-1a */
+static uint64_t
+_hash(const char *path, int len)
+{
+    uint64_t h = 14695981039346656037ULL;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char)path[i];
+        h *= 1099511628211ULL;
+    }
+
+    return h;
+}
+
+/* entry of name or the free slot where it goes */
+static struct file_entry *
+_table_find(const struct file_cache *c, uint64_t hash, const char *name, unsigned int len)
+{
+    unsigned int i = hash & (c->size - 1);
+
+    for (; c->table[i].id; i = (i + 1) & (c->size - 1)) {
+        const struct file_entry *e = c->table + i;
+
+        if (e->hash == hash && e->name_len == len &&
+            memcmp(c->paths + e->name, name, len) == 0)
+            break;
+    }
+
+    return c->table + i;
+}
+
+static inline uint64_t
+_bytes(const struct file_cache *c, unsigned int size, unsigned int paths_size)
+{
+    return (uint64_t)size * sizeof(*c->table) + paths_size;
+}
+
+/* Return: < 0 on errors, 1 if it doesn't fit the budget */
+static int
+_table_grow(struct file_cache *c, unsigned int budget)
+{
+    unsigned int i, size = c->size ? c->size * 2 : 1024;
+    struct file_entry *table;
+
+    if (_bytes(c, size, c->paths_size) > budget)
+        return 1;
+
+    table = calloc(size, sizeof(*table));
+    if (!table) {
+        perror("calloc");
+        return -1;
+    }
+
+    /* entries are all different, just look for free slots */
+    for (i = 0; i < c->size; i++) {
+        const struct file_entry *e = c->table + i;
+        unsigned int j;
+
+        if (!e->id)
+            continue;
+
+        for (j = e->hash & (size - 1); table[j].id; j = (j + 1) & (size - 1))
+            ;
+        table[j] = *e;
+    }
+
+    free(c->table);
+    c->table = table;
+    c->size = size;
+    return 0;
+}
+
+/* Return: < 0 on errors, 1 if it doesn't fit the budget */
+static int
+_paths_add(struct file_cache *c, const char *name, unsigned int len, unsigned int budget, uint32_t *offset)
+{
+    if ((uint64_t)c->paths_len + len > UINT32_MAX)
+        return 1;
+
+    if (c->paths_len + len > c->paths_size) {
+        unsigned int size = c->paths_size ? c->paths_size : 4096;
+        void *tmp;
+
+        while (size < c->paths_len + len)
+            size = size <= UINT32_MAX / 2 ? size * 2 : UINT32_MAX;
+        if (_bytes(c, c->size, size) > budget)
+            return 1;
+
+        tmp = realloc(c->paths, size);
+        if (!tmp) {
+            perror("realloc");
+            return -1;
+        }
+        c->paths = tmp;
+        c->paths_size = size;
+    }
+
+    *offset = c->paths_len;
+    memcpy(c->paths + c->paths_len, name, len);
+    c->paths_len += len;
+    return 0;
+}
+
+static int
+_file_cache_load(struct file_cache *c, sqlite3 *db, const char *path, int len, unsigned int budget)
+{
+    sqlite3_stmt *stmt;
+    int r, ret;
+
+    stmt = lms_db_compile_stmt_get_files(db);
+    if (!stmt)
+        return -1;
+
+    ret = lms_db_get_files(stmt, path, len);
+    if (ret != 0)
+        goto done;
+
+    while ((r = sqlite3_step(stmt)) == SQLITE_ROW) {
+        const char *row_path = sqlite3_column_blob(stmt, 1);
+        int row_len = sqlite3_column_bytes(stmt, 1);
+        struct file_entry *e;
+        uint32_t name;
+        uint64_t hash;
+
+        if (row_len < c->prefix_len)
+            continue; /* not under path, can't be looked up anyway */
+
+        /* at most 3/4 full, linear probing stays short */
+        if (4 * (c->count + 1) > 3 * c->size) {
+            ret = _table_grow(c, budget);
+            if (ret != 0)
+                goto done;
+        }
+
+        hash = _hash(row_path, row_len);
+        e = _table_find(c, hash, row_path + c->prefix_len,
+                        row_len - c->prefix_len);
+        if (e->id)
+            continue;
+
+        ret = _paths_add(c, row_path + c->prefix_len,
+                         row_len - c->prefix_len, budget, &name);
+        if (ret != 0)
+            goto done;
+
+        e->hash = hash;
+        e->id = sqlite3_column_int64(stmt, 0);
+        e->mtime = sqlite3_column_int(stmt, 2);
+        e->dtime = sqlite3_column_int(stmt, 3);
+        e->size = sqlite3_column_int64(stmt, 5);
+        e->name = name;
+        e->name_len = row_len - c->prefix_len;
+        c->count++;
+    }
+
+    if (r != SQLITE_DONE) {
+        fprintf(stderr, "ERROR: could not preload files: %s\n",
+                sqlite3_errmsg(db));
+        ret = -2;
+    }
+
+  done:
+    lms_db_reset_stmt(stmt);
+    lms_db_finalize_stmt(stmt, "get_files");
+    return ret;
+}
+
+/*
+ * Preload files under path, a directory ending with '/', if they fit
+ * lms->preload_budget. Stats are stored in lms->preload_stats.
+ *
+ * Return: NULL if it couldn't be done, files are looked up in the DB.
+ */
+struct file_cache *
+lms_file_cache_new(lms_t *lms, const char *path, int len)
+{
+    struct lms_preload_stats *stats = &lms->preload_stats;
+    struct file_cache *c;
+    sqlite3 *db;
+    int r;
+
+    c = calloc(1, sizeof(*c));
+    if (!c) {
+        perror("calloc");
+        return NULL;
+    }
+
+    c->prefix_len = len;
+
+    if (lms_db_open(lms, &db, 0) != 0) {
+        free(c);
+        return NULL;
+    }
+
+    r = lms_db_create_core_tables_if_required(db);
+    if (r != 0)
+        fprintf(stderr, "ERROR: could not setup tables and indexes.\n");
+    else
+        r = _file_cache_load(c, db, path, len, lms->preload_budget);
+    lms_db_close(db);
+
+    if (r == 1) {
+        fprintf(stderr, "INFO: files under \"%.*s\" don't fit preload "
+                "budget of %u bytes, querying them one by one.\n",
+                len, path, lms->preload_budget);
+        stats->over_budget = 1;
+    }
+
+    if (r != 0) {
+        lms_file_cache_free(c);
+        return NULL;
+    }
+
+    stats->files = c->count;
+    stats->bytes = _bytes(c, c->size, c->paths_size);
+    return c;
+}
+
+void
+lms_file_cache_free(struct file_cache *c)
+{
+    free(c->table);
+    free(c->paths);
+    free(c);
+}
+
+/*
+ * Same as lms_db_get_file_info(), itime is not known. Path must be
+ * under the one given to lms_file_cache_new().
+ *
+ * Return: 0 if found, 1 if not.
+ */
+int
+lms_file_cache_get(const struct file_cache *c, struct lms_file_info *finfo)
+{
+    const struct file_entry *e;
+
+    finfo->id = -1;
+    if (!c->size || finfo->path_len < c->prefix_len)
+        return 1;
+
+    e = _table_find(c, _hash(finfo->path, finfo->path_len),
+                    finfo->path + c->prefix_len,
+                    finfo->path_len - c->prefix_len);
+    if (!e->id)
+        return 1;
+
+    finfo->id = e->id;
+    finfo->mtime = e->mtime;
+    finfo->dtime = e->dtime;
+    finfo->itime = 0;
+    finfo->size = e->size;
+    return 0;
+}
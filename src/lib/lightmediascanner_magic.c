@@ -0,0 +1,326 @@
+/**
+ * Copyright (C) 2008-2011 by ProFUSION embedded systems
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * @author Gustavo Sverzut Barbieri <barbieri@profusion.mobi>
+ */
+
+/*
+ * Content match, see lms_set_content_match().
+ *
+ * Signatures given by parsers' lms_plugin_magic() are compiled into one
+ * trie per offset they're at, usually just 0 and a couple others. A
+ * file's first bytes are then looked up walking each trie at most once
+ * per byte, no matter how many parsers and signatures there are.
+ *
+ * The trie is rebuilt when parsers are added or removed, as it refers
+ * to them by index.
+ */
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lightmediascanner.h"
+#include "lightmediascanner_plugin.h"
+#include "lightmediascanner_private.h"
+
+struct magic_node {
+    int child; /* first child, 0 if none */
+    int next; /* next sibling, 0 if last */
+    int parser; /* whose signature ends here, -1 if none */
+    void *match;
+    unsigned char byte;
+};
+
+struct magic_root {
+    unsigned int offset;
+    int node;
+};
+
+struct lms_magic {
+    struct magic_node *nodes; /* 0 is not used, so it means none */
+    int n_nodes;
+    int size;
+    struct magic_root *roots;
+    unsigned int n_roots;
+    unsigned int head_len; /* bytes to read to check all signatures */
+    unsigned char *has_magic; /* by parser index */
+};
+
+/* Return: index of new node or -1 on errors */
+static int
+_node_new(struct lms_magic *m, unsigned char byte)
+{
+    struct magic_node *node;
+
+    if (m->n_nodes == m->size) {
+        int size = m->size ? m->size * 2 : 64;
+        void *tmp;
+
+        tmp = realloc(m->nodes, size * sizeof(*m->nodes));
+        if (!tmp) {
+            perror("realloc");
+            return -1;
+        }
+        m->nodes = tmp;
+        m->size = size;
+    }
+
+    node = m->nodes + m->n_nodes;
+    node->child = 0;
+    node->next = 0;
+    node->parser = -1;
+    node->match = NULL;
+    node->byte = byte;
+
+    return m->n_nodes++;
+}
+
+static inline int
+_child_find(const struct lms_magic *m, int node, unsigned char byte)
+{
+    int i;
+
+    for (i = m->nodes[node].child; i; i = m->nodes[i].next)
+        if (m->nodes[i].byte == byte)
+            return i;
+
+    return 0;
+}
+
+static int
+_child_get(struct lms_magic *m, int node, unsigned char byte)
+{
+    int i;
+
+    i = _child_find(m, node, byte);
+    if (i)
+        return i;
+
+    i = _node_new(m, byte);
+    if (i < 0)
+        return -1;
+
+    m->nodes[i].next = m->nodes[node].child;
+    m->nodes[node].child = i;
+    return i;
+}
+
+static int
+_root_get(struct lms_magic *m, unsigned int offset)
+{
+    struct magic_root *root;
+    unsigned int i;
+    void *tmp;
+
+    for (i = 0; i < m->n_roots; i++)
+        if (m->roots[i].offset == offset)
+            return m->roots[i].node;
+
+    tmp = realloc(m->roots, (m->n_roots + 1) * sizeof(*m->roots));
+    if (!tmp) {
+        perror("realloc");
+        return -1;
+    }
+    m->roots = tmp;
+
+    root = m->roots + m->n_roots;
+    root->offset = offset;
+    root->node = _node_new(m, 0);
+    if (root->node < 0)
+        return -1;
+
+    m->n_roots++;
+    return root->node;
+}
+
+static int
+_signature_add(struct lms_magic *m, int parser, const struct lms_plugin_magic *sig)
+{
+    const unsigned char *bytes = sig->bytes;
+    unsigned int i;
+    int node;
+
+    node = _root_get(m, sig->offset);
+    for (i = 0; node >= 0 && i < sig->len; i++)
+        node = _child_get(m, node, bytes[i]);
+
+    if (node < 0)
+        return -1;
+
+    /* parsers are sorted by order, first one keeps it */
+    if (m->nodes[node].parser < 0) {
+        m->nodes[node].parser = parser;
+        m->nodes[node].match = sig->match;
+    }
+
+    if (m->head_len < sig->offset + sig->len)
+        m->head_len = sig->offset + sig->len;
+
+    return 0;
+}
+
+static int
+_parser_magic_add(struct lms_magic *m, const struct parser *p, int parser)
+{
+    const struct lms_plugin_magic *(*plugin_magic)(void);
+    const struct lms_plugin_magic *sig;
+
+    plugin_magic = dlsym(p->dl_handle, "lms_plugin_magic");
+    if (!plugin_magic) {
+        dlerror(); /* optional, clear error */
+        return 0;
+    }
+
+    sig = plugin_magic();
+    for (; sig && sig->bytes; sig++) {
+        if (sig->len == 0 || sig->offset >= LMS_MAGIC_HEAD_LEN ||
+            sig->len > LMS_MAGIC_HEAD_LEN - sig->offset) {
+            fprintf(stderr, "WARNING: parser \"%s\" signature of %u bytes "
+                    "at %u ignored.\n", p->plugin->name, sig->len,
+                    sig->offset);
+            continue;
+        }
+
+        if (_signature_add(m, parser, sig) != 0)
+            return -1;
+        m->has_magic[parser] = 1;
+    }
+
+    return 0;
+}
+
+struct lms_magic *
+lms_magic_new(const lms_t *lms)
+{
+    struct lms_magic *m;
+    int i;
+
+    if (lms->n_parsers == 0)
+        return NULL;
+
+    m = calloc(1, sizeof(*m));
+    if (!m) {
+        perror("calloc");
+        return NULL;
+    }
+
+    m->has_magic = calloc(lms->n_parsers, sizeof(*m->has_magic));
+    if (!m->has_magic) {
+        perror("calloc");
+        goto error;
+    }
+
+    if (_node_new(m, 0) < 0) /* 0, meaning none */
+        goto error;
+
+    for (i = 0; i < lms->n_parsers; i++)
+        if (_parser_magic_add(m, lms->parsers + i, i) != 0)
+            goto error;
+
+    if (m->n_roots == 0)
+        goto error;
+
+    return m;
+
+  error:
+    lms_magic_free(m);
+    return NULL;
+}
+
+void
+lms_magic_free(struct lms_magic *m)
+{
+    free(m->nodes);
+    free(m->roots);
+    free(m->has_magic);
+    free(m);
+}
+
+/* longest signature found, NULL if none */
+static const struct magic_node *
+_lookup(const struct lms_magic *m, const unsigned char *head, unsigned int len)
+{
+    const struct magic_node *found = NULL;
+    unsigned int i, found_len = 0;
+
+    for (i = 0; i < m->n_roots; i++) {
+        const struct magic_root *root = m->roots + i;
+        unsigned int j;
+        int node;
+
+        node = root->node;
+        for (j = root->offset; j < len; j++) {
+            node = _child_find(m, node, head[j]);
+            if (!node)
+                break;
+
+            if (m->nodes[node].parser >= 0 && j + 1 - root->offset > found_len) {
+                found = m->nodes + node;
+                found_len = j + 1 - root->offset;
+            }
+        }
+    }
+
+    return found;
+}
+
+/*
+ * Second match stage, after parsers matched the path: if none with
+ * signatures did, look for them in the file's first bytes. The file is
+ * read with a new finfo->reader, to be given to parsers.
+ *
+ * Return: 1 if a parser was found, it replaces the path matches, 0 if
+ * none.
+ */
+int
+lms_magic_match(const lms_t *lms, void **parser_match, struct lms_file_info *finfo)
+{
+    const struct lms_magic *m = lms->magic;
+    const struct magic_node *node;
+    unsigned char head[LMS_MAGIC_HEAD_LEN];
+    ssize_t n;
+    int i;
+
+    if (!m)
+        return 0;
+
+    for (i = 0; i < lms->n_parsers; i++)
+        if (parser_match[i] && m->has_magic[i])
+            return 0;
+
+    if (!finfo->reader) {
+        finfo->reader = lms_reader_prefetch_new(finfo->path, finfo->size);
+        if (!finfo->reader)
+            return 0;
+    }
+
+    n = lms_reader_peek(finfo->reader, head, m->head_len);
+    if (n <= 0)
+        return 0;
+
+    node = _lookup(m, head, n);
+    if (!node)
+        return 0;
+
+    memset(parser_match, 0, lms->n_parsers * sizeof(*parser_match));
+    parser_match[node->parser] = node->match;
+    finfo->by_contents = 1;
+    return 1;
+}
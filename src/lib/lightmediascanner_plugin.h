@@ -69,7 +69,8 @@
  *       'base' bytes offset inside 'path', return a match. Non-NULL
  *       values means it matched, and this return will be given to
  *       parse() function so any match-time analysis can be reused.
- *       This function will be used in the slave process.
+ *       This function will be used in the slave process. It may be
+ *       NULL if the plugin implements lms_plugin_exts() instead.
  *
  *
  * @code
@@ -128,6 +129,37 @@
  * playlists and possible more. Use should be pretty straightforward, see
  * existing plugins to see usage examples.
  *
+ * Files should be read with finfo->reader and lms_reader_pread() (or
+ * lms_reader_read() and lms_reader_seek()), these avoid one syscall for
+ * every small field read. The file is opened once for all parsers and
+ * its head and tail are prefetched, so usual headers and trailing tags
+ * cost no syscall. Don't close it, use lms_reader_open() for other
+ * files.
+ *
+ * Plugins may also implement:
+ *
+ * @code
+ *    const struct lms_plugin_exts *lms_plugin_exts(void)
+ * @endcode
+ *
+ *       Return the extensions of files they parse, to be matched by the
+ *       core instead of calling match(): extensions of all parsers are
+ *       looked up at once, reading the path backwards only once. The
+ *       match given to parse() is the index of the extension plus one,
+ *       the first one found if several end the path.
+ *
+ *
+ * @code
+ *    const struct lms_plugin_magic *lms_plugin_magic(void)
+ * @endcode
+ *
+ *       Return signatures found in the first #LMS_MAGIC_HEAD_LEN bytes of
+ *       files they parse, ended by one with NULL bytes. If
+ *       lms_set_content_match() is enabled, files no parser with
+ *       signatures matched by name are given to the parser whose
+ *       signature is found in them, with the signature's match and
+ *       finfo->by_contents set: their extension isn't known then.
+ *
  */
 
 #ifndef _LIGHTMEDIASCANNER_PLUGIN_H_
@@ -142,6 +174,8 @@
 extern "C" {
 #endif
 
+    typedef struct lms_reader lms_reader_t;
+
     struct lms_file_info {
         const char *path; /**< file path */
         int path_len; /**< path length */
@@ -152,6 +186,8 @@ extern "C" {
         time_t itime; /**< insert time */
         size_t size; /**< file size in bytes */
         unsigned char parsed : 1; /**< if file was already successfully parsed before */
+        unsigned char by_contents : 1; /**< matched by lms_plugin_magic(), not by path */
+        lms_reader_t *reader; /**< shared by parsers, rewound for each */
     };
 
     struct lms_context {
@@ -186,9 +222,39 @@ extern "C" {
         const char *uri; /**< how to find who wrote it (bug reports, etc) */
     };
 
+    struct lms_plugin_exts {
+        const struct lms_string_size *exts; /**< lower case, with the dot */
+        unsigned int len; /**< number of extensions */
+    };
+
+#define LMS_MAGIC_HEAD_LEN 64
+
+    struct lms_plugin_magic {
+        const void *bytes; /**< signature, NULL ends the array */
+        unsigned int len; /**< signature length */
+        unsigned int offset; /**< where it starts, offset + len <= LMS_MAGIC_HEAD_LEN */
+        void *match; /**< given to parse() if found, not NULL */
+    };
+
+    typedef enum {
+        LMS_READER_AUTO = 0,
+        LMS_READER_BUFFERED,
+        LMS_READER_MMAP
+    } lms_reader_mode_t;
+
+    API lms_reader_t *lms_reader_open(const char *path, lms_reader_mode_t mode) GNUC_NON_NULL(1) GNUC_MALLOC GNUC_WARN_UNUSED_RESULT;
+    API int lms_reader_close(lms_reader_t *r) GNUC_NON_NULL(1);
+    API int lms_reader_fd(lms_reader_t *r) GNUC_NON_NULL(1);
+    API off_t lms_reader_size(const lms_reader_t *r) GNUC_NON_NULL(1);
+    API ssize_t lms_reader_pread(lms_reader_t *r, void *buf, size_t len, off_t off) GNUC_NON_NULL(1, 2);
+    API ssize_t lms_reader_read(lms_reader_t *r, void *buf, size_t len) GNUC_NON_NULL(1, 2);
+    API off_t lms_reader_seek(lms_reader_t *r, off_t off, int whence) GNUC_NON_NULL(1);
+
     /* Plugins' entrypoints */
     API struct lms_plugin *lms_plugin_open(void);
     API const struct lms_plugin_info *lms_plugin_info(void);
+    API const struct lms_plugin_exts *lms_plugin_exts(void); /* optional */
+    API const struct lms_plugin_magic *lms_plugin_magic(void); /* optional */
 
 #ifdef __cplusplus
 }
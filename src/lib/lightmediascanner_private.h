@@ -36,11 +36,26 @@
 #include "lightmediascanner_utils.h"
 #include "lightmediascanner_charset_conv.h"
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <poll.h>
 #include <limits.h>
+#include <stdint.h>
 #include <sqlite3.h>
 
 #define PATH_SIZE PATH_MAX
+#define DEFAULT_BUSY_TIMEOUT 1000
+/* see lms_set_db_pragma() */
+#define DB_PRAGMA_COUNT 6
+
+/* max paths sent to a slave before its reply is received */
+#define WINDOW_SIZE 64
+/* max record bytes in flight, keeps master from blocking on a full pipe */
+#define WINDOW_BYTES 32768
+/* sequence of replies not related to any path, ie: slave startup */
+#define WINDOW_SEQ_SYNC ((unsigned int)-1)
+/* records written to the pipe at once, both paths and replies */
+#define BATCH_SIZE 16
+#define IOBUF_SIZE 65536
 
 struct fds {
     int r;
@@ -52,6 +67,41 @@ struct cinfo {
     unsigned int update_id;
 };
 
+struct comm_reply {
+    unsigned int seq;
+    int status;
+};
+
+/* record as sent to slave, its header must start with the sequence id */
+struct window_entry {
+    unsigned int seq;
+    unsigned int flags;
+    int path_len;
+    const char *path;
+    char *record;
+    unsigned int record_len;
+};
+
+/* paths sent to a slave and still waiting for replies, in sending order */
+struct window {
+    struct window_entry entries[WINDOW_SIZE];
+    unsigned int first;
+    unsigned int count;
+    unsigned int bytes;
+    unsigned int next_seq;
+    int64_t deadline; /* for the first entry, the one slave is working on */
+};
+
+struct ring;
+
+struct iobuf {
+    char *data;
+    unsigned int start;
+    unsigned int len;
+    int fd; /* pipe end, or eventfd if using ring */
+    struct ring *ring;
+};
+
 /* info to be carried along lms_process() and lms_check() */
 struct pinfo {
     struct cinfo common;
@@ -59,6 +109,48 @@ struct pinfo {
     struct fds master;
     struct fds slave;
     struct pollfd poll;
+    struct window window;
+    int slave_timeout; /* of its pool */
+    struct iobuf in;
+    struct iobuf out;
+    struct ring *to_slave; /* shared memory transport, NULL if pipes */
+    struct ring *to_master;
+    unsigned int out_count; /* records in out, not yet written */
+    int64_t out_since;
+};
+
+/* jobs given to the thread pool */
+#define TJOB_PARSE (1 << 0) /* new or outdated, run parsers */
+#define TJOB_CHECK (1 << 1) /* from lms_check(), always update the row */
+
+/* path to be stat'ed by lms_stat_batch_run() and its result */
+struct stat_request {
+    const char *path;
+    int error;
+    struct stat st;
+};
+
+struct tpool;
+struct writer;
+struct stat_batch;
+struct dir_states;
+struct file_cache;
+struct lms_exts;
+struct lms_magic;
+struct lms_db_record_list;
+
+/* what the writer does with the file row */
+enum writer_op {
+    WRITER_OP_PARSED, /* insert or update it, then write records */
+    WRITER_OP_RESTORE, /* just update dtime and itime */
+    WRITER_OP_DELETE
+};
+
+/* same as struct pinfo for threaded versions */
+struct tinfo {
+    struct cinfo common;
+    struct tpool *tp;
+    sqlite3_stmt *get_file_info;
 };
 
 /* same as struct pinfo for single process versions */
@@ -70,10 +162,23 @@ struct sinfo {
     unsigned int total_committed;
 };
 
+struct lms_stats_io {
+    unsigned long long rchar;
+    unsigned long long syscalls;
+};
+
 struct parser {
     lms_plugin_t *plugin;
     void *dl_handle;
     char *so_path;
+    const struct lms_plugin_exts *exts; /* matched by lms->exts if not NULL */
+    unsigned int slave_pool; /* 0 for default slaves */
+};
+
+/* see lms_slave_pool_add() */
+struct slave_pool {
+    unsigned int workers;
+    int slave_timeout;
 };
 
 struct lms {
@@ -88,25 +193,138 @@ struct lms {
         lms_free_callback_t free_data;
     } progress;
     unsigned int commit_interval;
+    unsigned int commit_bytes;
+    int commit_latency;
+    unsigned int worker_count;
+    struct slave_pool *slave_pools; /* besides the default one */
+    unsigned int n_slave_pools;
+    unsigned int walker_count;
+    unsigned int check_batch;
+    struct lms_dir_read_stats dir_stats;
+    struct dir_states *dir_states; /* while processing, if skipping */
+    unsigned int preload_budget;
+    struct lms_preload_stats preload_stats;
+    struct file_cache *file_cache; /* while processing, if preloaded */
+    struct lms_exts *exts; /* parsers' extensions, NULL if none */
+    struct lms_magic *magic; /* parsers' signatures, NULL if none */
+    char *db_pragmas[DB_PRAGMA_COUNT];
+    lms_db_session_t *db_session; /* not owned */
+    struct lms_stats *stats; /* shared with slaves, may be NULL */
+    struct lms_stats_io stats_io; /* master's, at lms_stats_begin() */
     unsigned int is_processing:1;
     unsigned int stop_processing:1;
+    unsigned int shm_transport:1;
+    unsigned int bulk_readdir:1;
+    unsigned int skip_unchanged_dirs:1;
+    unsigned int content_match:1;
 };
 
-typedef int (*process_file_callback_t)(struct cinfo *info, int base, char *path, const char *name);
-typedef int (*check_row_callback_t)(void *db_ptr, struct cinfo *info);
+typedef int (*process_file_callback_t)(struct cinfo *info, int base, char *path, const char *name, const struct stat *st);
+typedef int (*check_row_callback_t)(void *db_ptr, struct cinfo *info, struct lms_file_info *finfo, unsigned int flags);
 
 int lms_parser_del_int(lms_t *lms, int i) GNUC_NON_NULL(1);
+int lms_db_apply_pragmas(const lms_t *lms, sqlite3 *db) GNUC_NON_NULL(1, 2);
+int lms_db_open(const lms_t *lms, sqlite3 **db, int flags) GNUC_NON_NULL(1, 2);
+int lms_db_close(sqlite3 *db);
+const char *lms_db_session_get_path(const lms_db_session_t *session) GNUC_NON_NULL(1);
+int lms_path_append(int base, char *path, const char *name) GNUC_NON_NULL(2, 3);
+int lms_walk(struct cinfo *info, int base, char *path, const char *name, process_file_callback_t process_file) GNUC_NON_NULL(1, 3, 4, 5);
 int lms_create_pipes(struct pinfo *pinfo) GNUC_NON_NULL(1);
 int lms_close_pipes(struct pinfo *pinfo) GNUC_NON_NULL(1);
 int lms_create_slave(struct pinfo *pinfo, int (*work)(struct pinfo *pinfo)) GNUC_NON_NULL(1, 2);
 int lms_restart_slave(struct pinfo *pinfo, int (*work)(struct pinfo *pinfo)) GNUC_NON_NULL(1, 2);
-int lms_finish_slave(struct pinfo *pinfo, int (*finish)(const struct fds *fds)) GNUC_NON_NULL(1, 2);
+int lms_finish_slave(struct pinfo *pinfo, int (*finish)(struct pinfo *pinfo)) GNUC_NON_NULL(1, 2);
+
+int64_t lms_monotonic_ms(void);
+int lms_window_is_full(const struct window *w, unsigned int record_len) GNUC_NON_NULL(1);
+struct window_entry *lms_window_push(struct window *w, const void *header, unsigned int header_len, const char *path, int path_len, unsigned int flags, int timeout) GNUC_NON_NULL(1, 2, 4);
+struct window_entry *lms_window_first(struct window *w) GNUC_NON_NULL(1);
+void lms_window_pop(struct window *w, int timeout) GNUC_NON_NULL(1);
+void lms_window_clear(struct window *w) GNUC_NON_NULL(1);
+int lms_window_timeout_left(const struct window *w) GNUC_NON_NULL(1);
+int lms_window_lost_before(const struct window *w, unsigned int seq) GNUC_NON_NULL(1);
+int lms_master_send(struct pinfo *pinfo, const struct window_entry *e) GNUC_NON_NULL(1, 2);
+int lms_master_flush(struct pinfo *pinfo) GNUC_NON_NULL(1);
+int lms_master_send_sync(struct pinfo *pinfo, const void *record, unsigned int size) GNUC_NON_NULL(1, 2);
+int lms_master_fill(struct pinfo *pinfo) GNUC_NON_NULL(1);
+int lms_master_get_reply(struct pinfo *pinfo, struct comm_reply *reply) GNUC_NON_NULL(1, 2);
+int lms_master_recv_reply(struct pinfo *pinfo, struct comm_reply *reply, int timeout) GNUC_NON_NULL(1, 2);
+int lms_slave_recv(struct pinfo *pinfo, void *data, unsigned int size) GNUC_NON_NULL(1, 2);
+int lms_slave_has_input(struct pinfo *pinfo, int timeout) GNUC_NON_NULL(1);
+int lms_slave_send_reply(struct pinfo *pinfo, unsigned int seq, int status) GNUC_NON_NULL(1);
+int lms_slave_flush(struct pinfo *pinfo) GNUC_NON_NULL(1);
+
+struct ring *lms_ring_new(void);
+void lms_ring_free(struct ring *r) GNUC_NON_NULL(1);
+int lms_ring_event_new(void);
+void lms_ring_clear_event(int efd);
+void lms_ring_reset(struct ring *r, int efd) GNUC_NON_NULL(1);
+int lms_ring_write(struct ring *r, int efd, const void *data, unsigned int size) GNUC_NON_NULL(1, 3);
+unsigned int lms_ring_read(struct ring *r, void *buf, unsigned int size) GNUC_NON_NULL(1, 2);
+unsigned int lms_ring_available(const struct ring *r) GNUC_NON_NULL(1);
+unsigned int lms_ring_prepare_wait(struct ring *r) GNUC_NON_NULL(1);
+
+struct tpool *lms_tpool_new(lms_t *lms) GNUC_NON_NULL(1);
+int lms_tpool_free(struct tpool *tp) GNUC_NON_NULL(1);
+sqlite3 *lms_tpool_get_db(const struct tpool *tp) GNUC_NON_NULL(1);
+int lms_tpool_get_error(struct tpool *tp) GNUC_NON_NULL(1);
+int lms_tpool_push(struct tpool *tp, const struct lms_file_info *finfo, unsigned int flags) GNUC_NON_NULL(1, 2);
+
+struct writer *lms_writer_new(const lms_t *lms, sqlite3 *db, unsigned int update_id) GNUC_NON_NULL(1, 2);
+int lms_writer_free(struct writer *w) GNUC_NON_NULL(1);
+int lms_writer_queue(struct writer *w, const struct lms_file_info *finfo, enum writer_op op, struct lms_db_record_list *records) GNUC_NON_NULL(1, 2);
+unsigned int lms_writer_pending(const struct writer *w) GNUC_NON_NULL(1);
+int lms_writer_timeout_left(const struct writer *w) GNUC_NON_NULL(1);
+int lms_writer_is_due(const struct writer *w) GNUC_NON_NULL(1);
+int lms_writer_flush(struct writer *w) GNUC_NON_NULL(1);
+
+struct dir_states *lms_dir_states_new(lms_t *lms, const char *path, int len) GNUC_NON_NULL(1, 2);
+void lms_dir_states_free(struct dir_states *s) GNUC_NON_NULL(1);
+int lms_dir_states_get(const struct dir_states *s, const char *path, int len, int64_t mtime) GNUC_NON_NULL(1, 2);
+int lms_dir_states_set(struct dir_states *s, const char *path, int len, int64_t mtime, int children) GNUC_NON_NULL(1, 2);
+void lms_dir_states_fail(struct dir_states *s, const char *path, int len) GNUC_NON_NULL(1, 2);
+int lms_dir_states_report(struct dir_states *s, const char *path, int len) GNUC_NON_NULL(1, 2);
+int lms_dir_states_commit(struct dir_states *s) GNUC_NON_NULL(1);
+
+struct file_cache *lms_file_cache_new(lms_t *lms, const char *path, int len) GNUC_NON_NULL(1, 2);
+void lms_file_cache_free(struct file_cache *c) GNUC_NON_NULL(1);
+int lms_file_cache_get(const struct file_cache *c, struct lms_file_info *finfo) GNUC_NON_NULL(1, 2);
+
+struct lms_stats *lms_stats_new(void);
+void lms_stats_free(struct lms_stats *s) GNUC_NON_NULL(1);
+int64_t lms_stats_now(void);
+int lms_stats_io_get(struct lms_stats_io *io) GNUC_NON_NULL(1);
+void lms_stats_io_add(const lms_t *lms, const struct lms_stats_io *since) GNUC_NON_NULL(1, 2);
+void lms_stats_begin(lms_t *lms) GNUC_NON_NULL(1);
+void lms_stats_end(lms_t *lms) GNUC_NON_NULL(1);
+void lms_stats_add(const lms_t *lms, lms_stats_phase_t phase, int64_t ns, unsigned int n) GNUC_NON_NULL(1);
+void lms_stats_time(const lms_t *lms, lms_stats_phase_t phase, int64_t start) GNUC_NON_NULL(1);
+void lms_stats_time_parser(const lms_t *lms, int parser, int64_t start) GNUC_NON_NULL(1);
+void lms_stats_files(const lms_t *lms, lms_progress_status_t status, unsigned int n) GNUC_NON_NULL(1);
+
+struct stat_batch *lms_stat_batch_new(unsigned int size);
+void lms_stat_batch_free(struct stat_batch *b) GNUC_NON_NULL(1);
+void lms_stat_batch_run(struct stat_batch *b, struct stat_request *reqs, unsigned int count) GNUC_NON_NULL(1, 2);
+
+lms_reader_t *lms_reader_prefetch_new(const char *path, off_t size) GNUC_NON_NULL(1);
+ssize_t lms_reader_peek(lms_reader_t *r, void *buf, size_t len) GNUC_NON_NULL(1, 2);
+
+struct lms_exts *lms_exts_new(const lms_t *lms) GNUC_NON_NULL(1);
+void lms_exts_free(struct lms_exts *e) GNUC_NON_NULL(1);
+int lms_exts_match(const struct lms_exts *e, void **parser_match, const char *path, int len) GNUC_NON_NULL(1, 2, 3);
+
+struct lms_magic *lms_magic_new(const lms_t *lms) GNUC_NON_NULL(1);
+void lms_magic_free(struct lms_magic *m) GNUC_NON_NULL(1);
+int lms_magic_match(const lms_t *lms, void **parser_match, struct lms_file_info *finfo) GNUC_NON_NULL(1, 2, 3);
+
+lms_charset_conv_t *lms_charset_conv_dup(const lms_charset_conv_t *lcc) GNUC_NON_NULL(1);
 
 int lms_parsers_setup(lms_t *lms, sqlite3 *db) GNUC_NON_NULL(1, 2);
 int lms_parsers_start(lms_t *lms, sqlite3 *db) GNUC_NON_NULL(1, 2);
 int lms_parsers_finish(lms_t *lms, sqlite3 *db) GNUC_NON_NULL(1, 2);
-int lms_parsers_check_using(lms_t *lms, void **parser_match, struct lms_file_info *finfo) GNUC_NON_NULL(1, 2, 3);
-int lms_parsers_run(lms_t *lms, sqlite3 *db, void **parser_match, struct lms_file_info *finfo) GNUC_NON_NULL(1, 2, 3, 4);
+void lms_context_init(struct lms_context *ctxt, const lms_t *lms, sqlite3 *db) GNUC_NON_NULL(1, 2);
+int lms_parsers_check_using(const lms_t *lms, const struct parser *parsers, void **parser_match, struct lms_file_info *finfo) GNUC_NON_NULL(1, 2, 3, 4);
+int lms_parsers_run(const lms_t *lms, const struct parser *parsers, struct lms_context *ctxt, void **parser_match, struct lms_file_info *finfo) GNUC_NON_NULL(1, 2, 3, 4, 5);
 API int lms_mime_type_get_from_path(const char *path, struct lms_string_size *mime) GNUC_NON_NULL(1, 2);
 API int lms_mime_type_get_from_fd(int fd, struct lms_string_size *mime) GNUC_NON_NULL(2);
 
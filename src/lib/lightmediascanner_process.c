@@ -22,11 +22,15 @@
 
 #include <sys/wait.h>
 #include <sys/stat.h>
+#ifdef HAVE_SYS_PRCTL_H
+#include <sys/prctl.h>
+#endif
 #include <unistd.h>
 #include <dirent.h>
 #include <signal.h>
 #include <time.h>
-
+#include <stdint.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -37,113 +41,376 @@
 
 struct db {
     sqlite3 *handle;
-    sqlite3_stmt *transaction_begin;
-    sqlite3_stmt *transaction_commit;
     sqlite3_stmt *get_file_info;
-    sqlite3_stmt *insert_file_info;
-    sqlite3_stmt *update_file_info;
-    sqlite3_stmt *delete_file_info;
-    sqlite3_stmt *set_file_dtime;
+    struct writer *writer;
+};
+
+/* slaves of one of lms->slave_pools, or the default ones */
+struct pool_group {
+    struct pinfo *workers; /* inside pool workers */
+    unsigned int n_workers;
+};
+
+/* info to be carried along lms_process() when using many slaves */
+struct pool {
+    struct cinfo common;
+    struct pinfo *workers; /* of all groups */
+    struct pollfd *pfds;
+    unsigned int n_workers;
+    struct pool_group *groups; /* 0 is the default */
+    unsigned int n_groups;
+    void **parser_match; /* to route paths, NULL if no parser has a group */
+    int error;
 };
 
 /***********************************************************************
  * Master-Slave communication.
  ***********************************************************************/
 
+/* mtime and size are from the walker, so slave doesn't stat() again */
+struct comm_path {
+    unsigned int seq;
+    int path_len;
+    int base;
+    time_t mtime;
+    size_t size;
+};
+
 static int
-_master_send_path(const struct fds *master, int plen, int dlen, const char *p)
+_iobuf_flush(struct iobuf *b)
 {
-    int lengths[2];
+    if (b->ring) {
+        if (b->len && lms_ring_write(b->ring, b->fd, b->data + b->start,
+                                     b->len) != 0)
+            return -1;
+        b->start = b->len = 0;
+        return 0;
+    }
 
-    lengths[0] = plen;
-    lengths[1] = dlen;
+    while (b->len > 0) {
+        ssize_t r;
 
-    if (write(master->w, lengths, sizeof(lengths)) < 0) {
-        perror("write");
-        return -1;
+        r = write(b->fd, b->data + b->start, b->len);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("write");
+            return -1;
+        }
+        b->start += r;
+        b->len -= r;
     }
+    b->start = 0;
+
+    return 0;
+}
 
-    if (write(master->w, p, plen) < 0) {
-        perror("write");
+static int
+_iobuf_put(struct iobuf *b, const void *data, unsigned int size)
+{
+    if (b->start + b->len + size > IOBUF_SIZE && _iobuf_flush(b) != 0)
         return -1;
-    }
 
+    memcpy(b->data + b->start + b->len, data, size);
+    b->len += size;
     return 0;
 }
 
+/*
+ * Ring may be empty even if its eventfd was signaled, so with wait
+ * unset this may return 0. Pipes are only read after poll(), they
+ * always have something.
+ */
 static int
-_master_send_finish(const struct fds *master)
+_iobuf_fill_ring(struct iobuf *b, int wait)
 {
-    const int lengths[2] = {-1, -1};
+    unsigned int r;
+    struct pollfd pfd;
 
-    if (write(master->w, lengths, sizeof(lengths)) < 0) {
-        perror("write");
-        return -1;
+    pfd.fd = b->fd;
+    pfd.events = POLLIN;
+
+    lms_ring_clear_event(b->fd);
+    while ((r = lms_ring_read(b->ring, b->data + b->len,
+                              IOBUF_SIZE - b->len)) == 0) {
+        if (!wait)
+            return 0;
+        if (lms_ring_prepare_wait(b->ring) > 0)
+            continue;
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+            perror("poll");
+            return -1;
+        }
+        lms_ring_clear_event(b->fd);
     }
-    return 0;
+
+    b->len += r;
+    return r;
 }
 
+/* single read(), takes whatever is available */
 static int
-_master_recv_reply(const struct fds *master, struct pollfd *pfd, int *reply, int timeout)
+_iobuf_fill(struct iobuf *b, int wait)
 {
-    int r;
+    ssize_t r;
+
+    if (b->start > 0) {
+        memmove(b->data, b->data + b->start, b->len);
+        b->start = 0;
+    }
+
+    if (b->ring)
+        return _iobuf_fill_ring(b, wait);
+
+    do {
+        r = read(b->fd, b->data + b->len, IOBUF_SIZE - b->len);
+    } while (r < 0 && errno == EINTR);
 
-    r = poll(pfd, 1, timeout);
     if (r < 0) {
-        perror("poll");
+        perror("read");
+        return -1;
+    } else if (r == 0) {
+        fprintf(stderr, "ERROR: unexpected end of stream.\n");
         return -1;
     }
 
-    if (r == 0)
+    b->len += r;
+    return r;
+}
+
+/* Return: 0 on success, 1 if there is not enough data buffered. */
+static int
+_iobuf_get(struct iobuf *b, void *data, unsigned int size)
+{
+    if (b->len < size)
         return 1;
 
-    if (read(master->r, reply, sizeof(*reply)) != sizeof(*reply)) {
-        perror("read");
-        return -2;
-    }
+    memcpy(data, b->data + b->start, size);
+    b->start += size;
+    b->len -= size;
+    if (b->len == 0)
+        b->start = 0;
+
+    return 0;
+}
+
+int
+lms_master_flush(struct pinfo *pinfo)
+{
+    pinfo->out_count = 0;
+    return _iobuf_flush(&pinfo->out);
+}
+
+/*
+ * Records are written in batches, but if the slave has nothing else to
+ * work on it gets the record right away.
+ */
+int
+lms_master_send(struct pinfo *pinfo, const struct window_entry *e)
+{
+    if (_iobuf_put(&pinfo->out, e->record, e->record_len))
+        return -1;
+
+    pinfo->out_count++;
+    if (pinfo->out_count == pinfo->window.count ||
+        pinfo->out_count >= BATCH_SIZE)
+        return lms_master_flush(pinfo);
 
     return 0;
 }
 
+/* records not related to the window, written right away */
+int
+lms_master_send_sync(struct pinfo *pinfo, const void *record, unsigned int size)
+{
+    if (_iobuf_put(&pinfo->out, record, size) != 0)
+        return -1;
+    return lms_master_flush(pinfo);
+}
+
+/* Return: bytes read, may be 0 with shared memory transport. */
+int
+lms_master_fill(struct pinfo *pinfo)
+{
+    return _iobuf_fill(&pinfo->in, 0);
+}
+
+/*
+ * Shared memory transport only wakes up master if it is about to
+ * sleep, so this must be called right before poll().
+ *
+ * Return: 1 if there are replies to read and poll() must be skipped.
+ */
 static int
-_slave_send_reply(const struct fds *slave, int reply)
+_master_prepare_poll(struct pinfo *pinfo)
+{
+    return pinfo->in.ring && lms_ring_prepare_wait(pinfo->in.ring) > 0;
+}
+
+int
+lms_master_get_reply(struct pinfo *pinfo, struct comm_reply *reply)
+{
+    return _iobuf_get(&pinfo->in, reply, sizeof(*reply));
+}
+
+/*
+ * Return: 0 on success, 1 on timeout, < 0 on error.
+ */
+int
+lms_master_recv_reply(struct pinfo *pinfo, struct comm_reply *reply, int timeout)
 {
-    if (write(slave->w, &reply, sizeof(reply)) == 0) {
-        perror("write");
+    int r;
+
+    if (lms_master_flush(pinfo) != 0)
         return -1;
+
+    while (lms_master_get_reply(pinfo, reply) != 0) {
+        if (_master_prepare_poll(pinfo))
+            r = 1;
+        else
+            r = poll(&pinfo->poll, 1, timeout);
+        if (r < 0) {
+            perror("poll");
+            return -1;
+        }
+
+        if (r == 0)
+            return 1;
+
+        if (lms_master_fill(pinfo) < 0)
+            return -2;
     }
+
     return 0;
 }
 
 static int
-_slave_recv_path(const struct fds *slave, int *plen, int *dlen, char *path)
+_master_send_path(struct pinfo *pinfo, int plen, int dlen, const char *p, const struct stat *st)
 {
-    int lengths[2], r;
+    struct window_entry *e;
+    struct comm_path cp;
+
+    cp.seq = 0; /* assigned by window */
+    cp.path_len = plen;
+    cp.base = dlen;
+    cp.mtime = st->st_mtime;
+    cp.size = st->st_size;
+
+    e = lms_window_push(&pinfo->window, &cp, sizeof(cp), p, plen, 0,
+                        pinfo->slave_timeout);
+    if (!e)
+        return -1;
 
-    r = read(slave->r, lengths, sizeof(lengths));
-    if (r != sizeof(lengths)) {
-        perror("read");
+    return lms_master_send(pinfo, e);
+}
+
+static int
+_master_send_finish(struct pinfo *pinfo)
+{
+    const struct comm_path cp = {WINDOW_SEQ_SYNC, -1, -1, 0, 0};
+
+    return lms_master_send_sync(pinfo, &cp, sizeof(cp));
+}
+
+int
+lms_slave_flush(struct pinfo *pinfo)
+{
+    pinfo->out_count = 0;
+    return _iobuf_flush(&pinfo->out);
+}
+
+/*
+ * Replies are written in batches. Master only starts the timeout of a
+ * path when it gets the reply for the previous one, so they are not held
+ * for long: flushed when slave runs out of input or after a fraction
+ * of slave timeout.
+ */
+int
+lms_slave_send_reply(struct pinfo *pinfo, unsigned int seq, int status)
+{
+    int timeout = pinfo->slave_timeout;
+    struct comm_reply reply;
+    int64_t now;
+
+    reply.seq = seq;
+    reply.status = status;
+
+    if (_iobuf_put(&pinfo->out, &reply, sizeof(reply)) != 0)
         return -1;
+
+    now = lms_monotonic_ms();
+    if (pinfo->out_count++ == 0)
+        pinfo->out_since = now;
+
+    if (pinfo->out_count >= BATCH_SIZE || pinfo->in.len == 0 ||
+        (timeout > 0 && now - pinfo->out_since >= timeout / 4))
+        return lms_slave_flush(pinfo);
+
+    return 0;
+}
+
+int
+lms_slave_recv(struct pinfo *pinfo, void *data, unsigned int size)
+{
+    while (_iobuf_get(&pinfo->in, data, size) != 0) {
+        /* about to block, let master know what is done */
+        if (pinfo->out_count && lms_slave_flush(pinfo) != 0)
+            return -1;
+        if (_iobuf_fill(&pinfo->in, 1) < 0)
+            return -1;
     }
-    *plen = lengths[0];
-    *dlen = lengths[1];
 
-    if (*plen == -1)
+    return 0;
+}
+
+int
+lms_slave_has_input(struct pinfo *pinfo, int timeout)
+{
+    struct pollfd pfd;
+
+    if (pinfo->in.len > 0)
+        return 1;
+
+    if (pinfo->out_count)
+        lms_slave_flush(pinfo);
+
+    pfd.fd = pinfo->slave.r;
+    pfd.events = POLLIN;
+
+    if (!pinfo->in.ring)
+        return poll(&pfd, 1, timeout) > 0;
+
+    if (lms_ring_prepare_wait(pinfo->in.ring) > 0)
+        return 1;
+    if (poll(&pfd, 1, timeout) <= 0)
+        return 0;
+    /* eventfd may be left signaled, make sure something was written */
+    lms_ring_clear_event(pinfo->slave.r);
+    return lms_ring_available(pinfo->in.ring) > 0;
+}
+
+static int
+_slave_recv_path(struct pinfo *pinfo, struct comm_path *cp, char *path)
+{
+    if (lms_slave_recv(pinfo, cp, sizeof(*cp)) != 0)
+        return -1;
+
+    if (cp->path_len == -1)
         return 0;
 
-    if (*plen > PATH_SIZE || *plen < 0) {
+    if (cp->path_len > PATH_SIZE || cp->path_len < 0) {
         fprintf(stderr, "ERROR: invalid path size (%d) (min: 0, max: %d)\n",
-                *plen, PATH_SIZE);
+                cp->path_len, PATH_SIZE);
         return -2;
     }
 
-    r = read(slave->r, path, *plen);
-    if (r != *plen) {
-        fprintf(stderr, "ERROR: could not read whole path %d/%d\n", r, *plen);
+    if (lms_slave_recv(pinfo, path, cp->path_len) != 0) {
+        fprintf(stderr, "ERROR: could not read whole path %d\n",
+                cp->path_len);
         return -3;
     }
 
-    path[*plen] = 0;
+    path[cp->path_len] = 0;
     return 0;
 }
 
@@ -158,39 +425,15 @@ _db_compile_all_stmts(struct db *db)
     sqlite3 *handle;
 
     handle = db->handle;
-    db->transaction_begin = lms_db_compile_stmt_begin_transaction(handle);
-    if (!db->transaction_begin)
-        return -1;
-
-    db->transaction_commit = lms_db_compile_stmt_end_transaction(handle);
-    if (!db->transaction_commit)
-        return -2;
-
     db->get_file_info = lms_db_compile_stmt_get_file_info(handle);
     if (!db->get_file_info)
-        return -4;
-
-    db->insert_file_info = lms_db_compile_stmt_insert_file_info(handle);
-    if (!db->insert_file_info)
-        return -5;
-
-    db->update_file_info = lms_db_compile_stmt_update_file_info(handle);
-    if (!db->update_file_info)
-        return -6;
-
-    db->delete_file_info = lms_db_compile_stmt_delete_file_info(handle);
-    if (!db->delete_file_info)
-        return -6;
-
-    db->set_file_dtime = lms_db_compile_stmt_set_file_dtime(handle);
-    if (!db->set_file_dtime)
-        return -7;
+        return -1;
 
     return 0;
 }
 
 static struct db *
-_db_open(const char *db_path)
+_db_open(const lms_t *lms)
 {
     struct db *db;
 
@@ -200,11 +443,16 @@ _db_open(const char *db_path)
         return NULL;
     }
 
-    if (sqlite3_open(db_path, &db->handle) != SQLITE_OK) {
-        fprintf(stderr, "ERROR: could not open DB \"%s\": %s\n",
-                db_path, sqlite3_errmsg(db->handle));
+    if (lms_db_open(lms, &db->handle, 0) != 0)
         goto error;
-    }
+
+    /* slaves share the DB, wait for each other instead of failing. So
+     * they do for master reading directory states.
+     */
+    if (lms->worker_count > 1 || lms->n_slave_pools ||
+        lms->skip_unchanged_dirs)
+        sqlite3_busy_timeout(db->handle, lms->slave_timeout > 0 ?
+                             lms->slave_timeout : DEFAULT_BUSY_TIMEOUT);
 
     if (lms_db_create_core_tables_if_required(db->handle) != 0) {
         fprintf(stderr, "ERROR: could not setup tables and indexes.\n");
@@ -214,7 +462,7 @@ _db_open(const char *db_path)
     return db;
 
   error:
-    sqlite3_close(db->handle);
+    lms_db_close(db->handle);
     free(db);
     return NULL;
 }
@@ -222,28 +470,10 @@ _db_open(const char *db_path)
 static int
 _db_close(struct db *db)
 {
-    if (db->transaction_begin)
-        lms_db_finalize_stmt(db->transaction_begin, "transaction_begin");
-
-    if (db->transaction_commit)
-        lms_db_finalize_stmt(db->transaction_commit, "transaction_commit");
-
     if (db->get_file_info)
         lms_db_finalize_stmt(db->get_file_info, "get_file_info");
 
-    if (db->insert_file_info)
-        lms_db_finalize_stmt(db->insert_file_info, "insert_file_info");
-
-    if (db->update_file_info)
-        lms_db_finalize_stmt(db->update_file_info, "update_file_info");
-
-    if (db->delete_file_info)
-        lms_db_finalize_stmt(db->delete_file_info, "delete_file_info");
-
-    if (db->set_file_dtime)
-        lms_db_finalize_stmt(db->set_file_dtime, "set_file_dtime");
-
-    if (sqlite3_close(db->handle) != SQLITE_OK) {
+    if (lms_db_close(db->handle) != 0) {
         fprintf(stderr, "ERROR: clould not close DB: %s\n",
                 sqlite3_errmsg(db->handle));
         return -1;
@@ -254,41 +484,101 @@ _db_close(struct db *db)
 }
 
 /*
+ * Queued records are written with parser's DB handles, so the writer
+ * must be gone before parsers are finished.
+ */
+static int
+_db_writer_start(const lms_t *lms, struct db *db, unsigned int update_id)
+{
+    db->writer = lms_writer_new(lms, db->handle, update_id);
+    if (!db->writer)
+        return -1;
+
+    return 0;
+}
+
+/*
+ * Files are reported as processed once queued, so failing to write them
+ * can only be told when the writer is stopped.
+ *
+ * Return: number of files that were not written.
+ */
+static int
+_db_writer_stop(struct db *db)
+{
+    int r;
+
+    if (!db->writer)
+        return 0;
+
+    r = lms_writer_free(db->writer);
+    db->writer = NULL;
+    if (r > 0)
+        fprintf(stderr, "ERROR: pid=%d failed to write %d files.\n",
+                getpid(), r);
+
+    return r;
+}
+
+/*
+ * Return: < 0 if the transaction could not start (files are kept
+ * pending), otherwise the number of files that were not written.
+ */
+static int
+_db_writer_flush(struct db *db)
+{
+    int r;
+
+    r = lms_writer_flush(db->writer);
+    if (r < 0)
+        fprintf(stderr, "ERROR: could not start transaction, %u files "
+                "pending.\n", lms_writer_pending(db->writer));
+    else if (r > 0)
+        fprintf(stderr, "ERROR: pid=%d failed to write %d files.\n",
+                getpid(), r);
+
+    return r;
+}
+
+/*
+ * finfo must come with in-disk mtime and size, as given by the walker.
+ *
  * Return:
  *  0: file found and nothing changed
  *  1: file not found or mtime/size is different
  *  < 0: error
  */
 static int
-_retrieve_file_status(struct db *db, struct lms_file_info *finfo)
+_retrieve_file_status(const lms_t *lms, sqlite3_stmt *get_file_info, struct lms_file_info *finfo)
 {
-    struct stat st;
+    time_t mtime = finfo->mtime;
+    size_t size = finfo->size;
+    int64_t start = lms_stats_now();
     int r;
 
-    if (stat(finfo->path, &st) != 0) {
-        perror("stat");
-        return -1;
-    }
-
-    r = lms_db_get_file_info(db->get_file_info, finfo);
+    if (lms->file_cache)
+        r = lms_file_cache_get(lms->file_cache, finfo);
+    else
+        r = lms_db_get_file_info(get_file_info, finfo);
+    lms_stats_time(lms, LMS_STATS_PHASE_LOOKUP, start);
     if (r == 0) {
-        if (st.st_mtime <= finfo->mtime && finfo->size == (size_t)st.st_size)
+        if (mtime <= finfo->mtime && finfo->size == size)
             return 0;
         else {
-            finfo->mtime = st.st_mtime;
-            finfo->size = st.st_size;
+            finfo->mtime = mtime;
+            finfo->size = size;
             return 1;
         }
     } else if (r == 1) {
-        finfo->mtime = st.st_mtime;
-        finfo->size = st.st_size;
+        finfo->mtime = mtime;
+        finfo->size = size;
         return 1;
     } else
         return -2;
 }
 
-static void
-_ctxt_init(struct lms_context *ctxt, const lms_t *lms, sqlite3 *db)
+void
+lms_context_init(struct lms_context *ctxt, const lms_t *lms, sqlite3 *db)
 {
     ctxt->cs_conv = lms->cs_conv;
     ctxt->db = db;
@@ -300,7 +590,7 @@ lms_parsers_setup(lms_t *lms, sqlite3 *db)
     struct lms_context ctxt;
     int i;
 
-    _ctxt_init(&ctxt, lms, db);
+    lms_context_init(&ctxt, lms, db);
 
     for (i = 0; i < lms->n_parsers; i++) {
         lms_plugin_t *plugin;
@@ -326,7 +616,7 @@ lms_parsers_start(lms_t *lms, sqlite3 *db)
     struct lms_context ctxt;
     int i;
 
-    _ctxt_init(&ctxt, lms, db);
+    lms_context_init(&ctxt, lms, db);
 
     for (i = 0; i < lms->n_parsers; i++) {
         lms_plugin_t *plugin;
@@ -352,7 +642,7 @@ lms_parsers_finish(lms_t *lms, sqlite3 *db)
     struct lms_context ctxt;
     int i;
 
-    _ctxt_init(&ctxt, lms, db);
+    lms_context_init(&ctxt, lms, db);
 
     for (i = 0; i < lms->n_parsers; i++) {
         lms_plugin_t *plugin;
@@ -368,33 +658,61 @@ lms_parsers_finish(lms_t *lms, sqlite3 *db)
     return 0;
 }
 
+/*
+ * Match finfo against parsers, lms->parsers or a copy with other
+ * instances of their plugins, like the ones of parser threads.
+ */
 int
-lms_parsers_check_using(lms_t *lms, void **parser_match, struct lms_file_info *finfo)
+lms_parsers_check_using(const lms_t *lms, const struct parser *parsers, void **parser_match, struct lms_file_info *finfo)
 {
+    int64_t start = lms_stats_now();
     int used, i;
 
+    finfo->reader = NULL;
+    finfo->by_contents = 0;
+
     used = 0;
     for (i = 0; i < lms->n_parsers; i++) {
         lms_plugin_t *plugin;
         void *r;
 
-        plugin = lms->parsers[i].plugin;
-        r = plugin->match(plugin, finfo->path, finfo->path_len, finfo->base);
+        plugin = parsers[i].plugin;
+        if (parsers[i].exts)
+            r = NULL; /* by lms_exts_match() */
+        else
+            r = plugin->match(plugin, finfo->path, finfo->path_len,
+                              finfo->base);
         parser_match[i] = r;
         if (r)
             used = 1;
     }
 
+    if (lms->exts &&
+        lms_exts_match(lms->exts, parser_match, finfo->path, finfo->path_len))
+        used = 1;
+
+    if (lms->content_match && lms_magic_match(lms, parser_match, finfo))
+        used = 1;
+    if (!used && finfo->reader) {
+        lms_reader_close(finfo->reader);
+        finfo->reader = NULL;
+    }
+
+    lms_stats_time(lms, LMS_STATS_PHASE_MATCH, start);
     return used;
 }
 
 int
-lms_parsers_run(lms_t *lms, sqlite3 *db, void **parser_match, struct lms_file_info *finfo)
+lms_parsers_run(const lms_t *lms, const struct parser *parsers, struct lms_context *ctxt, void **parser_match, struct lms_file_info *finfo)
 {
-    struct lms_context ctxt;
+    int64_t start = lms_stats_now();
     int i, failed, available;
 
-    _ctxt_init(&ctxt, lms, db);
+    /* opened once for all parsers, on first read, if not to match */
+    if (!finfo->reader)
+        finfo->reader = lms_reader_prefetch_new(finfo->path, finfo->size);
+    if (!finfo->reader)
+        return -1;
 
     finfo->parsed = 0;
     failed = 0;
@@ -402,12 +720,15 @@ lms_parsers_run(lms_t *lms, sqlite3 *db, void **parser_match, struct lms_file_in
     for (i = 0; i < lms->n_parsers; i++) {
         lms_plugin_t *plugin;
 
-        plugin = lms->parsers[i].plugin;
+        plugin = parsers[i].plugin;
         if (parser_match[i]) {
+            int64_t parse_start = lms_stats_now();
             int r;
 
             available++;
-            r = plugin->parse(plugin, &ctxt, finfo, parser_match[i]);
+            lms_reader_seek(finfo->reader, 0, SEEK_SET);
+            r = plugin->parse(plugin, ctxt, finfo, parser_match[i]);
+            lms_stats_time_parser(lms, i, parse_start);
             if (r != 0)
                 failed++;
             else
@@ -415,6 +736,11 @@ lms_parsers_run(lms_t *lms, sqlite3 *db, void **parser_match, struct lms_file_in
         }
     }
 
+    lms_reader_close(finfo->reader);
+    finfo->reader = NULL;
+
+    lms_stats_time(lms, LMS_STATS_PHASE_PARSE, start);
+
     if (!failed)
         return 0;
     else if (failed == available)
@@ -430,7 +756,7 @@ _db_and_parsers_setup(lms_t *lms, struct db **db_ret, void ***parser_match_ret)
     struct db *db;
     int r = 0;
 
-    db = _db_open(lms->db_path);
+    db = _db_open(lms);
     if (!db) {
         r = -1;
         return r;
@@ -477,6 +803,11 @@ _db_and_parsers_setup(lms_t *lms, struct db **db_ret, void ***parser_match_ret)
 }
 
 /*
+ * Parsing doesn't write to the DB: the file row and records given to
+ * lms_db_*_add() are queued in the writer, written later in a batch.
+ *
+ * finfo must have path, path_len, base and in-disk mtime and size set.
+ *
  * Return:
  *  LMS_PROGRESS_STATUS_UP_TO_DATE
  *  LMS_PROGRESS_STATUS_PROCESSED
@@ -485,54 +816,55 @@ _db_and_parsers_setup(lms_t *lms, struct db **db_ret, void ***parser_match_ret)
  */
 static int
 _db_and_parsers_process_file(lms_t *lms, struct db *db, void **parser_match,
-                             char *path, int path_len, int path_base,
-                             unsigned int update_id)
+                             struct lms_file_info *finfo)
 {
-    struct lms_file_info finfo;
+    struct lms_db_record_list records;
+    struct lms_context ctxt;
     int used, r;
 
-    finfo.path = path;
-    finfo.path_len = path_len;
-    finfo.base = path_base;
-
-    r = _retrieve_file_status(db, &finfo);
+    r = _retrieve_file_status(lms, db->get_file_info, finfo);
     if (r == 0) {
-        if (!finfo.dtime)
+        if (!finfo->dtime)
             return LMS_PROGRESS_STATUS_UP_TO_DATE;
 
-        finfo.dtime = 0;
-        finfo.itime = time(NULL);
-        lms_db_set_file_dtime(db->set_file_dtime, &finfo);
+        finfo->dtime = 0;
+        finfo->itime = time(NULL);
+        if (lms_writer_queue(db->writer, finfo, WRITER_OP_RESTORE,
+                             NULL) != 0)
+            return -1;
         return LMS_PROGRESS_STATUS_PROCESSED;
     } else if (r < 0) {
         fprintf(stderr, "ERROR: could not detect file status.\n");
         return r;
     }
 
-    used = lms_parsers_check_using(lms, parser_match, &finfo);
+    used = lms_parsers_check_using(lms, lms->parsers, parser_match, finfo);
     if (!used)
         return LMS_PROGRESS_STATUS_SKIPPED;
 
-    finfo.dtime = 0;
-    finfo.itime = time(NULL);
-    if (finfo.id > 0)
-        r = lms_db_update_file_info(db->update_file_info, &finfo, update_id);
-    else
-        r = lms_db_insert_file_info(db->insert_file_info, &finfo, update_id);
+    finfo->dtime = 0;
+    finfo->itime = time(NULL);
 
-    if (r < 0) {
-        fprintf(stderr, "ERROR: could not register path in DB\n");
-        return r;
-    }
+    lms_context_init(&ctxt, lms, db->handle);
+    memset(&records, 0, sizeof(records));
+    lms_db_record_capture_start(&records);
+    r = lms_parsers_run(lms, lms->parsers, &ctxt, parser_match, finfo);
+    lms_db_record_capture_stop();
 
-    r = lms_parsers_run(lms, db->handle, parser_match, &finfo);
     if (r < 0) {
         fprintf(stderr, "ERROR: pid=%d failed to parse \"%s\".\n",
-                getpid(), finfo.path);
-        lms_db_delete_file_info(db->delete_file_info, &finfo);
+                getpid(), finfo->path);
+        lms_db_record_list_clear(&records);
+        if (finfo->id > 0)
+            lms_writer_queue(db->writer, finfo, WRITER_OP_DELETE, NULL);
         return r;
     }
 
+    r = lms_writer_queue(db->writer, finfo, WRITER_OP_PARSED, &records);
+    lms_db_record_list_clear(&records);
+    if (r != 0)
+        return r;
+
     return LMS_PROGRESS_STATUS_PROCESSED;
 }
 
@@ -540,61 +872,57 @@ static int
 _slave_work(struct pinfo *pinfo)
 {
     lms_t *lms = pinfo->common.lms;
-    struct fds *fds = &pinfo->slave;
-    int r, len, base;
+    struct lms_file_info finfo;
+    struct comm_path cp;
     char path[PATH_SIZE];
     void **parser_match;
     struct db *db;
-    unsigned int total_committed, counter;
+    int r, failed = 0;
 
     r = _db_and_parsers_setup(lms, &db, &parser_match);
     if (r < 0)
         return r;
 
-    r = lms_db_update_id_get(db->handle);
-    if (r < 0) {
-        fprintf(stderr, "ERROR: could not get global update id.\n");
-        goto done;
+    if (_db_writer_start(lms, db, pinfo->common.update_id) != 0) {
+        r = -7;
+        goto end;
     }
 
-    pinfo->common.update_id = r + 1;
-
-    counter = 0;
-    total_committed = 0;
-    lms_db_begin_transaction(db->transaction_begin);
-
-    while (((r = _slave_recv_path(fds, &len, &base, path)) == 0) && len > 0) {
-        r = _db_and_parsers_process_file(
-            lms, db, parser_match, path, len, base, pinfo->common.update_id);
-
-        _slave_send_reply(fds, r);
+    for (;;) {
+        /* write pending files before the latency limit or if idle */
+        if (lms_writer_pending(db->writer)) {
+            int left = lms_writer_timeout_left(db->writer);
+            if (left == 0 ||
+                (left > 0 && !lms_slave_has_input(pinfo, left))) {
+                lms_slave_flush(pinfo);
+                if (_db_writer_flush(db) > 0)
+                    failed = 1;
+            }
+        }
 
-        if (r < 0 ||
-            (r == LMS_PROGRESS_STATUS_UP_TO_DATE ||
-             r == LMS_PROGRESS_STATUS_SKIPPED))
-            continue;
+        r = _slave_recv_path(pinfo, &cp, path);
+        if (r != 0 || cp.path_len <= 0)
+            break;
 
-        counter++;
-        if (counter > lms->commit_interval) {
-            if (!total_committed) {
-                total_committed += counter;
-                lms_db_update_id_set(db->handle, pinfo->common.update_id);
-            }
+        finfo.path = path;
+        finfo.path_len = cp.path_len;
+        finfo.base = cp.base;
+        finfo.mtime = cp.mtime;
+        finfo.size = cp.size;
+        r = _db_and_parsers_process_file(lms, db, parser_match, &finfo);
 
-            lms_db_end_transaction(db->transaction_commit);
-            lms_db_begin_transaction(db->transaction_begin);
-            counter = 0;
-        }
+        lms_slave_send_reply(pinfo, cp.seq, r);
     }
 
-    if (counter) {
-        total_committed += counter;
-        lms_db_update_id_set(db->handle, pinfo->common.update_id);
-    }
+    lms_slave_flush(pinfo);
+    if (_db_writer_stop(db) > 0)
+        failed = 1;
 
-    lms_db_end_transaction(db->transaction_commit);
+    /* replies are gone already, master only learns it from exit status */
+    if (r == 0 && failed)
+        r = -8;
 
-done:
+  end:
     free(parser_match);
     lms_parsers_finish(lms, db->handle);
     _db_close(db);
@@ -616,10 +944,10 @@ _consume_garbage(struct pollfd *pfd)
         if (pfd->revents & (POLLERR | POLLHUP | POLLNVAL))
             return 0;
         else if (pfd->revents & POLLIN) {
-            char c;
+            char buf[4096];
             ssize_t s;
 
-            s = read(pfd->fd, &c, sizeof(c));
+            s = read(pfd->fd, buf, sizeof(buf));
             if (s == 0)
                 return 0;
             else if (s < 0) {
@@ -658,18 +986,78 @@ lms_close_pipes(struct pinfo *pinfo)
 
     r = _close_fds(&pinfo->master);
     r += _close_fds(&pinfo->slave);
+    lms_window_clear(&pinfo->window);
+    free(pinfo->in.data);
+    free(pinfo->out.data);
+    if (pinfo->to_slave)
+        lms_ring_free(pinfo->to_slave);
+    if (pinfo->to_master)
+        lms_ring_free(pinfo->to_master);
 
     return r;
 }
 
-int
-lms_create_pipes(struct pinfo *pinfo)
+/*
+ * Same layout as pipes, but read ends are eventfds used to wake up the
+ * other side and write ends are dup() of them.
+ */
+static int
+_create_rings(struct pinfo *pinfo)
 {
-    int fds[2];
+    pinfo->to_slave = lms_ring_new();
+    pinfo->to_master = lms_ring_new();
+    if (!pinfo->to_slave || !pinfo->to_master)
+        goto error;
 
-    if (pipe(fds) != 0) {
-        perror("pipe");
-        return -1;
+    pinfo->master.r = lms_ring_event_new();
+    if (pinfo->master.r < 0)
+        goto error;
+    pinfo->slave.w = dup(pinfo->master.r);
+    if (pinfo->slave.w < 0) {
+        perror("dup");
+        close(pinfo->master.r);
+        goto error;
+    }
+
+    pinfo->slave.r = lms_ring_event_new();
+    if (pinfo->slave.r < 0)
+        goto error_slave;
+    pinfo->master.w = dup(pinfo->slave.r);
+    if (pinfo->master.w < 0) {
+        perror("dup");
+        close(pinfo->slave.r);
+        goto error_slave;
+    }
+
+    return 0;
+
+  error_slave:
+    close(pinfo->master.r);
+    close(pinfo->slave.w);
+  error:
+    if (pinfo->to_slave)
+        lms_ring_free(pinfo->to_slave);
+    if (pinfo->to_master)
+        lms_ring_free(pinfo->to_master);
+    pinfo->to_slave = pinfo->to_master = NULL;
+    return -1;
+}
+
+int
+lms_create_pipes(struct pinfo *pinfo)
+{
+    int fds[2];
+
+    pinfo->to_slave = pinfo->to_master = NULL;
+    if (pinfo->common.lms->shm_transport) {
+        if (_create_rings(pinfo) != 0)
+            return -1;
+        goto setup;
+    }
+
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        return -1;
     }
     pinfo->master.r = fds[0];
     pinfo->slave.w = fds[1];
@@ -683,15 +1071,35 @@ lms_create_pipes(struct pinfo *pinfo)
     pinfo->slave.r = fds[0];
     pinfo->master.w = fds[1];
 
+  setup:
     pinfo->poll.fd = pinfo->master.r;
     pinfo->poll.events = POLLIN;
 
+    memset(&pinfo->window, 0, sizeof(pinfo->window));
+    memset(&pinfo->in, 0, sizeof(pinfo->in));
+    memset(&pinfo->out, 0, sizeof(pinfo->out));
+    pinfo->out_count = 0;
+
+    pinfo->in.fd = pinfo->master.r;
+    pinfo->in.ring = pinfo->to_master;
+    pinfo->out.fd = pinfo->master.w;
+    pinfo->out.ring = pinfo->to_slave;
+
+    pinfo->in.data = malloc(IOBUF_SIZE);
+    pinfo->out.data = malloc(IOBUF_SIZE);
+    if (!pinfo->in.data || !pinfo->out.data) {
+        perror("malloc");
+        lms_close_pipes(pinfo);
+        return -1;
+    }
+
     return 0;
 }
 
 int
 lms_create_slave(struct pinfo *pinfo, int (*work)(struct pinfo *pinfo))
 {
+    struct lms_stats_io io;
     int r;
 
     pinfo->child = fork();
@@ -704,8 +1112,19 @@ lms_create_slave(struct pinfo *pinfo, int (*work)(struct pinfo *pinfo))
         return 0;
 
     _close_fds(&pinfo->master);
+    pinfo->in.fd = pinfo->slave.r;
+    pinfo->in.ring = pinfo->to_slave;
+    pinfo->out.fd = pinfo->slave.w;
+    pinfo->out.ring = pinfo->to_master;
+#ifdef HAVE_SYS_PRCTL_H
+    /* eventfds never hang up, do not outlive master */
+    if (pinfo->in.ring)
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+#endif
     nice(19);
+    lms_stats_io_get(&io);
     r = work(pinfo);
+    lms_stats_io_add(pinfo->common.lms, &io);
     lms_free(pinfo->common.lms);
     _exit(r);
     return r; /* shouldn't reach anyway... */
@@ -718,23 +1137,28 @@ _waitpid(pid_t pid)
     pid_t r;
 
     r = waitpid(pid, &status, 0);
-    if (r > -1)
-        return 0;
-    else
+    if (r < 0) {
         perror("waitpid");
+        return r;
+    }
 
-    return r;
+    if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "ERROR: slave returned %d.\n", WEXITSTATUS(status));
+        return -1;
+    }
+
+    return 0;
 }
 
 int
-lms_finish_slave(struct pinfo *pinfo, int (*finish)(const struct fds *fds))
+lms_finish_slave(struct pinfo *pinfo, int (*finish)(struct pinfo *pinfo))
 {
     int r;
 
     if (pinfo->child <= 0)
         return 0;
 
-    r = finish(&pinfo->master);
+    r = finish(pinfo);
     if (r == 0)
         r = _waitpid(pinfo->child);
     else {
@@ -749,6 +1173,45 @@ lms_finish_slave(struct pinfo *pinfo, int (*finish)(const struct fds *fds))
     return r;
 }
 
+/*
+ * Dead slave may have read more records than it replied to, so discard
+ * whatever is left in both pipes (or rings) and send the new slave every
+ * record still in the window.
+ */
+static int
+_recreate_slave(struct pinfo *pinfo, int (*work)(struct pinfo *pinfo))
+{
+    struct pollfd pfd;
+    unsigned int i;
+
+    if (pinfo->to_slave) {
+        lms_ring_reset(pinfo->to_master, pinfo->master.r);
+        lms_ring_reset(pinfo->to_slave, pinfo->slave.r);
+    } else {
+        _consume_garbage(&pinfo->poll);
+        pfd.fd = pinfo->slave.r;
+        pfd.events = POLLIN;
+        _consume_garbage(&pfd);
+    }
+
+    pinfo->in.start = pinfo->in.len = 0;
+    pinfo->out.start = pinfo->out.len = 0;
+    pinfo->out_count = 0;
+
+    if (lms_create_slave(pinfo, work) != 0)
+        return -1;
+
+    for (i = 0; i < pinfo->window.count; i++) {
+        const struct window_entry *e;
+
+        e = pinfo->window.entries + (pinfo->window.first + i) % WINDOW_SIZE;
+        if (_iobuf_put(&pinfo->out, e->record, e->record_len) != 0)
+            return -1;
+    }
+
+    return lms_master_flush(pinfo);
+}
+
 int
 lms_restart_slave(struct pinfo *pinfo, int (*work)(struct pinfo *pinfo))
 {
@@ -783,30 +1246,152 @@ lms_restart_slave(struct pinfo *pinfo, int (*work)(struct pinfo *pinfo))
     if (waitpid(pinfo->child, &status, 0) < 0)
         perror("waitpid");
 
-    _consume_garbage(&pinfo->poll);
-    return lms_create_slave(pinfo, work);
+    return _recreate_slave(pinfo, work);
 }
 
-static int
-_strcat(int base, char *path, const char *name)
+int64_t
+lms_monotonic_ms(void)
 {
-    int new_len, name_len;
+    struct timespec ts;
 
-    name_len = strlen(name);
-    new_len = base + name_len;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-    if (new_len >= PATH_SIZE) {
-        path[base] = '\0';
-        fprintf(stderr,
-                "ERROR: path concatenation too long %d of %d "
-                "available: \"%s\" + \"%s\"\n", new_len, PATH_SIZE,
-                path, name);
-        return -1;
+static void
+_window_set_deadline(struct window *w, int timeout)
+{
+    if (timeout < 0)
+        w->deadline = INT64_MAX;
+    else
+        w->deadline = lms_monotonic_ms() + timeout;
+}
+
+int
+lms_window_is_full(const struct window *w, unsigned int record_len)
+{
+    if (w->count == WINDOW_SIZE)
+        return 1;
+
+    /* a single record is always accepted, no matter its size */
+    return w->count > 0 && w->bytes + record_len > WINDOW_BYTES;
+}
+
+/*
+ * Track a new record (header followed by path) about to be sent to
+ * slave. Its sequence id is written to the start of the header. If it's
+ * the only one, the slave starts working on it right away and so does
+ * its timeout.
+ */
+struct window_entry *
+lms_window_push(struct window *w, const void *header, unsigned int header_len, const char *path, int path_len, unsigned int flags, int timeout)
+{
+    struct window_entry *e;
+
+    e = w->entries + (w->first + w->count) % WINDOW_SIZE;
+    e->record_len = header_len + path_len;
+    e->record = malloc(e->record_len + 1);
+    if (!e->record) {
+        perror("malloc");
+        return NULL;
     }
+    e->seq = w->next_seq++;
+    if (w->next_seq == WINDOW_SEQ_SYNC)
+        w->next_seq = 0;
+
+    memcpy(e->record, header, header_len);
+    memcpy(e->record, &e->seq, sizeof(e->seq));
+    memcpy(e->record + header_len, path, path_len);
+    e->record[e->record_len] = '\0';
+    e->path = e->record + header_len;
+    e->path_len = path_len;
+    e->flags = flags;
+
+    if (w->count == 0)
+        _window_set_deadline(w, timeout);
+
+    w->count++;
+    w->bytes += e->record_len;
+    return e;
+}
+
+struct window_entry *
+lms_window_first(struct window *w)
+{
+    if (w->count == 0)
+        return NULL;
+    return w->entries + w->first;
+}
+
+/*
+ * Forget the first path, slave is now working on the next one (if any),
+ * so restart the timeout.
+ */
+void
+lms_window_pop(struct window *w, int timeout)
+{
+    struct window_entry *e;
+
+    if (w->count == 0)
+        return;
+
+    e = w->entries + w->first;
+    w->bytes -= e->record_len;
+    free(e->record);
+    e->record = NULL;
+    e->path = NULL;
+
+    w->first = (w->first + 1) % WINDOW_SIZE;
+    w->count--;
+    if (w->count)
+        _window_set_deadline(w, timeout);
+}
+
+void
+lms_window_clear(struct window *w)
+{
+    while (w->count)
+        lms_window_pop(w, -1);
+    w->first = 0;
+}
+
+/*
+ * Return: -1 if there is nothing to wait for, otherwise milliseconds
+ * until the first path times out.
+ */
+int
+lms_window_timeout_left(const struct window *w)
+{
+    int64_t left;
+
+    if (w->count == 0 || w->deadline == INT64_MAX)
+        return -1;
+
+    left = w->deadline - lms_monotonic_ms();
+    if (left < 0)
+        return 0;
+    else if (left > INT_MAX)
+        return INT_MAX;
+    return left;
+}
+
+/*
+ * Replies come in sending order, but when a slave is restarted replies
+ * it already wrote may be discarded. Tell how many paths before the one
+ * with the given sequence id were lost that way.
+ *
+ * Return: number of lost paths, -1 if seq is not in the window.
+ */
+int
+lms_window_lost_before(const struct window *w, unsigned int seq)
+{
+    unsigned int i;
 
-    memcpy(path + base, name, name_len + 1);
+    for (i = 0; i < w->count; i++)
+        if (w->entries[(w->first + i) % WINDOW_SIZE].seq == seq)
+            return i;
 
-    return new_len;
+    return -1;
 }
 
 static inline void
@@ -815,6 +1400,14 @@ _report_progress(struct cinfo *info, const char *path, int path_len, lms_progres
     lms_progress_callback_t cb;
     lms_t *lms = info->lms;
 
+    lms_stats_files(lms, status, 1);
+
+    /* directory must be walked again next time */
+    if (lms->dir_states && status != LMS_PROGRESS_STATUS_UP_TO_DATE &&
+        status != LMS_PROGRESS_STATUS_PROCESSED &&
+        status != LMS_PROGRESS_STATUS_SKIPPED)
+        lms_dir_states_fail(lms->dir_states, path, path_len);
+
     cb = lms->progress.cb;
     if (!cb)
         return;
@@ -822,186 +1415,342 @@ _report_progress(struct cinfo *info, const char *path, int path_len, lms_progres
     cb(lms, path, path_len, status, lms->progress.data);
 }
 
+/* least loaded slave of group that can take the given path, if any */
+static struct pinfo *
+_pool_get_available(struct pool *pool, unsigned int group, unsigned int record_len)
+{
+    const struct pool_group *g = pool->groups + group;
+    struct pinfo *best = NULL;
+    unsigned int i;
+
+    for (i = 0; i < g->n_workers; i++) {
+        struct pinfo *w = g->workers + i;
+
+        if (lms_window_is_full(&w->window, record_len))
+            continue;
+        if (!best || w->window.count < best->window.count)
+            best = w;
+    }
+
+    return best;
+}
+
 static int
-_process_file(struct cinfo *info, int base, char *path, const char *name)
+_pool_handle_reply(struct pool *pool, struct pinfo *w, const struct comm_reply *reply)
 {
-    struct pinfo *pinfo = (struct pinfo *)info;
-    int new_len, reply, r;
+    struct cinfo *info = &pool->common;
+    int timeout = w->slave_timeout;
+    struct window_entry *e;
+    int lost;
+
+    lost = lms_window_lost_before(&w->window, reply->seq);
+    if (lost < 0) {
+        fprintf(stderr, "ERROR: unexpected reply %u from slave %d\n",
+                reply->seq, w->child);
+        return 0;
+    }
 
-    new_len = _strcat(base, path, name);
-    if (new_len < 0)
-        return -1;
+    for (; lost > 0; lost--) {
+        e = lms_window_first(&w->window);
+        _report_progress(info, e->path, e->path_len,
+                         LMS_PROGRESS_STATUS_KILLED);
+        lms_window_pop(&w->window, timeout);
+    }
 
-    if (_master_send_path(&pinfo->master, new_len, base, path) != 0)
-        return -2;
+    e = lms_window_first(&w->window);
+    if (reply->status < 0) {
+        fprintf(stderr, "ERROR: pid=%d failed to parse \"%s\".\n",
+                getpid(), e->path);
+        _report_progress(info, e->path, e->path_len,
+                         LMS_PROGRESS_STATUS_ERROR_PARSE);
+        pool->error = reply->status;
+    } else
+        _report_progress(info, e->path, e->path_len, reply->status);
 
-    r = _master_recv_reply(&pinfo->master, &pinfo->poll, &reply,
-                           pinfo->common.lms->slave_timeout);
-    if (r < 0) {
-        _report_progress(info, path, new_len, LMS_PROGRESS_STATUS_ERROR_COMM);
+    lms_window_pop(&w->window, timeout);
+    return 0;
+}
+
+/* read whatever the slave wrote and handle every complete reply */
+static int
+_pool_handle_input(struct pool *pool, struct pinfo *w)
+{
+    struct comm_reply reply;
+
+    if (lms_master_fill(w) < 0) {
+        struct window_entry *e = lms_window_first(&w->window);
+        _report_progress(&pool->common, e->path, e->path_len,
+                         LMS_PROGRESS_STATUS_ERROR_COMM);
         return -3;
-    } else if (r == 1) {
-        fprintf(stderr, "ERROR: slave took too long, restart %d\n",
-                pinfo->child);
-        _report_progress(info, path, new_len, LMS_PROGRESS_STATUS_KILLED);
-        if (lms_restart_slave(pinfo, _slave_work) != 0)
-            return -4;
-        return 1;
-    } else {
-        if (reply < 0) {
-            fprintf(stderr, "ERROR: pid=%d failed to parse \"%s\".\n",
-                    getpid(), path);
-            _report_progress(
-                info, path, new_len, LMS_PROGRESS_STATUS_ERROR_PARSE);
-            return reply;
-        }
-        _report_progress(info, path, new_len, reply);
-        return reply;
     }
+
+    while (w->window.count && lms_master_get_reply(w, &reply) == 0)
+        _pool_handle_reply(pool, w, &reply);
+
+    return 0;
 }
 
+/*
+ * Slave is stuck on its first path: report and forget it. Paths after
+ * it are still in the pipe and will be handled by the new slave.
+ */
 static int
-_process_file_single_process(struct cinfo *info, int base, char *path, const char *name)
+_pool_handle_timeout(struct pool *pool, struct pinfo *w)
 {
-    struct sinfo *sinfo = (struct sinfo *)info;
-    int new_len, r;
+    struct window_entry *e;
+
+    fprintf(stderr, "ERROR: slave took too long, restart %d\n", w->child);
+    e = lms_window_first(&w->window);
+    _report_progress(&pool->common, e->path, e->path_len,
+                     LMS_PROGRESS_STATUS_KILLED);
+    lms_window_pop(&w->window, w->slave_timeout);
+    if (lms_restart_slave(w, _slave_work) != 0)
+        return -4;
+    return 0;
+}
 
-    void **parser_match = sinfo->parser_match;
-    struct db *db = sinfo->db;
-    lms_t *lms = sinfo->common.lms;
+/*
+ * Wait for replies from busy slaves, killing the ones whose current
+ * path exceeded its deadline.
+ *
+ * Return: 0 on success, < 0 on communication error or if a slave could
+ * not be restarted.
+ */
+static int
+_pool_wait(struct pool *pool)
+{
+    unsigned int i, busy;
+    int r, timeout, ready;
+
+    busy = 0;
+    ready = 0;
+    timeout = -1;
+    for (i = 0; i < pool->n_workers; i++) {
+        struct pinfo *w = pool->workers + i;
+        int left;
+
+        pool->pfds[i].fd = w->window.count ? w->master.r : -1;
+        pool->pfds[i].events = POLLIN;
+        pool->pfds[i].revents = 0;
+        if (!w->window.count)
+            continue;
 
-    new_len = _strcat(base, path, name);
-    if (new_len < 0)
-        return -1;
+        if (w->out_count && lms_master_flush(w) != 0)
+            return -2;
+
+        busy++;
+        if (_master_prepare_poll(w))
+            ready = 1;
+        left = lms_window_timeout_left(&w->window);
+        if (left >= 0 && (timeout < 0 || left < timeout))
+            timeout = left;
+    }
+
+    if (!busy)
+        return 0;
 
-    r = _db_and_parsers_process_file(lms, db, parser_match, path, new_len,
-                                     base, sinfo->common.update_id);
+    r = poll(pool->pfds, pool->n_workers, ready ? 0 : timeout);
     if (r < 0) {
-        fprintf(stderr, "ERROR: pid=%d failed to parse \"%s\".\n",
-                getpid(), path);
-        _report_progress(info, path, new_len, LMS_PROGRESS_STATUS_ERROR_PARSE);
-        return r;
+        if (errno == EINTR)
+            return 0;
+        perror("poll");
+        return -1;
     }
 
-    if (r != LMS_PROGRESS_STATUS_UP_TO_DATE)
-        sinfo->commit_counter++;
+    for (i = 0; i < pool->n_workers; i++) {
+        struct pinfo *w = pool->workers + i;
 
-    if (sinfo->commit_counter > lms->commit_interval) {
-        if (!sinfo->total_committed) {
-            sinfo->total_committed += sinfo->commit_counter;
-            lms_db_update_id_set(db->handle, sinfo->common.update_id);
-        }
+        if (!w->window.count)
+            continue;
+
+        if ((pool->pfds[i].revents & POLLIN) ||
+            (w->in.ring && lms_ring_available(w->in.ring) > 0))
+            r = _pool_handle_input(pool, w);
+        else if (lms_window_timeout_left(&w->window) == 0)
+            r = _pool_handle_timeout(pool, w);
+        else
+            r = 0;
 
-        lms_db_end_transaction(db->transaction_commit);
-        lms_db_begin_transaction(db->transaction_begin);
-        sinfo->commit_counter = 0;
+        if (r < 0)
+            return r;
     }
 
-    _report_progress(info, path, new_len, r);
+    return 0;
+}
 
-    return r;
+static int
+_pool_is_busy(const struct pool *pool)
+{
+    unsigned int i;
+
+    for (i = 0; i < pool->n_workers; i++)
+        if (pool->workers[i].window.count)
+            return 1;
+
+    return 0;
+}
+
+static int
+_pool_drain(struct pool *pool)
+{
+    int r;
+
+    while (_pool_is_busy(pool)) {
+        r = _pool_wait(pool);
+        if (r < 0)
+            return r;
+    }
+
+    return 0;
 }
 
-static int _process_dir(struct cinfo *info, int base, char *path, const char *name, process_file_callback_t process_file);
+/*
+ * Group of the first parser matching path that has one, see
+ * lms_parser_set_slave_pool(). Only the path is looked at, contents are
+ * left to slaves.
+ */
+static unsigned int
+_pool_route(struct pool *pool, const char *path, int path_len, int base)
+{
+    const lms_t *lms = pool->common.lms;
+    void **parser_match = pool->parser_match;
+    int i;
+
+    memset(parser_match, 0, lms->n_parsers * sizeof(*parser_match));
+    if (lms->exts)
+        lms_exts_match(lms->exts, parser_match, path, path_len);
+
+    for (i = 0; i < lms->n_parsers; i++) {
+        const struct parser *p = lms->parsers + i;
+
+        if (!p->slave_pool)
+            continue;
+
+        if (p->exts ? parser_match[i] != NULL :
+            p->plugin->match(p->plugin, path, path_len, base) != NULL)
+            return p->slave_pool;
+    }
+
+    return 0;
+}
 
 static int
-_process_unknown(struct cinfo *info, int base, char *path, const char *name, process_file_callback_t process_file)
+_process_file(struct cinfo *info, int base, char *path, const char *name, const struct stat *st)
 {
-    struct stat st;
-    int new_len;
+    struct pool *pool = (struct pool *)info;
+    struct pinfo *w;
+    unsigned int group;
+    int new_len, r;
 
-    new_len = _strcat(base, path, name);
+    if (pool->error)
+        return pool->error;
+
+    new_len = lms_path_append(base, path, name);
     if (new_len < 0)
         return -1;
 
-    if (stat(path, &st) != 0) {
-        perror("stat");
-        return -2;
-    }
+    group = pool->parser_match ? _pool_route(pool, path, new_len, base) : 0;
 
-    if (S_ISREG(st.st_mode)) {
-        int r = process_file(info, base, path, name);
-        if (r >= 0) /* if success and ignore non-fatal errors */
-            return 0;
-        return r;
-    } else if (S_ISDIR(st.st_mode)) {
-        int r = _process_dir(info, base, path, name, process_file);
-        if (r >= 0) /* ignore non-fatal errors */
-            return 0;
-        return r;
-    } else {
-        fprintf(stderr,
-                "INFO: %s is neither a directory nor a regular file.\n", path);
-        return -3;
+    /* only wait for slaves when they can't take more paths, so walking
+     * directories overlaps with parsing.
+     */
+    while ((w = _pool_get_available(
+                pool, group, sizeof(struct comm_path) + new_len)) == NULL) {
+        r = _pool_wait(pool);
+        if (r < 0)
+            return r;
+        if (pool->error)
+            return pool->error;
     }
+
+    if (_master_send_path(w, new_len, base, path, st) != 0)
+        return -2;
+
+    return 0;
 }
 
 static int
-_process_dir(struct cinfo *info, int base, char *path, const char *name, process_file_callback_t process_file)
+_process_file_single_process(struct cinfo *info, int base, char *path, const char *name, const struct stat *st)
 {
-    lms_t *lms = info->lms;
-    struct dirent *de;
+    struct sinfo *sinfo = (struct sinfo *)info;
+    struct lms_file_info finfo;
     int new_len, r;
-    DIR *dir;
 
-    new_len = _strcat(base, path, name);
+    void **parser_match = sinfo->parser_match;
+    struct db *db = sinfo->db;
+    lms_t *lms = sinfo->common.lms;
+
+    new_len = lms_path_append(base, path, name);
     if (new_len < 0)
         return -1;
-    else if (new_len + 1 >= PATH_SIZE) {
-        fprintf(stderr, "ERROR: path too long\n");
-        return 2;
-    }
 
-    dir = opendir(path);
-    if (dir == NULL) {
-        perror("opendir");
-        return 3;
+    finfo.path = path;
+    finfo.path_len = new_len;
+    finfo.base = base;
+    finfo.mtime = st->st_mtime;
+    finfo.size = st->st_size;
+    r = _db_and_parsers_process_file(lms, db, parser_match, &finfo);
+    if (r < 0) {
+        fprintf(stderr, "ERROR: pid=%d failed to parse \"%s\".\n",
+                getpid(), path);
+        _report_progress(info, path, new_len, LMS_PROGRESS_STATUS_ERROR_PARSE);
+        return r;
     }
 
-    path[new_len] = '/';
-    new_len++;
+    _report_progress(info, path, new_len, r);
 
-    r = 0;
-    while ((de = readdir(dir)) != NULL && !lms->stop_processing) {
-        if (de->d_name[0] == '.')
-            continue;
-        if (de->d_type == DT_REG) {
-            if (process_file(info, new_len, path, de->d_name) < 0) {
-                fprintf(stderr,
-                        "ERROR: unrecoverable error parsing file, "
-                        "exit \"%s\".\n", path);
-                path[new_len - 1] = '\0';
-                r = -4;
-                goto end;
-            }
-        } else if (de->d_type == DT_DIR) {
-            if (_process_dir(
-                    info, new_len, path, de->d_name, process_file) < 0) {
-                fprintf(stderr,
-                        "ERROR: unrecoverable error parsing dir, "
-                        "exit \"%s\".\n", path);
-                path[new_len - 1] = '\0';
-                r = -5;
-                goto end;
-            }
-        } else if (de->d_type == DT_UNKNOWN) {
-            if (_process_unknown(
-                    info, new_len, path, de->d_name, process_file) < 0) {
-                fprintf(stderr,
-                        "ERROR: unrecoverable error parsing DT_UNKNOWN, "
-                        "exit \"%s\".\n", path);
-                path[new_len - 1] = '\0';
-                r = -6;
-                goto end;
-            }
-        }
-    }
+    if (lms_writer_is_due(db->writer) && _db_writer_flush(db) > 0)
+        return -1;
 
-  end:
-    closedir(dir);
     return r;
 }
 
+/*
+ * File status is checked here, in the calling thread, only files that
+ * need parsing are given to parser threads.
+ */
+static int
+_process_file_threaded(struct cinfo *info, int base, char *path, const char *name, const struct stat *st)
+{
+    struct tinfo *tinfo = (struct tinfo *)info;
+    struct lms_file_info finfo;
+    unsigned int flags;
+    int new_len, r;
+
+    r = lms_tpool_get_error(tinfo->tp);
+    if (r)
+        return r;
+
+    new_len = lms_path_append(base, path, name);
+    if (new_len < 0)
+        return -1;
+
+    finfo.path = path;
+    finfo.path_len = new_len;
+    finfo.base = base;
+    finfo.mtime = st->st_mtime;
+    finfo.size = st->st_size;
+
+    r = _retrieve_file_status(info->lms, tinfo->get_file_info, &finfo);
+    if (r == 0) {
+        if (!finfo.dtime) {
+            _report_progress(info, path, new_len,
+                             LMS_PROGRESS_STATUS_UP_TO_DATE);
+            return 0;
+        }
+        flags = 0; /* just restore it */
+    } else if (r < 0) {
+        fprintf(stderr, "ERROR: could not detect file status.\n");
+        _report_progress(info, path, new_len, LMS_PROGRESS_STATUS_ERROR_PARSE);
+        return r;
+    } else
+        flags = TJOB_PARSE;
+
+    finfo.dtime = 0;
+    finfo.itime = time(NULL);
+    return lms_tpool_push(tinfo->tp, &finfo, flags);
+}
+
 static int
 _lms_process_check_valid(lms_t *lms, const char *path)
 {
@@ -1024,6 +1773,21 @@ _lms_process_check_valid(lms_t *lms, const char *path)
     return 0;
 }
 
+/* not being able to skip directories is not an error, walk them all */
+static void
+_process_dir_states_new(lms_t *lms, char *path)
+{
+    int len = strlen(path);
+
+    if (path[len - 1] == '/')
+        lms->dir_states = lms_dir_states_new(lms, path, len);
+    else if (len + 1 < PATH_SIZE) {
+        path[len] = '/';
+        lms->dir_states = lms_dir_states_new(lms, path, len + 1);
+        path[len] = '\0';
+    }
+}
+
 static int
 _process_trigger(struct cinfo *info, const char *top_path, process_file_callback_t process_file)
 {
@@ -1049,7 +1813,14 @@ _process_trigger(struct cinfo *info, const char *top_path, process_file_callback
 
     lms->is_processing = 1;
     lms->stop_processing = 0;
-    r = _process_unknown(info, len, path, bname, process_file);
+    memset(&lms->dir_stats, 0, sizeof(lms->dir_stats));
+    if (lms->skip_unchanged_dirs)
+        _process_dir_states_new(lms, path);
+    r = lms_walk(info, len, path, bname, process_file);
+    if (lms->dir_states && (r < 0 || lms->stop_processing)) {
+        lms_dir_states_free(lms->dir_states);
+        lms->dir_states = NULL;
+    }
     lms->is_processing = 0;
     lms->stop_processing = 0;
     free(bname);
@@ -1057,11 +1828,250 @@ _process_trigger(struct cinfo *info, const char *top_path, process_file_callback
     return r;
 }
 
+/*
+ * Done before slaves are forked, so they all share it. Failing is not an
+ * error, files are then looked up one by one.
+ */
+static void
+_process_file_cache_new(lms_t *lms, const char *top_path)
+{
+    char path[PATH_SIZE];
+    struct stat st;
+    int len;
+
+    memset(&lms->preload_stats, 0, sizeof(lms->preload_stats));
+    if (!lms->preload_budget)
+        return;
+
+    /* errors are reported once walking it */
+    if (realpath(top_path, path) == NULL || stat(path, &st) != 0)
+        return;
+
+    /* a single file is better queried */
+    if (!S_ISDIR(st.st_mode))
+        return;
+
+    len = strlen(path);
+    if (path[len - 1] != '/') {
+        if (len + 1 >= PATH_SIZE)
+            return;
+        path[len++] = '/';
+        path[len] = '\0';
+    }
+
+    lms->file_cache = lms_file_cache_new(lms, path, len);
+}
+
+static void
+_process_file_cache_free(lms_t *lms)
+{
+    if (!lms->file_cache)
+        return;
+
+    lms_file_cache_free(lms->file_cache);
+    lms->file_cache = NULL;
+}
+
+/*
+ * Called once every file was written: states of walked directories are
+ * only written if it succeeded.
+ */
+static int
+_process_dir_states_finish(lms_t *lms, int r)
+{
+    if (!lms->dir_states)
+        return r;
+
+    if (r == 0)
+        lms_dir_states_commit(lms->dir_states);
+    lms_dir_states_free(lms->dir_states);
+    lms->dir_states = NULL;
+
+    return r;
+}
+
+/*
+ * Done by master before forking: get the update id all slaves will use
+ * and, when there are many of them, have parsers create their tables so
+ * slaves don't race on schema changes.
+ */
+static int
+_pool_prepare_db(struct pool *pool)
+{
+    lms_t *lms = pool->common.lms;
+    struct db *db;
+    int r;
+
+    db = _db_open(lms);
+    if (!db)
+        return -1;
+
+    if (pool->n_workers > 1) {
+        lms_parsers_setup(lms, db->handle);
+        lms_parsers_finish(lms, db->handle);
+    }
+
+    r = lms_db_update_id_get(db->handle);
+    if (r < 0)
+        fprintf(stderr, "ERROR: could not get global update id.\n");
+    else {
+        pool->common.update_id = r + 1;
+        r = 0;
+    }
+
+    _db_close(db);
+    return r;
+}
+
+/* default slaves first, then the ones of each of lms->slave_pools */
+static int
+_pool_groups_new(struct pool *pool)
+{
+    const lms_t *lms = pool->common.lms;
+    struct pinfo *w = pool->workers;
+    unsigned int i, j;
+
+    pool->n_groups = lms->n_slave_pools + 1;
+    pool->groups = calloc(pool->n_groups, sizeof(*pool->groups));
+    if (!pool->groups) {
+        perror("calloc");
+        return -1;
+    }
+
+    for (i = 0; i < pool->n_groups; i++) {
+        struct pool_group *g = pool->groups + i;
+        int timeout;
+
+        if (i == 0) {
+            g->n_workers = lms->worker_count;
+            timeout = lms->slave_timeout;
+        } else {
+            g->n_workers = lms->slave_pools[i - 1].workers;
+            timeout = lms->slave_pools[i - 1].slave_timeout;
+        }
+
+        g->workers = w;
+        for (j = 0; j < g->n_workers; j++, w++)
+            w->slave_timeout = timeout;
+    }
+
+    pool->parser_match = NULL;
+    for (i = 0; i < (unsigned int)lms->n_parsers; i++)
+        if (lms->parsers[i].slave_pool)
+            break;
+
+    if (i < (unsigned int)lms->n_parsers) {
+        pool->parser_match = malloc(lms->n_parsers *
+                                    sizeof(*pool->parser_match));
+        if (!pool->parser_match) {
+            perror("malloc");
+            free(pool->groups);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void
+_pool_groups_free(struct pool *pool)
+{
+    free(pool->parser_match);
+    free(pool->groups);
+}
+
+static int
+_pool_new(struct pool *pool, lms_t *lms)
+{
+    unsigned int i;
+
+    pool->common.lms = lms;
+    pool->n_workers = lms->worker_count;
+    for (i = 0; i < lms->n_slave_pools; i++)
+        pool->n_workers += lms->slave_pools[i].workers;
+    pool->error = 0;
+
+    if (_pool_prepare_db(pool) != 0)
+        return -1;
+
+    pool->workers = calloc(pool->n_workers, sizeof(*pool->workers));
+    if (!pool->workers) {
+        perror("calloc");
+        return -1;
+    }
+
+    pool->pfds = calloc(pool->n_workers, sizeof(*pool->pfds));
+    if (!pool->pfds) {
+        perror("calloc");
+        free(pool->workers);
+        return -1;
+    }
+
+    if (_pool_groups_new(pool) != 0) {
+        free(pool->pfds);
+        free(pool->workers);
+        return -1;
+    }
+
+    for (i = 0; i < pool->n_workers; i++) {
+        struct pinfo *w = pool->workers + i;
+
+        w->common = pool->common;
+        if (lms_create_pipes(w) != 0)
+            goto error;
+
+        if (lms_create_slave(w, _slave_work) != 0) {
+            lms_close_pipes(w);
+            goto error;
+        }
+    }
+
+    return 0;
+
+  error:
+    pool->n_workers = i;
+    for (i = 0; i < pool->n_workers; i++) {
+        lms_finish_slave(pool->workers + i, _master_send_finish);
+        lms_close_pipes(pool->workers + i);
+    }
+    _pool_groups_free(pool);
+    free(pool->pfds);
+    free(pool->workers);
+    return -2;
+}
+
+/* Return: < 0 if any slave exited with an error, like failing to write. */
+static int
+_pool_free(struct pool *pool)
+{
+    unsigned int i;
+    int r = 0;
+
+    for (i = 0; i < pool->n_workers; i++) {
+        if (lms_finish_slave(pool->workers + i, _master_send_finish) < 0)
+            r = -1;
+        lms_close_pipes(pool->workers + i);
+    }
+
+    _pool_groups_free(pool);
+    free(pool->pfds);
+    free(pool->workers);
+
+    return r;
+}
+
 /**
  * Process the given directory or file.
  *
  * This will add or update media found in the given directory or its children.
  *
+ * Files are handed to lms_get_worker_count() slave processes, each one
+ * subject to its own slave timeout, or to the slaves of the pool their
+ * parser was given, see lms_slave_pool_add(). Every slave is given a
+ * few paths ahead, so walking directories overlaps with parsing; as a
+ * consequence a parse error may only stop the walk some files later.
+ * Progress callbacks are always called from the calling process.
+ *
  * @param lms previously allocated Light Media Scanner instance.
  * @param top_path top directory or file to scan.
  *
@@ -1070,31 +2080,39 @@ _process_trigger(struct cinfo *info, const char *top_path, process_file_callback
 int
 lms_process(lms_t *lms, const char *top_path)
 {
-    struct pinfo pinfo;
-    int r;
+    struct pool pool;
+    int r, r2;
 
     r = _lms_process_check_valid(lms, top_path);
     if (r < 0)
         return r;
 
-    pinfo.common.lms = lms;
-
-    if (lms_create_pipes(&pinfo) != 0) {
-        r = -1;
-        goto end;
+    lms_stats_begin(lms);
+    _process_file_cache_new(lms, top_path);
+    r = _pool_new(&pool, lms);
+    if (r < 0) {
+        _process_file_cache_free(lms);
+        lms_stats_end(lms);
+        return r;
     }
 
-    if (lms_create_slave(&pinfo, _slave_work) != 0) {
-        r = -2;
-        goto close_pipes;
+    r = _process_trigger(&pool.common, top_path, _process_file);
+
+    r2 = _pool_drain(&pool);
+    if (r >= 0) {
+        if (r2 < 0)
+            r = r2;
+        else if (pool.error)
+            r = pool.error;
     }
 
-    r = _process_trigger(&pinfo.common, top_path, _process_file);
+    r2 = _pool_free(&pool);
+    if (r >= 0 && r2 < 0)
+        r = r2;
 
-    lms_finish_slave(&pinfo, _master_send_finish);
-  close_pipes:
-    lms_close_pipes(&pinfo);
-  end:
+    _process_file_cache_free(lms);
+    r = _process_dir_states_finish(lms, r);
+    lms_stats_end(lms);
     return r;
 }
 
@@ -1120,12 +2138,15 @@ lms_process_single_process(lms_t *lms, const char *top_path)
         return r;
 
     sinfo.common.lms = lms;
-    sinfo.commit_counter = 0;
-    sinfo.total_committed = 0;
 
+    lms_stats_begin(lms);
+    _process_file_cache_new(lms, top_path);
     r = _db_and_parsers_setup(sinfo.common.lms, &sinfo.db, &sinfo.parser_match);
-    if (r < 0)
+    if (r < 0) {
+        _process_file_cache_free(lms);
+        lms_stats_end(lms);
         return r;
+    }
 
     r = lms_db_update_id_get(sinfo.db->handle);
     if (r < 0) {
@@ -1135,22 +2156,80 @@ lms_process_single_process(lms_t *lms, const char *top_path)
 
     sinfo.common.update_id = r + 1;
 
-    lms_db_begin_transaction(sinfo.db->transaction_begin);
+    r = _db_writer_start(lms, sinfo.db, sinfo.common.update_id);
+    if (r < 0)
+        goto done;
 
     r = _process_trigger(&sinfo.common, top_path, _process_file_single_process);
 
-    /* Check only if there are remaining commits to do */
-    if (sinfo.commit_counter) {
-        sinfo.total_committed += sinfo.commit_counter;
-        lms_db_update_id_set(sinfo.db->handle, sinfo.common.update_id);
-    }
-
-    lms_db_end_transaction(sinfo.db->transaction_commit);
+    if (_db_writer_stop(sinfo.db) > 0 && r >= 0)
+        r = -1;
+    r = _process_dir_states_finish(lms, r);
 
 done:
     free(sinfo.parser_match);
     lms_parsers_finish(lms, sinfo.db->handle);
     _db_close(sinfo.db);
+    _process_file_cache_free(lms);
+    lms_stats_end(lms);
+    return r;
+}
+
+/**
+ * Process the given directory or file using threads instead of processes.
+ *
+ * This will add or update media found in the given directory or its children.
+ *
+ * Calling thread walks directories while lms_get_worker_count() threads
+ * run parsers and another one writes to the database. There is no crash
+ * isolation nor slave timeout: if a parser crashes or hangs, so does
+ * this call. Use it only with trusted parsers and media.
+ *
+ * Parsers must not keep per file state outside their own instance, as
+ * each thread uses its own instance of every parser. Progress callbacks
+ * may be called from any of these threads, but never concurrently.
+ *
+ * @param lms previously allocated Light Media Scanner instance.
+ * @param top_path top directory or file to scan.
+ *
+ * @return On success 0 is returned.
+ */
+int
+lms_process_threaded(lms_t *lms, const char *top_path)
+{
+    struct tinfo tinfo;
+    int r, r2;
+
+    r = _lms_process_check_valid(lms, top_path);
+    if (r < 0)
+        return r;
+
+    tinfo.common.lms = lms;
+    lms_stats_begin(lms);
+    _process_file_cache_new(lms, top_path);
+    tinfo.tp = lms_tpool_new(lms);
+    if (!tinfo.tp) {
+        _process_file_cache_free(lms);
+        lms_stats_end(lms);
+        return -5;
+    }
+
+    tinfo.get_file_info =
+        lms_db_compile_stmt_get_file_info(lms_tpool_get_db(tinfo.tp));
+    if (!tinfo.get_file_info)
+        r = -6;
+    else {
+        r = _process_trigger(&tinfo.common, top_path, _process_file_threaded);
+        lms_db_finalize_stmt(tinfo.get_file_info, "get_file_info");
+    }
+
+    r2 = lms_tpool_free(tinfo.tp);
+    if (r >= 0 && r2)
+        r = r2;
+
+    _process_file_cache_free(lms);
+    r = _process_dir_states_finish(lms, r);
+    lms_stats_end(lms);
     return r;
 }
 
@@ -0,0 +1,501 @@
+/**
+ * Copyright (C) 2008-2011 by ProFUSION embedded systems
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * @author Gustavo Sverzut Barbieri <barbieri@profusion.mobi>
+ */
+
+/*
+ * File reader for plugins, so parsing small fields costs memcpy()
+ * instead of one lseek() and read() each.
+ *
+ * Buffered readers keep a read-ahead window filled with pread(), the
+ * first one usually has the whole header. Mapped readers copy from a
+ * mapping of the whole file; if the file is truncated meanwhile the
+ * SIGBUS is caught, the mapping dropped and the reader goes on
+ * buffered, getting the short reads pread() gives.
+ *
+ * The reader given to parsers in lms_file_info is created by the core
+ * with lms_reader_prefetch_new(): the file is only opened when a parser
+ * first reads it, then its head and tail are read at once and shared by
+ * all parsers matching the file.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "lightmediascanner_plugin.h"
+#include "lightmediascanner_private.h"
+
+#define READER_BUFSIZE 4096
+#define READER_PREFETCH_HEAD 16384 /* id3v2, exif, asf header... */
+#define READER_PREFETCH_TAIL 4096 /* id3v1, playlist entries count */
+
+struct reader_window {
+    unsigned char *data;
+    off_t off;
+    size_t len;
+};
+
+struct lms_reader {
+    int fd; /* -1 until first read if prefetching */
+    const char *path; /* to open, NULL once opened */
+    off_t size;
+    off_t pos;
+    const unsigned char *map; /* whole file, NULL if buffered */
+    struct reader_window head; /* prefetched */
+    struct reader_window tail; /* prefetched */
+    struct reader_window ahead; /* read-ahead from last miss */
+    unsigned int prefetch:1; /* head and tail on first read */
+};
+
+static __thread sigjmp_buf *volatile _fault_jmp; /* set while copying from map */
+static struct sigaction _old_sigbus;
+static pthread_once_t _sigbus_once = PTHREAD_ONCE_INIT;
+
+static void
+_sigbus_handler(int sig, siginfo_t *si, void *ctx)
+{
+    if (_fault_jmp)
+        siglongjmp(*_fault_jmp, 1);
+
+    /* not from a reader, behave as before */
+    if (_old_sigbus.sa_flags & SA_SIGINFO)
+        _old_sigbus.sa_sigaction(sig, si, ctx);
+    else if (_old_sigbus.sa_handler != SIG_DFL &&
+             _old_sigbus.sa_handler != SIG_IGN)
+        _old_sigbus.sa_handler(sig);
+    else {
+        signal(sig, SIG_DFL);
+        raise(sig);
+    }
+}
+
+/*
+ * SA_NODEFER as siglongjmp() doesn't restore the signal mask, saving it
+ * with sigsetjmp() would cost a syscall per copy.
+ */
+static void
+_sigbus_setup(void)
+{
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = _sigbus_handler;
+    sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGBUS, &sa, &_old_sigbus) != 0)
+        perror("sigaction");
+}
+
+/* Return: 0 on success, -1 if pages went away */
+static int
+_map_copy(const struct lms_reader *r, void *buf, size_t len, off_t off)
+{
+    sigjmp_buf jmp;
+
+    if (sigsetjmp(jmp, 0)) {
+        _fault_jmp = NULL;
+        return -1;
+    }
+
+    _fault_jmp = &jmp;
+    memcpy(buf, r->map + off, len);
+    _fault_jmp = NULL;
+
+    return 0;
+}
+
+static void
+_unmap(struct lms_reader *r)
+{
+    munmap((void *)r->map, r->size);
+    r->map = NULL;
+}
+
+static ssize_t
+_pread(int fd, void *buf, size_t len, off_t off)
+{
+    ssize_t n;
+
+    do {
+        n = pread(fd, buf, len, off);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0)
+        perror("pread");
+
+    return n;
+}
+
+static ssize_t
+_window_fill(int fd, struct reader_window *w, size_t size, off_t off)
+{
+    ssize_t n;
+
+    if (!w->data) {
+        w->data = malloc(size);
+        if (!w->data) {
+            perror("malloc");
+            return -1;
+        }
+    }
+
+    n = _pread(fd, w->data, size, off);
+    w->off = off;
+    w->len = n > 0 ? n : 0;
+
+    return n;
+}
+
+static inline const struct reader_window *
+_window_find(const struct lms_reader *r, off_t off)
+{
+    const struct reader_window *w[] = {&r->ahead, &r->head, &r->tail};
+    unsigned int i;
+
+    for (i = 0; i < sizeof(w) / sizeof(*w); i++)
+        if (off >= w[i]->off && off < w[i]->off + (off_t)w[i]->len)
+            return w[i];
+
+    return NULL;
+}
+
+/* one pread() for the whole file if both windows would cover it */
+static void
+_prefetch(struct lms_reader *r)
+{
+    if (r->size <= READER_PREFETCH_HEAD + READER_PREFETCH_TAIL) {
+        if (r->size > 0)
+            _window_fill(r->fd, &r->head, r->size, 0);
+        return;
+    }
+
+    _window_fill(r->fd, &r->head, READER_PREFETCH_HEAD, 0);
+    _window_fill(r->fd, &r->tail, READER_PREFETCH_TAIL,
+                 r->size - READER_PREFETCH_TAIL);
+}
+
+/* Return: 0 on success, -1 if file couldn't be opened */
+static int
+_open(struct lms_reader *r)
+{
+    const char *path = r->path;
+
+    if (r->fd >= 0)
+        return 0;
+    else if (!path) {
+        errno = EBADF;
+        return -1;
+    }
+
+    r->path = NULL;
+    r->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (r->fd < 0) {
+        perror("open");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+_open_lazy(struct lms_reader *r)
+{
+    if (_open(r) != 0)
+        return -1;
+
+    if (r->prefetch) {
+        r->prefetch = 0;
+        _prefetch(r);
+    }
+
+    return 0;
+}
+
+static ssize_t
+_buffered_read(struct lms_reader *r, unsigned char *buf, size_t len, off_t off)
+{
+    size_t done = 0;
+
+    while (len > 0) {
+        const struct reader_window *w;
+        ssize_t n;
+
+        w = _window_find(r, off);
+        if (w) {
+            n = w->off + w->len - off;
+            if ((size_t)n > len)
+                n = len;
+            memcpy(buf + done, w->data + (off - w->off), n);
+        } else if (len >= READER_BUFSIZE)
+            /* would not fit the window anyway */
+            n = _pread(r->fd, buf + done, len, off);
+        else {
+            n = _window_fill(r->fd, &r->ahead, READER_BUFSIZE, off);
+            if (n > 0)
+                continue;
+        }
+
+        if (n < 0)
+            return done > 0 ? (ssize_t)done : -1;
+        else if (n == 0)
+            break;
+
+        done += n;
+        off += n;
+        len -= n;
+    }
+
+    return done;
+}
+
+/**
+ * Open file to be read by parser.
+ *
+ * @param path file to read.
+ * @param mode LMS_READER_MMAP to map whole file, only pays off if
+ *        parser jumps around big files, LMS_READER_BUFFERED otherwise.
+ *        LMS_READER_AUTO is the same as buffered.
+ * @return new reader or NULL on errors.
+ * @ingroup LMS_Plugin
+ */
+lms_reader_t *
+lms_reader_open(const char *path, lms_reader_mode_t mode)
+{
+    struct lms_reader *r;
+    struct stat st;
+
+    r = calloc(1, sizeof(*r));
+    if (!r) {
+        perror("calloc");
+        return NULL;
+    }
+
+    r->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (r->fd < 0) {
+        perror("open");
+        free(r);
+        return NULL;
+    }
+
+    if (fstat(r->fd, &st) != 0) {
+        perror("fstat");
+        close(r->fd);
+        free(r);
+        return NULL;
+    }
+    r->size = st.st_size;
+
+    if (mode == LMS_READER_MMAP && r->size > 0) {
+        void *map;
+
+        pthread_once(&_sigbus_once, _sigbus_setup);
+        map = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, r->fd, 0);
+        if (map != MAP_FAILED)
+            r->map = map;
+        else
+            perror("mmap");
+    }
+
+    return r;
+}
+
+/*
+ * Reader for parsers of a file, see lms_file_info. The file is only
+ * opened on first read, path must be valid until then.
+ */
+lms_reader_t *
+lms_reader_prefetch_new(const char *path, off_t size)
+{
+    struct lms_reader *r;
+
+    r = calloc(1, sizeof(*r));
+    if (!r) {
+        perror("calloc");
+        return NULL;
+    }
+
+    r->fd = -1;
+    r->path = path;
+    r->size = size;
+    r->prefetch = 1;
+
+    return r;
+}
+
+/*
+ * Read first bytes of file without prefetching, most files only looked
+ * at to find their type are not parsed.
+ */
+ssize_t
+lms_reader_peek(lms_reader_t *r, void *buf, size_t len)
+{
+    if (_open(r) != 0)
+        return -1;
+    else if (r->prefetch)
+        return _pread(r->fd, buf, len, 0);
+
+    return lms_reader_pread(r, buf, len, 0);
+}
+
+/**
+ * Close reader and its file. The file is also dropped from page cache,
+ * scanners read each file once.
+ *
+ * @param r reader returned by lms_reader_open().
+ * @return On success 0 is returned.
+ * @ingroup LMS_Plugin
+ */
+int
+lms_reader_close(lms_reader_t *r)
+{
+    int ret = 0;
+
+    if (r->map)
+        _unmap(r);
+
+    if (r->fd >= 0) {
+        posix_fadvise(r->fd, 0, 0, POSIX_FADV_DONTNEED);
+        ret = close(r->fd);
+    }
+
+    free(r->head.data);
+    free(r->tail.data);
+    free(r->ahead.data);
+    free(r);
+
+    return ret;
+}
+
+/**
+ * File descriptor, to use with other libraries. Its offset is not
+ * changed by reads.
+ *
+ * @return file descriptor or -1 if file couldn't be opened.
+ * @ingroup LMS_Plugin
+ */
+int
+lms_reader_fd(lms_reader_t *r)
+{
+    _open_lazy(r);
+    return r->fd;
+}
+
+/**
+ * File size when it was opened.
+ *
+ * @ingroup LMS_Plugin
+ */
+off_t
+lms_reader_size(const lms_reader_t *r)
+{
+    return r->size;
+}
+
+/**
+ * Read from given offset, as pread(2).
+ *
+ * @param r reader returned by lms_reader_open().
+ * @param buf where to store bytes.
+ * @param len how many bytes to read.
+ * @param off file offset to read from.
+ * @return bytes read, less than @a len at end of file, or -1 on errors.
+ * @ingroup LMS_Plugin
+ */
+ssize_t
+lms_reader_pread(lms_reader_t *r, void *buf, size_t len, off_t off)
+{
+    if (off < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (r->map) {
+        if (off >= r->size)
+            return 0;
+        if ((off_t)len > r->size - off)
+            len = r->size - off;
+        if (_map_copy(r, buf, len, off) == 0)
+            return len;
+
+        fprintf(stderr, "WARNING: file was truncated while mapped, "
+                "reading it instead.\n");
+        _unmap(r);
+    }
+
+    if (_open_lazy(r) != 0)
+        return -1;
+
+    return _buffered_read(r, buf, len, off);
+}
+
+/**
+ * Read from current offset and move it, as read(2).
+ *
+ * @ingroup LMS_Plugin
+ */
+ssize_t
+lms_reader_read(lms_reader_t *r, void *buf, size_t len)
+{
+    ssize_t n;
+
+    n = lms_reader_pread(r, buf, len, r->pos);
+    if (n > 0)
+        r->pos += n;
+
+    return n;
+}
+
+/**
+ * Change current offset, as lseek(2). No syscall is done, seeking past
+ * end of file is allowed and reads will return 0.
+ *
+ * @return new offset or -1 if it would be negative.
+ * @ingroup LMS_Plugin
+ */
+off_t
+lms_reader_seek(lms_reader_t *r, off_t off, int whence)
+{
+    off_t pos;
+
+    if (whence == SEEK_SET)
+        pos = off;
+    else if (whence == SEEK_CUR)
+        pos = r->pos + off;
+    else if (whence == SEEK_END)
+        pos = r->size + off;
+    else
+        pos = -1;
+
+    if (pos < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    r->pos = pos;
+    return pos;
+}
@@ -0,0 +1,247 @@
+/**
+ * Copyright (C) 2008-2011 by ProFUSION embedded systems
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * @author Gustavo Sverzut Barbieri <barbieri@profusion.mobi>
+ */
+
+/*
+ * Single producer, single consumer byte ring shared between master and
+ * slave, an alternative to pipes that avoids copying records through
+ * the kernel.
+ *
+ * Each ring comes with an eventfd, used just like the pipe read end was:
+ * consumer poll()s it with the slave timeout. To avoid one syscall per
+ * record, producer only writes to it if consumer announced it is about
+ * to sleep (lms_ring_prepare_wait()).
+ */
+
+#include <sys/mman.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "lightmediascanner_private.h"
+
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+
+#define RING_SIZE IOBUF_SIZE /* must be power of 2 */
+
+struct ring {
+    uint32_t head; /* written by producer only */
+    uint32_t tail; /* written by consumer only */
+    uint32_t waiting;
+    char data[RING_SIZE];
+};
+
+struct ring *
+lms_ring_new(void)
+{
+    struct ring *r;
+
+    r = mmap(NULL, sizeof(*r), PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (r == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    r->head = 0;
+    r->tail = 0;
+    r->waiting = 0;
+    return r;
+}
+
+void
+lms_ring_free(struct ring *r)
+{
+    if (munmap(r, sizeof(*r)) != 0)
+        perror("munmap");
+}
+
+int
+lms_ring_event_new(void)
+{
+    int fd;
+
+    fd = eventfd(0, EFD_NONBLOCK);
+    if (fd < 0)
+        perror("eventfd");
+    return fd;
+}
+
+void
+lms_ring_clear_event(int efd)
+{
+    eventfd_t v;
+
+    eventfd_read(efd, &v); /* EAGAIN if it was not signaled */
+}
+
+/* only safe while the other side is not running, ie: restarting slave */
+void
+lms_ring_reset(struct ring *r, int efd)
+{
+    r->head = 0;
+    r->tail = 0;
+    r->waiting = 0;
+    lms_ring_clear_event(efd);
+}
+
+int
+lms_ring_write(struct ring *r, int efd, const void *data, unsigned int size)
+{
+    uint32_t head, tail;
+    unsigned int off, n;
+
+    head = r->head;
+    tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+
+    /* window limits what is in flight, this should never happen */
+    if (size > RING_SIZE - (head - tail)) {
+        fprintf(stderr, "ERROR: ring is full, %u bytes pending.\n",
+                head - tail);
+        return -1;
+    }
+
+    off = head & (RING_SIZE - 1);
+    n = RING_SIZE - off;
+    if (n > size)
+        n = size;
+    memcpy(r->data + off, data, n);
+    memcpy(r->data, (const char *)data + n, size - n);
+    __atomic_store_n(&r->head, head + size, __ATOMIC_RELEASE);
+
+    /* pairs with lms_ring_prepare_wait(): either consumer sees the new
+     * head or we see it's going to sleep.
+     */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&r->waiting, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&r->waiting, 0, __ATOMIC_RELAXED);
+        if (eventfd_write(efd, 1) != 0) {
+            perror("eventfd_write");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+unsigned int
+lms_ring_read(struct ring *r, void *buf, unsigned int size)
+{
+    uint32_t head, tail;
+    unsigned int off, n;
+
+    tail = r->tail;
+    head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+
+    if (size > head - tail)
+        size = head - tail;
+
+    off = tail & (RING_SIZE - 1);
+    n = RING_SIZE - off;
+    if (n > size)
+        n = size;
+    memcpy(buf, r->data + off, n);
+    memcpy((char *)buf + n, r->data, size - n);
+    __atomic_store_n(&r->tail, tail + size, __ATOMIC_RELEASE);
+
+    return size;
+}
+
+unsigned int
+lms_ring_available(const struct ring *r)
+{
+    return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - r->tail;
+}
+
+/*
+ * Announce consumer is about to sleep on the eventfd.
+ *
+ * Return: bytes available, if 0 it is safe to poll() the eventfd.
+ */
+unsigned int
+lms_ring_prepare_wait(struct ring *r)
+{
+    unsigned int avail;
+
+    __atomic_store_n(&r->waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    avail = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - r->tail;
+    if (avail)
+        __atomic_store_n(&r->waiting, 0, __ATOMIC_RELAXED);
+
+    return avail;
+}
+
+#else /* !HAVE_SYS_EVENTFD_H */
+
+struct ring *
+lms_ring_new(void)
+{
+    fprintf(stderr, "ERROR: shared memory transport is not supported.\n");
+    return NULL;
+}
+
+void
+lms_ring_free(struct ring *r)
+{
+}
+
+int
+lms_ring_event_new(void)
+{
+    return -1;
+}
+
+void
+lms_ring_clear_event(int efd)
+{
+}
+
+void
+lms_ring_reset(struct ring *r, int efd)
+{
+}
+
+int
+lms_ring_write(struct ring *r, int efd, const void *data, unsigned int size)
+{
+    return -1;
+}
+
+unsigned int
+lms_ring_read(struct ring *r, void *buf, unsigned int size)
+{
+    return 0;
+}
+
+unsigned int
+lms_ring_available(const struct ring *r)
+{
+    return 0;
+}
+
+unsigned int
+lms_ring_prepare_wait(struct ring *r)
+{
+    return 0;
+}
+
+#endif /* HAVE_SYS_EVENTFD_H */
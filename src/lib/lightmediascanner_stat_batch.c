@@ -0,0 +1,474 @@
+/**
+ * Copyright (C) 2008-2011 by ProFUSION embedded systems
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * @author Gustavo Sverzut Barbieri <barbieri@profusion.mobi>
+ */
+
+/*
+ * Batched stat() used by lms_check().
+ *
+ * Checking a row is a stat() of its path, serializing them makes check
+ * bound by the latency of each one, which is bad on network filesystems
+ * and spinning disks. Here all paths of a batch are stat'ed at once and
+ * the caller only looks at results after every one completed.
+ *
+ * If the kernel supports it, a batch is submitted to an io_uring as
+ * IORING_OP_STATX entries, otherwise it's split among a few threads
+ * doing plain stat().
+ */
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if HAVE_DECL_SYS_IO_URING_SETUP && HAVE_DECL_IORING_OP_STATX
+#define USE_IO_URING 1
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#endif
+
+#include "lightmediascanner_private.h"
+
+/* threads stat'ing when io_uring is not available */
+#define STAT_BATCH_MAX_THREADS 32
+
+#ifdef USE_IO_URING
+struct uring {
+    int fd;
+    void *sq_ptr;
+    size_t sq_size;
+    void *cq_ptr;
+    size_t cq_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned int *sq_tail;
+    unsigned int sq_mask;
+    unsigned int *sq_array;
+    unsigned int sq_entries;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int cq_mask;
+    struct io_uring_cqe *cqes;
+    struct statx *results;
+};
+#endif
+
+struct stat_pool {
+    pthread_t *threads;
+    unsigned int n_threads;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    struct stat_request *reqs;
+    unsigned int count;
+    unsigned int next;
+    unsigned int pending;
+    int quit;
+};
+
+struct stat_batch {
+    unsigned int size;
+#ifdef USE_IO_URING
+    struct uring *uring;
+    unsigned int uring_failed:1;
+#endif
+    struct stat_pool *pool;
+};
+
+#ifdef USE_IO_URING
+static void
+_uring_free(struct uring *u)
+{
+    if (u->sqes)
+        munmap(u->sqes, u->sqes_size);
+    if (u->cq_ptr && u->cq_ptr != u->sq_ptr)
+        munmap(u->cq_ptr, u->cq_size);
+    if (u->sq_ptr)
+        munmap(u->sq_ptr, u->sq_size);
+    if (u->fd >= 0)
+        close(u->fd);
+    free(u->results);
+    free(u);
+}
+
+static int
+_uring_supports_statx(int fd)
+{
+    struct io_uring_probe *probe;
+    unsigned int n = IORING_OP_STATX + 1;
+    int r;
+
+    probe = calloc(1, sizeof(*probe) + n * sizeof(probe->ops[0]));
+    if (!probe)
+        return 0;
+
+    r = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, n);
+    r = (r == 0 && probe->last_op >= IORING_OP_STATX &&
+         (probe->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED));
+
+    free(probe);
+    return r;
+}
+
+/* NULL if io_uring can't be used, caller should fallback to threads */
+static struct uring *
+_uring_new(unsigned int size)
+{
+    struct io_uring_params p;
+    struct uring *u;
+
+    u = calloc(1, sizeof(*u));
+    if (!u)
+        return NULL;
+
+    memset(&p, 0, sizeof(p));
+    u->fd = syscall(__NR_io_uring_setup, size, &p);
+    if (u->fd < 0 || !_uring_supports_statx(u->fd))
+        goto error;
+
+    u->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    u->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (u->cq_size > u->sq_size)
+            u->sq_size = u->cq_size;
+        u->cq_size = u->sq_size;
+    }
+
+    u->sq_ptr = mmap(NULL, u->sq_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_ptr == MAP_FAILED) {
+        u->sq_ptr = NULL;
+        goto error;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        u->cq_ptr = u->sq_ptr;
+    else {
+        u->cq_ptr = mmap(NULL, u->cq_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+        if (u->cq_ptr == MAP_FAILED) {
+            u->cq_ptr = NULL;
+            goto error;
+        }
+    }
+
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) {
+        u->sqes = NULL;
+        goto error;
+    }
+
+    u->sq_tail = (unsigned int *)((char *)u->sq_ptr + p.sq_off.tail);
+    u->sq_mask = *(unsigned int *)((char *)u->sq_ptr + p.sq_off.ring_mask);
+    u->sq_array = (unsigned int *)((char *)u->sq_ptr + p.sq_off.array);
+    u->sq_entries = p.sq_entries;
+    u->cq_head = (unsigned int *)((char *)u->cq_ptr + p.cq_off.head);
+    u->cq_tail = (unsigned int *)((char *)u->cq_ptr + p.cq_off.tail);
+    u->cq_mask = *(unsigned int *)((char *)u->cq_ptr + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)((char *)u->cq_ptr + p.cq_off.cqes);
+
+    u->results = malloc(size * sizeof(*u->results));
+    if (!u->results)
+        goto error;
+
+    return u;
+
+  error:
+    _uring_free(u);
+    return NULL;
+}
+
+static void
+_uring_queue(struct uring *u, const struct stat_request *req, unsigned int i)
+{
+    struct io_uring_sqe *sqe;
+    unsigned int tail, idx;
+
+    tail = *u->sq_tail;
+    idx = tail & u->sq_mask;
+    sqe = u->sqes + idx;
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uintptr_t)req->path;
+    sqe->len = STATX_TYPE | STATX_MODE | STATX_MTIME | STATX_SIZE;
+    sqe->off = (uintptr_t)(u->results + i);
+    sqe->user_data = i;
+
+    u->sq_array[idx] = idx;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/* only fields lms_check() looks at */
+static void
+_statx_to_stat(const struct statx *stx, struct stat *st)
+{
+    memset(st, 0, sizeof(*st));
+    st->st_mode = stx->stx_mode;
+    st->st_size = stx->stx_size;
+    st->st_mtime = stx->stx_mtime.tv_sec;
+}
+
+static unsigned int
+_uring_reap(struct uring *u, struct stat_request *reqs)
+{
+    struct io_uring_cqe *cqe;
+    unsigned int head, tail, n = 0;
+
+    head = *u->cq_head;
+    tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++, n++) {
+        struct stat_request *req;
+
+        cqe = u->cqes + (head & u->cq_mask);
+        req = reqs + cqe->user_data;
+        if (cqe->res < 0)
+            req->error = -cqe->res;
+        else {
+            req->error = 0;
+            _statx_to_stat(u->results + cqe->user_data, &req->st);
+        }
+    }
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+
+    return n;
+}
+
+static int
+_uring_run(struct uring *u, struct stat_request *reqs, unsigned int count)
+{
+    unsigned int queued = 0, submitted = 0, completed = 0;
+    int r;
+
+    while (completed < count) {
+        /* never more in flight than the ring holds */
+        while (queued < count && queued - completed < u->sq_entries) {
+            _uring_queue(u, reqs + queued, queued);
+            queued++;
+        }
+
+        r = syscall(__NR_io_uring_enter, u->fd, queued - submitted, 1,
+                    IORING_ENTER_GETEVENTS, NULL, 0);
+        if (r < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                completed += _uring_reap(u, reqs);
+                continue;
+            }
+            perror("io_uring_enter");
+            return -1;
+        }
+
+        submitted += r;
+        completed += _uring_reap(u, reqs);
+    }
+
+    return 0;
+}
+#endif
+
+static void *
+_stat_pool_worker(void *data)
+{
+    struct stat_pool *p = data;
+    struct stat_request *req;
+
+    pthread_mutex_lock(&p->lock);
+    while (1) {
+        while (!p->quit && p->next >= p->count)
+            pthread_cond_wait(&p->work, &p->lock);
+        if (p->quit)
+            break;
+
+        req = p->reqs + p->next;
+        p->next++;
+        pthread_mutex_unlock(&p->lock);
+
+        req->error = (stat(req->path, &req->st) == 0) ? 0 : errno;
+
+        pthread_mutex_lock(&p->lock);
+        p->pending--;
+        if (p->pending == 0)
+            pthread_cond_signal(&p->done);
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    return NULL;
+}
+
+static void
+_stat_pool_free(struct stat_pool *p)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&p->lock);
+    p->quit = 1;
+    pthread_cond_broadcast(&p->work);
+    pthread_mutex_unlock(&p->lock);
+
+    for (i = 0; i < p->n_threads; i++)
+        pthread_join(p->threads[i], NULL);
+
+    pthread_cond_destroy(&p->done);
+    pthread_cond_destroy(&p->work);
+    pthread_mutex_destroy(&p->lock);
+    free(p->threads);
+    free(p);
+}
+
+static struct stat_pool *
+_stat_pool_new(unsigned int size)
+{
+    struct stat_pool *p;
+    unsigned int n;
+
+    n = size < STAT_BATCH_MAX_THREADS ? size : STAT_BATCH_MAX_THREADS;
+
+    p = calloc(1, sizeof(*p));
+    if (!p) {
+        perror("calloc");
+        return NULL;
+    }
+
+    p->threads = malloc(n * sizeof(*p->threads));
+    if (!p->threads) {
+        perror("malloc");
+        free(p);
+        return NULL;
+    }
+
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->work, NULL);
+    pthread_cond_init(&p->done, NULL);
+
+    for (; p->n_threads < n; p->n_threads++) {
+        if (pthread_create(p->threads + p->n_threads, NULL,
+                           _stat_pool_worker, p) != 0) {
+            fprintf(stderr, "ERROR: could not create stat thread.\n");
+            break;
+        }
+    }
+
+    if (!p->n_threads) {
+        _stat_pool_free(p);
+        return NULL;
+    }
+
+    return p;
+}
+
+static void
+_stat_pool_run(struct stat_pool *p, struct stat_request *reqs, unsigned int count)
+{
+    pthread_mutex_lock(&p->lock);
+    p->reqs = reqs;
+    p->count = count;
+    p->next = 0;
+    p->pending = count;
+    pthread_cond_broadcast(&p->work);
+    while (p->pending)
+        pthread_cond_wait(&p->done, &p->lock);
+    p->reqs = NULL;
+    p->count = 0;
+    p->next = 0;
+    pthread_mutex_unlock(&p->lock);
+}
+
+static void
+_stat_sync_run(struct stat_request *reqs, unsigned int count)
+{
+    unsigned int i;
+
+    for (i = 0; i < count; i++)
+        reqs[i].error = (stat(reqs[i].path, &reqs[i].st) == 0) ? 0 : errno;
+}
+
+/* batches of up to size paths */
+struct stat_batch *
+lms_stat_batch_new(unsigned int size)
+{
+    struct stat_batch *b;
+
+    b = calloc(1, sizeof(*b));
+    if (!b) {
+        perror("calloc");
+        return NULL;
+    }
+
+    b->size = size;
+    if (size < 2)
+        return b;
+
+#ifdef USE_IO_URING
+    b->uring = _uring_new(size);
+    if (b->uring)
+        return b;
+#endif
+
+    b->pool = _stat_pool_new(size);
+    return b;
+}
+
+void
+lms_stat_batch_free(struct stat_batch *b)
+{
+#ifdef USE_IO_URING
+    if (b->uring)
+        _uring_free(b->uring);
+#endif
+    if (b->pool)
+        _stat_pool_free(b->pool);
+    free(b);
+}
+
+/*
+ * Stat every request, returning once all of them are done. Request's
+ * error is 0 and st is filled on success, errno otherwise. Only st_mode,
+ * st_size and st_mtime are guaranteed to be filled.
+ */
+void
+lms_stat_batch_run(struct stat_batch *b, struct stat_request *reqs, unsigned int count)
+{
+#ifdef USE_IO_URING
+    if (b->uring && !b->uring_failed) {
+        if (_uring_run(b->uring, reqs, count) == 0)
+            return;
+
+        /* entries may still be in flight, ring is only released by
+         * lms_stat_batch_free()
+         */
+        fprintf(stderr, "ERROR: io_uring failed, stat'ing with threads.\n");
+        b->uring_failed = 1;
+        b->pool = _stat_pool_new(b->size);
+    }
+#endif
+
+    if (b->pool && count > 1)
+        _stat_pool_run(b->pool, reqs, count);
+    else
+        _stat_sync_run(reqs, count);
+}
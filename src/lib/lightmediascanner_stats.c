@@ -0,0 +1,183 @@
+/**
+ * Copyright (C) 2008-2011 by ProFUSION embedded systems
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * @author Gustavo Sverzut Barbieri <barbieri@profusion.mobi>
+ */
+
+/*
+ * Counters of lms_get_stats(). They live in a shared mapping so slaves
+ * forked by lms_process() and lms_check() add to the same ones as the
+ * master and threads, all with atomic operations.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "lightmediascanner.h"
+#include "lightmediascanner_private.h"
+
+struct lms_stats *
+lms_stats_new(void)
+{
+    struct lms_stats *s;
+
+    s = mmap(NULL, sizeof(*s), PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (s == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    return s;
+}
+
+void
+lms_stats_free(struct lms_stats *s)
+{
+    munmap(s, sizeof(*s));
+}
+
+int64_t
+lms_stats_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Return: 0 on success, -1 if not known (not Linux or no /proc) */
+int
+lms_stats_io_get(struct lms_stats_io *io)
+{
+    unsigned long long syscr = 0, syscw = 0;
+    char line[64];
+    FILE *fp;
+
+    io->rchar = 0;
+    io->syscalls = 0;
+
+    fp = fopen("/proc/self/io", "re");
+    if (!fp)
+        return -1;
+
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "rchar: %llu", &io->rchar) == 1)
+            continue;
+        if (sscanf(line, "syscr: %llu", &syscr) == 1)
+            continue;
+        sscanf(line, "syscw: %llu", &syscw);
+    }
+    fclose(fp);
+
+    io->syscalls = syscr + syscw;
+    return 0;
+}
+
+/* add what this process did since io, done by master and each slave */
+void
+lms_stats_io_add(const lms_t *lms, const struct lms_stats_io *since)
+{
+    struct lms_stats_io now;
+
+    if (!lms->stats || lms_stats_io_get(&now) != 0)
+        return;
+
+    __atomic_fetch_add(&lms->stats->bytes_read, now.rchar - since->rchar,
+                       __ATOMIC_RELAXED);
+    __atomic_fetch_add(&lms->stats->syscalls, now.syscalls - since->syscalls,
+                       __ATOMIC_RELAXED);
+}
+
+/* reset for a new lms_process() or lms_check() */
+void
+lms_stats_begin(lms_t *lms)
+{
+    if (!lms->stats)
+        return;
+
+    memset(lms->stats, 0, sizeof(*lms->stats));
+    lms_stats_io_get(&lms->stats_io);
+}
+
+void
+lms_stats_end(lms_t *lms)
+{
+    lms_stats_io_add(lms, &lms->stats_io);
+}
+
+/* n events that took ns nanoseconds altogether */
+static void
+_timer_add(struct lms_stats_timer *t, int64_t ns, unsigned int n)
+{
+    unsigned long long us, each, max;
+    unsigned int b;
+
+    if (n < 1)
+        return;
+    if (ns < 0)
+        ns = 0;
+
+    us = (ns + 500) / 1000;
+    each = us / n;
+    b = each ? 64 - __builtin_clzll(each) : 0;
+    if (b >= LMS_STATS_BUCKETS)
+        b = LMS_STATS_BUCKETS - 1;
+
+    __atomic_fetch_add(&t->count, n, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&t->total_us, us, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&t->buckets[b], n, __ATOMIC_RELAXED);
+
+    max = __atomic_load_n(&t->max_us, __ATOMIC_RELAXED);
+    while (each > max &&
+           !__atomic_compare_exchange_n(&t->max_us, &max, each, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+void
+lms_stats_add(const lms_t *lms, lms_stats_phase_t phase, int64_t ns, unsigned int n)
+{
+    if (lms->stats)
+        _timer_add(&lms->stats->phases[phase], ns, n);
+}
+
+/* single event started at start, see lms_stats_now() */
+void
+lms_stats_time(const lms_t *lms, lms_stats_phase_t phase, int64_t start)
+{
+    if (lms->stats)
+        _timer_add(&lms->stats->phases[phase], lms_stats_now() - start, 1);
+}
+
+void
+lms_stats_time_parser(const lms_t *lms, int parser, int64_t start)
+{
+    if (lms->stats && parser < LMS_STATS_MAX_PARSERS)
+        _timer_add(&lms->stats->parsers[parser].parse,
+                   lms_stats_now() - start, 1);
+}
+
+void
+lms_stats_files(const lms_t *lms, lms_progress_status_t status, unsigned int n)
+{
+    if (lms->stats && status <= LMS_PROGRESS_STATUS_UNKNOWN)
+        __atomic_fetch_add(&lms->stats->files[status], n, __ATOMIC_RELAXED);
+}
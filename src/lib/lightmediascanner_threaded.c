@@ -0,0 +1,741 @@
+/**
+ * Copyright (C) 2008-2011 by ProFUSION embedded systems
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * @author Gustavo Sverzut Barbieri <barbieri@profusion.mobi>
+ */
+
+/*
+ * Thread pool used by lms_process_threaded() and lms_check_threaded().
+ *
+ * The calling thread walks directories (or DB rows) and pushes jobs,
+ * parser threads run plugins, each with its own plugin instances and
+ * match state, and a single writer thread owns all DB writes. Records
+ * given to lms_db_*_add() by parser threads are captured and written by
+ * the writer once the file row exists.
+ *
+ * Everybody shares one DB connection opened in serialized mode, but
+ * only the calling thread reads from it (file status) and only the
+ * writer writes, so no locking happens besides SQLite's own. Rows to
+ * check are read from a connection of their own, see
+ * lms_check_threaded().
+ */
+
+#include <pthread.h>
+#include <dlfcn.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lightmediascanner.h"
+#include "lightmediascanner_private.h"
+#include "lightmediascanner_db_private.h"
+
+#define TPOOL_QUEUE_SIZE 256
+
+struct tjob {
+    struct tjob *next;
+    struct lms_file_info finfo;
+    unsigned int flags;
+    int status;
+    struct lms_db_record_list records;
+    char path[];
+};
+
+struct tqueue {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    struct tjob *head;
+    struct tjob *tail;
+    unsigned int count;
+    unsigned int max;
+    int closed;
+};
+
+struct tparser {
+    struct tpool *tp;
+    pthread_t thread;
+    struct parser *parsers; /* of lms, with this thread's plugins */
+    int n_plugins; /* started */
+    void **parser_match;
+    struct lms_context ctxt;
+    unsigned int running:1;
+};
+
+struct tpool {
+    lms_t *lms;
+    unsigned int update_id;
+    sqlite3 *handle;
+    struct writer *writer;
+    struct tqueue parse;
+    struct tqueue write;
+    struct tparser *parsers;
+    unsigned int n_parsers;
+    pthread_t writer_thread;
+    pthread_mutex_t progress_lock;
+    lms_progress_callback_t progress_cb;
+    void *progress_data;
+    int error;
+    unsigned int writer_running:1;
+    unsigned int parsers_started:1;
+};
+
+/***********************************************************************
+ * Job queues.
+ ***********************************************************************/
+
+static int
+_tqueue_init(struct tqueue *q, unsigned int max)
+{
+    memset(q, 0, sizeof(*q));
+    q->max = max;
+
+    if (pthread_mutex_init(&q->lock, NULL) != 0)
+        return -1;
+    if (pthread_cond_init(&q->not_empty, NULL) != 0) {
+        pthread_mutex_destroy(&q->lock);
+        return -1;
+    }
+    if (pthread_cond_init(&q->not_full, NULL) != 0) {
+        pthread_cond_destroy(&q->not_empty);
+        pthread_mutex_destroy(&q->lock);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+_tjob_free(struct tjob *job)
+{
+    lms_db_record_list_clear(&job->records);
+    free(job);
+}
+
+static void
+_tqueue_shutdown(struct tqueue *q)
+{
+    struct tjob *job, *next;
+
+    for (job = q->head; job; job = next) {
+        next = job->next;
+        _tjob_free(job);
+    }
+
+    pthread_cond_destroy(&q->not_full);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_mutex_destroy(&q->lock);
+}
+
+/* blocks while full. Return: 0 on success, -1 if closed. */
+static int
+_tqueue_push(struct tqueue *q, struct tjob *job)
+{
+    pthread_mutex_lock(&q->lock);
+    while (q->count >= q->max && !q->closed)
+        pthread_cond_wait(&q->not_full, &q->lock);
+
+    if (q->closed) {
+        pthread_mutex_unlock(&q->lock);
+        return -1;
+    }
+
+    job->next = NULL;
+    if (q->tail)
+        q->tail->next = job;
+    else
+        q->head = job;
+    q->tail = job;
+    q->count++;
+
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+    return 0;
+}
+
+/*
+ * Blocks while empty, up to timeout milliseconds (< 0 is forever).
+ *
+ * Return: 0 with job set, 1 on timeout, -1 once closed and empty.
+ */
+static int
+_tqueue_pop(struct tqueue *q, int timeout, struct tjob **job)
+{
+    struct timespec deadline;
+    int r = 0;
+
+    if (timeout >= 0) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout / 1000;
+        deadline.tv_nsec += (long)(timeout % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    pthread_mutex_lock(&q->lock);
+    while (!q->head && !q->closed && r == 0) {
+        if (timeout < 0)
+            pthread_cond_wait(&q->not_empty, &q->lock);
+        else
+            r = pthread_cond_timedwait(&q->not_empty, &q->lock, &deadline);
+    }
+
+    *job = q->head;
+    if (*job) {
+        q->head = (*job)->next;
+        if (!q->head)
+            q->tail = NULL;
+        q->count--;
+        pthread_cond_signal(&q->not_full);
+        r = 0;
+    } else
+        r = q->closed ? -1 : 1;
+
+    pthread_mutex_unlock(&q->lock);
+    return r;
+}
+
+/* no more pushes, consumers exit once it's empty */
+static void
+_tqueue_close(struct tqueue *q)
+{
+    pthread_mutex_lock(&q->lock);
+    q->closed = 1;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_cond_broadcast(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+}
+
+/***********************************************************************
+ * Common.
+ ***********************************************************************/
+
+/* progress callback may be called from any thread, serialize calls */
+static void
+_tpool_progress(lms_t *lms, const char *path, int path_len, lms_progress_status_t status, void *data)
+{
+    struct tpool *tp = data;
+
+    pthread_mutex_lock(&tp->progress_lock);
+    tp->progress_cb(lms, path, path_len, status, tp->progress_data);
+    pthread_mutex_unlock(&tp->progress_lock);
+}
+
+static inline void
+_report_progress(struct tpool *tp, const struct lms_file_info *finfo, lms_progress_status_t status)
+{
+    lms_t *lms = tp->lms;
+
+    lms_stats_files(lms, status, 1);
+
+    if (lms->dir_states && status != LMS_PROGRESS_STATUS_UP_TO_DATE &&
+        status != LMS_PROGRESS_STATUS_PROCESSED &&
+        status != LMS_PROGRESS_STATUS_SKIPPED)
+        lms_dir_states_fail(lms->dir_states, finfo->path, finfo->path_len);
+
+    if (!tp->progress_cb)
+        return;
+
+    _tpool_progress(lms, finfo->path, finfo->path_len, status, tp);
+}
+
+static void
+_tpool_set_error(struct tpool *tp, int error)
+{
+    int none = 0;
+
+    __atomic_compare_exchange_n(&tp->error, &none, error, 0,
+                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+/***********************************************************************
+ * Parser threads.
+ ***********************************************************************/
+
+/*
+ * Plugins keep state (ie: charset converters) in their instance, so each
+ * thread gets its own, loaded from the same shared object.
+ */
+static int
+_tparser_start(struct tparser *p, lms_t *lms, sqlite3 *db)
+{
+    int i;
+
+    p->parsers = malloc(lms->n_parsers * sizeof(*p->parsers));
+    p->parser_match = malloc(lms->n_parsers * sizeof(*p->parser_match));
+    if (!p->parsers || !p->parser_match) {
+        perror("malloc");
+        return -1;
+    }
+    memcpy(p->parsers, lms->parsers, lms->n_parsers * sizeof(*p->parsers));
+
+    p->ctxt.db = db;
+    p->ctxt.cs_conv = lms_charset_conv_dup(lms->cs_conv);
+    if (!p->ctxt.cs_conv)
+        return -2;
+
+    for (i = 0; i < lms->n_parsers; i++) {
+        lms_plugin_t *(*plugin_open)(void);
+        lms_plugin_t *plugin;
+
+        plugin_open = dlsym(lms->parsers[i].dl_handle, "lms_plugin_open");
+        if (!plugin_open) {
+            fprintf(stderr, "ERROR: could not find plugin entry point %s\n",
+                    dlerror());
+            return -3;
+        }
+
+        plugin = plugin_open();
+        if (!plugin) {
+            fprintf(stderr, "ERROR: plugin \"%s\" failed to init.\n",
+                    lms->parsers[i].so_path);
+            return -4;
+        }
+
+        if (plugin->setup(plugin, &p->ctxt) != 0 ||
+            plugin->start(plugin, &p->ctxt) != 0) {
+            fprintf(stderr, "ERROR: parser \"%s\" failed to start.\n",
+                    plugin->name);
+            plugin->finish(plugin, &p->ctxt);
+            plugin->close(plugin);
+            return -5;
+        }
+
+        p->parsers[i].plugin = plugin;
+        p->n_plugins = i + 1;
+    }
+
+    return 0;
+}
+
+static void
+_tparser_finish(struct tparser *p)
+{
+    int i;
+
+    for (i = 0; i < p->n_plugins; i++) {
+        lms_plugin_t *plugin = p->parsers[i].plugin;
+
+        if (plugin->finish(plugin, &p->ctxt) != 0)
+            fprintf(stderr, "ERROR: parser \"%s\" failed to finish.\n",
+                    plugin->name);
+        if (plugin->close(plugin) != 0)
+            fprintf(stderr, "ERROR: parser \"%s\" failed to deinit.\n",
+                    plugin->name);
+    }
+
+    if (p->ctxt.cs_conv)
+        lms_charset_conv_free(p->ctxt.cs_conv);
+    free(p->parser_match);
+    free(p->parsers);
+}
+
+static void *
+_tparser_work(void *data)
+{
+    struct tparser *p = data;
+    struct tpool *tp = p->tp;
+    struct tjob *job;
+
+    while (_tqueue_pop(&tp->parse, -1, &job) == 0) {
+        if (lms_parsers_check_using(tp->lms, p->parsers, p->parser_match,
+                                    &job->finfo)) {
+            lms_db_record_capture_start(&job->records);
+            job->status = lms_parsers_run(tp->lms, p->parsers, &p->ctxt,
+                                          p->parser_match, &job->finfo);
+            lms_db_record_capture_stop();
+        } else if (job->flags & TJOB_CHECK)
+            job->status = 0; /* still must update the file row */
+        else {
+            _report_progress(tp, &job->finfo, LMS_PROGRESS_STATUS_SKIPPED);
+            _tjob_free(job);
+            continue;
+        }
+
+        if (_tqueue_push(&tp->write, job) != 0)
+            _tjob_free(job);
+    }
+
+    return NULL;
+}
+
+/***********************************************************************
+ * Writer thread.
+ ***********************************************************************/
+
+/*
+ * Queue the job's changes in the writer, they are written in batches.
+ *
+ * Return:
+ *  LMS_PROGRESS_STATUS_PROCESSED
+ *  LMS_PROGRESS_STATUS_DELETED
+ *  < 0 on error
+ */
+static int
+_tpool_write(struct tpool *tp, struct tjob *job)
+{
+    struct lms_file_info *finfo = &job->finfo;
+    enum writer_op op;
+
+    if (job->status < 0) {
+        if (finfo->id > 0)
+            lms_writer_queue(tp->writer, finfo, WRITER_OP_DELETE, NULL);
+        return job->status;
+    }
+
+    if (job->flags & (TJOB_PARSE | TJOB_CHECK))
+        op = WRITER_OP_PARSED;
+    else
+        op = WRITER_OP_RESTORE;
+
+    if (lms_writer_queue(tp->writer, finfo, op, &job->records) != 0)
+        return -1;
+
+    if ((job->flags & TJOB_CHECK) && finfo->dtime)
+        return LMS_PROGRESS_STATUS_DELETED;
+    return LMS_PROGRESS_STATUS_PROCESSED;
+}
+
+/*
+ * Files were reported as processed when queued, so failing to write them
+ * fails the whole scan.
+ *
+ * Return: < 0 if the transaction could not start, files are kept pending.
+ */
+static int
+_tpool_flush(struct tpool *tp)
+{
+    int r;
+
+    r = lms_writer_flush(tp->writer);
+    if (r < 0)
+        fprintf(stderr, "ERROR: could not start transaction, %u files "
+                "pending.\n", lms_writer_pending(tp->writer));
+    else if (r > 0) {
+        fprintf(stderr, "ERROR: failed to write %d files.\n", r);
+        _tpool_set_error(tp, -1);
+    }
+
+    return r;
+}
+
+static void *
+_tpool_writer_work(void *data)
+{
+    struct tpool *tp = data;
+    struct tjob *job;
+    int r;
+
+    for (;;) {
+        r = _tqueue_pop(&tp->write, lms_writer_timeout_left(tp->writer),
+                        &job);
+        if (r < 0)
+            break;
+        else if (r > 0) {
+            _tpool_flush(tp);
+            continue;
+        }
+
+        r = _tpool_write(tp, job);
+        if (r < 0) {
+            fprintf(stderr, "ERROR: failed to parse \"%s\".\n",
+                    job->finfo.path);
+            _report_progress(tp, &job->finfo, LMS_PROGRESS_STATUS_ERROR_PARSE);
+            /* same as lms_process(), a broken file stops the scan */
+            if (!(job->flags & TJOB_CHECK))
+                _tpool_set_error(tp, r);
+        } else
+            _report_progress(tp, &job->finfo, r);
+        _tjob_free(job);
+
+        if (lms_writer_is_due(tp->writer))
+            _tpool_flush(tp);
+    }
+
+    /* last chance, parsers are finished before the writer is freed */
+    if (_tpool_flush(tp) < 0)
+        _tpool_set_error(tp, -1);
+    return NULL;
+}
+
+/***********************************************************************
+ * Pool.
+ ***********************************************************************/
+
+static int
+_tpool_db_open(struct tpool *tp)
+{
+    int r;
+
+    if (!sqlite3_threadsafe()) {
+        fprintf(stderr, "ERROR: sqlite was built without thread support.\n");
+        return -1;
+    }
+
+    if (lms_db_open(tp->lms, &tp->handle, SQLITE_OPEN_FULLMUTEX) != 0)
+        return -1;
+
+    /* directory states and rows to check are read from others meanwhile */
+    sqlite3_busy_timeout(tp->handle, DEFAULT_BUSY_TIMEOUT);
+
+    if (lms_db_create_core_tables_if_required(tp->handle) != 0) {
+        fprintf(stderr, "ERROR: could not setup tables and indexes.\n");
+        return -2;
+    }
+
+    r = lms_db_update_id_get(tp->handle);
+    if (r < 0) {
+        fprintf(stderr, "ERROR: could not get global update id.\n");
+        return -3;
+    }
+    tp->update_id = r + 1;
+
+    tp->writer = lms_writer_new(tp->lms, tp->handle, tp->update_id);
+    if (!tp->writer)
+        return -4;
+
+    return 0;
+}
+
+static void
+_tpool_db_close(struct tpool *tp)
+{
+    /* writer thread already wrote everything */
+    if (tp->writer && lms_writer_free(tp->writer) > 0)
+        _tpool_set_error(tp, -1);
+
+    if (tp->handle && lms_db_close(tp->handle) != 0)
+        fprintf(stderr, "ERROR: clould not close DB: %s\n",
+                sqlite3_errmsg(tp->handle));
+}
+
+static int
+_tpool_start_threads(struct tpool *tp)
+{
+    unsigned int i;
+
+    if (pthread_create(&tp->writer_thread, NULL, _tpool_writer_work, tp) != 0) {
+        perror("pthread_create");
+        return -1;
+    }
+    tp->writer_running = 1;
+
+    for (i = 0; i < tp->n_parsers; i++) {
+        struct tparser *p = tp->parsers + i;
+
+        if (pthread_create(&p->thread, NULL, _tparser_work, p) != 0) {
+            perror("pthread_create");
+            return -1;
+        }
+        p->running = 1;
+    }
+
+    return 0;
+}
+
+static void
+_tpool_stop_threads(struct tpool *tp)
+{
+    unsigned int i;
+
+    _tqueue_close(&tp->parse);
+    for (i = 0; i < tp->n_parsers; i++) {
+        struct tparser *p = tp->parsers + i;
+
+        if (p->running) {
+            pthread_join(p->thread, NULL);
+            p->running = 0;
+        }
+    }
+
+    _tqueue_close(&tp->write);
+    if (tp->writer_running) {
+        pthread_join(tp->writer_thread, NULL);
+        tp->writer_running = 0;
+    }
+}
+
+/*
+ * Open the DB, start parsers and threads. Scan must be done by pushing
+ * jobs with lms_tpool_push() and then lms_tpool_free().
+ */
+struct tpool *
+lms_tpool_new(lms_t *lms)
+{
+    struct tpool *tp;
+    unsigned int i;
+
+    tp = calloc(1, sizeof(*tp));
+    if (!tp) {
+        perror("calloc");
+        return NULL;
+    }
+
+    tp->lms = lms;
+    tp->n_parsers = lms->worker_count;
+    if (pthread_mutex_init(&tp->progress_lock, NULL) != 0) {
+        free(tp);
+        return NULL;
+    }
+
+    if (_tqueue_init(&tp->parse, TPOOL_QUEUE_SIZE) != 0)
+        goto error_parse_queue;
+    if (_tqueue_init(&tp->write, TPOOL_QUEUE_SIZE) != 0)
+        goto error_write_queue;
+
+    if (_tpool_db_open(tp) != 0)
+        goto error_db;
+
+    if (lms_parsers_setup(lms, tp->handle) != 0) {
+        fprintf(stderr, "ERROR: could not setup parsers.\n");
+        goto error_db;
+    }
+    if (lms_parsers_start(lms, tp->handle) != 0) {
+        fprintf(stderr, "ERROR: could not start parsers.\n");
+        goto error_parsers;
+    }
+    tp->parsers_started = 1;
+    if (lms->n_parsers < 1) {
+        fprintf(stderr, "ERROR: no parser could be started, exit.\n");
+        goto error_parsers;
+    }
+
+    tp->parsers = calloc(tp->n_parsers, sizeof(*tp->parsers));
+    if (!tp->parsers) {
+        perror("calloc");
+        goto error_parsers;
+    }
+    for (i = 0; i < tp->n_parsers; i++) {
+        tp->parsers[i].tp = tp;
+        if (_tparser_start(tp->parsers + i, lms, tp->handle) != 0)
+            goto error_threads;
+    }
+
+    if (lms->progress.cb) {
+        tp->progress_cb = lms->progress.cb;
+        tp->progress_data = lms->progress.data;
+        lms->progress.cb = _tpool_progress;
+        lms->progress.data = tp;
+    }
+
+    if (_tpool_start_threads(tp) != 0)
+        goto error_threads;
+
+    return tp;
+
+  error_threads:
+    lms_tpool_free(tp);
+    return NULL;
+
+  error_parsers:
+    lms_parsers_finish(lms, tp->handle);
+  error_db:
+    _tpool_db_close(tp);
+    _tqueue_shutdown(&tp->write);
+  error_write_queue:
+    _tqueue_shutdown(&tp->parse);
+  error_parse_queue:
+    pthread_mutex_destroy(&tp->progress_lock);
+    free(tp);
+    return NULL;
+}
+
+/*
+ * Wait for every pushed job to be written and release everything.
+ *
+ * Return: 0 on success or the error that stopped the scan.
+ */
+int
+lms_tpool_free(struct tpool *tp)
+{
+    lms_t *lms = tp->lms;
+    unsigned int i;
+    int r;
+
+    _tpool_stop_threads(tp);
+
+    if (tp->progress_cb) {
+        lms->progress.cb = tp->progress_cb;
+        lms->progress.data = tp->progress_data;
+    }
+
+    if (tp->parsers) {
+        for (i = 0; i < tp->n_parsers; i++)
+            _tparser_finish(tp->parsers + i);
+        free(tp->parsers);
+    }
+
+    if (tp->parsers_started)
+        lms_parsers_finish(lms, tp->handle);
+    _tpool_db_close(tp);
+
+    _tqueue_shutdown(&tp->write);
+    _tqueue_shutdown(&tp->parse);
+    pthread_mutex_destroy(&tp->progress_lock);
+
+    r = tp->error;
+    free(tp);
+    return r;
+}
+
+sqlite3 *
+lms_tpool_get_db(const struct tpool *tp)
+{
+    return tp->handle;
+}
+
+int
+lms_tpool_get_error(struct tpool *tp)
+{
+    return __atomic_load_n(&tp->error, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Queue a file, blocks if threads are behind. Jobs with TJOB_PARSE go
+ * through parser threads, others straight to the writer.
+ */
+int
+lms_tpool_push(struct tpool *tp, const struct lms_file_info *finfo, unsigned int flags)
+{
+    struct tjob *job;
+
+    job = malloc(sizeof(*job) + finfo->path_len + 1);
+    if (!job) {
+        perror("malloc");
+        return -1;
+    }
+
+    memcpy(job->path, finfo->path, finfo->path_len);
+    job->path[finfo->path_len] = '\0';
+    job->finfo = *finfo;
+    job->finfo.path = job->path;
+    job->flags = flags;
+    job->status = 0;
+    memset(&job->records, 0, sizeof(job->records));
+
+    if (_tqueue_push((flags & TJOB_PARSE) ? &tp->parse : &tp->write,
+                     job) != 0) {
+        _tjob_free(job);
+        return -2;
+    }
+
+    return 0;
+}
@@ -0,0 +1,1177 @@
+/**
+ * Copyright (C) 2008-2011 by ProFUSION embedded systems
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * @author Gustavo Sverzut Barbieri <barbieri@profusion.mobi>
+ */
+
+/*
+ * Directory walker used by lms_process() and friends.
+ *
+ * Directories are opened relative to their parent's fd and entries are
+ * checked with fstatat(), so the kernel doesn't resolve the whole path
+ * again for each entry. The path is still built along the way, but file
+ * names are only appended when a file is given to process_file().
+ *
+ * With a single walker the tree is walked depth first by the calling
+ * thread, using a stack of open directories. With more, directories are
+ * read by walker threads, each one with its own deque of pending
+ * directories: owner takes the deepest one, idle threads steal the
+ * shallowest from others. Files found are queued to the calling thread,
+ * the only one that calls process_file().
+ *
+ * When skipping unchanged directories, a directory with a known state
+ * is first only skimmed: its children are counted, files are neither
+ * stat'ed nor processed. If the count matches, its files are reported
+ * up to date, otherwise it's read again for its files only.
+ */
+
+#include <sys/stat.h>
+#if HAVE_DECL_SYS_GETDENTS64
+#include <sys/syscall.h>
+#endif
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lightmediascanner.h"
+#include "lightmediascanner_private.h"
+
+#define WALK_BULK_BUF_SIZE (256 * 1024)
+/* files found by walker threads and not yet processed */
+#define WALK_QUEUE_SIZE 1024
+
+int
+lms_path_append(int base, char *path, const char *name)
+{
+    int new_len, name_len;
+
+    name_len = strlen(name);
+    new_len = base + name_len;
+
+    if (new_len >= PATH_SIZE) {
+        path[base] = '\0';
+        fprintf(stderr,
+                "ERROR: path concatenation too long %d of %d "
+                "available: \"%s\" + \"%s\"\n", new_len, PATH_SIZE,
+                path, name);
+        return -1;
+    }
+
+    memcpy(path + base, name, name_len + 1);
+
+    return new_len;
+}
+
+/***********************************************************************
+ * Directory reading.
+ ***********************************************************************/
+
+struct dir_reader {
+    DIR *dir; /* NULL if reading in bulk */
+    int fd;
+    char *buf;
+    unsigned int pos;
+    unsigned int end;
+    unsigned int reads;
+};
+
+/* same as struct linux_dirent64, not exported by glibc */
+struct walk_dirent {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+/* buf is given for bulk reads. On failure fd is closed. */
+static int
+_dir_reader_open(struct dir_reader *r, int fd, char *buf)
+{
+    r->fd = fd;
+    r->buf = buf;
+    r->pos = r->end = r->reads = 0;
+    if (buf) {
+        r->dir = NULL;
+        return 0;
+    }
+
+    r->dir = fdopendir(fd);
+    if (!r->dir) {
+        perror("fdopendir");
+        close(fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+_dir_reader_close(struct dir_reader *r)
+{
+    if (r->dir)
+        closedir(r->dir);
+    else
+        close(r->fd);
+}
+
+static void
+_dir_reader_stats(const struct dir_reader *r, struct lms_dir_read_stats *stats)
+{
+    if (r->dir)
+        return;
+
+    stats->dirs++;
+    stats->syscalls += r->reads;
+    if (stats->max_syscalls < r->reads)
+        stats->max_syscalls = r->reads;
+}
+
+/*
+ * Entries are iterated in place, straight from the buffer filled by
+ * getdents64().
+ *
+ * Return: 1 if there is an entry, 0 at the end, < 0 on error.
+ */
+static int
+_dir_reader_next_bulk(struct dir_reader *r, const char **name, unsigned char *type)
+{
+#if HAVE_DECL_SYS_GETDENTS64
+    const struct walk_dirent *de;
+
+    if (r->pos >= r->end) {
+        long n;
+
+        r->reads++;
+        n = syscall(SYS_getdents64, r->fd, r->buf, WALK_BULK_BUF_SIZE);
+        if (n < 0) {
+            perror("getdents64");
+            return -1;
+        } else if (n == 0)
+            return 0;
+
+        r->pos = 0;
+        r->end = n;
+    }
+
+    de = (const struct walk_dirent *)(r->buf + r->pos);
+    r->pos += de->d_reclen;
+    *name = de->d_name;
+    *type = de->d_type;
+    return 1;
+#else
+    return -1;
+#endif
+}
+
+static int
+_dir_reader_rewind(struct dir_reader *r)
+{
+    if (r->dir) {
+        rewinddir(r->dir);
+        return 0;
+    }
+
+    if (lseek(r->fd, 0, SEEK_SET) < 0) {
+        perror("lseek");
+        return -1;
+    }
+    r->pos = r->end = 0;
+    return 0;
+}
+
+static int
+_dir_reader_next(struct dir_reader *r, const char **name, unsigned char *type)
+{
+    struct dirent *de;
+
+    if (!r->dir)
+        return _dir_reader_next_bulk(r, name, type);
+
+    de = readdir(r->dir);
+    if (!de)
+        return 0;
+
+    *name = de->d_name;
+    *type = de->d_type;
+    return 1;
+}
+
+enum walk_kind {
+    WALK_SKIP,
+    WALK_FILE,
+    WALK_DIR
+};
+
+/*
+ * Hidden entries and anything but files and directories are skipped.
+ * Unless need_stat is set, st is only filled if type is not known.
+ */
+static enum walk_kind
+_walk_classify(int fd, const char *name, unsigned char type, struct stat *st, int need_stat)
+{
+    if (name[0] == '.')
+        return WALK_SKIP;
+
+    if (type == DT_DIR)
+        return WALK_DIR;
+    else if (type == DT_REG && !need_stat)
+        return WALK_FILE;
+    else if (type != DT_REG && type != DT_UNKNOWN)
+        return WALK_SKIP;
+
+    if (fstatat(fd, name, st, 0) != 0) {
+        perror("fstatat");
+        return WALK_SKIP;
+    }
+
+    if (S_ISREG(st->st_mode))
+        return WALK_FILE;
+    else if (S_ISDIR(st->st_mode))
+        return WALK_DIR;
+    return WALK_SKIP;
+}
+
+/* directory state while it's read, see lms_set_skip_unchanged_dirs() */
+struct walk_state {
+    int64_t mtime;
+    int known; /* children last time, -1 if not known */
+    int children;
+    unsigned int skim:1; /* just counting children */
+    unsigned int rescan:1; /* children counted, reading files only */
+    unsigned int unchanged:1;
+    unsigned int error:1;
+};
+
+static void
+_walk_state_init(struct walk_state *ws, const struct dir_states *states, int fd, const char *path, int len)
+{
+    struct stat st;
+
+    memset(ws, 0, sizeof(*ws));
+    ws->known = -1;
+    if (!states)
+        return;
+
+    if (fstat(fd, &st) != 0) {
+        perror("fstat");
+        ws->error = 1;
+        return;
+    }
+
+    ws->mtime = st.st_mtime;
+    ws->known = lms_dir_states_get(states, path, len, ws->mtime);
+    ws->skim = ws->known >= 0;
+}
+
+/*
+ * Directory was read to its end.
+ *
+ * Return: 1 if it must be read again for its files, 0 if done.
+ */
+static int
+_walk_state_end(struct walk_state *ws, struct dir_states *states, struct dir_reader *r, const char *path, int len)
+{
+    if (!states || ws->error)
+        return 0;
+
+    if (ws->skim) {
+        ws->skim = 0;
+        if (ws->children == ws->known) {
+            ws->unchanged = 1;
+            return 0;
+        }
+
+        if (_dir_reader_rewind(r) != 0) {
+            fprintf(stderr, "ERROR: could not read files of %s again\n",
+                    path);
+            return 0;
+        }
+        ws->rescan = 1;
+        return 1;
+    }
+
+    lms_dir_states_set(states, path, len, ws->mtime, ws->children);
+    return 0;
+}
+
+/***********************************************************************
+ * Single walker.
+ ***********************************************************************/
+
+struct walk_dir {
+    struct dir_reader r;
+    struct walk_state ws;
+    char *buf; /* bulk reads, kept for the next directory at this depth */
+    int len; /* path length up to and including the trailing '/' */
+    int64_t walk_ns; /* opening and reading it, not its files */
+};
+
+struct walker {
+    struct cinfo *info;
+    process_file_callback_t process_file;
+    char *path;
+    struct walk_dir *stack;
+    unsigned int depth;
+    unsigned int size;
+    unsigned int bulk:1;
+};
+
+/*
+ * Return: 0 on success, > 0 if it was not entered (non fatal), < 0 on
+ * error.
+ */
+static int
+_walker_push(struct walker *w, int parent_fd, int base, const char *name)
+{
+    int64_t start = lms_stats_now();
+    struct walk_dir *d;
+    int fd, new_len;
+
+    new_len = lms_path_append(base, w->path, name);
+    if (new_len < 0)
+        return -1;
+    else if (new_len + 1 >= PATH_SIZE) {
+        fprintf(stderr, "ERROR: path too long\n");
+        return 2;
+    }
+
+    if (w->depth == w->size) {
+        unsigned int size = w->size ? w->size * 2 : 16;
+
+        d = realloc(w->stack, size * sizeof(*d));
+        if (!d) {
+            perror("realloc");
+            return -2;
+        }
+        memset(d + w->size, 0, (size - w->size) * sizeof(*d));
+        w->stack = d;
+        w->size = size;
+    }
+
+    d = w->stack + w->depth;
+    if (w->bulk && !d->buf) {
+        d->buf = malloc(WALK_BULK_BUF_SIZE);
+        if (!d->buf) {
+            perror("malloc");
+            return -2;
+        }
+    }
+
+    /* top directory has no parent, open it by its (absolute) path */
+    if (parent_fd == AT_FDCWD)
+        name = w->path;
+
+    fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        perror("openat");
+        return 3;
+    }
+
+    if (_dir_reader_open(&d->r, fd, d->buf) != 0)
+        return 3;
+
+    w->path[new_len] = '/';
+    w->path[new_len + 1] = '\0';
+    d->len = new_len + 1;
+    _walk_state_init(&d->ws, w->info->lms->dir_states, fd, w->path, d->len);
+    d->walk_ns = lms_stats_now() - start;
+    w->depth++;
+
+    return 0;
+}
+
+static void
+_walker_pop(struct walker *w)
+{
+    struct walk_dir *d = w->stack + w->depth - 1;
+
+    _dir_reader_stats(&d->r, &w->info->lms->dir_stats);
+    _dir_reader_close(&d->r);
+    lms_stats_add(w->info->lms, LMS_STATS_PHASE_WALK, d->walk_ns, 1);
+    w->depth--;
+    if (w->depth)
+        w->path[w->stack[w->depth - 1].len] = '\0';
+}
+
+static void
+_walker_clear(struct walker *w)
+{
+    unsigned int i;
+
+    while (w->depth)
+        _walker_pop(w);
+
+    for (i = 0; i < w->size; i++)
+        free(w->stack[i].buf);
+    free(w->stack);
+}
+
+/* Return: < 0 on fatal errors, others are ignored */
+static int
+_walker_file(struct walker *w, int base, const char *name, const struct stat *st)
+{
+    int r;
+
+    r = w->process_file(w->info, base, w->path, name, st);
+    w->path[base] = '\0';
+    if (r < 0) {
+        fprintf(stderr, "ERROR: unrecoverable error parsing file, "
+                "exit \"%s\".\n", w->path);
+        return -4;
+    }
+
+    return 0;
+}
+
+/* errors reading are handled as the end of the directory */
+static void
+_walker_dir_end(struct walker *w, struct walk_dir *d, int error)
+{
+    struct dir_states *states = w->info->lms->dir_states;
+
+    if (error)
+        d->ws.error = 1;
+
+    if (_walk_state_end(&d->ws, states, &d->r, w->path, d->len))
+        return;
+
+    if (d->ws.unchanged)
+        lms_dir_states_report(states, w->path, d->len);
+    _walker_pop(w);
+}
+
+static int
+_walker_run(struct walker *w)
+{
+    lms_t *lms = w->info->lms;
+    enum walk_kind kind;
+    const char *name;
+    unsigned char type;
+    struct stat st;
+    int r;
+
+    while (w->depth && !lms->stop_processing) {
+        struct walk_dir *d = w->stack + w->depth - 1;
+        int64_t start = lms_stats_now();
+
+        r = _dir_reader_next(&d->r, &name, &type);
+        if (r <= 0) {
+            d->walk_ns += lms_stats_now() - start;
+            _walker_dir_end(w, d, r < 0);
+            continue;
+        }
+
+        kind = _walk_classify(d->r.fd, name, type, &st, !d->ws.skim);
+        d->walk_ns += lms_stats_now() - start;
+        if (kind != WALK_SKIP && !d->ws.rescan)
+            d->ws.children++;
+
+        r = 0;
+        if (kind == WALK_FILE && !d->ws.skim)
+            r = _walker_file(w, d->len, name, &st);
+        else if (kind == WALK_DIR && !d->ws.rescan)
+            r = _walker_push(w, d->r.fd, d->len, name);
+
+        if (r < 0)
+            return r;
+    }
+
+    return 0;
+}
+
+static int
+_walk_single(struct walker *w, int base, const char *name)
+{
+    int r;
+
+    r = _walker_push(w, AT_FDCWD, base, name);
+    if (r == 0)
+        r = _walker_run(w);
+    else if (r > 0) /* ignore non-fatal errors */
+        r = 0;
+
+    _walker_clear(w);
+    return r;
+}
+
+/***********************************************************************
+ * Many walker threads.
+ ***********************************************************************/
+
+/*
+ * Directory pending or being read. It holds a reference to its parent,
+ * so parent's fd is kept open until this one is opened relative to it.
+ */
+struct pdir {
+    struct pdir *parent;
+    struct dir_reader r;
+    int refs;
+    int base; /* where the name starts in path */
+    int len;
+    char path[];
+};
+
+/* without a name, it's an unchanged directory to be reported */
+struct pfile {
+    struct pfile *next;
+    struct stat st;
+    int base;
+    int len;
+    unsigned int unchanged:1;
+    char path[];
+};
+
+struct pdeque {
+    pthread_mutex_t lock;
+    struct pdir **items;
+    unsigned int top; /* stolen from here, shallowest */
+    unsigned int bottom; /* owner pushes and pops here, deepest */
+    unsigned int size;
+};
+
+struct pwalk;
+
+struct pwalker {
+    struct pwalk *pw;
+    pthread_t thread;
+    struct pdeque deque;
+    char *buf;
+    struct lms_dir_read_stats stats;
+    unsigned int running:1;
+};
+
+struct pwalk {
+    struct cinfo *info;
+    struct pwalker *walkers;
+    unsigned int n_walkers;
+    unsigned int bulk:1;
+    int abort;
+    int error;
+
+    /* pending directories, idle walkers wait for new ones */
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    unsigned int pending; /* queued or being read */
+    unsigned int generation; /* bumped on every queued directory */
+    unsigned int idle;
+
+    /* files to be processed by the calling thread */
+    pthread_mutex_t files_lock;
+    pthread_cond_t files_not_empty;
+    pthread_cond_t files_not_full;
+    struct pfile *head;
+    struct pfile *tail;
+    unsigned int n_files;
+    unsigned int done:1;
+};
+
+static struct pdir *
+_pdir_new(struct pdir *parent, const char *name)
+{
+    int base, len;
+    struct pdir *d;
+
+    base = parent ? parent->len : 0;
+    len = base + strlen(name);
+    if (len + 1 >= PATH_SIZE) {
+        fprintf(stderr, "ERROR: path too long %s%s\n",
+                parent ? parent->path : "", name);
+        return NULL;
+    }
+
+    d = malloc(sizeof(*d) + len + 2); /* with trailing '/' */
+    if (!d) {
+        perror("malloc");
+        return NULL;
+    }
+
+    if (parent) {
+        memcpy(d->path, parent->path, base);
+        __atomic_add_fetch(&parent->refs, 1, __ATOMIC_RELAXED);
+    }
+    memcpy(d->path + base, name, len - base + 1);
+    d->parent = parent;
+    d->refs = 1;
+    d->base = base;
+    d->len = len;
+    d->r.fd = -1;
+
+    return d;
+}
+
+static void
+_pdir_unref(struct pdir *d)
+{
+    if (__atomic_sub_fetch(&d->refs, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+
+    if (d->parent)
+        _pdir_unref(d->parent);
+    if (d->r.fd >= 0)
+        _dir_reader_close(&d->r);
+    free(d);
+}
+
+static int
+_pdeque_init(struct pdeque *q)
+{
+    memset(q, 0, sizeof(*q));
+    if (pthread_mutex_init(&q->lock, NULL) != 0)
+        return -1;
+    return 0;
+}
+
+static void
+_pdeque_shutdown(struct pdeque *q)
+{
+    unsigned int i;
+
+    for (i = q->top; i < q->bottom; i++)
+        _pdir_unref(q->items[i]);
+    free(q->items);
+    pthread_mutex_destroy(&q->lock);
+}
+
+static int
+_pdeque_push(struct pdeque *q, struct pdir *d)
+{
+    pthread_mutex_lock(&q->lock);
+    if (q->bottom == q->size) {
+        if (q->top > 0) {
+            memmove(q->items, q->items + q->top,
+                    (q->bottom - q->top) * sizeof(*q->items));
+            q->bottom -= q->top;
+            q->top = 0;
+        } else {
+            unsigned int size = q->size ? q->size * 2 : 64;
+            struct pdir **items;
+
+            items = realloc(q->items, size * sizeof(*items));
+            if (!items) {
+                perror("realloc");
+                pthread_mutex_unlock(&q->lock);
+                return -1;
+            }
+            q->items = items;
+            q->size = size;
+        }
+    }
+
+    q->items[q->bottom++] = d;
+    pthread_mutex_unlock(&q->lock);
+    return 0;
+}
+
+static struct pdir *
+_pdeque_take(struct pdeque *q, int steal)
+{
+    struct pdir *d = NULL;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->top < q->bottom) {
+        if (steal)
+            d = q->items[q->top++];
+        else
+            d = q->items[--q->bottom];
+        if (q->top == q->bottom)
+            q->top = q->bottom = 0;
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    return d;
+}
+
+static int
+_pwalk_is_aborted(struct pwalk *pw)
+{
+    return __atomic_load_n(&pw->abort, __ATOMIC_RELAXED) ||
+        pw->info->lms->stop_processing;
+}
+
+static void
+_pwalk_set_done(struct pwalk *pw)
+{
+    pthread_mutex_lock(&pw->files_lock);
+    pw->done = 1;
+    pthread_cond_broadcast(&pw->files_not_empty);
+    pthread_cond_broadcast(&pw->files_not_full);
+    pthread_mutex_unlock(&pw->files_lock);
+}
+
+static void
+_pwalk_abort(struct pwalk *pw)
+{
+    __atomic_store_n(&pw->abort, 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&pw->lock);
+    pthread_cond_broadcast(&pw->work);
+    pthread_mutex_unlock(&pw->lock);
+
+    _pwalk_set_done(pw);
+}
+
+static int
+_pwalk_queue_dir(struct pwalk *pw, struct pwalker *w, struct pdir *d)
+{
+    if (_pdeque_push(&w->deque, d) != 0) {
+        _pdir_unref(d);
+        return -1;
+    }
+
+    pthread_mutex_lock(&pw->lock);
+    pw->pending++;
+    pw->generation++;
+    if (pw->idle)
+        pthread_cond_signal(&pw->work);
+    pthread_mutex_unlock(&pw->lock);
+
+    return 0;
+}
+
+/* once the last one is done, walkers exit and no more files come */
+static void
+_pwalk_dir_done(struct pwalk *pw)
+{
+    unsigned int pending;
+
+    pthread_mutex_lock(&pw->lock);
+    pending = --pw->pending;
+    if (!pending)
+        pthread_cond_broadcast(&pw->work);
+    pthread_mutex_unlock(&pw->lock);
+
+    if (!pending)
+        _pwalk_set_done(pw);
+}
+
+/*
+ * Name and st are NULL for unchanged directories.
+ *
+ * Blocks while the queue is full. Return: < 0 if aborted.
+ */
+static int
+_pwalk_queue_file(struct pwalk *pw, const struct pdir *d, const char *name, const struct stat *st)
+{
+    int name_len, len;
+    struct pfile *f;
+
+    name_len = name ? strlen(name) : 0;
+    len = d->len + name_len;
+    if (len >= PATH_SIZE) {
+        fprintf(stderr, "ERROR: path too long %s%s\n", d->path, name);
+        return 0;
+    }
+
+    f = malloc(sizeof(*f) + len + 1);
+    if (!f) {
+        perror("malloc");
+        return -1;
+    }
+    memcpy(f->path, d->path, d->len);
+    memcpy(f->path + d->len, name ? name : "", name_len + 1);
+    f->next = NULL;
+    if (st)
+        f->st = *st;
+    f->base = d->len;
+    f->len = len;
+    f->unchanged = !name;
+
+    pthread_mutex_lock(&pw->files_lock);
+    while (pw->n_files >= WALK_QUEUE_SIZE && !_pwalk_is_aborted(pw))
+        pthread_cond_wait(&pw->files_not_full, &pw->files_lock);
+
+    if (_pwalk_is_aborted(pw)) {
+        pthread_mutex_unlock(&pw->files_lock);
+        free(f);
+        return -1;
+    }
+
+    if (pw->tail)
+        pw->tail->next = f;
+    else
+        pw->head = f;
+    pw->tail = f;
+    pw->n_files++;
+    pthread_cond_signal(&pw->files_not_empty);
+    pthread_mutex_unlock(&pw->files_lock);
+
+    return 0;
+}
+
+static struct pfile *
+_pwalk_next_file(struct pwalk *pw)
+{
+    struct pfile *f;
+
+    pthread_mutex_lock(&pw->files_lock);
+    while (!pw->head && !pw->done)
+        pthread_cond_wait(&pw->files_not_empty, &pw->files_lock);
+
+    f = _pwalk_is_aborted(pw) ? NULL : pw->head;
+    if (f) {
+        pw->head = f->next;
+        if (!pw->head)
+            pw->tail = NULL;
+        pw->n_files--;
+        pthread_cond_signal(&pw->files_not_full);
+    }
+    pthread_mutex_unlock(&pw->files_lock);
+
+    return f;
+}
+
+/* Return: < 0 on fatal errors, others are ignored */
+static int
+_pwalker_read_dir(struct pwalker *w, struct pdir *d)
+{
+    struct pwalk *pw = w->pw;
+    struct dir_states *states = pw->info->lms->dir_states;
+    int64_t start = lms_stats_now(), walk_ns = 0;
+    struct walk_state ws;
+    enum walk_kind kind;
+    const char *name;
+    unsigned char type;
+    struct stat st;
+    int fd, n = 0, r;
+
+    if (d->parent)
+        fd = openat(d->parent->r.fd, d->path + d->base,
+                    O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    else
+        fd = open(d->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (d->parent) {
+        _pdir_unref(d->parent);
+        d->parent = NULL;
+    }
+
+    if (fd < 0) {
+        perror("openat");
+        return 0;
+    }
+
+    if (_dir_reader_open(&d->r, fd, pw->bulk ? w->buf : NULL) != 0) {
+        d->r.fd = -1;
+        return 0;
+    }
+
+    d->path[d->len++] = '/';
+    d->path[d->len] = '\0';
+    _walk_state_init(&ws, states, fd, d->path, d->len);
+
+    r = 0;
+  read:
+    while (!_pwalk_is_aborted(pw) &&
+           (n = _dir_reader_next(&d->r, &name, &type)) > 0) {
+        struct pdir *child;
+
+        kind = _walk_classify(d->r.fd, name, type, &st, !ws.skim);
+        /* not waiting for queues to have room */
+        walk_ns += lms_stats_now() - start;
+        if (kind != WALK_SKIP && !ws.rescan)
+            ws.children++;
+
+        if (kind == WALK_FILE && !ws.skim)
+            r = _pwalk_queue_file(pw, d, name, &st);
+        else if (kind == WALK_DIR && !ws.rescan) {
+            child = _pdir_new(d, name);
+            if (child)
+                r = _pwalk_queue_dir(pw, w, child);
+        }
+
+        if (r < 0)
+            break;
+        start = lms_stats_now();
+    }
+
+    if (r == 0 && !_pwalk_is_aborted(pw)) {
+        if (n < 0)
+            ws.error = 1;
+        if (_walk_state_end(&ws, states, &d->r, d->path, d->len))
+            goto read;
+        if (ws.unchanged)
+            r = _pwalk_queue_file(pw, d, NULL, NULL);
+    }
+
+    _dir_reader_stats(&d->r, &w->stats);
+    lms_stats_add(pw->info->lms, LMS_STATS_PHASE_WALK,
+                  walk_ns + lms_stats_now() - start, 1);
+    /* bulk buffer is going to be reused, it's not needed by children */
+    d->r.buf = NULL;
+    return r;
+}
+
+static struct pdir *
+_pwalker_get_work(struct pwalker *w)
+{
+    struct pwalk *pw = w->pw;
+    unsigned int i, self, generation;
+    struct pdir *d;
+
+    self = w - pw->walkers;
+    for (;;) {
+        if (_pwalk_is_aborted(pw))
+            return NULL;
+
+        pthread_mutex_lock(&pw->lock);
+        generation = pw->generation;
+        pthread_mutex_unlock(&pw->lock);
+
+        d = _pdeque_take(&w->deque, 0);
+        for (i = 1; !d && i < pw->n_walkers; i++)
+            d = _pdeque_take(&pw->walkers[(self + i) % pw->n_walkers].deque,
+                             1);
+        if (d)
+            return d;
+
+        pthread_mutex_lock(&pw->lock);
+        if (!pw->pending) {
+            pthread_mutex_unlock(&pw->lock);
+            return NULL;
+        }
+        if (generation == pw->generation && !_pwalk_is_aborted(pw)) {
+            pw->idle++;
+            pthread_cond_wait(&pw->work, &pw->lock);
+            pw->idle--;
+        }
+        pthread_mutex_unlock(&pw->lock);
+    }
+}
+
+static void *
+_pwalker_work(void *data)
+{
+    struct pwalker *w = data;
+    struct pwalk *pw = w->pw;
+    struct pdir *d;
+
+    while ((d = _pwalker_get_work(w)) != NULL) {
+        int r = _pwalker_read_dir(w, d);
+
+        _pdir_unref(d);
+        _pwalk_dir_done(pw);
+        if (r < 0) {
+            __atomic_store_n(&pw->error, r, __ATOMIC_RELAXED);
+            _pwalk_abort(pw);
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static void
+_pwalk_finish(struct pwalk *pw)
+{
+    struct lms_dir_read_stats *stats = &pw->info->lms->dir_stats;
+    struct pfile *f, *next;
+    unsigned int i;
+
+    for (i = 0; i < pw->n_walkers; i++) {
+        struct pwalker *w = pw->walkers + i;
+
+        if (w->running)
+            pthread_join(w->thread, NULL);
+
+        stats->dirs += w->stats.dirs;
+        stats->syscalls += w->stats.syscalls;
+        if (stats->max_syscalls < w->stats.max_syscalls)
+            stats->max_syscalls = w->stats.max_syscalls;
+    }
+
+    for (i = 0; i < pw->n_walkers; i++) {
+        _pdeque_shutdown(&pw->walkers[i].deque);
+        free(pw->walkers[i].buf);
+    }
+    free(pw->walkers);
+
+    for (f = pw->head; f; f = next) {
+        next = f->next;
+        free(f);
+    }
+
+    pthread_cond_destroy(&pw->files_not_full);
+    pthread_cond_destroy(&pw->files_not_empty);
+    pthread_mutex_destroy(&pw->files_lock);
+    pthread_cond_destroy(&pw->work);
+    pthread_mutex_destroy(&pw->lock);
+}
+
+static int
+_pwalk_start(struct pwalk *pw, struct cinfo *info, const char *path)
+{
+    unsigned int i;
+    struct pdir *root;
+
+    memset(pw, 0, sizeof(*pw));
+    pw->info = info;
+    pw->bulk = info->lms->bulk_readdir;
+    pw->n_walkers = info->lms->walker_count;
+
+    pthread_mutex_init(&pw->lock, NULL);
+    pthread_cond_init(&pw->work, NULL);
+    pthread_mutex_init(&pw->files_lock, NULL);
+    pthread_cond_init(&pw->files_not_empty, NULL);
+    pthread_cond_init(&pw->files_not_full, NULL);
+
+    pw->walkers = calloc(pw->n_walkers, sizeof(*pw->walkers));
+    if (!pw->walkers) {
+        perror("calloc");
+        pw->n_walkers = 0;
+        return -1;
+    }
+
+    for (i = 0; i < pw->n_walkers; i++) {
+        struct pwalker *w = pw->walkers + i;
+
+        w->pw = pw;
+        if (_pdeque_init(&w->deque) != 0) {
+            pw->n_walkers = i;
+            return -1;
+        }
+        if (pw->bulk) {
+            w->buf = malloc(WALK_BULK_BUF_SIZE);
+            if (!w->buf) {
+                perror("malloc");
+                pw->n_walkers = i + 1;
+                return -1;
+            }
+        }
+    }
+
+    root = _pdir_new(NULL, path);
+    if (!root || _pwalk_queue_dir(pw, pw->walkers, root) != 0)
+        return -1;
+
+    for (i = 0; i < pw->n_walkers; i++) {
+        struct pwalker *w = pw->walkers + i;
+
+        if (pthread_create(&w->thread, NULL, _pwalker_work, w) != 0) {
+            perror("pthread_create");
+            return -1;
+        }
+        w->running = 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Walker threads only read directories, files are processed by the
+ * calling thread as they're found.
+ */
+static int
+_walk_threaded(struct cinfo *info, char *path, process_file_callback_t process_file)
+{
+    struct pwalk pw;
+    struct pfile *f;
+    int r = 0;
+
+    if (_pwalk_start(&pw, info, path) != 0) {
+        _pwalk_abort(&pw);
+        _pwalk_finish(&pw);
+        return -1;
+    }
+
+    while ((f = _pwalk_next_file(&pw)) != NULL) {
+        if (f->unchanged) {
+            lms_dir_states_report(info->lms->dir_states, f->path, f->len);
+            free(f);
+            continue;
+        }
+
+        memcpy(path, f->path, f->base);
+        path[f->base] = '\0';
+        r = process_file(info, f->base, path, f->path + f->base, &f->st);
+        path[f->base] = '\0';
+        free(f);
+
+        if (r < 0) {
+            fprintf(stderr, "ERROR: unrecoverable error parsing file, "
+                    "exit \"%s\".\n", path);
+            r = -4;
+            break;
+        }
+        r = 0;
+
+        if (info->lms->stop_processing)
+            break;
+    }
+
+    _pwalk_abort(&pw);
+    _pwalk_finish(&pw);
+
+    if (!r && pw.error)
+        r = pw.error;
+    return r;
+}
+
+/***********************************************************************
+ * Entry point.
+ ***********************************************************************/
+
+/*
+ * Walk name, a file or a directory inside path[0:base], calling
+ * process_file() for every file found. Path must be PATH_SIZE long.
+ *
+ * Return: < 0 on fatal errors, including process_file() ones.
+ */
+int
+lms_walk(struct cinfo *info, int base, char *path, const char *name, process_file_callback_t process_file)
+{
+    struct walker w;
+    struct stat st;
+
+    w.info = info;
+    w.process_file = process_file;
+    w.path = path;
+    w.stack = NULL;
+    w.depth = 0;
+    w.size = 0;
+    w.bulk = info->lms->bulk_readdir;
+
+    if (lms_path_append(base, path, name) < 0)
+        return -1;
+
+    if (stat(path, &st) != 0) {
+        perror("stat");
+        return -2;
+    }
+
+    if (S_ISDIR(st.st_mode) && info->lms->walker_count > 1)
+        return _walk_threaded(info, path, process_file);
+
+    path[base] = '\0';
+
+    if (S_ISREG(st.st_mode))
+        return _walker_file(&w, base, name, &st);
+    else if (!S_ISDIR(st.st_mode)) {
+        fprintf(stderr,
+                "INFO: %s%s is neither a directory nor a regular file.\n",
+                path, name);
+        return -3;
+    }
+
+    return _walk_single(&w, base, name);
+}
@@ -195,40 +195,40 @@ _to_number(const char *data, unsigned int type_size, unsigned int data_size)
 }
 
 static short
-_read_word(int fd)
+_read_word(lms_reader_t *reader)
 {
     char v[2];
-    if (read(fd, &v, 2) != 2)
+    if (lms_reader_read(reader, &v, 2) != 2)
         return 0;
     return (short) _to_number(v, sizeof(unsigned short), 2);
 }
 
 static unsigned int
-_read_dword(int fd)
+_read_dword(lms_reader_t *reader)
 {
     char v[4];
-    if (read(fd, &v, 4) != 4)
+    if (lms_reader_read(reader, &v, 4) != 4)
         return 0;
     return (unsigned int) _to_number(v, sizeof(unsigned int), 4);
 }
 
 static long long
-_read_qword(int fd)
+_read_qword(lms_reader_t *reader)
 {
     char v[8];
-    if (read(fd, &v, 8) != 8)
+    if (lms_reader_read(reader, &v, 8) != 8)
         return 0;
     return _to_number(v, sizeof(unsigned long long), 8);
 }
 
 static int
-_read_string(int fd, size_t count, char **str, unsigned int *len)
+_read_string(lms_reader_t *reader, size_t count, char **str, unsigned int *len)
 {
     char *data;
     ssize_t data_size, size;
 
     data = malloc(sizeof(char) * count);
-    data_size = read(fd, data, count);
+    data_size = lms_reader_read(reader, data, count);
     if (data_size == -1) {
         free(data);
         return -1;
@@ -248,7 +248,7 @@ _read_string(int fd, size_t count, char **str, unsigned int *len)
 }
 
 static int
-_parse_file_properties(int fd, struct asf_info *info)
+_parse_file_properties(lms_reader_t *reader, struct asf_info *info)
 {
     struct {
         char fileid[16];
@@ -265,7 +265,7 @@ _parse_file_properties(int fd, struct asf_info *info)
     } __attribute__((packed)) props;
     int r;
 
-    r = read(fd, &props, sizeof(props));
+    r = lms_reader_read(reader, &props, sizeof(props));
     if (r != sizeof(props))
         return r;
 
@@ -358,7 +358,7 @@ static void _stream_copy_extension_properties(struct stream *s)
 }
 
 static int
-_parse_stream_properties(int fd, struct asf_info *info)
+_parse_stream_properties(lms_reader_t *reader, struct asf_info *info)
 {
     struct {
         char stream_type[16];
@@ -373,7 +373,7 @@ _parse_stream_properties(int fd, struct asf_info *info)
     struct stream *s;
     int r, type;
 
-    r = read(fd, &props, sizeof(props));
+    r = lms_reader_read(reader, &props, sizeof(props));
     if (r != sizeof(props))
         return r;
 
@@ -401,11 +401,11 @@ _parse_stream_properties(int fd, struct asf_info *info)
         if (le32toh(props.type_specific_len) < 18)
             goto done;
 
-        s->base.codec = *_audio_codec_id_to_str(_read_word(fd));
-        s->base.audio.channels = _read_word(fd);
-        s->priv.sampling_rate = _read_dword(fd);
+        s->base.codec = *_audio_codec_id_to_str(_read_word(reader));
+        s->base.audio.channels = _read_word(reader);
+        s->priv.sampling_rate = _read_dword(reader);
         s->base.audio.sampling_rate = s->priv.sampling_rate;
-        s->base.audio.bitrate = _read_dword(fd) * 8;
+        s->base.audio.bitrate = _read_dword(reader) * 8;
     } else {
         struct {
             uint32_t width_unused;
@@ -424,7 +424,7 @@ _parse_stream_properties(int fd, struct asf_info *info)
             /* other fields are ignored */
         } __attribute__((packed)) video;
 
-        r = read(fd, &video, sizeof(video));
+        r = lms_reader_read(reader, &video, sizeof(video));
         if (r != sizeof(video))
             goto done;
 
@@ -449,7 +449,7 @@ done:
 }
 
 static int _parse_extended_stream_properties(lms_charset_conv_t *cs_conv,
-                                             int fd, struct asf_info *info)
+                                             lms_reader_t *reader, struct asf_info *info)
 {
     struct {
         uint64_t start_time;
@@ -474,7 +474,7 @@ static int _parse_extended_stream_properties(lms_charset_conv_t *cs_conv,
     uint16_t n;
     int r;
 
-    r = read(fd, &props, sizeof(props));
+    r = lms_reader_read(reader, &props, sizeof(props));
     if (r != sizeof(props))
         return r;
 
@@ -489,15 +489,15 @@ static int _parse_extended_stream_properties(lms_charset_conv_t *cs_conv,
                          (double) get_le64(&props.avg_time_per_frame));
     for (n = get_le16(&props.stream_name_count); n; n--) {
         uint16_t j;
-        lseek(fd, 2, SEEK_CUR);
-        j = _read_word(fd);
-        lseek(fd, j, SEEK_CUR);
+        lms_reader_seek(reader, 2, SEEK_CUR);
+        j = _read_word(reader);
+        lms_reader_seek(reader, j, SEEK_CUR);
     }
     for (n = get_le16(&props.payload_extension_system_count); n; n--) {
         uint32_t j;
-        lseek(fd, 18, SEEK_CUR);
-        j = _read_dword(fd);
-        lseek(fd, j, SEEK_CUR);
+        lms_reader_seek(reader, 18, SEEK_CUR);
+        j = _read_dword(reader);
+        lms_reader_seek(reader, j, SEEK_CUR);
     }
 
     return 0;
@@ -507,25 +507,25 @@ static int _parse_extended_stream_properties(lms_charset_conv_t *cs_conv,
  * this is wrong, since it might parse objects in the extension header that
  * should be in the header object, however this should parse ok all good files
  * and eventually the bad ones. */
-static int _parse_header_extension(lms_charset_conv_t *cs_conv, int fd,
+static int _parse_header_extension(lms_charset_conv_t *cs_conv, lms_reader_t *reader,
                                    struct asf_info *info)
 {
-    lseek(fd, 22, SEEK_CUR);
+    lms_reader_seek(reader, 22, SEEK_CUR);
     return 0;
 }
 
 static int
-_parse_content_description(lms_charset_conv_t *cs_conv, int fd,
+_parse_content_description(lms_charset_conv_t *cs_conv, lms_reader_t *reader,
                            struct asf_info *info)
 {
-    int title_length = _read_word(fd);
-    int artist_length = _read_word(fd);
+    int title_length = _read_word(reader);
+    int artist_length = _read_word(reader);
 
-    lseek(fd, 6, SEEK_CUR);
+    lms_reader_seek(reader, 6, SEEK_CUR);
 
-    _read_string(fd, title_length, &info->title.str, &info->title.len);
+    _read_string(reader, title_length, &info->title.str, &info->title.len);
     lms_charset_conv_force(cs_conv, &info->title.str, &info->title.len);
-    _read_string(fd, artist_length, &info->artist.str, &info->artist.len);
+    _read_string(reader, artist_length, &info->artist.str, &info->artist.len);
     lms_charset_conv_force(cs_conv, &info->artist.str, &info->artist.len);
 
     /* ignore copyright, comment and rating */
@@ -533,7 +533,7 @@ _parse_content_description(lms_charset_conv_t *cs_conv, int fd,
 }
 
 static void
-_parse_attribute_name(int fd,
+_parse_attribute_name(lms_reader_t *reader,
                       char **attr_name,
                       unsigned int *attr_name_len,
                       int *attr_type,
@@ -541,50 +541,50 @@ _parse_attribute_name(int fd,
 {
     int attr_name_length;
 
-    attr_name_length = _read_word(fd);
-    _read_string(fd, attr_name_length, attr_name, attr_name_len);
-    *attr_type = _read_word(fd);
-    *attr_size = _read_word(fd);
+    attr_name_length = _read_word(reader);
+    _read_string(reader, attr_name_length, attr_name, attr_name_len);
+    *attr_type = _read_word(reader);
+    *attr_size = _read_word(reader);
 }
 
 static void
 _parse_attribute_string_data(lms_charset_conv_t *cs_conv,
-                             int fd,
+                             lms_reader_t *reader,
                              int attr_size,
                              char **attr_data,
                              unsigned int *attr_data_len)
 {
-    _read_string(fd, attr_size, attr_data, attr_data_len);
+    _read_string(reader, attr_size, attr_data, attr_data_len);
     lms_charset_conv_force(cs_conv, attr_data, attr_data_len);
 }
 
 static void
-_skip_attribute_data(int fd, int kind, int attr_type, int attr_size)
+_skip_attribute_data(lms_reader_t *reader, int kind, int attr_type, int attr_size)
 {
     switch (attr_type) {
     case ATTR_TYPE_WORD:
-        lseek(fd, 2, SEEK_CUR);
+        lms_reader_seek(reader, 2, SEEK_CUR);
         break;
 
     case ATTR_TYPE_BOOL:
         if (kind == 0)
-            lseek(fd, 4, SEEK_CUR);
+            lms_reader_seek(reader, 4, SEEK_CUR);
         else
-            lseek(fd, 2, SEEK_CUR);
+            lms_reader_seek(reader, 2, SEEK_CUR);
         break;
 
     case ATTR_TYPE_DWORD:
-        lseek(fd, 4, SEEK_CUR);
+        lms_reader_seek(reader, 4, SEEK_CUR);
         break;
 
     case ATTR_TYPE_QWORD:
-        lseek(fd, 8, SEEK_CUR);
+        lms_reader_seek(reader, 8, SEEK_CUR);
         break;
 
     case ATTR_TYPE_UNICODE:
     case ATTR_TYPE_BYTES:
     case ATTR_TYPE_GUID:
-        lseek(fd, attr_size, SEEK_CUR);
+        lms_reader_seek(reader, attr_size, SEEK_CUR);
         break;
 
     default:
@@ -593,40 +593,40 @@ _skip_attribute_data(int fd, int kind, int attr_type, int attr_size)
 }
 
 static int
-_parse_extended_content_description_object(lms_charset_conv_t *cs_conv, int fd,
+_parse_extended_content_description_object(lms_charset_conv_t *cs_conv, lms_reader_t *reader,
                                            struct asf_info *info)
 {
-    int count = _read_word(fd);
+    int count = _read_word(reader);
     char *attr_name;
     unsigned int attr_name_len;
     int attr_type, attr_size;
 
     while (count--) {
         attr_name = NULL;
-        _parse_attribute_name(fd,
+        _parse_attribute_name(reader,
                               &attr_name, &attr_name_len,
                               &attr_type, &attr_size);
         if (attr_type == ATTR_TYPE_UNICODE) {
             if (memcmp(attr_name, attr_name_wm_album_title, attr_name_len) == 0)
                 _parse_attribute_string_data(cs_conv,
-                                             fd, attr_size,
+                                             reader, attr_size,
                                              &info->album.str,
                                              &info->album.len);
             else if (memcmp(attr_name, attr_name_wm_genre, attr_name_len) == 0)
                 _parse_attribute_string_data(cs_conv,
-                                             fd, attr_size,
+                                             reader, attr_size,
                                              &info->genre.str,
                                              &info->genre.len);
             else if (memcmp(attr_name, attr_name_wm_album_artist, attr_name_len) == 0)
                 _parse_attribute_string_data(cs_conv,
-                                             fd, attr_size,
+                                             reader, attr_size,
                                              &info->artist.str,
                                              &info->artist.len);
             else if (memcmp(attr_name, attr_name_wm_track_number, attr_name_len) == 0) {
                 char *trackno;
                 unsigned int trackno_len;
                 _parse_attribute_string_data(cs_conv,
-                                             fd, attr_size,
+                                             reader, attr_size,
                                              &trackno,
                                              &trackno_len);
                 if (trackno) {
@@ -635,28 +635,16 @@ _parse_extended_content_description_object(lms_charset_conv_t *cs_conv, int fd,
                 }
             }
             else
-                _skip_attribute_data(fd, 0, attr_type, attr_size);
+                _skip_attribute_data(reader, 0, attr_type, attr_size);
         }
         else
-            _skip_attribute_data(fd, 0, attr_type, attr_size);
+            _skip_attribute_data(reader, 0, attr_type, attr_size);
         free(attr_name);
     }
 
     return 1;
 }
 
-static void *
-_match(struct plugin *p, const char *path, int len, int base)
-{
-    long i;
-
-    i = lms_which_extension(path, len, _exts, LMS_ARRAY_SIZE(_exts));
-    if (i < 0)
-      return NULL;
-    else
-      return (void*)(i + 1);
-}
-
 static void streams_free(struct stream *streams)
 {
     while (streams) {
@@ -682,7 +670,8 @@ static int
 _parse(struct plugin *plugin, struct lms_context *ctxt, const struct lms_file_info *finfo, void *match)
 {
     struct asf_info info = { .type = LMS_STREAM_TYPE_UNKNOWN };
-    int r, fd;
+    lms_reader_t *reader = finfo->reader;
+    int r;
     char guid[16];
     unsigned int size;
     unsigned long long hdrsize;
@@ -690,13 +679,7 @@ _parse(struct plugin *plugin, struct lms_context *ctxt, const struct lms_file_in
     const struct lms_dlna_video_profile *video_dlna;
     const struct lms_dlna_audio_profile *audio_dlna;
 
-    fd = open(finfo->path, O_RDONLY);
-    if (fd < 0) {
-        perror("open");
-        return -1;
-    }
-
-    if (read(fd, &guid, 16) != 16) {
+    if (lms_reader_read(reader, &guid, 16) != 16) {
         perror("read");
         r = -2;
         goto done;
@@ -708,32 +691,32 @@ _parse(struct plugin *plugin, struct lms_context *ctxt, const struct lms_file_in
         goto done;
     }
 
-    hdrsize = _read_qword(fd);
-    pos_end = lseek(fd, 6, SEEK_CUR) - 24 + hdrsize;
+    hdrsize = _read_qword(reader);
+    pos_end = lms_reader_seek(reader, 6, SEEK_CUR) - 24 + hdrsize;
 
     while (1) {
         if (!pos)
-            pos = lseek(fd, 0, SEEK_CUR);
+            pos = lms_reader_seek(reader, 0, SEEK_CUR);
         if (pos > pos_end - 24)
             break;
 
-        read(fd, &guid, 16);
-        size = _read_qword(fd);
+        lms_reader_read(reader, &guid, 16);
+        size = _read_qword(reader);
 
         if (memcmp(guid, header_extension_guid, 16) == 0)
-            r = _parse_header_extension(plugin->cs_conv, fd, &info);
+            r = _parse_header_extension(plugin->cs_conv, reader, &info);
         else if (memcmp(guid, extended_stream_properties_guid, 16) == 0)
-            r = _parse_extended_stream_properties(plugin->cs_conv, fd, &info);
+            r = _parse_extended_stream_properties(plugin->cs_conv, reader, &info);
         else if (memcmp(guid, file_properties_guid, 16) == 0)
-            r = _parse_file_properties(fd, &info);
+            r = _parse_file_properties(reader, &info);
         else if (memcmp(guid, stream_properties_guid, 16) == 0)
-            r = _parse_stream_properties(fd, &info);
+            r = _parse_stream_properties(reader, &info);
         else if (memcmp(guid, language_list_guid, 16) == 0)
             r = 1;
         else if (memcmp(guid, content_description_guid, 16) == 0)
-            r = _parse_content_description(plugin->cs_conv, fd, &info);
+            r = _parse_content_description(plugin->cs_conv, reader, &info);
         else if (memcmp(guid, extended_content_description_guid, 16) == 0)
-            r = _parse_extended_content_description_object(plugin->cs_conv, fd,
+            r = _parse_extended_content_description_object(plugin->cs_conv, reader,
                                                            &info);
         else if (memcmp(guid, content_encryption_object_guid, 16) == 0 ||
                  memcmp(guid, extended_content_encryption_object_guid, 16) == 0)
@@ -746,7 +729,7 @@ _parse(struct plugin *plugin, struct lms_context *ctxt, const struct lms_file_in
             goto done;
 
         if (r > 0)
-            pos = lseek(fd, pos + size, SEEK_SET);
+            pos = lms_reader_seek(reader, pos + size, SEEK_SET);
         else
             pos = 0;
     }
@@ -768,7 +751,7 @@ _parse(struct plugin *plugin, struct lms_context *ctxt, const struct lms_file_in
 
     if (!info.title.str)
         lms_name_from_path(&info.title, finfo->path, finfo->path_len,
-                           finfo->base, _exts[((long) match) - 1].len,
+                           finfo->base, lms_match_ext_len(finfo, _exts, match),
                            ctxt->cs_conv);
 
     if (info.type == LMS_STREAM_TYPE_AUDIO) {
@@ -792,7 +775,8 @@ _parse(struct plugin *plugin, struct lms_context *ctxt, const struct lms_file_in
             audio_info.codec = s->base.codec;
         }
 
-        LMS_DLNA_GET_AUDIO_PROFILE_FD_FB(&audio_info, audio_dlna, fd);
+        LMS_DLNA_GET_AUDIO_PROFILE_FD_FB(&audio_info, audio_dlna,
+                                         lms_reader_fd(reader));
         r = lms_db_audio_add(plugin->audio_db, &audio_info);
     } else {
         struct lms_video_info video_info = { };
@@ -803,7 +787,8 @@ _parse(struct plugin *plugin, struct lms_context *ctxt, const struct lms_file_in
         video_info.length = info.length;
         video_info.container = _container;
         video_info.streams = (struct lms_stream *) info.streams;
-        LMS_DLNA_GET_VIDEO_PROFILE_FD_FB(&video_info, video_dlna, fd);
+        LMS_DLNA_GET_VIDEO_PROFILE_FD_FB(&video_info, video_dlna,
+                                         lms_reader_fd(reader));
         r = lms_db_video_add(plugin->video_db, &video_info);
     }
 
@@ -815,9 +800,6 @@ done:
     free(info.album.str);
     free(info.genre.str);
 
-    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
-    close(fd);
-
     return r;
 }
 
@@ -874,7 +856,7 @@ lms_plugin_open(void)
 
     plugin = (struct plugin *)malloc(sizeof(*plugin));
     plugin->plugin.name = _name;
-    plugin->plugin.match = (lms_plugin_match_fn_t)_match;
+    plugin->plugin.match = NULL;
     plugin->plugin.parse = (lms_plugin_parse_fn_t)_parse;
     plugin->plugin.close = (lms_plugin_close_fn_t)_close;
     plugin->plugin.setup = (lms_plugin_setup_fn_t)_setup;
@@ -885,6 +867,16 @@ lms_plugin_open(void)
     return (struct lms_plugin *)plugin;
 }
 
+API const struct lms_plugin_exts *
+lms_plugin_exts(void)
+{
+    static const struct lms_plugin_exts exts = {
+        _exts, LMS_ARRAY_SIZE(_exts)
+    };
+
+    return &exts;
+}
+
 API const struct lms_plugin_info *
 lms_plugin_info(void)
 {
@@ -899,3 +891,14 @@ lms_plugin_info(void)
 
     return &info;
 }
+
+API const struct lms_plugin_magic *
+lms_plugin_magic(void)
+{
+    static const struct lms_plugin_magic magic[] = {
+        {header_guid, 16, 0, (void *)3}, /* .asf, header object */
+        {NULL, 0, 0, NULL}
+    };
+
+    return magic;
+}
@@ -49,18 +49,6 @@ struct plugin {
     lms_db_audio_t *audio_db;
 };
 
-static void *
-_match(struct plugin *p, const char *path, int len, int base)
-{
-    long i;
-
-    i = lms_which_extension(path, len, _exts, LMS_ARRAY_SIZE(_exts));
-    if (i < 0)
-        return NULL;
-    else
-        return (void*)(i + 1);
-}
-
 static int
 _parse(struct plugin *plugin, struct lms_context *ctxt, const struct lms_file_info *finfo, void *match)
 {
@@ -121,7 +109,7 @@ lms_plugin_open(void)
 
     plugin = malloc(sizeof(*plugin));
     plugin->plugin.name = _name;
-    plugin->plugin.match = (lms_plugin_match_fn_t)_match;
+    plugin->plugin.match = NULL;
     plugin->plugin.parse = (lms_plugin_parse_fn_t)_parse;
     plugin->plugin.close = (lms_plugin_close_fn_t)_close;
     plugin->plugin.setup = (lms_plugin_setup_fn_t)_setup;
@@ -132,6 +120,16 @@ lms_plugin_open(void)
     return (struct lms_plugin *)plugin;
 }
 
+API const struct lms_plugin_exts *
+lms_plugin_exts(void)
+{
+    static const struct lms_plugin_exts exts = {
+        _exts, LMS_ARRAY_SIZE(_exts)
+    };
+
+    return &exts;
+}
+
 API const struct lms_plugin_info *
 lms_plugin_info(void)
 {
@@ -27,6 +27,7 @@
 #include <lightmediascanner_plugin.h>
 #include <lightmediascanner_db.h>
 #include <lightmediascanner_dlna.h>
+#include <shared/util.h>
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -53,18 +54,6 @@ static const char *_authors[] = {
     NULL
 };
 
-static void *
-_match(struct plugin *p, const char *path, int len, int base)
-{
-    long i;
-
-    i = lms_which_extension(path, len, _exts, LMS_ARRAY_SIZE(_exts));
-    if (i < 0)
-      return NULL;
-    else
-      return (void*)(i + 1);
-}
-
 static int
 _parse(struct plugin *plugin, struct lms_context *ctxt, const struct lms_file_info *finfo, void *match)
 {
@@ -123,7 +112,7 @@ _parse(struct plugin *plugin, struct lms_context *ctxt, const struct lms_file_in
 title_fallback:
     if (!info.title.str)
         lms_name_from_path(&info.title, finfo->path, finfo->path_len,
-                           finfo->base, _exts[((long) match) - 1].len,
+                           finfo->base, lms_match_ext_len(finfo, _exts, match),
                            NULL);
     if (info.title.str)
         lms_charset_conv(ctxt->cs_conv, &info.title.str, &info.title.len);
@@ -193,7 +182,7 @@ lms_plugin_open(void)
 
     plugin = (struct plugin *)malloc(sizeof(*plugin));
     plugin->plugin.name = _name;
-    plugin->plugin.match = (lms_plugin_match_fn_t)_match;
+    plugin->plugin.match = NULL;
     plugin->plugin.parse = (lms_plugin_parse_fn_t)_parse;
     plugin->plugin.close = (lms_plugin_close_fn_t)_close;
     plugin->plugin.setup = (lms_plugin_setup_fn_t)_setup;
@@ -204,6 +193,16 @@ lms_plugin_open(void)
     return (struct lms_plugin *)plugin;
 }
 
+API const struct lms_plugin_exts *
+lms_plugin_exts(void)
+{
+    static const struct lms_plugin_exts exts = {
+        _exts, LMS_ARRAY_SIZE(_exts)
+    };
+
+    return &exts;
+}
+
 API const struct lms_plugin_info *
 lms_plugin_info(void)
 {
@@ -218,3 +217,14 @@ lms_plugin_info(void)
 
     return &info;
 }
+
+API const struct lms_plugin_magic *
+lms_plugin_magic(void)
+{
+    static const struct lms_plugin_magic magic[] = {
+        {"fLaC", 4, 0, (void *)1}, /* .flac */
+        {NULL, 0, 0, NULL}
+    };
+
+    return magic;
+}
@@ -327,18 +327,6 @@ struct mpeg_info {
     struct lms_string_size genre;
 };
 
-static void *
-_match(struct plugin *p, const char *path, int len, int base)
-{
-    long i;
-
-    i = lms_which_extension(path, len, _exts, LMS_ARRAY_SIZE(_exts));
-    if (i < 0)
-      return NULL;
-    else
-      return (void*)(i + 1);
-}
-
 static char *
 _get_dict_value(AVDictionary *dict, const char *key)
 {
@@ -638,7 +626,7 @@ lms_plugin_open(void)
 
     plugin = (struct plugin *)malloc(sizeof(*plugin));
     plugin->plugin.name = _name;
-    plugin->plugin.match = (lms_plugin_match_fn_t)_match;
+    plugin->plugin.match = NULL;
     plugin->plugin.parse = (lms_plugin_parse_fn_t)_parse;
     plugin->plugin.close = (lms_plugin_close_fn_t)_close;
     plugin->plugin.setup = (lms_plugin_setup_fn_t)_setup;
@@ -649,6 +637,16 @@ lms_plugin_open(void)
     return (struct lms_plugin *)plugin;
 }
 
+API const struct lms_plugin_exts *
+lms_plugin_exts(void)
+{
+    static const struct lms_plugin_exts exts = {
+        _exts, LMS_ARRAY_SIZE(_exts)
+    };
+
+    return &exts;
+}
+
 API const struct lms_plugin_info *
 lms_plugin_info(void)
 {
@@ -383,7 +383,7 @@ _fill_mpeg_header(struct mpeg_header *hdr, const uint8_t b[4])
 }
 
 static int
-_estimate_mp3_bitrate_from_frames(int fd, off_t mpeg_offset,
+_estimate_mp3_bitrate_from_frames(lms_reader_t *reader, off_t mpeg_offset,
                                   struct mpeg_header *orig_hdr)
 {
     struct mpeg_header hdr = *orig_hdr;
@@ -425,8 +425,8 @@ _estimate_mp3_bitrate_from_frames(int fd, off_t mpeg_offset,
 
         offset += framesize;
 
-        lseek(fd, offset, SEEK_SET);
-        r = read(fd, buf, sizeof(buf));
+        lms_reader_seek(reader, offset, SEEK_SET);
+        r = lms_reader_read(reader, buf, sizeof(buf));
 
         if (r < 0) {
             fprintf(stderr, "ERROR reading frame header at %#x\n",
@@ -452,7 +452,7 @@ _estimate_mp3_bitrate_from_frames(int fd, off_t mpeg_offset,
 }
 
 static int
-_parse_vbr_headers(int fd, off_t mpeg_offset, struct mpeg_header *hdr)
+_parse_vbr_headers(lms_reader_t *reader, off_t mpeg_offset, struct mpeg_header *hdr)
 {
     unsigned int sampling_rate, samples_per_frame, flags, nframes = 0, size = 0;
     int xing_offset_table[2][2] = { /* [(version == 1)][channels == 1)] */
@@ -466,8 +466,8 @@ _parse_vbr_headers(int fd, off_t mpeg_offset, struct mpeg_header *hdr)
     xing_offset = mpeg_offset + 4 + 2 * hdr->crc
         + xing_offset_table[(hdr->version == 1)][(hdr->channels == 1)];
 
-    lseek(fd, xing_offset, SEEK_SET);
-    if (read(fd, buf, sizeof(buf)) != sizeof(buf))
+    lms_reader_seek(reader, xing_offset, SEEK_SET);
+    if (lms_reader_read(reader, buf, sizeof(buf)) != sizeof(buf))
         return -1;
 
     hdr->cbr = (memcmp(buf, "Info", 4) == 0);
@@ -484,8 +484,8 @@ _parse_vbr_headers(int fd, off_t mpeg_offset, struct mpeg_header *hdr)
 
     /* VBRI is found in files encoded by Fraunhofer Encoder. Fixed location: 32
      * bytes after the mpeg header */
-    lseek(fd, mpeg_offset + 36, SEEK_SET);
-    if (read(fd, buf, sizeof(buf)) != sizeof(buf))
+    lms_reader_seek(reader, mpeg_offset + 36, SEEK_SET);
+    if (lms_reader_read(reader, buf, sizeof(buf)) != sizeof(buf))
         return -1;
 
     if (memcmp(buf, "VBRI", 4) == 0 && get_be16(buf) == 1) {
@@ -511,7 +511,7 @@ proceed:
 }
 
 static int
-_parse_mpeg_header(int fd, off_t off, struct lms_audio_info *audio_info,
+_parse_mpeg_header(lms_reader_t *reader, off_t off, struct lms_audio_info *audio_info,
                    size_t size)
 {
     uint8_t buffer[32];
@@ -520,12 +520,13 @@ _parse_mpeg_header(int fd, off_t off, struct lms_audio_info *audio_info,
     struct mpeg_header hdr = { };
     int r;
 
-    lseek(fd, off, SEEK_SET);
+    lms_reader_seek(reader, off, SEEK_SET);
 
     /* Find sync word */
     prev_read = 0;
     do {
-        int nread = read(fd, buffer + prev_read, sizeof(buffer) - prev_read);
+        int nread = lms_reader_read(reader, buffer + prev_read,
+                                    sizeof(buffer) - prev_read);
         if (nread < MPEG_HEADER_SIZE)
             return -1;
 
@@ -559,14 +560,14 @@ found:
         r = _fill_aac_header(&hdr, p);
     else {
         if ((r = _fill_mp3_header(&hdr, p) < 0) ||
-            (r = _parse_vbr_headers(fd, off, &hdr) < 0))
+            (r = _parse_vbr_headers(reader, off, &hdr) < 0))
             return r;
 
         if (hdr.cbr)
             hdr.bitrate =
                 _bitrate_table[hdr.version][hdr.layer][hdr.bitrate_idx] * 1000;
         else if (!hdr.bitrate) {
-            r = _estimate_mp3_bitrate_from_frames(fd, off, &hdr);
+            r = _estimate_mp3_bitrate_from_frames(reader, off, &hdr);
             if (r < 0)
                 return r;
         }
@@ -587,19 +588,19 @@ found:
     return 0;
 }
 
-/* Returns the offset in fd to the position after the ID3 tag, iff it occurs
+/* Returns the offset in file to the position after the ID3 tag, iff it occurs
  * *before* a sync word. Otherwise < 0 is returned and if we gave up looking
  * after ID3 because of a sync value, @syncframe_offset is set to its
  * correspondent offset */
 static long
-_find_id3v2(int fd, off_t *sync_offset)
+_find_id3v2(lms_reader_t *reader, off_t *sync_offset)
 {
     static const char pattern[3] = "ID3";
     char buffer[3];
     unsigned int prev_part_match, prev_part_match_sync = 0;
     long buffer_offset;
 
-    if (read(fd, buffer, sizeof(buffer)) != sizeof(buffer))
+    if (lms_reader_read(reader, buffer, sizeof(buffer)) != sizeof(buffer))
         return -1;
 
     if (memcmp(buffer, pattern, sizeof(pattern)) == 0)
@@ -678,7 +679,7 @@ _find_id3v2(int fd, off_t *sync_offset)
             }
         }
 
-        if (read(fd, buffer, sizeof(buffer)) != sizeof(buffer))
+        if (lms_reader_read(reader, buffer, sizeof(buffer)) != sizeof(buffer))
             return -1;
         buffer_offset += sizeof(buffer);
     }
@@ -958,7 +959,7 @@ _parse_id3v2_frame(struct id3v2_frame_header *fh, const char *frame_data, struct
 }
 
 static int
-_parse_id3v2(int fd, long id3v2_offset, struct id3_info *info,
+_parse_id3v2(lms_reader_t *reader, long id3v2_offset, struct id3_info *info,
              lms_charset_conv_t **cs_convs, off_t *ptag_size)
 {
     char header_data[10], frame_header_data[10];
@@ -967,10 +968,10 @@ _parse_id3v2(int fd, long id3v2_offset, struct id3_info *info,
     struct id3v2_frame_header fh;
     size_t nread;
 
-    lseek(fd, id3v2_offset, SEEK_SET);
+    lms_reader_seek(reader, id3v2_offset, SEEK_SET);
 
     /* parse header */
-    if (read(fd, header_data, ID3V2_HEADER_SIZE) != ID3V2_HEADER_SIZE)
+    if (lms_reader_read(reader, header_data, ID3V2_HEADER_SIZE) != ID3V2_HEADER_SIZE)
         return -1;
 
     tag_size = _to_uint_max7b(header_data + 6, 4);
@@ -993,7 +994,7 @@ _parse_id3v2(int fd, long id3v2_offset, struct id3_info *info,
         char extended_header_data[6];
         bool crc;
 
-        if (read(fd, extended_header_data, 4) != 4)
+        if (lms_reader_read(reader, extended_header_data, 4) != 4)
             return -1;
 
         extended_header_size = _to_uint(extended_header_data, 4);
@@ -1001,7 +1002,7 @@ _parse_id3v2(int fd, long id3v2_offset, struct id3_info *info,
 
         *ptag_size += extended_header_size + (crc * 4);
 
-        lseek(fd, extended_header_size - 6, SEEK_CUR);
+        lms_reader_seek(reader, extended_header_size - 6, SEEK_CUR);
         frame_data_pos += extended_header_size;
         frame_data_length -= extended_header_size;
     }
@@ -1012,7 +1013,7 @@ _parse_id3v2(int fd, long id3v2_offset, struct id3_info *info,
 
     frame_header_size = _get_id3v2_frame_header_size(major_version);
     while (frame_data_pos < frame_data_length - frame_header_size) {
-        nread = read(fd, frame_header_data, frame_header_size);
+        nread = lms_reader_read(reader, frame_header_data, frame_header_size);
         if (nread == 0)
             break;
 
@@ -1031,10 +1032,11 @@ _parse_id3v2(int fd, long id3v2_offset, struct id3_info *info,
             char *frame_data;
 
             if (fh.data_length_indicator)
-                lseek(fd, 4, SEEK_CUR);
+                lms_reader_seek(reader, 4, SEEK_CUR);
 
             frame_data = malloc(sizeof(char) * fh.frame_size);
-            if (read(fd, frame_data, fh.frame_size) != (int)fh.frame_size) {
+            if (lms_reader_read(reader, frame_data, fh.frame_size) !=
+                (int)fh.frame_size) {
                 free(frame_data);
                 return -1;
             }
@@ -1044,9 +1046,9 @@ _parse_id3v2(int fd, long id3v2_offset, struct id3_info *info,
         }
         else {
             if (fh.data_length_indicator)
-                lseek(fd, fh.frame_size + 4, SEEK_CUR);
+                lms_reader_seek(reader, fh.frame_size + 4, SEEK_CUR);
             else
-                lseek(fd, fh.frame_size, SEEK_CUR);
+                lms_reader_seek(reader, fh.frame_size, SEEK_CUR);
         }
 
         frame_data_pos += fh.frame_size + frame_header_size;
@@ -1097,10 +1099,10 @@ _id3v1_str_get(struct lms_string_size *s, const char *buf, int maxlen, lms_chars
 }
 
 static int
-_parse_id3v1(int fd, struct id3_info *info, lms_charset_conv_t *cs_conv)
+_parse_id3v1(lms_reader_t *reader, struct id3_info *info, lms_charset_conv_t *cs_conv)
 {
     struct id3v1_tag tag;
-    if (read(fd, &tag, sizeof(struct id3v1_tag)) == -1)
+    if (lms_reader_read(reader, &tag, sizeof(struct id3v1_tag)) == -1)
         return -1;
 
     if (!info->title.str)
@@ -1118,18 +1120,6 @@ _parse_id3v1(int fd, struct id3_info *info, lms_charset_conv_t *cs_conv)
     return 0;
 }
 
-static void *
-_match(struct plugin *p, const char *path, int len, int base)
-{
-    long i;
-
-    i = lms_which_extension(path, len, _exts, LMS_ARRAY_SIZE(_exts));
-    if (i < 0)
-      return NULL;
-    else
-      return (void*)(i + 1);
-}
-
 static int
 _parse(struct plugin *plugin, struct lms_context *ctxt, const struct lms_file_info *finfo, void *match)
 {
@@ -1138,18 +1128,13 @@ _parse(struct plugin *plugin, struct lms_context *ctxt, const struct lms_file_in
         .cur_artist_priority = -1,
     };
     struct lms_audio_info audio_info = { };
-    int r, fd;
+    lms_reader_t *reader = finfo->reader;
+    int r;
     long id3v2_offset;
     off_t sync_offset = 0;
     const struct lms_dlna_audio_profile *audio_dlna;
 
-    fd = open(finfo->path, O_RDONLY);
-    if (fd < 0) {
-        perror("open");
-        return -1;
-    }
-
-    id3v2_offset = _find_id3v2(fd, &sync_offset);
+    id3v2_offset = _find_id3v2(reader, &sync_offset);
     if (id3v2_offset >= 0) {
         off_t id3v2_size = 3;
 
@@ -1159,7 +1144,7 @@ _parse(struct plugin *plugin, struct lms_context *ctxt, const struct lms_file_in
         fprintf(stderr, "id3v2 tag found in file %s with offset %ld\n",
                 finfo->path, id3v2_offset);
 #endif
-        if (_parse_id3v2(fd, id3v2_offset, &info, plugin->cs_convs,
+        if (_parse_id3v2(reader, id3v2_offset, &info, plugin->cs_convs,
                          &id3v2_size) != 0 ||
             !info.title.str || !info.artist.str ||
             !info.album.str || !info.genre.str ||
@@ -1182,12 +1167,12 @@ _parse(struct plugin *plugin, struct lms_context *ctxt, const struct lms_file_in
                 finfo->path);
 #endif
         /* check for id3v1 tag */
-        if (lseek(fd, -128, SEEK_END) == -1) {
+        if (lms_reader_seek(reader, -128, SEEK_END) == -1) {
             r = -3;
             goto done;
         }
 
-        if (read(fd, &tag, 3) == -1) {
+        if (lms_reader_read(reader, &tag, 3) == -1) {
             r = -4;
             goto done;
         }
@@ -1196,7 +1181,7 @@ _parse(struct plugin *plugin, struct lms_context *ctxt, const struct lms_file_in
 #if 0
             fprintf(stderr, "id3v1 tag found in file %s\n", finfo->path);
 #endif
-            if (_parse_id3v1(fd, &info, ctxt->cs_conv) != 0) {
+            if (_parse_id3v1(reader, &info, ctxt->cs_conv) != 0) {
                 r = -5;
                 goto done;
             }
@@ -1205,7 +1190,7 @@ _parse(struct plugin *plugin, struct lms_context *ctxt, const struct lms_file_in
 
     if (!info.title.str)
         lms_name_from_path(&info.title, finfo->path, finfo->path_len,
-                           finfo->base, _exts[((long) match) - 1].len,
+                           finfo->base, lms_match_ext_len(finfo, _exts, match),
                            ctxt->cs_conv);
 
     if (info.trackno == -1)
@@ -1227,16 +1212,14 @@ _parse(struct plugin *plugin, struct lms_context *ctxt, const struct lms_file_in
     audio_info.genre = info.genre;
     audio_info.trackno = info.trackno;
 
-    _parse_mpeg_header(fd, sync_offset, &audio_info, finfo->size);
+    _parse_mpeg_header(reader, sync_offset, &audio_info, finfo->size);
 
     audio_info.container = _container_mp3;
-    LMS_DLNA_GET_AUDIO_PROFILE_FD_FB(&audio_info, audio_dlna, fd);
+    LMS_DLNA_GET_AUDIO_PROFILE_FD_FB(&audio_info, audio_dlna,
+                                     lms_reader_fd(reader));
     r = lms_db_audio_add(plugin->audio_db, &audio_info);
 
   done:
-    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
-    close(fd);
-
     free(info.title.str);
     free(info.artist.str);
     free(info.album.str);
@@ -1312,7 +1295,7 @@ lms_plugin_open(void)
 
     plugin = (struct plugin *)malloc(sizeof(*plugin));
     plugin->plugin.name = _name;
-    plugin->plugin.match = (lms_plugin_match_fn_t)_match;
+    plugin->plugin.match = NULL;
     plugin->plugin.parse = (lms_plugin_parse_fn_t)_parse;
     plugin->plugin.close = (lms_plugin_close_fn_t)_close;
     plugin->plugin.setup = (lms_plugin_setup_fn_t)_setup;
@@ -1323,6 +1306,16 @@ lms_plugin_open(void)
     return (struct lms_plugin *)plugin;
 }
 
+API const struct lms_plugin_exts *
+lms_plugin_exts(void)
+{
+    static const struct lms_plugin_exts exts = {
+        _exts, LMS_ARRAY_SIZE(_exts)
+    };
+
+    return &exts;
+}
+
 API const struct lms_plugin_info *
 lms_plugin_info(void)
 {
@@ -1337,3 +1330,20 @@ lms_plugin_info(void)
 
     return &info;
 }
+
+API const struct lms_plugin_magic *
+lms_plugin_magic(void)
+{
+    static const struct lms_plugin_magic magic[] = {
+        {"ID3", 3, 0, (void *)1}, /* .mp3 */
+        {"\xff\xfb", 2, 0, (void *)1}, /* .mp3, MPEG-1 layer 3 frame */
+        {"\xff\xfa", 2, 0, (void *)1},
+        {"\xff\xf3", 2, 0, (void *)1}, /* .mp3, MPEG-2 layer 3 frame */
+        {"\xff\xf2", 2, 0, (void *)1},
+        {"\xff\xf1", 2, 0, (void *)2}, /* .aac, ADTS frame */
+        {"\xff\xf9", 2, 0, (void *)2},
+        {NULL, 0, 0, NULL}
+    };
+
+    return magic;
+}
@@ -68,11 +68,11 @@ enum {
  * Process SOF JPEG, this contains width and height.
  */
 static int
-_jpeg_sof_process(int fd, unsigned short *width, unsigned short *height)
+_jpeg_sof_process(lms_reader_t *reader, unsigned short *width, unsigned short *height)
 {
     unsigned char buf[6];
 
-    if (read(fd, buf, 6) != 6) {
+    if (lms_reader_read(reader, buf, 6) != 6) {
         perror("could not read() SOF data");
         return -1;
     }
@@ -87,7 +87,7 @@ _jpeg_sof_process(int fd, unsigned short *width, unsigned short *height)
  * Process COM JPEG, this contains user comment.
  */
 static int
-_jpeg_com_process(int fd, int len, struct lms_string_size *comment)
+_jpeg_com_process(lms_reader_t *reader, int len, struct lms_string_size *comment)
 {
     if (len < 1) {
         comment->str = NULL;
@@ -100,7 +100,7 @@ _jpeg_com_process(int fd, int len, struct lms_string_size *comment)
         perror("malloc");
         return -1;
     }
-    if (read(fd, comment->str, len) != len) {
+    if (lms_reader_read(reader, comment->str, len) != len) {
         perror("read");
         free(comment->str);
         comment->str = NULL;
@@ -122,23 +122,23 @@ _jpeg_com_process(int fd, int len, struct lms_string_size *comment)
  * Walk JPEG markers in order to get useful information.
  */
 static int
-_jpeg_info_get(int fd, int len, struct lms_image_info *info)
+_jpeg_info_get(lms_reader_t *reader, int len, struct lms_image_info *info)
 {
     unsigned char buf[4];
     int found;
     off_t offset;
 
     found = info->title.str ? 1 : 0;
-    offset = lseek(fd, len - 2, SEEK_CUR);
+    offset = lms_reader_seek(reader, len - 2, SEEK_CUR);
     len = 0;
     while (found < 2) {
-        offset = lseek(fd, offset + len, SEEK_SET);
+        offset = lms_reader_seek(reader, offset + len, SEEK_SET);
         if (offset == -1) {
             perror("lseek");
             return -1;
         }
 
-        if (read(fd, buf, 4) != 4) {
+        if (lms_reader_read(reader, buf, 4) != 4) {
             perror("read");
             return -2;
         }
@@ -155,14 +155,14 @@ _jpeg_info_get(int fd, int len, struct lms_image_info *info)
             buf[1] == JPEG_MARKER_SOF2 ||
             buf[1] == JPEG_MARKER_SOF9 ||
             buf[1] == JPEG_MARKER_SOF10) {
-            if (_jpeg_sof_process(fd, &info->width, &info->height) != 0)
+            if (_jpeg_sof_process(reader, &info->width, &info->height) != 0)
                 return -4;
             found++;
         } else if (buf[1] == JPEG_MARKER_COMM && !info->title.str) {
             /* abort if COMM is too big, it's unexpected and we suspect
              * it's a broken or malicious JPEG header.
              */
-            if (len > 1024 || _jpeg_com_process(fd, len, &info->title) != 0)
+            if (len > 1024 || _jpeg_com_process(reader, len, &info->title) != 0)
                 return -5;
             found++;
         } else if (buf[1] == JPEG_MARKER_SOS)
@@ -179,16 +179,16 @@ _jpeg_info_get(int fd, int len, struct lms_image_info *info)
  * marker type and its length.
  */
 static int
-_jpeg_data_get(int fd, int *type, int *len)
+_jpeg_data_get(lms_reader_t *reader, int *type, int *len)
 {
     unsigned char buf[6];
 
-    if (lseek(fd, 0, SEEK_SET) != 0) {
+    if (lms_reader_seek(reader, 0, SEEK_SET) != 0) {
         perror("lseek");
         return -1;
     }
 
-    if (read(fd, buf, 6) != 6) {
+    if (lms_reader_read(reader, buf, 6) != 6) {
         perror("read");
         return -2;
     }
@@ -242,11 +242,11 @@ struct exif_ifd {
  * Read IFD from stream.
  */
 static int
-_exif_ifd_get(int fd, int little_endian, struct exif_ifd *ifd)
+_exif_ifd_get(lms_reader_t *reader, int little_endian, struct exif_ifd *ifd)
 {
     unsigned char buf[12];
 
-    if (read(fd, buf, 12) != 12) {
+    if (lms_reader_read(reader, buf, 12) != 12) {
         perror("read");
         return -1;
     }
@@ -271,14 +271,14 @@ _exif_ifd_get(int fd, int little_endian, struct exif_ifd *ifd)
  * This will setup the file description position and call _jpeg_info_get().
  */
 static int
-_exif_extra_get(int fd, int abs_offset, int len, struct lms_image_info *info)
+_exif_extra_get(lms_reader_t *reader, int abs_offset, int len, struct lms_image_info *info)
 {
-    if (lseek(fd, abs_offset, SEEK_SET) == -1) {
+    if (lms_reader_seek(reader, abs_offset, SEEK_SET) == -1) {
         perror("lseek");
         return -1;
     }
 
-    if (_jpeg_info_get(fd, len, info) != 0) {
+    if (_jpeg_info_get(reader, len, info) != 0) {
         fprintf(stderr, "ERROR: could not get image size.\n");
         return -2;
     }
@@ -286,7 +286,7 @@ _exif_extra_get(int fd, int abs_offset, int len, struct lms_image_info *info)
 }
 
 static int
-_exif_text_encoding_get(int fd, unsigned int count, int offset, struct lms_string_size *s)
+_exif_text_encoding_get(lms_reader_t *reader, unsigned int count, int offset, struct lms_string_size *s)
 {
     if (count <= 8)
         return -1;
@@ -294,14 +294,14 @@ _exif_text_encoding_get(int fd, unsigned int count, int offset, struct lms_strin
     count -= 8; /* XXX don't just ignore character code, handle it. */
     offset += 8;
 
-    if (lseek(fd, offset, SEEK_SET) == -1) {
+    if (lms_reader_seek(reader, offset, SEEK_SET) == -1) {
         perror("lseek");
         return -2;
     }
 
     s->str = malloc(count + 1);
 
-    if (read(fd, s->str, count) != (int)count) {
+    if (lms_reader_read(reader, s->str, count) != (int)count) {
         perror("read");
         free(s->str);
         s->str = NULL;
@@ -317,7 +317,7 @@ _exif_text_encoding_get(int fd, unsigned int count, int offset, struct lms_strin
 }
 
 static int
-_exif_text_ascii_get(int fd, unsigned int count, int offset, struct lms_string_size *s)
+_exif_text_ascii_get(lms_reader_t *reader, unsigned int count, int offset, struct lms_string_size *s)
 {
     if (count < 1) {
         s->str = NULL;
@@ -325,14 +325,14 @@ _exif_text_ascii_get(int fd, unsigned int count, int offset, struct lms_string_s
         return 0;
     }
 
-    if (lseek(fd, offset, SEEK_SET) == -1) {
+    if (lms_reader_seek(reader, offset, SEEK_SET) == -1) {
         perror("lseek");
         return -1;
     }
 
     s->str = malloc(count);
 
-    if (read(fd, s->str, count) != (int)count) {
+    if (lms_reader_read(reader, s->str, count) != (int)count) {
         perror("read");
         free(s->str);
         s->str = NULL;
@@ -348,17 +348,17 @@ _exif_text_ascii_get(int fd, unsigned int count, int offset, struct lms_string_s
 }
 
 static unsigned int
-_exif_datetime_get(int fd, int offset)
+_exif_datetime_get(lms_reader_t *reader, int offset)
 {
     char buf[20];
     struct tm tm = { };
 
-    if (lseek(fd, offset, SEEK_SET) == -1) {
+    if (lms_reader_seek(reader, offset, SEEK_SET) == -1) {
         perror("lseek");
         return 0;
     }
 
-    if (read(fd, buf, 20) != 20) {
+    if (lms_reader_read(reader, buf, 20) != 20) {
         perror("read");
         return 0;
     }
@@ -370,13 +370,13 @@ _exif_datetime_get(int fd, int offset)
     return 0;
 }
 
-static int _exif_private_ifd_get(int fd, int base_offset, int offset, int little_endian, struct lms_image_info *info);
+static int _exif_private_ifd_get(lms_reader_t *reader, int base_offset, int offset, int little_endian, struct lms_image_info *info);
 
 /**
  * Process IFD contents.
  */
 static int
-_exif_ifd_process(int fd, int count, int ifd_offset, int tiff_base, int little_endian, struct lms_image_info *info)
+_exif_ifd_process(lms_reader_t *reader, int count, int ifd_offset, int tiff_base, int little_endian, struct lms_image_info *info)
 {
     int i, torig, tdig, tlast;
 
@@ -385,8 +385,8 @@ _exif_ifd_process(int fd, int count, int ifd_offset, int tiff_base, int little_e
     for (i = 0; i < count; i++) {
         struct exif_ifd ifd;
 
-        lseek(fd, tiff_base + ifd_offset + i * 12, SEEK_SET);
-        if (_exif_ifd_get(fd, little_endian, &ifd) != 0) {
+        lms_reader_seek(reader, tiff_base + ifd_offset + i * 12, SEEK_SET);
+        if (_exif_ifd_get(reader, little_endian, &ifd) != 0) {
             fprintf(stderr, "ERROR: could not read Exif IFD.\n");
             return -8;
         }
@@ -397,34 +397,34 @@ _exif_ifd_process(int fd, int count, int ifd_offset, int tiff_base, int little_e
             break;
         case EXIF_TAG_ARTIST:
             if (!info->artist.str)
-                _exif_text_ascii_get(fd, ifd.count, tiff_base + ifd.offset,
+                _exif_text_ascii_get(reader, ifd.count, tiff_base + ifd.offset,
                                      &info->artist);
             break;
         case EXIF_TAG_USER_COMMENT:
             if (!info->title.str)
-                _exif_text_encoding_get(fd, ifd.count, tiff_base + ifd.offset,
+                _exif_text_encoding_get(reader, ifd.count, tiff_base + ifd.offset,
                                         &info->title);
             break;
         case EXIF_TAG_IMAGE_DESCRIPTION:
             if (!info->title.str)
-                _exif_text_ascii_get(fd, ifd.count, tiff_base + ifd.offset,
+                _exif_text_ascii_get(reader, ifd.count, tiff_base + ifd.offset,
                                      &info->title);
             break;
         case EXIF_TAG_DATE_TIME:
             if (torig == 0 && info->date == 0)
-                tlast = _exif_datetime_get(fd, tiff_base + ifd.offset);
+                tlast = _exif_datetime_get(reader, tiff_base + ifd.offset);
             break;
         case EXIF_TAG_DATE_TIME_ORIGINAL:
             if (torig == 0 && info->date == 0)
-                torig = _exif_datetime_get(fd, tiff_base + ifd.offset);
+                torig = _exif_datetime_get(reader, tiff_base + ifd.offset);
             break;
         case EXIF_TAG_DATE_TIME_DIGITIZED:
             if (torig == 0 && info->date == 0)
-                tdig = _exif_datetime_get(fd, tiff_base + ifd.offset);
+                tdig = _exif_datetime_get(reader, tiff_base + ifd.offset);
             break;
         case EXIF_TAG_EXIF_IFD_POINTER:
             if (ifd.count == 1 && ifd.type == EXIF_TYPE_LONG)
-                _exif_private_ifd_get(fd, ifd.offset, tiff_base,
+                _exif_private_ifd_get(reader, ifd.offset, tiff_base,
                                       little_endian, info);
             break;
         default:
@@ -449,23 +449,23 @@ _exif_ifd_process(int fd, int count, int ifd_offset, int tiff_base, int little_e
  * Process Exif IFD (Exif Private Tag), with more specific info.
  */
 static int
-_exif_private_ifd_get(int fd, int ifd_offset, int tiff_base, int little_endian, struct lms_image_info *info)
+_exif_private_ifd_get(lms_reader_t *reader, int ifd_offset, int tiff_base, int little_endian, struct lms_image_info *info)
 {
     char buf[2];
     unsigned int count;
 
-    if (lseek(fd, tiff_base + ifd_offset, SEEK_SET) == -1) {
+    if (lms_reader_seek(reader, tiff_base + ifd_offset, SEEK_SET) == -1) {
         perror("lseek");
         return -1;
     }
 
-    if (read(fd, buf, 2) != 2) {
+    if (lms_reader_read(reader, buf, 2) != 2) {
         perror("read");
         return -1;
     }
 
     count = E_2BTYE(little_endian, buf);
-    return _exif_ifd_process(fd, count, ifd_offset + 2, tiff_base,
+    return _exif_ifd_process(reader, count, ifd_offset + 2, tiff_base,
                              little_endian, info);
 }
 
@@ -474,20 +474,20 @@ _exif_private_ifd_get(int fd, int ifd_offset, int tiff_base, int little_endian,
  * JPEG markers (comment, size).
  */
 static int
-_exif_data_get(int fd, int len, struct lms_image_info *info)
+_exif_data_get(lms_reader_t *reader, int len, struct lms_image_info *info)
 {
     const unsigned char exif_hdr[6] = "Exif\0";
     unsigned char buf[9];
     unsigned int little_endian, offset, count;
     off_t abs_offset, tiff_base;
 
-    abs_offset = lseek(fd, 0, SEEK_CUR);
+    abs_offset = lms_reader_seek(reader, 0, SEEK_CUR);
     if (abs_offset == -1) {
         perror("lseek");
         return -1;
     }
 
-    if (read(fd, buf, 6) != 6) {
+    if (lms_reader_read(reader, buf, 6) != 6) {
         perror("read");
         return -2;
     }
@@ -496,9 +496,9 @@ _exif_data_get(int fd, int len, struct lms_image_info *info)
     info->orientation = 1;
 
     if (memcmp(buf, exif_hdr, 6) != 0)
-        return _exif_extra_get(fd, abs_offset, len, info);
+        return _exif_extra_get(reader, abs_offset, len, info);
 
-    if (read(fd, buf, 8) != 8) {
+    if (lms_reader_read(reader, buf, 8) != 8) {
         perror("read");
         return -4;
     }
@@ -516,30 +516,30 @@ _exif_data_get(int fd, int len, struct lms_image_info *info)
     }
 
     offset -= 8;
-    if (offset > 0 && lseek(fd, offset, SEEK_CUR) == -1) {
+    if (offset > 0 && lms_reader_seek(reader, offset, SEEK_CUR) == -1) {
         perror("lseek");
         return -6;
     }
 
     tiff_base = abs_offset + 6; /* offsets are relative to TIFF base */
 
-    if (read(fd, buf, 2) != 2) {
+    if (lms_reader_read(reader, buf, 2) != 2) {
         perror("read");
         return -7;
     }
     count = E_2BTYE(little_endian, buf);
 
-    _exif_ifd_process(fd, count, 8 + 2, tiff_base,
+    _exif_ifd_process(reader, count, 8 + 2, tiff_base,
                       little_endian, info);
 
-    return _exif_extra_get(fd, abs_offset, len, info);
+    return _exif_extra_get(reader, abs_offset, len, info);
 }
 
 /**
  * Process file as it being JFIF
  */
 static int
-_jfif_data_get(int fd, int len, struct lms_image_info *info)
+_jfif_data_get(lms_reader_t *reader, int len, struct lms_image_info *info)
 {
     unsigned char buf[4];
     int new_len;
@@ -548,12 +548,12 @@ _jfif_data_get(int fd, int len, struct lms_image_info *info)
     info->orientation = 1;
 
     /* JFIF provides no useful information, try to find out Exif */
-    if (lseek(fd, len - 2, SEEK_CUR) == -1) {
+    if (lms_reader_seek(reader, len - 2, SEEK_CUR) == -1) {
         perror("lseek");
         return -1;
     }
 
-    if (read(fd, buf, 4) != 4) {
+    if (lms_reader_read(reader, buf, 4) != 4) {
         perror("read");
         return -2;
     }
@@ -565,14 +565,14 @@ _jfif_data_get(int fd, int len, struct lms_image_info *info)
     }
 
     if (buf[1] == JPEG_MARKER_EXIF)
-        return _exif_data_get(fd, new_len, info);
+        return _exif_data_get(reader, new_len, info);
     else {
         /* rollback to avoid losing initial frame */
-        if (lseek(fd, - len - 2, SEEK_CUR) == -1) {
+        if (lms_reader_seek(reader, - len - 2, SEEK_CUR) == -1) {
             perror("lseek");
             return -1;
         }
-        return _jpeg_info_get(fd, len, info);
+        return _jpeg_info_get(reader, len, info);
     }
 }
 
@@ -597,45 +597,28 @@ struct plugin {
     lms_db_image_t *img_db;
 };
 
-static void *
-_match(struct plugin *p, const char *path, int len, int base)
-{
-    long i;
-
-    i = lms_which_extension(path, len, _exts, LMS_ARRAY_SIZE(_exts));
-    if (i < 0)
-        return NULL;
-    else
-        return (void*)(i + 1);
-}
-
 static int
 _parse(struct plugin *plugin, struct lms_context *ctxt, const struct lms_file_info *finfo, void *match)
 {
     struct lms_image_info info = { };
-    int fd, type, len, r;
+    lms_reader_t *reader = finfo->reader;
+    int type, len, r;
     const struct lms_dlna_image_profile *image_dlna;
 
-    fd = open(finfo->path, O_RDONLY);
-    if (fd < 0) {
-        perror("open");
-        return -1;
-    }
-
-    if (_jpeg_data_get(fd, &type, &len) != 0) {
+    if (_jpeg_data_get(reader, &type, &len) != 0) {
         r = -2;
         goto done;
     }
 
     if (type == JPEG_MARKER_EXIF) {
-        if (_exif_data_get(fd, len, &info) != 0) {
+        if (_exif_data_get(reader, len, &info) != 0) {
             fprintf(stderr, "ERROR: could not get EXIF info (%s).\n",
                     finfo->path);
             r = -3;
             goto done;
         }
     } else if (type == JPEG_MARKER_JFIF || type == JPEG_MARKER_DQT) {
-        if (_jfif_data_get(fd, len, &info) != 0) {
+        if (_jfif_data_get(reader, len, &info) != 0) {
             fprintf(stderr, "ERROR: could not get JPEG size (%s).\n",
                     finfo->path);
             r = -4;
@@ -653,23 +636,20 @@ _parse(struct plugin *plugin, struct lms_context *ctxt, const struct lms_file_in
 
     if (!info.title.str)
         lms_name_from_path(&info.title, finfo->path, finfo->path_len,
-                           finfo->base, _exts[((long) match) - 1].len,
+                           finfo->base, lms_match_ext_len(finfo, _exts, match),
                            ctxt->cs_conv);
     if (info.artist.str)
       lms_charset_conv(ctxt->cs_conv, &info.artist.str, &info.artist.len);
 
     info.container = _container_jpeg;
     info.id = finfo->id;
-    LMS_DLNA_GET_IMAGE_PROFILE_FD_FB(&info, image_dlna, fd);
+    LMS_DLNA_GET_IMAGE_PROFILE_FD_FB(&info, image_dlna, lms_reader_fd(reader));
     r = lms_db_image_add(plugin->img_db, &info);
 
   done:
     free(info.title.str);
     free(info.artist.str);
 
-    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
-    close(fd);
-
     return r;
 }
 
@@ -713,7 +693,7 @@ lms_plugin_open(void)
 
     plugin = malloc(sizeof(*plugin));
     plugin->plugin.name = _name;
-    plugin->plugin.match = (lms_plugin_match_fn_t)_match;
+    plugin->plugin.match = NULL;
     plugin->plugin.parse = (lms_plugin_parse_fn_t)_parse;
     plugin->plugin.close = (lms_plugin_close_fn_t)_close;
     plugin->plugin.setup = (lms_plugin_setup_fn_t)_setup;
@@ -724,6 +704,16 @@ lms_plugin_open(void)
     return (struct lms_plugin *)plugin;
 }
 
+API const struct lms_plugin_exts *
+lms_plugin_exts(void)
+{
+    static const struct lms_plugin_exts exts = {
+        _exts, LMS_ARRAY_SIZE(_exts)
+    };
+
+    return &exts;
+}
+
 API const struct lms_plugin_info *
 lms_plugin_info(void)
 {
@@ -738,3 +728,14 @@ lms_plugin_info(void)
 
     return &info;
 }
+
+API const struct lms_plugin_magic *
+lms_plugin_magic(void)
+{
+    static const struct lms_plugin_magic magic[] = {
+        {"\xff\xd8\xff", 3, 0, (void *)1}, /* .jpg, SOI and next marker */
+        {NULL, 0, 0, NULL}
+    };
+
+    return magic;
+}
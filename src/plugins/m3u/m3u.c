@@ -38,7 +38,7 @@
 #include <string.h>
 
 static int
-_m3u_get_n_entries(int fd, struct lms_playlist_info *info)
+_m3u_get_n_entries(lms_reader_t *reader, struct lms_playlist_info *info)
 {
     char buf[1024];
     enum {
@@ -52,7 +52,7 @@ _m3u_get_n_entries(int fd, struct lms_playlist_info *info)
         ssize_t r;
         int i;
 
-        r = read(fd, buf, sizeof(buf));
+        r = lms_reader_read(reader, buf, sizeof(buf));
         if (r < 0) {
             perror("read");
             return -1;
@@ -102,32 +102,15 @@ struct plugin {
     lms_db_playlist_t *playlist_db;
 };
 
-static void *
-_match(struct plugin *p, const char *path, int len, int base)
-{
-    long i;
-
-    i = lms_which_extension(path, len, _exts, LMS_ARRAY_SIZE(_exts));
-    if (i < 0)
-      return NULL;
-    else
-      return (void*)(i + 1);
-}
-
 static int
 _parse(struct plugin *plugin, struct lms_context *ctxt, const struct lms_file_info *finfo, void *match)
 {
     struct lms_playlist_info info = { };
-    int fd, r;
+    lms_reader_t *reader = finfo->reader;
     long ext_idx;
+    int r;
 
-    fd = open(finfo->path, O_RDONLY);
-    if (fd < 0) {
-        perror("open");
-        return -1;
-    }
-
-    if (_m3u_get_n_entries(fd, &info) != 0)
+    if (_m3u_get_n_entries(reader, &info) != 0)
         fprintf(stderr,
                 "WARNING: could not get number of entries in playlist '%s'.\n",
                 finfo->path);
@@ -141,8 +124,6 @@ _parse(struct plugin *plugin, struct lms_context *ctxt, const struct lms_file_in
     r = lms_db_playlist_add(plugin->playlist_db, &info);
 
     free(info.title.str);
-    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
-    close(fd);
 
     return r;
 }
@@ -187,7 +168,7 @@ lms_plugin_open(void)
 
     plugin = malloc(sizeof(*plugin));
     plugin->plugin.name = _name;
-    plugin->plugin.match = (lms_plugin_match_fn_t)_match;
+    plugin->plugin.match = NULL;
     plugin->plugin.parse = (lms_plugin_parse_fn_t)_parse;
     plugin->plugin.close = (lms_plugin_close_fn_t)_close;
     plugin->plugin.setup = (lms_plugin_setup_fn_t)_setup;
@@ -198,6 +179,16 @@ lms_plugin_open(void)
     return (struct lms_plugin *)plugin;
 }
 
+API const struct lms_plugin_exts *
+lms_plugin_exts(void)
+{
+    static const struct lms_plugin_exts exts = {
+        _exts, LMS_ARRAY_SIZE(_exts)
+    };
+
+    return &exts;
+}
+
 API const struct lms_plugin_info *
 lms_plugin_info(void)
 {
@@ -29,6 +29,7 @@ static const char PV[] = PACKAGE_VERSION; /* mp4.h screws PACKAGE_VERSION */
 #include <lightmediascanner_plugin.h>
 #include <lightmediascanner_db.h>
 #include <lightmediascanner_dlna.h>
+#include <shared/util.h>
 
 #include <mp4v2/mp4v2.h>
 #include <string.h>
@@ -341,18 +342,6 @@ static const char *_authors[] = {
 
 static const struct lms_string_size nullstr = { };
 
-static void *
-_match(struct plugin *p, const char *path, int len, int base)
-{
-    long i;
-
-    i = lms_which_extension(path, len, _exts, LMS_ARRAY_SIZE(_exts));
-    if (i < 0)
-      return NULL;
-    else
-      return (void*)(i + 1);
-}
-
 static inline struct lms_string_size
 _find_type_str(const struct type_str *base, uint8_t type)
 {
@@ -668,7 +657,7 @@ _parse(struct plugin *plugin, struct lms_context *ctxt, const struct lms_file_in
 
     if (!info.title.str)
         lms_name_from_path(&info.title, finfo->path, finfo->path_len,
-                           finfo->base, _exts[((long) match) - 1].len,
+                           finfo->base, lms_match_ext_len(finfo, _exts, match),
                            NULL);
     if (info.title.str)
         lms_charset_conv(ctxt->cs_conv, &info.title.str, &info.title.len);
@@ -773,7 +762,7 @@ lms_plugin_open(void)
 
     plugin = (struct plugin *)malloc(sizeof(*plugin));
     plugin->plugin.name = _name;
-    plugin->plugin.match = (lms_plugin_match_fn_t)_match;
+    plugin->plugin.match = NULL;
     plugin->plugin.parse = (lms_plugin_parse_fn_t)_parse;
     plugin->plugin.close = (lms_plugin_close_fn_t)_close;
     plugin->plugin.setup = (lms_plugin_setup_fn_t)_setup;
@@ -784,6 +773,16 @@ lms_plugin_open(void)
     return (struct lms_plugin *)plugin;
 }
 
+API const struct lms_plugin_exts *
+lms_plugin_exts(void)
+{
+    static const struct lms_plugin_exts exts = {
+        _exts, LMS_ARRAY_SIZE(_exts)
+    };
+
+    return &exts;
+}
+
 API const struct lms_plugin_info *
 lms_plugin_info(void)
 {
@@ -798,3 +797,14 @@ lms_plugin_info(void)
 
     return &info;
 }
+
+API const struct lms_plugin_magic *
+lms_plugin_magic(void)
+{
+    static const struct lms_plugin_magic magic[] = {
+        {"ftyp", 4, 4, (void *)1}, /* .mp4, first box */
+        {NULL, 0, 0, NULL}
+    };
+
+    return magic;
+}
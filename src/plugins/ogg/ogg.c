@@ -33,6 +33,7 @@
 #include <lightmediascanner_plugin.h>
 #include <lightmediascanner_db.h>
 #include <lightmediascanner_dlna.h>
+#include <shared/util.h>
 #include <lightmediascanner_utils.h>
 
 #include <assert.h>
@@ -88,16 +89,16 @@ static const struct lms_string_size _video_codec =
     LMS_STATIC_STRING_SIZE("theora");
 
 static long int
-_id3_tag_size(FILE *file)
+_id3_tag_size(lms_reader_t *reader)
 {
     unsigned char tmp[4];
     long int size;
 
-    if (fread(tmp, 1, 4, file) == 4) {
+    if (lms_reader_read(reader, tmp, 4) == 4) {
         if (tmp[0] == 'I' && tmp[1] == 'D' &&
             tmp[2] == '3' && tmp[3] < 0xFF) {
-            fseek(file, 2, SEEK_CUR);
-            if (fread(tmp, 1, 4, file) == 4) {
+            lms_reader_seek(reader, 2, SEEK_CUR);
+            if (lms_reader_read(reader, tmp, 4) == 4) {
                 size = 10 +   ( (long)(tmp[3])
                               | ((long)(tmp[2]) << 7)
                               | ((long)(tmp[1]) << 14)
@@ -120,17 +121,17 @@ _set_lms_info(struct lms_string_size *info, const char *tag)
     lms_string_size_strip_and_free(info);
 }
 
-static bool _ogg_read_page(FILE *fp, ogg_sync_state *osync, ogg_page *page)
+static bool _ogg_read_page(lms_reader_t *reader, ogg_sync_state *osync, ogg_page *page)
 {
     int i;
 
     for (i = 0; i < MAX_CHUNKS_PER_PAGE && ogg_sync_pageout(osync, page) != 1;
          i++) {
         lms_ogg_buffer_t buffer = lms_get_ogg_sync_buffer(osync, CHUNKSIZE);
-        int bytes = fread(buffer, 1, CHUNKSIZE, fp);
+        int bytes = lms_reader_read(reader, buffer, CHUNKSIZE);
 
         /* EOF */
-        if (bytes == 0)
+        if (bytes <= 0)
             return false;
 
         ogg_sync_wrote(osync, bytes);
@@ -371,9 +372,8 @@ static void _parse_vorbis_stream(struct ogg_info *info, struct stream *s)
         info->trackno = atoi(tag);
 }
 
-static int _parse_ogg(const char *filename, struct ogg_info *info)
+static int _parse_ogg(lms_reader_t *reader, struct ogg_info *info)
 {
-    FILE *fp;
     ogg_page page;
     ogg_sync_state *osync;
     int r = 0;
@@ -382,18 +382,11 @@ static int _parse_ogg(const char *filename, struct ogg_info *info)
     /* the 1st audio stream, the one used if audio */
     struct stream *s, *audio_stream = NULL, *video_stream = NULL;
 
-    if (!filename)
-        return -1;
-
-    fp = fopen(filename, "rb");
-    if (fp == NULL)
-        return -1;
-
     /* Skip ID3 on the beginning */
-    fseek(fp, _id3_tag_size(fp), SEEK_SET);
+    lms_reader_seek(reader, _id3_tag_size(reader), SEEK_SET);
 
     osync = lms_create_ogg_sync();
-    while (_ogg_read_page(fp, osync, &page)) {
+    while (_ogg_read_page(reader, osync, &page)) {
         int serial = ogg_page_serialno(&page);
 
         s = _info_find_stream(info, serial);
@@ -441,7 +434,6 @@ static int _parse_ogg(const char *filename, struct ogg_info *info)
 
 done:
     lms_destroy_ogg_sync(osync);
-    fclose(fp);
 
     return r;
 }
@@ -470,18 +462,6 @@ struct plugin {
     lms_db_video_t *video_db;
 };
 
-static void *
-_match(struct plugin *p, const char *path, int len, int base)
-{
-    long i;
-
-    i = lms_which_extension(path, len, _exts, LMS_ARRAY_SIZE(_exts));
-    if (i < 0)
-      return NULL;
-    else
-      return (void*)(i + 1);
-}
-
 static int
 _parse(struct plugin *plugin, struct lms_context *ctxt,
        const struct lms_file_info *finfo, void *match)
@@ -491,13 +471,13 @@ _parse(struct plugin *plugin, struct lms_context *ctxt,
     const struct lms_dlna_video_profile *video_dlna;
     const struct lms_dlna_audio_profile *audio_dlna;
 
-    r = _parse_ogg(finfo->path, &info);
+    r = _parse_ogg(finfo->reader, &info);
     if (r != 0)
       goto done;
 
     if (!info.title.str)
         lms_name_from_path(&info.title, finfo->path, finfo->path_len,
-                           finfo->base, _exts[((long) match) - 1].len,
+                           finfo->base, lms_match_ext_len(finfo, _exts, match),
                            NULL);
     if (info.title.str)
         lms_charset_conv(ctxt->cs_conv, &info.title.str, &info.title.len);
@@ -602,7 +582,7 @@ lms_plugin_open(void)
 
     plugin = (struct plugin *)malloc(sizeof(*plugin));
     plugin->plugin.name = _name;
-    plugin->plugin.match = (lms_plugin_match_fn_t)_match;
+    plugin->plugin.match = NULL;
     plugin->plugin.parse = (lms_plugin_parse_fn_t)_parse;
     plugin->plugin.close = (lms_plugin_close_fn_t)_close;
     plugin->plugin.setup = (lms_plugin_setup_fn_t)_setup;
@@ -613,6 +593,16 @@ lms_plugin_open(void)
     return (struct lms_plugin *)plugin;
 }
 
+API const struct lms_plugin_exts *
+lms_plugin_exts(void)
+{
+    static const struct lms_plugin_exts exts = {
+        _exts, LMS_ARRAY_SIZE(_exts)
+    };
+
+    return &exts;
+}
+
 API const struct lms_plugin_info *
 lms_plugin_info(void)
 {
@@ -627,3 +617,14 @@ lms_plugin_info(void)
 
     return &info;
 }
+
+API const struct lms_plugin_magic *
+lms_plugin_magic(void)
+{
+    static const struct lms_plugin_magic magic[] = {
+        {"OggS", 4, 0, (void *)1}, /* .ogg */
+        {NULL, 0, 0, NULL}
+    };
+
+    return magic;
+}
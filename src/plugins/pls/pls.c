@@ -47,7 +47,7 @@
 #define PLS_MAX_N_ENTRIES_BYTES_LOOKUP 64
 
 static int
-_pls_find_header(int fd)
+_pls_find_header(lms_reader_t *reader)
 {
     const char header[] = "[playlist]";
     char buf[sizeof(header) - 1];
@@ -55,7 +55,7 @@ _pls_find_header(int fd)
 
     /* skip out white spaces */
     do {
-        r = read(fd, buf, 1);
+        r = lms_reader_read(reader, buf, 1);
         if (r < 0) {
             perror("read");
             return -1;
@@ -72,7 +72,7 @@ _pls_find_header(int fd)
         return -3;
 
     /* try to read rest (from the second on) of the header */
-    r = read(fd, buf + 1, sizeof(buf) - 1);
+    r = lms_reader_read(reader, buf + 1, sizeof(buf) - 1);
     if (r < 0) {
         perror("read");
         return -4;
@@ -90,7 +90,7 @@ _pls_find_header(int fd)
 
     /* find '\n' */
     do {
-        r = read(fd, buf, 1);
+        r = lms_reader_read(reader, buf, 1);
         if (r < 0) {
             perror("read");
             return -7;
@@ -105,7 +105,7 @@ _pls_find_header(int fd)
 }
 
 static int
-_pls_find_n_entries_start(int fd, struct lms_playlist_info *info)
+_pls_find_n_entries_start(lms_reader_t *reader, struct lms_playlist_info *info)
 {
     char buf[PLS_MAX_N_ENTRIES_BYTES_LOOKUP];
     const char n_entries[] = "NumberOfEntries=";
@@ -113,13 +113,13 @@ _pls_find_n_entries_start(int fd, struct lms_playlist_info *info)
     int i;
     off_t off;
 
-    off = lseek(fd, 0, SEEK_CUR);
+    off = lms_reader_seek(reader, 0, SEEK_CUR);
     if (off < 0) {
         perror("lseek");
         return -1;
     }
 
-    r = read(fd, buf, sizeof(buf));
+    r = lms_reader_read(reader, buf, sizeof(buf));
     if (r < 0) {
         perror("read");
         return -2;
@@ -166,7 +166,7 @@ _pls_find_n_entries_start(int fd, struct lms_playlist_info *info)
 
   done:
     /* not at the file beginning, reset offset */
-    if (lseek(fd, off, SEEK_SET) < 0) {
+    if (lms_reader_seek(reader, off, SEEK_SET) < 0) {
         perror("lseek");
         return -1;
     }
@@ -175,7 +175,7 @@ _pls_find_n_entries_start(int fd, struct lms_playlist_info *info)
 }
 
 static int
-_pls_parse_entries_line(int fd, struct lms_playlist_info *info, char *buf, int len)
+_pls_parse_entries_line(lms_reader_t *reader, struct lms_playlist_info *info, char *buf, int len)
 {
     const char n_entries[] = "NumberOfEntries=";
     int i;
@@ -200,19 +200,19 @@ _pls_parse_entries_line(int fd, struct lms_playlist_info *info, char *buf, int l
 }
 
 static int
-_pls_find_n_entries_end(int fd, const struct lms_file_info *finfo, struct lms_playlist_info *info)
+_pls_find_n_entries_end(lms_reader_t *reader, const struct lms_file_info *finfo, struct lms_playlist_info *info)
 {
     char buf[PLS_MAX_N_ENTRIES_BYTES_LOOKUP];
     ssize_t r;
     int i, last_nl;
 
     if (finfo->size > sizeof(buf))
-        if (lseek(fd, finfo->size - sizeof(buf), SEEK_SET) < 0) {
+        if (lms_reader_seek(reader, finfo->size - sizeof(buf), SEEK_SET) < 0) {
             perror("lseek");
             return -1;
         }
 
-    r = read(fd, buf, sizeof(buf));
+    r = lms_reader_read(reader, buf, sizeof(buf));
     if (r < 0) {
         perror("read");
         return -1;
@@ -229,7 +229,7 @@ _pls_find_n_entries_end(int fd, const struct lms_file_info *finfo, struct lms_pl
                 if (len > 0) {
                     int ret;
 
-                    ret = _pls_parse_entries_line(fd, info, buf + i + 1, len);
+                    ret = _pls_parse_entries_line(reader, info, buf + i + 1, len);
                     if (ret <= 0)
                         return ret;
                 }
@@ -242,21 +242,21 @@ _pls_find_n_entries_end(int fd, const struct lms_file_info *finfo, struct lms_pl
 }
 
 static int
-_pls_parse(int fd, const struct lms_file_info *finfo, struct lms_playlist_info *info)
+_pls_parse(lms_reader_t *reader, const struct lms_file_info *finfo, struct lms_playlist_info *info)
 {
     int r;
 
-    r = _pls_find_header(fd);
+    r = _pls_find_header(reader);
     if (r != 0) {
         fprintf(stderr, "ERROR: could not find pls header. code=%d\n", r);
         return -1;
     }
 
-    r = _pls_find_n_entries_start(fd, info);
+    r = _pls_find_n_entries_start(reader, info);
     if (r <= 0)
         return r;
 
-    r = _pls_find_n_entries_end(fd, finfo, info);
+    r = _pls_find_n_entries_end(reader, finfo, info);
     if (r != 0)
         fprintf(stderr, "ERROR: could not find pls NumberOfEntries=\n");
 
@@ -283,35 +283,17 @@ struct plugin {
     lms_db_playlist_t *playlist_db;
 };
 
-static void *
-_match(struct plugin *p, const char *path, int len, int base)
-{
-    long i;
-
-    i = lms_which_extension(path, len, _exts, LMS_ARRAY_SIZE(_exts));
-    if (i < 0)
-      return NULL;
-    else
-      return (void*)(i + 1);
-}
-
 static int
 _parse(struct plugin *plugin, struct lms_context *ctxt, const struct lms_file_info *finfo, void *match)
 {
     struct lms_playlist_info info = { };
-    int fd, r;
+    lms_reader_t *reader = finfo->reader;
     long ext_idx;
+    int r;
 
-    fd = open(finfo->path, O_RDONLY);
-    if (fd < 0) {
-        perror("open");
-        return -1;
-    }
-
-    if (_pls_parse(fd, finfo, &info) != 0) {
+    if (_pls_parse(reader, finfo, &info) != 0) {
         fprintf(stderr,
                 "WARNING: could not parse playlist '%s'.\n", finfo->path);
-        close(fd);
         return -1;
     }
 
@@ -324,8 +306,6 @@ _parse(struct plugin *plugin, struct lms_context *ctxt, const struct lms_file_in
     r = lms_db_playlist_add(plugin->playlist_db, &info);
 
     free(info.title.str);
-    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
-    close(fd);
 
     return r;
 }
@@ -370,7 +350,7 @@ lms_plugin_open(void)
 
     plugin = malloc(sizeof(*plugin));
     plugin->plugin.name = _name;
-    plugin->plugin.match = (lms_plugin_match_fn_t)_match;
+    plugin->plugin.match = NULL;
     plugin->plugin.parse = (lms_plugin_parse_fn_t)_parse;
     plugin->plugin.close = (lms_plugin_close_fn_t)_close;
     plugin->plugin.setup = (lms_plugin_setup_fn_t)_setup;
@@ -381,6 +361,16 @@ lms_plugin_open(void)
     return (struct lms_plugin *)plugin;
 }
 
+API const struct lms_plugin_exts *
+lms_plugin_exts(void)
+{
+    static const struct lms_plugin_exts exts = {
+        _exts, LMS_ARRAY_SIZE(_exts)
+    };
+
+    return &exts;
+}
+
 API const struct lms_plugin_info *
 lms_plugin_info(void)
 {
@@ -31,6 +31,7 @@
 #include <lightmediascanner_utils.h>
 #include <lightmediascanner_db.h>
 #include <lightmediascanner_dlna.h>
+#include <shared/util.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -54,14 +55,15 @@ _chunk_to_uint(unsigned char *buf)
 }
 
 static int
-_png_data_get(int fd, struct lms_image_info *info)
+_png_data_get(lms_reader_t *reader, struct lms_image_info *info)
 {
     unsigned char buf[17], *p;
     const unsigned char sig[8] = {0x89, 0x50, 0x4e, 0x47, 0xd, 0xa, 0x1a, 0xa};
     const unsigned char ihdr[4] = {'I', 'H', 'D', 'R'};
     unsigned int length;
+    uint32_t width, height;
 
-    if (read(fd, buf, sizeof(buf) - 1) != sizeof(buf) - 1) {
+    if (lms_reader_read(reader, buf, sizeof(buf) - 1) != sizeof(buf) - 1) {
         perror("read");
         return -1;
     }
@@ -85,12 +87,13 @@ _png_data_get(int fd, struct lms_image_info *info)
         return -4;
     }
 
-    if (read(fd, buf, 8) != 8) {
-        perror("read");
+    if (lms_reader_get_be32(reader, 16, &width) != 0 ||
+        lms_reader_get_be32(reader, 20, &height) != 0) {
+        fprintf(stderr, "ERROR: IHDR chunk is truncated.\n");
         return -5;
     }
-    info->width = _chunk_to_uint(buf);
-    info->height = _chunk_to_uint(buf + 4);
+    info->width = width;
+    info->height = height;
 
     return 0;
 }
@@ -114,32 +117,15 @@ struct plugin {
     lms_db_image_t *img_db;
 };
 
-static void *
-_match(struct plugin *p, const char *path, int len, int base)
-{
-    long i;
-
-    i = lms_which_extension(path, len, _exts, LMS_ARRAY_SIZE(_exts));
-    if (i < 0)
-        return NULL;
-    else
-        return (void*)(i + 1);
-}
-
 static int
 _parse(struct plugin *plugin, struct lms_context *ctxt, const struct lms_file_info *finfo, void *match)
 {
     struct lms_image_info info = { };
-    int fd, r;
+    lms_reader_t *reader = finfo->reader;
+    int r;
     const struct lms_dlna_image_profile *image_dlna;
 
-    fd = open(finfo->path, O_RDONLY);
-    if (fd < 0) {
-        perror("open");
-        return -1;
-    }
-
-    if (_png_data_get(fd, &info) != 0) {
+    if (_png_data_get(reader, &info) != 0) {
         r = -2;
         goto done;
     }
@@ -149,7 +135,7 @@ _parse(struct plugin *plugin, struct lms_context *ctxt, const struct lms_file_in
 
     if (!info.title.str)
         lms_name_from_path(&info.title, finfo->path, finfo->path_len,
-                           finfo->base, _exts[((long) match) - 1].len,
+                           finfo->base, lms_match_ext_len(finfo, _exts, match),
                            NULL);
     if (info.title.str)
         lms_charset_conv(ctxt->cs_conv, &info.title.str, &info.title.len);
@@ -158,16 +144,13 @@ _parse(struct plugin *plugin, struct lms_context *ctxt, const struct lms_file_in
 
     info.id = finfo->id;
     info.container = _container_png;
-    LMS_DLNA_GET_IMAGE_PROFILE_FD_FB(&info, image_dlna, fd);
+    LMS_DLNA_GET_IMAGE_PROFILE_FD_FB(&info, image_dlna, lms_reader_fd(reader));
     r = lms_db_image_add(plugin->img_db, &info);
 
   done:
     free(info.title.str);
     free(info.artist.str);
 
-    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
-    close(fd);
-
     return r;
 }
 
@@ -211,7 +194,7 @@ lms_plugin_open(void)
 
     plugin = malloc(sizeof(*plugin));
     plugin->plugin.name = _name;
-    plugin->plugin.match = (lms_plugin_match_fn_t)_match;
+    plugin->plugin.match = NULL;
     plugin->plugin.parse = (lms_plugin_parse_fn_t)_parse;
     plugin->plugin.close = (lms_plugin_close_fn_t)_close;
     plugin->plugin.setup = (lms_plugin_setup_fn_t)_setup;
@@ -222,6 +205,16 @@ lms_plugin_open(void)
     return (struct lms_plugin *)plugin;
 }
 
+API const struct lms_plugin_exts *
+lms_plugin_exts(void)
+{
+    static const struct lms_plugin_exts exts = {
+        _exts, LMS_ARRAY_SIZE(_exts)
+    };
+
+    return &exts;
+}
+
 API const struct lms_plugin_info *
 lms_plugin_info(void)
 {
@@ -236,3 +229,14 @@ lms_plugin_info(void)
 
     return &info;
 }
+
+API const struct lms_plugin_magic *
+lms_plugin_magic(void)
+{
+    static const struct lms_plugin_magic magic[] = {
+        {"\x89PNG\r\n\x1a\n", 8, 0, (void *)1}, /* .png */
+        {NULL, 0, 0, NULL}
+    };
+
+    return magic;
+}
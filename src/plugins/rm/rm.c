@@ -30,6 +30,7 @@
 #include <lightmediascanner_plugin.h>
 #include <lightmediascanner_db.h>
 #include <lightmediascanner_dlna.h>
+#include <shared/util.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -98,9 +99,9 @@ static const char *_authors[] = {
  * .ra\xfd
  */
 static int
-_parse_file_header(int fd, struct rm_file_header *file_header)
+_parse_file_header(lms_reader_t *reader, struct rm_file_header *file_header)
 {
-    if (read(fd, file_header, sizeof(struct rm_file_header)) == -1) {
+    if (lms_reader_read(reader, file_header, sizeof(struct rm_file_header)) == -1) {
         fprintf(stderr, "ERROR: could not read file header\n");
         return -1;
     }
@@ -123,18 +124,18 @@ _parse_file_header(int fd, struct rm_file_header *file_header)
      * it fails */
     /* ignore file header extra fields
      * file version and number of headers */
-    lseek(fd, 8, SEEK_CUR);
+    lms_reader_seek(reader, 8, SEEK_CUR);
 
     return 0;
 }
 
 static int
-_read_header_type_and_size(int fd, char *type, uint32_t *size)
+_read_header_type_and_size(lms_reader_t *reader, char *type, uint32_t *size)
 {
-    if (read(fd, type, 4) != 4)
+    if (lms_reader_read(reader, type, 4) != 4)
         return -1;
 
-    if (read(fd, size, 4) != 4)
+    if (lms_reader_read(reader, size, 4) != 4)
         return -1;
 
     *size = be32toh(*size);
@@ -148,12 +149,12 @@ _read_header_type_and_size(int fd, char *type, uint32_t *size)
 }
 
 static int
-_read_string(int fd, char **out, unsigned int *out_len)
+_read_string(lms_reader_t *reader, char **out, unsigned int *out_len)
 {
     char *s;
     uint16_t len;
 
-    if (read(fd, &len, 2) == -1)
+    if (lms_reader_read(reader, &len, 2) == -1)
         return -1;
 
     len = be16toh(len);
@@ -161,7 +162,7 @@ _read_string(int fd, char **out, unsigned int *out_len)
     if (out) {
         if (len > 0) {
             s = malloc(sizeof(char) * (len + 1));
-            if (read(fd, s, len) == -1) {
+            if (lms_reader_read(reader, s, len) == -1) {
                 free(s);
                 return -1;
             }
@@ -172,7 +173,7 @@ _read_string(int fd, char **out, unsigned int *out_len)
 
         *out_len = len;
     } else
-        lseek(fd, len, SEEK_CUR);
+        lms_reader_seek(reader, len, SEEK_CUR);
 
     return 0;
 }
@@ -192,22 +193,22 @@ _read_string(int fd, char **out, unsigned int *out_len)
  * byte[]  Comment string
  */
 static long
-_parse_cont_header(int fd, struct rm_info *info)
+_parse_cont_header(lms_reader_t *reader, struct rm_info *info)
 {
     long pos1;
     /* Ps.: type and size were already read */
 
     /* ignore version */
-    pos1 = lseek(fd, 2, SEEK_CUR);
+    pos1 = lms_reader_seek(reader, 2, SEEK_CUR);
     if (pos1 < 0)
         return pos1;
 
-    _read_string(fd, &info->title.str, &info->title.len);
-    _read_string(fd, &info->artist.str, &info->artist.len);
-    _read_string(fd, NULL, NULL); /* copyright */
-    _read_string(fd, NULL, NULL); /* comment */
+    _read_string(reader, &info->title.str, &info->title.len);
+    _read_string(reader, &info->artist.str, &info->artist.len);
+    _read_string(reader, NULL, NULL); /* copyright */
+    _read_string(reader, NULL, NULL); /* comment */
 
-    return lseek(fd, 0, SEEK_CUR) - pos1;
+    return lms_reader_seek(reader, 0, SEEK_CUR) - pos1;
 }
 
 static struct lms_string_size
@@ -245,21 +246,21 @@ _ra_codec_to_str(uint8_t fourcc[4])
 }
 
 static bool
-_parse_mdpr_codec_header(int fd, struct rm_info *info)
+_parse_mdpr_codec_header(lms_reader_t *reader, struct rm_info *info)
 {
     uint32_t size;
     uint8_t fourcc[4];
     uint16_t version;
     long skipbytes;
 
-    if (read(fd, &size, sizeof(size)) != sizeof(size)
-        || read(fd, fourcc, sizeof(fourcc)) != sizeof(fourcc))
+    if (lms_reader_read(reader, &size, sizeof(size)) != sizeof(size)
+        || lms_reader_read(reader, fourcc, sizeof(fourcc)) != sizeof(fourcc))
         return false;
 
     if (memcmp(fourcc, ".ra\xfd", 4) != 0)
         return false;
 
-    if (read(fd, &version, sizeof(version)) != sizeof(version))
+    if (lms_reader_read(reader, &version, sizeof(version)) != sizeof(version))
         return false;
     version = be16toh(version);
 
@@ -276,14 +277,14 @@ _parse_mdpr_codec_header(int fd, struct rm_info *info)
     else
         return false;
 
-    if (lseek(fd, skipbytes, SEEK_CUR) < 0
-        && read(fd, &info->sampling_rate, 2) != 2)
+    if (lms_reader_seek(reader, skipbytes, SEEK_CUR) < 0
+        && lms_reader_read(reader, &info->sampling_rate, 2) != 2)
         return false;
 
     info->sampling_rate = be16toh(info->sampling_rate);
 
-    if (lseek(fd, 4, SEEK_CUR) < 0
-        || read(fd, &info->channels, 2) != 2)
+    if (lms_reader_seek(reader, 4, SEEK_CUR) < 0
+        || lms_reader_read(reader, &info->channels, 2) != 2)
         return true;
 
     info->channels = be16toh(info->channels);
@@ -293,7 +294,7 @@ _parse_mdpr_codec_header(int fd, struct rm_info *info)
     else
         skipbytes = 4;
 
-    if (read(fd, fourcc, 4) != 4)
+    if (lms_reader_read(reader, fourcc, 4) != 4)
         return true;
 
     info->codec = _ra_codec_to_str(fourcc);
@@ -301,33 +302,33 @@ _parse_mdpr_codec_header(int fd, struct rm_info *info)
 }
 
 static int
-_parse_mdpr_header(int fd, struct rm_info *info, bool *has_mdpr)
+_parse_mdpr_header(lms_reader_t *reader, struct rm_info *info, bool *has_mdpr)
 {
     uint16_t object_version;
     uint8_t slen;
     char buf[32];
     long pos1;
 
-    pos1 = lseek(fd, 0, SEEK_CUR);
+    pos1 = lms_reader_seek(reader, 0, SEEK_CUR);
 
-    if (read(fd, &object_version, sizeof(object_version)) !=
+    if (lms_reader_read(reader, &object_version, sizeof(object_version)) !=
         sizeof(object_version))
         return -1;
 
     if (object_version != 0)
         return sizeof(object_version);
 
-    lseek(fd, 7 * sizeof(uint32_t), SEEK_CUR);
+    lms_reader_seek(reader, 7 * sizeof(uint32_t), SEEK_CUR);
 
     /* stream description string: ignore */
-    if (read(fd, &slen, sizeof(slen)) != sizeof(slen))
+    if (lms_reader_read(reader, &slen, sizeof(slen)) != sizeof(slen))
         return -1;
-    lseek(fd, slen, SEEK_CUR);
+    lms_reader_seek(reader, slen, SEEK_CUR);
 
     /* mime type string */
-    if (read(fd, &slen, sizeof(slen)) != sizeof(slen)
+    if (lms_reader_read(reader, &slen, sizeof(slen)) != sizeof(slen)
         || slen >= 32
-        || read(fd, buf, slen) != slen)
+        || lms_reader_read(reader, buf, slen) != slen)
         goto done;
 
     buf[slen] = '\0';
@@ -336,16 +337,16 @@ _parse_mdpr_header(int fd, struct rm_info *info, bool *has_mdpr)
         strcmp(buf, "audio/x-pn-multirate-realaudio") != 0)
         goto done;
 
-    *has_mdpr = _parse_mdpr_codec_header(fd, info);
+    *has_mdpr = _parse_mdpr_codec_header(reader, info);
     if (*has_mdpr)
         info->stream_type = LMS_STREAM_TYPE_AUDIO;
 
 done:
-    return lseek(fd, 0, SEEK_CUR) - pos1;
+    return lms_reader_seek(reader, 0, SEEK_CUR) - pos1;
 }
 
 static int
-_parse_prop_header(int fd, struct rm_info *info)
+_parse_prop_header(lms_reader_t *reader, struct rm_info *info)
 {
     uint16_t object_version;
     struct {
@@ -362,12 +363,12 @@ _parse_prop_header(int fd, struct rm_info *info)
         uint16_t flags;
     } __attribute__((packed, aligned)) hdr;
 
-    if (read(fd, &object_version, sizeof(object_version))
+    if (lms_reader_read(reader, &object_version, sizeof(object_version))
         != sizeof(object_version)
         || object_version != 0)
         return -1;
 
-    if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+    if (lms_reader_read(reader, &hdr, sizeof(hdr)) != sizeof(hdr))
         return -1;
 
     info->bitrate = be32toh(hdr.avg_bit_rate);
@@ -376,25 +377,14 @@ _parse_prop_header(int fd, struct rm_info *info)
     return sizeof(object_version) + sizeof(hdr);
 }
 
-static void *
-_match(struct plugin *p, const char *path, int len, int base)
-{
-    long i;
-
-    i = lms_which_extension(path, len, _exts, LMS_ARRAY_SIZE(_exts));
-    if (i < 0)
-      return NULL;
-    else
-      return (void*)(i + 1);
-}
-
 static int
 _parse(struct plugin *plugin, struct lms_context *ctxt, const struct lms_file_info *finfo, void *match)
 {
     struct rm_info info = { .stream_type = LMS_STREAM_TYPE_UNKNOWN };
     struct lms_audio_info audio_info = { };
     struct lms_video_info video_info = { };
-    int r, fd;
+    lms_reader_t *reader = finfo->reader;
+    int r;
     struct rm_file_header file_header;
     char type[4];
     uint32_t size;
@@ -402,19 +392,13 @@ _parse(struct plugin *plugin, struct lms_context *ctxt, const struct lms_file_in
     const struct lms_dlna_video_profile *video_dlna;
     const struct lms_dlna_audio_profile *audio_dlna;
 
-    fd = open(finfo->path, O_RDONLY);
-    if (fd < 0) {
-        perror("open");
-        return -1;
-    }
-
-    if (_parse_file_header(fd, &file_header) != 0) {
+    if (_parse_file_header(reader, &file_header) != 0) {
         r = -2;
         goto done;
     }
 
     do {
-        if (_read_header_type_and_size(fd, type, &size) != 0) {
+        if (_read_header_type_and_size(reader, type, &size) != 0) {
             r = -3;
             goto done;
         }
@@ -424,25 +408,25 @@ _parse(struct plugin *plugin, struct lms_context *ctxt, const struct lms_file_in
             break;
 
         if (memcmp(type, "CONT", 4) == 0) {
-            r = _parse_cont_header(fd, &info);
+            r = _parse_cont_header(reader, &info);
             if (r < 0)
                 goto done;
-            lseek(fd, size - 8 - r, SEEK_CUR);
+            lms_reader_seek(reader, size - 8 - r, SEEK_CUR);
             has_cont = true;
         } else if (memcmp(type, "PROP", 4) == 0) {
-            r = _parse_prop_header(fd, &info);
+            r = _parse_prop_header(reader, &info);
             if (r < 0)
                 goto done;
-            lseek(fd, size - 8 - r, SEEK_CUR);
+            lms_reader_seek(reader, size - 8 - r, SEEK_CUR);
             has_prop = true;
         } else if (memcmp(type, "MDPR", 4)) {
-            r = _parse_mdpr_header(fd, &info, &has_mdpr);
+            r = _parse_mdpr_header(reader, &info, &has_mdpr);
             if (r < 0)
                 goto done;
-            lseek(fd, size - 8 - r, SEEK_CUR);
+            lms_reader_seek(reader, size - 8 - r, SEEK_CUR);
         } else
             /* Ignore other headers */
-            lseek(fd, size - 8, SEEK_CUR);
+            lms_reader_seek(reader, size - 8, SEEK_CUR);
     } while (!has_cont && !has_prop && !has_mdpr);
 
     /* try to define stream type by extension */
@@ -460,7 +444,7 @@ _parse(struct plugin *plugin, struct lms_context *ctxt, const struct lms_file_in
 
     if (!info.title.str)
         lms_name_from_path(&info.title, finfo->path, finfo->path_len,
-                           finfo->base, _exts[((long) match) - 1].len,
+                           finfo->base, lms_match_ext_len(finfo, _exts, match),
                            NULL);
     if (info.title.str)
         lms_charset_conv(ctxt->cs_conv, &info.title.str, &info.title.len);
@@ -478,14 +462,16 @@ _parse(struct plugin *plugin, struct lms_context *ctxt, const struct lms_file_in
         audio_info.id = finfo->id;
         audio_info.title = info.title;
         audio_info.artist = info.artist;
-        LMS_DLNA_GET_AUDIO_PROFILE_FD_FB(&audio_info, audio_dlna, fd);
+        LMS_DLNA_GET_AUDIO_PROFILE_FD_FB(&audio_info, audio_dlna,
+                                         lms_reader_fd(reader));
         r = lms_db_audio_add(plugin->audio_db, &audio_info);
     }
     else {
         video_info.id = finfo->id;
         video_info.title = info.title;
         video_info.artist = info.artist;
-        LMS_DLNA_GET_VIDEO_PROFILE_FD_FB(&video_info, video_dlna, fd);
+        LMS_DLNA_GET_VIDEO_PROFILE_FD_FB(&video_info, video_dlna,
+                                         lms_reader_fd(reader));
         r = lms_db_video_add(plugin->video_db, &video_info);
     }
 
@@ -493,9 +479,6 @@ _parse(struct plugin *plugin, struct lms_context *ctxt, const struct lms_file_in
     free(info.title.str);
     free(info.artist.str);
 
-    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
-    close(fd);
-
     return r;
 }
 
@@ -546,7 +529,7 @@ lms_plugin_open(void)
 
     plugin = (struct plugin *)malloc(sizeof(*plugin));
     plugin->plugin.name = _name;
-    plugin->plugin.match = (lms_plugin_match_fn_t)_match;
+    plugin->plugin.match = NULL;
     plugin->plugin.parse = (lms_plugin_parse_fn_t)_parse;
     plugin->plugin.close = (lms_plugin_close_fn_t)_close;
     plugin->plugin.setup = (lms_plugin_setup_fn_t)_setup;
@@ -557,6 +540,16 @@ lms_plugin_open(void)
     return (struct lms_plugin *)plugin;
 }
 
+API const struct lms_plugin_exts *
+lms_plugin_exts(void)
+{
+    static const struct lms_plugin_exts exts = {
+        _exts, LMS_ARRAY_SIZE(_exts)
+    };
+
+    return &exts;
+}
+
 API const struct lms_plugin_info *
 lms_plugin_info(void)
 {
@@ -571,3 +564,15 @@ lms_plugin_info(void)
 
     return &info;
 }
+
+API const struct lms_plugin_magic *
+lms_plugin_magic(void)
+{
+    static const struct lms_plugin_magic magic[] = {
+        {".RMF", 4, 0, (void *)3}, /* .rm */
+        {".ra\xfd", 4, 0, (void *)1}, /* .ra, audio only */
+        {NULL, 0, 0, NULL}
+    };
+
+    return magic;
+}
@@ -23,7 +23,9 @@
 #include <endian.h>
 #include <inttypes.h>
 #include <stddef.h>
+#include <string.h>
 
+#include <lightmediascanner_plugin.h>
 #include <lightmediascanner_utils.h>
 
 #define NSEC100_PER_SEC  10000000ULL
@@ -102,3 +104,95 @@ static inline uint16_t get_be16(const void *ptr)
 #else
 #error "Unknown byte order"
 #endif
+
+/*
+ * pread-style helpers for lms_reader, return 0 on success or -1 if
+ * there are not enough bytes at off.
+ */
+static inline int lms_reader_get_bytes(lms_reader_t *r, off_t off, void *buf, size_t len)
+{
+    return lms_reader_pread(r, buf, len, off) == (ssize_t)len ? 0 : -1;
+}
+
+static inline int lms_reader_get_u8(lms_reader_t *r, off_t off, uint8_t *v)
+{
+    return lms_reader_get_bytes(r, off, v, 1);
+}
+
+static inline int lms_reader_get_le16(lms_reader_t *r, off_t off, uint16_t *v)
+{
+    uint8_t b[2];
+
+    if (lms_reader_get_bytes(r, off, b, sizeof(b)) != 0)
+        return -1;
+    *v = get_le16(b);
+    return 0;
+}
+
+static inline int lms_reader_get_be16(lms_reader_t *r, off_t off, uint16_t *v)
+{
+    uint8_t b[2];
+
+    if (lms_reader_get_bytes(r, off, b, sizeof(b)) != 0)
+        return -1;
+    *v = get_be16(b);
+    return 0;
+}
+
+static inline int lms_reader_get_le32(lms_reader_t *r, off_t off, uint32_t *v)
+{
+    uint8_t b[4];
+
+    if (lms_reader_get_bytes(r, off, b, sizeof(b)) != 0)
+        return -1;
+    *v = get_le32(b);
+    return 0;
+}
+
+static inline int lms_reader_get_be32(lms_reader_t *r, off_t off, uint32_t *v)
+{
+    uint8_t b[4];
+
+    if (lms_reader_get_bytes(r, off, b, sizeof(b)) != 0)
+        return -1;
+    *v = get_be32(b);
+    return 0;
+}
+
+static inline int lms_reader_get_le64(lms_reader_t *r, off_t off, uint64_t *v)
+{
+    uint8_t b[8];
+
+    if (lms_reader_get_bytes(r, off, b, sizeof(b)) != 0)
+        return -1;
+    *v = get_le64(b);
+    return 0;
+}
+
+static inline int lms_reader_get_be64(lms_reader_t *r, off_t off, uint64_t *v)
+{
+    uint8_t b[8];
+
+    if (lms_reader_get_bytes(r, off, b, sizeof(b)) != 0)
+        return -1;
+    *v = get_be64(b);
+    return 0;
+}
+
+/*
+ * Length of extension to strip from path to get a title: the one
+ * matched, or whatever it is if file was matched by contents.
+ */
+static inline int lms_match_ext_len(const struct lms_file_info *finfo, const struct lms_string_size *exts, void *match)
+{
+    const char *name, *dot;
+
+    if (!finfo->by_contents)
+        return exts[((long)match) - 1].len;
+
+    name = finfo->path + finfo->base;
+    dot = strrchr(name, '.');
+    if (!dot || dot == name)
+        return 0;
+    return finfo->path + finfo->path_len - dot;
+}
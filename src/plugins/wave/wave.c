@@ -71,20 +71,8 @@ struct plugin {
     lms_db_audio_t *audio_db;
 };
 
-static void *
-_match(struct plugin *p, const char *path, int len, int base)
-{
-    long i;
-
-    i = lms_which_extension(path, len, _exts, LMS_ARRAY_SIZE(_exts));
-    if (i < 0)
-        return NULL;
-    else
-        return (void*)(i + 1);
-}
-
 static int
-_parse_info(int fd, struct lms_audio_info *info)
+_parse_info(lms_reader_t *reader, struct lms_audio_info *info)
 {
     struct hdr {
         uint8_t id[4];
@@ -97,7 +85,7 @@ _parse_info(int fd, struct lms_audio_info *info)
     do {
         uint32_t size;
 
-        if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+        if (lms_reader_read(reader, &hdr, sizeof(hdr)) != sizeof(hdr))
             goto done;
 
         size = get_le32(&hdr.size) - sizeof(hdr.infoid);
@@ -110,7 +98,7 @@ _parse_info(int fd, struct lms_audio_info *info)
             /* 'data' chunk has a 1-byte padding if size is odd */
             size++;
 
-        lseek(fd, size, SEEK_CUR);
+        lms_reader_seek(reader, size, SEEK_CUR);
     } while (1);
 
     while (maxsize > 8) {
@@ -118,14 +106,14 @@ _parse_info(int fd, struct lms_audio_info *info)
         uint32_t size;
         struct lms_string_size *str;
 
-        if (read(fd, chunkid, sizeof(chunkid)) != sizeof(chunkid)
-            || read(fd, &size, sizeof(size)) != sizeof(size))
+        if (lms_reader_read(reader, chunkid, sizeof(chunkid)) != sizeof(chunkid)
+            || lms_reader_read(reader, &size, sizeof(size)) != sizeof(size))
             break;
 
         size = le32toh(size);
         if (size > 1024) {
             /* we don't expect any info field to be that big. */
-            if (lseek(fd, size, SEEK_CUR) < 0) {
+            if (lms_reader_seek(reader, size, SEEK_CUR) < 0) {
                 perror("lseek");
                 return -1;
             }
@@ -142,22 +130,22 @@ _parse_info(int fd, struct lms_audio_info *info)
         else if (memcmp(chunkid, "IGNR", 4) == 0)
             str = &info->genre;
         else {
-            lseek(fd, size, SEEK_CUR);
+            lms_reader_seek(reader, size, SEEK_CUR);
             maxsize -= size;
             goto next_field;
         }
 
         str->str = malloc(size + 1);
-        read(fd, str->str, size);
+        lms_reader_read(reader, str->str, size);
         str->str[size] = '\0';
         str->len = size;
 
     next_field:
         /* Ignore trailing '\0', even if they are not part of the previous
          * size */
-        while (maxsize > 0 && read(fd, chunkid, 1) == 1) {
+        while (maxsize > 0 && lms_reader_read(reader, chunkid, 1) == 1) {
             if (chunkid[0] != '\0') {
-                if (lseek(fd, -1, SEEK_CUR) < 0) {
+                if (lms_reader_seek(reader, -1, SEEK_CUR) < 0) {
                     perror("lseek");
                     return -1;
                 }
@@ -172,7 +160,7 @@ done:
 }
 
 static int
-_parse_fmt(int fd, struct lms_audio_info *info)
+_parse_fmt(lms_reader_t *reader, struct lms_audio_info *info)
 {
     struct fmt {
         uint8_t fmt[4];
@@ -186,7 +174,7 @@ _parse_fmt(int fd, struct lms_audio_info *info)
     } __attribute__((packed)) fmt;
     long remain;
 
-    if (read(fd, &fmt, sizeof(fmt)) != sizeof(fmt)
+    if (lms_reader_read(reader, &fmt, sizeof(fmt)) != sizeof(fmt)
         || memcmp(fmt.fmt, "fmt ", 4) != 0)
         return -1;
 
@@ -197,13 +185,13 @@ _parse_fmt(int fd, struct lms_audio_info *info)
     remain = get_le32(&fmt.size) - sizeof(fmt) +
         offsetof(struct fmt, audio_format);
     if (remain > 0)
-        lseek(fd, remain, SEEK_CUR);
+        lms_reader_seek(reader, remain, SEEK_CUR);
 
     return 0;
 }
 
 static int
-_parse_wave(int fd, struct lms_audio_info *info)
+_parse_wave(lms_reader_t *reader, struct lms_audio_info *info)
 {
     struct hdr {
         uint8_t riff[4];
@@ -211,10 +199,10 @@ _parse_wave(int fd, struct lms_audio_info *info)
         uint8_t wave[4];
     } __attribute__((packed)) hdr;
 
-    if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr)
+    if (lms_reader_read(reader, &hdr, sizeof(hdr)) != sizeof(hdr)
         || memcmp(hdr.riff, "RIFF", 4) != 0
         || memcmp(hdr.wave, "WAVE", 4) != 0
-        || _parse_fmt(fd, info) < 0)
+        || _parse_fmt(reader, info) < 0)
         return -1;
 
     info->container = _container;
@@ -227,34 +215,28 @@ _parse(struct plugin *plugin, struct lms_context *ctxt,
        const struct lms_file_info *finfo, void *match)
 {
     struct lms_audio_info info = { };
-    int r, fd;
+    lms_reader_t *reader = finfo->reader;
+    int r;
     const struct lms_dlna_audio_profile *audio_dlna;
 
-    fd = open(finfo->path, O_RDONLY);
-    if (fd < 0)
-        return -errno;
-
-    r = _parse_wave(fd, &info);
+    r = _parse_wave(reader, &info);
     if (r < 0)
         goto done;
 
     /* Ignore errors, waves likely don't have any additional information */
-    _parse_info(fd, &info);
+    _parse_info(reader, &info);
 
     if (!info.title.str)
         lms_name_from_path(&info.title, finfo->path, finfo->path_len,
-                           finfo->base, _exts[((long) match) - 1].len,
+                           finfo->base, lms_match_ext_len(finfo, _exts, match),
                            ctxt->cs_conv);
 
     info.id = finfo->id;
 
-    LMS_DLNA_GET_AUDIO_PROFILE_FD_FB(&info, audio_dlna, fd);
+    LMS_DLNA_GET_AUDIO_PROFILE_FD_FB(&info, audio_dlna, lms_reader_fd(reader));
     r = lms_db_audio_add(plugin->audio_db, &info);
 
 done:
-    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
-    close(fd);
-
     free(info.title.str);
     free(info.artist.str);
     free(info.album.str);
@@ -303,7 +285,7 @@ lms_plugin_open(void)
 
     plugin = (struct lms_plugin *) malloc(sizeof(struct plugin));
     plugin->name = _name;
-    plugin->match = (lms_plugin_match_fn_t) _match;
+    plugin->match = NULL;
     plugin->parse = (lms_plugin_parse_fn_t) _parse;
     plugin->close = (lms_plugin_close_fn_t) _close;
     plugin->setup = (lms_plugin_setup_fn_t) _setup;
@@ -314,6 +296,16 @@ lms_plugin_open(void)
     return plugin;
 }
 
+API const struct lms_plugin_exts *
+lms_plugin_exts(void)
+{
+    static const struct lms_plugin_exts exts = {
+        _exts, LMS_ARRAY_SIZE(_exts)
+    };
+
+    return &exts;
+}
+
 API const struct lms_plugin_info *
 lms_plugin_info(void)
 {
@@ -328,3 +320,14 @@ lms_plugin_info(void)
 
     return &info;
 }
+
+API const struct lms_plugin_magic *
+lms_plugin_magic(void)
+{
+    static const struct lms_plugin_magic magic[] = {
+        {"WAVE", 4, 8, (void *)1}, /* .wav, "RIFF" at 0 is also AVI */
+        {NULL, 0, 0, NULL}
+    };
+
+    return magic;
+}